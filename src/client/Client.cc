@@ -159,6 +159,8 @@ Client::Client(Messenger *m, MonClient *mc)
 				  cct->_conf->client_oc_max_dirty,
 				  cct->_conf->client_oc_target_dirty,
 				  cct->_conf->client_oc_max_dirty_age);
+  objectcacher->set_max_dirty_per_set(cct->_conf->client_oc_max_dirty_per_file);
+  objectcacher->set_max_flush_size(cct->_conf->client_oc_max_flush_size);
   filer = new Filer(objecter);
 }
 
@@ -53,4 +53,30 @@ public:
 };
 
 
+/**
+ * Bound the number of concurrent asynchronous operations
+ *
+ * start_op() blocks while max operations are in flight; end_op() is
+ * called from each operation's completion.  wait_for_ret() waits for
+ * everything to finish and returns the first error seen, if any.
+ */
+class SimpleThrottle {
+public:
+  SimpleThrottle(uint64_t max, bool ignore_enoent);
+  ~SimpleThrottle();
+  void start_op();
+  void end_op(int r);
+  int wait_for_ret();
+  /// true once any operation has failed; callers may stop issuing more
+  bool pending_error();
+private:
+  Mutex m_lock;
+  Cond m_cond;
+  uint64_t m_max;
+  uint64_t m_current;
+  int m_ret;
+  bool m_ignore_enoent;
+};
+
+
 #endif
@@ -170,6 +170,8 @@ OPTION(client_oc_size, OPT_INT, 1024*1024* 200)    // MB * n
 OPTION(client_oc_max_dirty, OPT_INT, 1024*1024* 100)    // MB * n  (dirty OR tx.. bigish)
 OPTION(client_oc_target_dirty, OPT_INT, 1024*1024* 8) // target dirty (keep this smallish)
 OPTION(client_oc_max_dirty_age, OPT_DOUBLE, 5.0)      // max age in cache before writeback
+OPTION(client_oc_max_dirty_per_file, OPT_INT, 0) // dirty|tx limit for a single file, 0 for none
+OPTION(client_oc_max_flush_size, OPT_INT, 0)      // cap on coalesced writeback size, 0 for none
 // note: the max amount of "in flight" dirty data is roughly (max - target)
 OPTION(fuse_use_invalidate_cb, OPT_BOOL, false) // use fuse 2.8+ invalidate callback to keep page cache consistent
 OPTION(fuse_big_writes, OPT_BOOL, true)
@@ -292,14 +294,43 @@ OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
 OPTION(osd_disk_threads, OPT_INT, 1)
+OPTION(osd_op_sched, OPT_BOOL, false)  // schedule op classes by reservation/weight/limit (read at startup)
+OPTION(osd_op_sched_client_res, OPT_DOUBLE, 0)    // ops/s guaranteed; 0 == none
+OPTION(osd_op_sched_client_wgt, OPT_DOUBLE, 100)  // share of what is left
+OPTION(osd_op_sched_client_lim, OPT_DOUBLE, 0)    // ops/s at most; 0 == no limit
+OPTION(osd_op_sched_subop_res, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_subop_wgt, OPT_DOUBLE, 100)
+OPTION(osd_op_sched_subop_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_recovery_res, OPT_DOUBLE, 5)
+OPTION(osd_op_sched_recovery_wgt, OPT_DOUBLE, 10)
+OPTION(osd_op_sched_recovery_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_scrub_res, OPT_DOUBLE, 1)
+OPTION(osd_op_sched_scrub_wgt, OPT_DOUBLE, 5)
+OPTION(osd_op_sched_scrub_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_sched_snaptrim_res, OPT_DOUBLE, 1)
+OPTION(osd_op_sched_snaptrim_wgt, OPT_DOUBLE, 5)
+OPTION(osd_op_sched_snaptrim_lim, OPT_DOUBLE, 0)
+OPTION(osd_load_pgs_threads, OPT_INT, 4)  // threads reading pg state at startup
+OPTION(osd_lazy_pg_log, OPT_BOOL, false)  // read pg logs at first peering, not at startup
+OPTION(osd_pg_object_context_cache_count, OPT_INT, 64)  // idle object and snapset contexts each pg keeps
+OPTION(osd_hit_set_period, OPT_INT, 600)  // seconds each pg hit set covers; 0 to keep none
+OPTION(osd_hit_set_count, OPT_INT, 12)  // sealed hit sets each pg keeps
+OPTION(osd_hit_set_target_size, OPT_INT, 1000)  // distinct objects a hit set is sized for
+OPTION(osd_hit_set_fpp, OPT_DOUBLE, .05)  // hit set false positive probability at its target size
 OPTION(osd_recovery_threads, OPT_INT, 1)
+OPTION(osd_peering_threads, OPT_INT, 2)
+OPTION(osd_peering_wq_batch_size, OPT_U64, 200)  // pgs per peering batch, and per message flush
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
+OPTION(osd_recovery_delta, OPT_BOOL, false)   // log written extents; push only those to replicas with an older copy
+OPTION(osd_recovery_batch, OPT_BOOL, false)   // send pushes and pulls to one peer together, up to osd_recovery_max_chunk bytes
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
 OPTION(osd_op_thread_timeout, OPT_INT, 30)
 OPTION(osd_backlog_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
 OPTION(osd_snap_trim_thread_timeout, OPT_INT, 60*60*1)
+OPTION(osd_snap_trim_batch, OPT_INT, 16)       // clones trimmed per transaction and repop
+OPTION(osd_snap_trim_list_max, OPT_INT, 1024)  // snap collection objects listed at a time
 OPTION(osd_scrub_thread_timeout, OPT_INT, 60)
 OPTION(osd_scrub_finalize_thread_timeout, OPT_INT, 60*10)
 OPTION(osd_remove_thread_timeout, OPT_INT, 60*60)
@@ -328,6 +359,7 @@ OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
 OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
 OPTION(osd_deep_scrub_stride, OPT_INT, 524288)
+OPTION(osd_deep_scrub_bytes_per_sec, OPT_U64, 0)   // data and omap read by deep scrub, per osd; 0 for no limit
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_dir, OPT_STR, CEPH_LIBDIR "/rados-classes") // where rados plugins are stored
 OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
@@ -349,6 +381,7 @@ OPTION(osd_op_history_duration, OPT_U32, 600) // Oldest completed op to track
 OPTION(osd_target_transaction_size, OPT_INT, 300)     // to adjust various transactions that batch smaller items
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
+OPTION(filestore_omap_header_cache_size, OPT_INT, 1024) // omap headers (and parent headers) cached in memory
 // Use omap for xattrs for attrs over
 OPTION(filestore_xattr_use_omap, OPT_BOOL, false)
 // filestore_max_inline_xattr_size or
@@ -376,15 +409,31 @@ OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
 OPTION(filestore_op_threads, OPT_INT, 2)
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
+OPTION(filestore_parallel_apply, OPT_BOOL, false) // apply ops of one sequencer concurrently unless they touch the same objects
+OPTION(filestore_aio, OPT_BOOL, false)  // submit page aligned writes with O_DIRECT aio
+OPTION(filestore_aio_queue_depth, OPT_INT, 128)  // max aio writes in flight
+OPTION(filestore_csum, OPT_BOOL, false)  // keep a crc32c of each block of object data, and check it on read
+OPTION(filestore_csum_block_size, OPT_U32, 64 << 10)
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_split_in_background, OPT_BOOL, false) // split collection directories in a background thread
+OPTION(filestore_split_rate, OPT_INT, 1000)  // objects per second moved by background splits, 0 for no limit
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_dump_file, OPT_STR, "")         // file onto which store transaction dumps
 OPTION(filestore_kill_at, OPT_INT, 0)            // inject a failure at the n'th opportunity
 OPTION(filestore_fail_eio, OPT_BOOL, true)       // fail/crash on EIO
+OPTION(leveldb_write_buffer_size, OPT_U64, 8 << 20) // bytes buffered in memory before a level-0 table is written; 0 for leveldb's default (4MB)
+OPTION(leveldb_cache_size, OPT_U64, 128 << 20) // block cache bytes; 0 for leveldb's default (8MB)
+OPTION(leveldb_block_size, OPT_U64, 0)         // bytes per block; 0 for leveldb's default (4KB)
+OPTION(leveldb_bloom_size, OPT_INT, 10)        // bloom filter bits per key; 0 to disable
+OPTION(leveldb_max_open_files, OPT_INT, 0)     // 0 for leveldb's default (1000)
+OPTION(leveldb_compression, OPT_BOOL, true)    // compress blocks with snappy
+OPTION(leveldb_paranoid, OPT_BOOL, false)      // have leveldb check aggressively for corruption
+OPTION(leveldb_compact_on_mount, OPT_BOOL, false) // compact everything when the store is opened
+OPTION(objectstore_transaction_tables, OPT_BOOL, false)  // encode transactions with collection/object tables (v7); all osds must understand it
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, false)
 OPTION(journal_block_align, OPT_BOOL, true)
@@ -395,11 +444,21 @@ OPTION(journal_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
 OPTION(journal_replay_from, OPT_INT, 0)
 OPTION(journal_zero_on_create, OPT_BOOL, false)
+OPTION(journal_pack_small_entries, OPT_BOOL, false)  // share one journal entry between several small ones
+OPTION(journal_pack_entry_max, OPT_INT, 16 << 10)  // entries up to this size can be packed
+OPTION(journal_pack_max_bytes, OPT_INT, 64 << 10)  // max payload of a packed entry
+OPTION(journal_compress, OPT_BOOL, false)  // compress packed entries
+OPTION(journal_stripes, OPT_STR, "")  // more journal files/devices (comma separated) to stripe entries across, after osd journal
 OPTION(rbd_cache, OPT_BOOL, false) // whether to enable caching (writeback unless rbd_cache_max_dirty is 0)
 OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size in bytes
 OPTION(rbd_cache_max_dirty, OPT_LONGLONG, 24<<20)    // dirty limit in bytes - set to 0 for write-through caching
 OPTION(rbd_cache_target_dirty, OPT_LONGLONG, 16<<20) // target dirty limit in bytes
 OPTION(rbd_cache_max_dirty_age, OPT_FLOAT, 1.0)      // seconds in cache before writeback starts
+OPTION(rbd_cache_max_flush_size, OPT_LONGLONG, 0)    // cap on coalesced writeback size in bytes, 0 for none
+OPTION(rbd_persistent_cache, OPT_BOOL, false) // keep data read from snapshots (and so parents) on local disk
+OPTION(rbd_persistent_cache_path, OPT_STR, "/var/lib/ceph/rbd-cache") // directory for persistent cache files
+OPTION(rbd_persistent_cache_size, OPT_LONGLONG, 1<<30) // max bytes cached per image snapshot
+OPTION(rbd_concurrent_management_ops, OPT_INT, 10) // how many objects copy, flatten, import and export keep in flight
 OPTION(rgw_data, OPT_STR, "/var/lib/ceph/radosgw/$cluster-$id")
 OPTION(rgw_cache_enabled, OPT_BOOL, true)   // rgw cache enabled
 OPTION(rgw_cache_lru_size, OPT_INT, 10000)   // num of entries in rgw cache
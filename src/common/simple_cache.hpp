@@ -37,6 +37,13 @@ class SimpleLRU {
   }
 
   void _add(K key, V value) {
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator i =
+      contents.find(key);
+    if (i != contents.end()) {
+      i->second->second = value;
+      lru.splice(lru.begin(), lru, i->second);
+      return;
+    }
     lru.push_front(make_pair(key, value));
     contents[key] = lru.begin();
     trim_cache();
@@ -89,6 +96,17 @@ public:
     Mutex::Locker l(lock);
     _add(key, value);
   }
+
+  void clear(K key) {
+    Mutex::Locker l(lock);
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator i =
+      contents.find(key);
+    if (i != contents.end()) {
+      lru.erase(i->second);
+      contents.erase(i);
+    }
+    pinned.erase(key);
+  }
 };
 
 #endif
@@ -25,6 +25,8 @@
 #define CEPH_FEATURE_CRUSH_TUNABLES (1<<18)
 #define CEPH_FEATURE_CHUNKY_SCRUB   (1<<19)
 #define CEPH_FEATURE_MON_NULLROUTE  (1<<20)
+#define CEPH_FEATURE_OSD_DELTA_RECOVERY (1<<21)
+#define CEPH_FEATURE_OSD_BATCHED_RECOVERY (1<<22)
 
 /*
  * Features supported.  Should be everything above.
@@ -50,7 +52,9 @@
 	 CEPH_FEATURE_INDEP_PG_MAP |	 \
 	 CEPH_FEATURE_CRUSH_TUNABLES |	 \
 	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
-	 CEPH_FEATURE_MON_NULLROUTE)
+	 CEPH_FEATURE_MON_NULLROUTE |	 \
+	 CEPH_FEATURE_OSD_DELTA_RECOVERY | \
+	 CEPH_FEATURE_OSD_BATCHED_RECOVERY)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
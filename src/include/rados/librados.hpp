@@ -115,6 +115,18 @@ namespace librados
     OP_FAILOK = 2,
   };
 
+  /*
+   * Where a read may go.  By default reads go to the primary.  With
+   * these they may go to a replica, which serves them only if its copy
+   * is complete and committed everywhere, and sends them on to the
+   * primary otherwise.
+   */
+  enum ObjectOperationGlobalFlags {
+    OPERATION_NOFLAG         = 0,
+    OPERATION_BALANCE_READS  = 1,  // whichever replica we have least in flight to
+    OPERATION_LOCALIZE_READS = 2,  // a replica on this host, if any
+  };
+
   /*
    * ObjectOperation : compount object operation
    * Batch multiple object operations into a single request, to be applied
@@ -447,6 +459,29 @@ namespace librados
 
     uint64_t get_last_version();
 
+    /**
+     * List the intervals of a placement group's hit sets
+     *
+     * The primary of each placement group notes the name of every
+     * object it serves an op on in a bloom filter, one per interval.
+     *
+     * @param hash the placement group's seed within the pool
+     * @param ls [out] begin and end of each interval, oldest first; the
+     * end of the one still being recorded is 0
+     * @returns 0 on success, negative error code on failure
+     */
+    int hit_set_list(uint32_t hash, std::list< std::pair<time_t, time_t> > *ls);
+
+    /**
+     * Get the hit set of a placement group covering a time
+     *
+     * @param hash the placement group's seed within the pool
+     * @param stamp a time within the interval
+     * @param bl [out] the encoded HitSet
+     * @returns 0 on success, -ENOENT if no hit set kept covers stamp
+     */
+    int hit_set_get(uint32_t hash, time_t stamp, bufferlist *bl);
+
     int aio_read(const std::string& oid, AioCompletion *c,
 		 bufferlist *pbl, size_t len, uint64_t off);
     int aio_sparse_read(const std::string& oid, AioCompletion *c,
@@ -482,9 +517,13 @@ namespace librados
     // compound object operations
     int operate(const std::string& oid, ObjectWriteOperation *op);
     int operate(const std::string& oid, ObjectReadOperation *op, bufferlist *pbl);
+    int operate(const std::string& oid, ObjectReadOperation *op, bufferlist *pbl,
+		int flags);
     int aio_operate(const std::string& oid, AioCompletion *c, ObjectWriteOperation *op);
     int aio_operate(const std::string& oid, AioCompletion *c, ObjectReadOperation *op,
 		    bufferlist *pbl);
+    int aio_operate(const std::string& oid, AioCompletion *c, ObjectReadOperation *op,
+		    int flags, bufferlist *pbl);
 
     // watch/notify
     int watch(const std::string& o, uint64_t ver, uint64_t *handle,
@@ -493,6 +532,9 @@ namespace librados
     int notify(const std::string& o, uint64_t ver, bufferlist& bl);
     void set_notify_timeout(uint32_t timeout);
 
+    // OPERATION_*_READS for every read through this context
+    void set_read_flags(int flags);
+
     // assert version for next sync operations
     void set_assert_version(uint64_t ver);
     void set_assert_src_version(const std::string& o, uint64_t ver);
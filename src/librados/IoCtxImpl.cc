@@ -27,6 +27,7 @@
 
 librados::IoCtxImpl::IoCtxImpl() :
   ref_cnt(0), client(NULL), poolid(0), assert_ver(0), notify_timeout(30),
+  read_flags(0),
   aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
   aio_write_seq(0), lock(NULL), objecter(NULL)
 {
@@ -37,7 +38,7 @@ librados::IoCtxImpl::IoCtxImpl(RadosClient *c, Objecter *objecter,
 			       const char *pool_name, snapid_t s)
   : ref_cnt(0), client(c), poolid(poolid), pool_name(pool_name), snap_seq(s),
     assert_ver(0), notify_timeout(c->cct->_conf->client_notify_timeout),
-    oloc(poolid),
+    read_flags(0), oloc(poolid),
     aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
     aio_write_seq(0), lock(client_lock), objecter(objecter)
 {
@@ -628,7 +629,8 @@ int librados::IoCtxImpl::operate(const object_t& oid, ::ObjectOperation *o,
 }
 
 int librados::IoCtxImpl::operate_read(const object_t& oid,
-				      ::ObjectOperation *o, bufferlist *pbl)
+				      ::ObjectOperation *o, bufferlist *pbl,
+				      int flags)
 {
   if (!o->size())
     return 0;
@@ -643,7 +645,7 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
 
   lock->Lock();
   objecter->read(oid, oloc,
-	           *o, snap_seq, pbl, 0,
+	           *o, snap_seq, pbl, flags | read_flags,
 	           onack, &ver);
   lock->Unlock();
 
@@ -657,9 +659,32 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
   return r;
 }
 
+int librados::IoCtxImpl::pg_read(uint32_t hash, ::ObjectOperation *o,
+				 bufferlist *pbl)
+{
+  Mutex mylock("IoCtxImpl::pg_read::mylock");
+  Cond cond;
+  bool done;
+  int r;
+
+  Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
+
+  lock->Lock();
+  objecter->pg_read(hash, oloc, *o, pbl, 0, onack, NULL);
+  lock->Unlock();
+
+  mylock.Lock();
+  while (!done)
+    cond.Wait(mylock);
+  mylock.Unlock();
+
+  return r;
+}
+
 int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
 					  ::ObjectOperation *o,
-					  AioCompletionImpl *c, bufferlist *pbl)
+					  AioCompletionImpl *c, int flags,
+					  bufferlist *pbl)
 {
   Context *onack = new C_aio_Ack(c);
 
@@ -669,7 +694,7 @@ int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
 
   Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 *o, snap_seq, pbl, 0,
+		 *o, snap_seq, pbl, flags | read_flags,
 		 onack, &c->objver);
   return 0;
 }
@@ -709,7 +734,7 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
 
   Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, read_flags,
 		 onack, &c->objver);
   return 0;
 }
@@ -729,7 +754,7 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
 
   Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, read_flags,
 		 onack, &c->objver);
 
   return 0;
@@ -754,7 +779,7 @@ int librados::IoCtxImpl::aio_sparse_read(const object_t oid,
 
   Mutex::Locker l(*lock);
   objecter->sparse_read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, read_flags,
 		 onack);
   return 0;
 }
@@ -1010,7 +1035,7 @@ int librados::IoCtxImpl::tmap_get(const object_t& oid, bufferlist& bl)
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.tmap_get(&bl, NULL);
-  objecter->read(oid, oloc, rd, snap_seq, 0, 0, onack, &ver);
+  objecter->read(oid, oloc, rd, snap_seq, 0, read_flags, onack, &ver);
   lock->Unlock();
 
   mylock.Lock();
@@ -1090,7 +1115,7 @@ int librados::IoCtxImpl::read(const object_t& oid,
 
   lock->Lock();
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &bl, 0,
+		 off, len, snap_seq, &bl, read_flags,
 		 onack, &ver, pop);
   lock->Unlock();
 
@@ -1164,7 +1189,7 @@ int librados::IoCtxImpl::sparse_read(const object_t& oid,
 
   lock->Lock();
   objecter->sparse_read(oid, oloc,
-			off, len, snap_seq, &bl, 0,
+			off, len, snap_seq, &bl, read_flags,
 			onack);
   lock->Unlock();
 
@@ -1203,7 +1228,7 @@ int librados::IoCtxImpl::stat(const object_t& oid, uint64_t *psize, time_t *pmti
 
   lock->Lock();
   objecter->stat(oid, oloc,
-		 snap_seq, psize, &mtime, 0,
+		 snap_seq, psize, &mtime, read_flags,
 		 onack, &ver, pop);
   lock->Unlock();
 
@@ -1237,7 +1262,7 @@ int librados::IoCtxImpl::getxattr(const object_t& oid,
 
   lock->Lock();
   objecter->getxattr(oid, oloc,
-		     name, snap_seq, &bl, 0,
+		     name, snap_seq, &bl, read_flags,
 		     onack, &ver, pop);
   lock->Unlock();
 
@@ -1350,7 +1375,7 @@ int librados::IoCtxImpl::getxattrs(const object_t& oid,
   map<string, bufferlist> aset;
   objecter->getxattrs(oid, oloc, snap_seq,
 		      aset,
-		      0, onack, &ver, pop);
+		      read_flags, onack, &ver, pop);
   lock->Unlock();
 
   attrset.clear();
@@ -1371,6 +1396,39 @@ int librados::IoCtxImpl::getxattrs(const object_t& oid,
   return r;
 }
 
+int librados::IoCtxImpl::hit_set_list(uint32_t hash,
+				      std::list< std::pair<time_t, time_t> > *ls)
+{
+  ::ObjectOperation op;
+  op.hit_set_ls();
+  bufferlist bl;
+  int r = pg_read(hash, &op, &bl);
+  if (r < 0)
+    return r;
+
+  std::list<std::pair<utime_t, utime_t> > intervals;
+  try {
+    bufferlist::iterator p = bl.begin();
+    ::decode(intervals, p);
+  }
+  catch (buffer::error& e) {
+    return -EIO;
+  }
+  ls->clear();
+  for (std::list<std::pair<utime_t, utime_t> >::iterator p = intervals.begin();
+       p != intervals.end();
+       ++p)
+    ls->push_back(std::make_pair((time_t)p->first.sec(), (time_t)p->second.sec()));
+  return 0;
+}
+
+int librados::IoCtxImpl::hit_set_get(uint32_t hash, time_t stamp, bufferlist *bl)
+{
+  ::ObjectOperation op;
+  op.hit_set_get(utime_t(stamp, 0));
+  return pg_read(hash, &op, bl);
+}
+
 void librados::IoCtxImpl::set_sync_op_version(eversion_t& ver)
 {
   last_objver = ver;
@@ -1529,6 +1587,11 @@ void librados::IoCtxImpl::set_notify_timeout(uint32_t timeout)
   notify_timeout = timeout;
 }
 
+void librados::IoCtxImpl::set_read_flags(int flags)
+{
+  read_flags = flags;
+}
+
 ///////////////////////////// C_aio_Ack ////////////////////////////////
 
 librados::IoCtxImpl::C_aio_Ack::C_aio_Ack(AioCompletionImpl *_c) : c(_c)
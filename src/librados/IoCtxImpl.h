@@ -40,6 +40,7 @@ struct librados::IoCtxImpl {
   map<object_t, uint64_t> assert_src_version;
   eversion_t last_objver;
   uint32_t notify_timeout;
+  int read_flags;  // CEPH_OSD_FLAG_*_READS added to plain reads
   object_locator_t oloc;
 
   Mutex aio_write_list_lock;
@@ -65,6 +66,7 @@ struct librados::IoCtxImpl {
     assert_src_version = rhs.assert_src_version;
     last_objver = rhs.last_objver;
     notify_timeout = rhs.notify_timeout;
+    read_flags = rhs.read_flags;
     oloc = rhs.oloc;
     lock = rhs.lock;
     objecter = rhs.objecter;
@@ -134,10 +136,16 @@ struct librados::IoCtxImpl {
   int getxattrs(const object_t& oid, map<string, bufferlist>& attrset);
   int rmxattr(const object_t& oid, const char *name);
 
+  int hit_set_list(uint32_t hash, std::list< std::pair<time_t, time_t> > *ls);
+  int hit_set_get(uint32_t hash, time_t stamp, bufferlist *bl);
+
   int operate(const object_t& oid, ::ObjectOperation *o, time_t *pmtime);
-  int operate_read(const object_t& oid, ::ObjectOperation *o, bufferlist *pbl);
+  int operate_read(const object_t& oid, ::ObjectOperation *o, bufferlist *pbl,
+		   int flags = 0);
   int aio_operate(const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c);
-  int aio_operate_read(const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c, bufferlist *pbl);
+  int pg_read(uint32_t hash, ::ObjectOperation *o, bufferlist *pbl);
+  int aio_operate_read(const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c,
+		       int flags, bufferlist *pbl);
 
   struct C_aio_Ack : public Context {
     librados::AioCompletionImpl *c;
@@ -189,6 +197,7 @@ struct librados::IoCtxImpl {
   void set_assert_version(uint64_t ver);
   void set_assert_src_version(const object_t& oid, uint64_t ver);
   void set_notify_timeout(uint32_t timeout);
+  void set_read_flags(int flags);
 
   struct C_NotifyComplete : public librados::WatchCtx {
     Mutex *lock;
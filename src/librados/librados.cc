@@ -815,12 +815,30 @@ int librados::IoCtx::operate(const std::string& oid, librados::ObjectWriteOperat
   return io_ctx_impl->operate(obj, (::ObjectOperation*)o->impl, o->pmtime);
 }
 
+static int translate_read_flags(int flags)
+{
+  int op_flags = 0;
+  if (flags & librados::OPERATION_BALANCE_READS)
+    op_flags |= CEPH_OSD_FLAG_BALANCE_READS;
+  if (flags & librados::OPERATION_LOCALIZE_READS)
+    op_flags |= CEPH_OSD_FLAG_LOCALIZE_READS;
+  return op_flags;
+}
+
 int librados::IoCtx::operate(const std::string& oid, librados::ObjectReadOperation *o, bufferlist *pbl)
 {
   object_t obj(oid);
   return io_ctx_impl->operate_read(obj, (::ObjectOperation*)o->impl, pbl);
 }
 
+int librados::IoCtx::operate(const std::string& oid, librados::ObjectReadOperation *o,
+			     bufferlist *pbl, int flags)
+{
+  object_t obj(oid);
+  return io_ctx_impl->operate_read(obj, (::ObjectOperation*)o->impl, pbl,
+				   translate_read_flags(flags));
+}
+
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectWriteOperation *o)
 {
   object_t obj(oid);
@@ -830,7 +848,16 @@ int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, libra
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectReadOperation *o, bufferlist *pbl)
 {
   object_t obj(oid);
-  return io_ctx_impl->aio_operate_read(obj, (::ObjectOperation*)o->impl, c->pc, pbl);
+  return io_ctx_impl->aio_operate_read(obj, (::ObjectOperation*)o->impl, c->pc, 0, pbl);
+}
+
+int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c,
+				 librados::ObjectReadOperation *o, int flags,
+				 bufferlist *pbl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->aio_operate_read(obj, (::ObjectOperation*)o->impl, c->pc,
+				       translate_read_flags(flags), pbl);
 }
 
 void librados::IoCtx::snap_set_read(snap_t seq)
@@ -913,6 +940,17 @@ const librados::ObjectIterator& librados::IoCtx::objects_end() const
   return ObjectIterator::__EndObjectIterator;
 }
 
+int librados::IoCtx::hit_set_list(uint32_t hash,
+				  std::list< std::pair<time_t, time_t> > *ls)
+{
+  return io_ctx_impl->hit_set_list(hash, ls);
+}
+
+int librados::IoCtx::hit_set_get(uint32_t hash, time_t stamp, bufferlist *bl)
+{
+  return io_ctx_impl->hit_set_get(hash, stamp, bl);
+}
+
 uint64_t librados::IoCtx::get_last_version()
 {
   eversion_t ver = io_ctx_impl->last_version();
@@ -997,6 +1035,11 @@ void librados::IoCtx::set_notify_timeout(uint32_t timeout)
   io_ctx_impl->set_notify_timeout(timeout);
 }
 
+void librados::IoCtx::set_read_flags(int flags)
+{
+  io_ctx_impl->set_read_flags(translate_read_flags(flags));
+}
+
 void librados::IoCtx::set_assert_version(uint64_t ver)
 {
   io_ctx_impl->set_assert_version(ver);
@@ -17,6 +17,17 @@
 
 namespace librbd {
 
+  class C_AioRequestComplete : public Context {
+  public:
+    C_AioRequestComplete(AioRequest *req) : m_req(req) {}
+    virtual ~C_AioRequestComplete() {}
+    virtual void finish(int r) {
+      m_req->complete(r);
+    }
+  private:
+    AioRequest *m_req;
+  };
+
   AioRequest::AioRequest() :
     m_ictx(NULL), m_image_ofs(0), m_block_ofs(0), m_len(0),
     m_snap_id(CEPH_NOSNAP), m_completion(NULL), m_parent_completion(NULL),
@@ -80,10 +91,75 @@ namespace librbd {
       }
     }
 
+    if (r >= 0 || r == -ENOENT)
+      write_to_persistent_cache();
+    return true;
+  }
+
+  bool AioRead::read_from_persistent_cache()
+  {
+    PersistentCache *pcache = m_ictx->get_persistent_cache(m_snap_id);
+    if (!pcache)
+      return false;
+
+    if (!pcache->read(m_image_ofs, m_len, &m_read_data)) {
+      m_ictx->perfcounter->inc(l_librbd_pcache_miss);
+      m_ictx->perfcounter->inc(l_librbd_pcache_miss_bytes, m_len);
+      return false;
+    }
+    m_ictx->perfcounter->inc(l_librbd_pcache_hit);
+    m_ictx->perfcounter->inc(l_librbd_pcache_hit_bytes, m_len);
+
+    ldout(m_ictx->cct, 20) << "read " << m_oid << " " << m_block_ofs << "~"
+			   << m_len << " from persistent cache" << dendl;
+    m_ext_map.clear();
+    m_ext_map[m_block_ofs] = m_len;
+    // callers may hold locks our completion needs, so never complete
+    // from within send()
+    m_ictx->persistent_cache_finisher->queue(new C_AioRequestComplete(this),
+					     m_len);
     return true;
   }
 
+  void AioRead::write_to_persistent_cache()
+  {
+    PersistentCache *pcache = m_ictx->get_persistent_cache(m_snap_id);
+    if (!pcache)
+      return;
+
+    // store the dense result, with holes and short reads as zeros
+    bufferlist bl;
+    if (m_sparse || m_tried_parent) {
+      uint64_t pos = m_block_ofs, data_ofs = 0;
+      for (std::map<uint64_t, uint64_t>::iterator p = m_ext_map.begin();
+	   p != m_ext_map.end(); ++p) {
+	if (p->first < pos ||
+	    p->first + p->second > m_block_ofs + m_len ||
+	    data_ofs + p->second > m_read_data.length())
+	  return;  // not something we understand; don't cache it
+	if (p->first > pos)
+	  bl.append_zero(p->first - pos);
+	bufferlist ext;
+	ext.substr_of(m_read_data, data_ofs, p->second);
+	bl.claim_append(ext);
+	data_ofs += p->second;
+	pos = p->first + p->second;
+      }
+    } else {
+      if (m_read_data.length() > m_len)
+	return;
+      bl = m_read_data;
+    }
+    if (bl.length() < m_len)
+      bl.append_zero(m_len - bl.length());
+
+    pcache->write(m_image_ofs, bl);
+  }
+
   int AioRead::send() {
+    if (read_from_persistent_cache())
+      return 0;
+
     librados::AioCompletion *rados_completion =
       librados::Rados::aio_create_completion(this, rados_req_cb, NULL);
     int r;
@@ -91,6 +91,9 @@ namespace librbd {
     }
 
   private:
+    bool read_from_persistent_cache();
+    void write_to_persistent_cache();
+
     std::map<uint64_t, uint64_t> m_ext_map;
     bool m_tried_parent;
     bool m_sparse;
@@ -45,7 +45,9 @@ namespace librbd {
       refresh_lock("librbd::ImageCtx::refresh_lock"),
       old_format(true),
       order(0), size(0), features(0),	id(image_id), parent(NULL),
-      object_cacher(NULL), writeback_handler(NULL), object_set(NULL)
+      object_cacher(NULL), writeback_handler(NULL), object_set(NULL),
+      persistent_cache_lock("librbd::ImageCtx::persistent_cache_lock"),
+      persistent_cache_finisher(NULL)
   {
     md_ctx.dup(p);
     data_ctx.dup(p);
@@ -71,9 +73,15 @@ namespace librbd {
 				       cct->_conf->rbd_cache_max_dirty,
 				       cct->_conf->rbd_cache_target_dirty,
 				       cct->_conf->rbd_cache_max_dirty_age);
+      object_cacher->set_max_flush_size(cct->_conf->rbd_cache_max_flush_size);
       object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(), 0);
       object_cacher->start();
     }
+
+    if (cct->_conf->rbd_persistent_cache) {
+      persistent_cache_finisher = new Finisher(cct);
+      persistent_cache_finisher->start();
+    }
   }
 
   ImageCtx::~ImageCtx() {
@@ -90,6 +98,12 @@ namespace librbd {
       delete object_set;
       object_set = NULL;
     }
+    if (persistent_cache_finisher) {
+      persistent_cache_finisher->stop();
+      delete persistent_cache_finisher;
+      persistent_cache_finisher = NULL;
+    }
+    close_persistent_caches();
   }
 
   int ImageCtx::init() {
@@ -156,6 +170,10 @@ namespace librbd {
     plb.add_u64_counter(l_librbd_snap_rollback, "snap_rollback");
     plb.add_u64_counter(l_librbd_notify, "notify");
     plb.add_u64_counter(l_librbd_resize, "resize");
+    plb.add_u64_counter(l_librbd_pcache_hit, "persistent_cache_hit");
+    plb.add_u64_counter(l_librbd_pcache_hit_bytes, "persistent_cache_hit_bytes");
+    plb.add_u64_counter(l_librbd_pcache_miss, "persistent_cache_miss");
+    plb.add_u64_counter(l_librbd_pcache_miss_bytes, "persistent_cache_miss_bytes");
 
     perfcounter = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perfcounter);
@@ -414,6 +432,11 @@ namespace librbd {
     return r;
   }
 
+  void ImageCtx::discard_from_cache(std::vector<ObjectExtent>& extents) {
+    Mutex::Locker l(cache_lock);
+    object_cacher->discard_set(object_set, extents);
+  }
+
   int ImageCtx::flush_cache() {
     int r = 0;
     Mutex mylock("librbd::ImageCtx::flush_cache");
@@ -490,4 +513,48 @@ namespace librbd {
 		   << parent_len << dendl;
     return parent_len;
   }
+
+  /**
+   * Get the local cache for reads from a snapshot, opening it on first
+   * use. Returns NULL if persistent caching is off or the cache could
+   * not be opened, in which case reads go to the cluster as usual.
+   */
+  PersistentCache *ImageCtx::get_persistent_cache(snap_t in_snap_id)
+  {
+    if (!persistent_cache_finisher || in_snap_id == CEPH_NOSNAP)
+      return NULL;
+
+    Mutex::Locker l(persistent_cache_lock);
+    map<snap_t, PersistentCache*>::iterator it =
+      persistent_caches.find(in_snap_id);
+    if (it != persistent_caches.end())
+      return it->second;
+
+    string path = PersistentCache::get_path(cct->_conf->rbd_persistent_cache_path,
+					    data_ctx.get_id(), object_prefix,
+					    in_snap_id);
+    PersistentCache *pcache = new PersistentCache(cct, path,
+						  cct->_conf->rbd_persistent_cache_size,
+						  order);
+    int r = pcache->open();
+    if (r < 0) {
+      ldout(cct, 5) << "not using persistent cache " << path << ": "
+		    << cpp_strerror(r) << dendl;
+      delete pcache;
+      pcache = NULL;
+    }
+    // remember failures too, so we don't retry on every read
+    persistent_caches[in_snap_id] = pcache;
+    return pcache;
+  }
+
+  void ImageCtx::close_persistent_caches()
+  {
+    Mutex::Locker l(persistent_cache_lock);
+    for (map<snap_t, PersistentCache*>::iterator it = persistent_caches.begin();
+	 it != persistent_caches.end(); ++it) {
+      delete it->second;  // closes and saves the index
+    }
+    persistent_caches.clear();
+  }
 }
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "common/Finisher.h"
 #include "common/Mutex.h"
 #include "common/snap_types.h"
 #include "include/buffer.h"
@@ -20,6 +21,7 @@
 
 #include "librbd/cls_rbd_client.h"
 #include "librbd/LibrbdWriteback.h"
+#include "librbd/PersistentCache.h"
 #include "librbd/SnapInfo.h"
 #include "librbd/parent_types.h"
 
@@ -79,6 +81,10 @@ namespace librbd {
     LibrbdWriteback *writeback_handler;
     ObjectCacher::ObjectSet *object_set;
 
+    Mutex persistent_cache_lock; // protects persistent_caches
+    std::map<librados::snap_t, PersistentCache*> persistent_caches;
+    Finisher *persistent_cache_finisher; // completes reads served locally
+
     /**
      * Either image_name or image_id must be set.
      * If id is not known, pass the empty std::string,
@@ -112,6 +118,7 @@ namespace librbd {
 			     uint64_t off, Context *onfinish);
     void write_to_cache(object_t o, bufferlist& bl, size_t len, uint64_t off);
     int read_from_cache(object_t o, bufferlist *bl, size_t len, uint64_t off);
+    void discard_from_cache(std::vector<ObjectExtent>& extents);
     int flush_cache();
     void shutdown_cache();
     void invalidate_cache();
@@ -119,6 +126,8 @@ namespace librbd {
     void unregister_watch();
     size_t parent_io_len(uint64_t offset, size_t length,
 			 librados::snap_t in_snap_id);
+    PersistentCache *get_persistent_cache(librados::snap_t in_snap_id);
+    void close_persistent_caches();
   };
 }
 
@@ -0,0 +1,261 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "acconfig.h"
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/safe_io.h"
+#include "include/encoding.h"
+
+#include "librbd/PersistentCache.h"
+
+#include "include/assert.h"
+
+// from include/linux/falloc.h:
+#ifndef FALLOC_FL_KEEP_SIZE
+# define FALLOC_FL_KEEP_SIZE 0x1
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+# define FALLOC_FL_PUNCH_HOLE 0x2
+#endif
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::PersistentCache: " << m_path << " "
+
+using std::list;
+using std::map;
+using std::string;
+
+using ceph::bufferlist;
+
+namespace librbd {
+
+  PersistentCache::PersistentCache(CephContext *cct, const string &path,
+				   uint64_t max_size, uint8_t order)
+    : m_cct(cct), m_path(path), m_index_path(path + ".index"),
+      m_max_size(max_size), m_order(order),
+      m_lock("librbd::PersistentCache::m_lock"), m_fd(-1)
+  {
+  }
+
+  PersistentCache::~PersistentCache()
+  {
+    close();
+  }
+
+  string PersistentCache::get_path(const string &dir, int64_t pool_id,
+				   const string &object_prefix,
+				   uint64_t snap_id)
+  {
+    std::ostringstream oss;
+    oss << dir << "/" << pool_id << "." << object_prefix << "."
+	<< std::hex << snap_id;
+    return oss.str();
+  }
+
+  int PersistentCache::open()
+  {
+    Mutex::Locker l(m_lock);
+    assert(m_fd < 0);
+
+    int fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      int r = -errno;
+      lderr(m_cct) << "error opening cache file: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    if (::flock(fd, LOCK_EX | LOCK_NB) < 0) {
+      int r = -errno;
+      ldout(m_cct, 5) << "cache file in use by another process, not caching"
+		      << dendl;
+      TEMP_FAILURE_RETRY(::close(fd));
+      return r;
+    }
+    m_fd = fd;
+
+    int r = load_index();
+    if (r < 0) {
+      // anything in the data file is untrustworthy without an index
+      ldout(m_cct, 10) << "no usable index (" << cpp_strerror(r)
+		       << "), starting empty" << dendl;
+      m_extents.clear();
+      m_lru.clear();
+      m_lru_pos.clear();
+      if (::ftruncate(m_fd, 0) < 0) {
+	r = -errno;
+	lderr(m_cct) << "error truncating cache file: " << cpp_strerror(r)
+		     << dendl;
+      }
+    }
+    // the index is only valid until we write to the data file again
+    ::unlink(m_index_path.c_str());
+
+    ldout(m_cct, 10) << "opened with " << m_extents.size() << " bytes cached"
+		     << dendl;
+    trim();
+    return 0;
+  }
+
+  void PersistentCache::close()
+  {
+    Mutex::Locker l(m_lock);
+    if (m_fd < 0)
+      return;
+
+    int r = ::fdatasync(m_fd);
+    if (r < 0) {
+      r = -errno;
+      lderr(m_cct) << "error syncing cache file: " << cpp_strerror(r) << dendl;
+    } else {
+      r = save_index();
+      if (r < 0)
+	lderr(m_cct) << "error saving index: " << cpp_strerror(r) << dendl;
+    }
+    TEMP_FAILURE_RETRY(::close(m_fd));
+    m_fd = -1;
+  }
+
+  bool PersistentCache::read(uint64_t off, size_t len, bufferlist *bl)
+  {
+    Mutex::Locker l(m_lock);
+    if (m_fd < 0 || !len || !m_extents.contains(off, len))
+      return false;
+
+    bufferptr bp(len);
+    ssize_t r = safe_pread_exact(m_fd, bp.c_str(), len, off);
+    if (r < 0) {
+      lderr(m_cct) << "error reading " << off << "~" << len << ": "
+		   << cpp_strerror(r) << dendl;
+      evict_object(off >> m_order);
+      return false;
+    }
+    bl->clear();
+    bl->push_back(bp);
+    touch_object(off >> m_order);
+    return true;
+  }
+
+  void PersistentCache::write(uint64_t off, const bufferlist &bl)
+  {
+    Mutex::Locker l(m_lock);
+    if (m_fd < 0 || !bl.length())
+      return;
+    if (m_extents.contains(off, bl.length()))
+      return;
+
+    bufferlist data(bl);
+    ssize_t r = safe_pwrite(m_fd, data.c_str(), data.length(), off);
+    if (r < 0) {
+      lderr(m_cct) << "error writing " << off << "~" << data.length() << ": "
+		   << cpp_strerror(r) << dendl;
+      return;
+    }
+
+    interval_set<uint64_t> added;
+    added.insert(off, data.length());
+    m_extents.union_of(added);
+    touch_object(off >> m_order);
+    trim();
+  }
+
+  void PersistentCache::touch_object(uint64_t object_no)
+  {
+    assert(m_lock.is_locked());
+    map<uint64_t, list<uint64_t>::iterator>::iterator p =
+      m_lru_pos.find(object_no);
+    if (p != m_lru_pos.end())
+      m_lru.erase(p->second);
+    m_lru.push_front(object_no);
+    m_lru_pos[object_no] = m_lru.begin();
+  }
+
+  void PersistentCache::trim()
+  {
+    assert(m_lock.is_locked());
+    while ((uint64_t)m_extents.size() > m_max_size && !m_lru.empty())
+      evict_object(m_lru.back());
+  }
+
+  void PersistentCache::evict_object(uint64_t object_no)
+  {
+    assert(m_lock.is_locked());
+    uint64_t object_size = 1ull << m_order;
+
+    interval_set<uint64_t> object, evicted;
+    object.insert(object_no * object_size, object_size);
+    evicted.intersection_of(m_extents, object);
+    m_extents.subtract(evicted);
+
+    map<uint64_t, list<uint64_t>::iterator>::iterator p =
+      m_lru_pos.find(object_no);
+    if (p != m_lru_pos.end()) {
+      m_lru.erase(p->second);
+      m_lru_pos.erase(p);
+    }
+
+    ldout(m_cct, 20) << "evicting object " << object_no << ": " << evicted
+		     << dendl;
+#ifdef CEPH_HAVE_FALLOCATE
+    // give the space back; if we can't, the data just sits unreferenced
+    for (interval_set<uint64_t>::iterator q = evicted.begin();
+	 q != evicted.end(); ++q) {
+      ::fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  q.get_start(), q.get_len());
+    }
+#endif
+  }
+
+  int PersistentCache::load_index()
+  {
+    assert(m_lock.is_locked());
+    bufferlist bl;
+    string err;
+    int r = bl.read_file(m_index_path.c_str(), &err);
+    if (r < 0)
+      return r;
+
+    try {
+      bufferlist::iterator p = bl.begin();
+      DECODE_START(1, p);
+      ::decode(m_extents, p);
+      ::decode(m_lru, p);
+      DECODE_FINISH(p);
+    } catch (const buffer::error &e) {
+      lderr(m_cct) << "corrupt index: " << e.what() << dendl;
+      return -EINVAL;
+    }
+
+    for (list<uint64_t>::iterator p = m_lru.begin(); p != m_lru.end(); ++p)
+      m_lru_pos[*p] = p;
+    return 0;
+  }
+
+  int PersistentCache::save_index()
+  {
+    assert(m_lock.is_locked());
+    bufferlist bl;
+    ENCODE_START(1, 1, bl);
+    ::encode(m_extents, bl);
+    ::encode(m_lru, bl);
+    ENCODE_FINISH(bl);
+
+    string tmp = m_index_path + ".tmp";
+    int r = bl.write_file(tmp.c_str(), 0600);
+    if (r < 0)
+      return r;
+    if (::rename(tmp.c_str(), m_index_path.c_str()) < 0)
+      return -errno;
+    return 0;
+  }
+}
@@ -0,0 +1,96 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_PERSISTENTCACHE_H
+#define CEPH_LIBRBD_PERSISTENTCACHE_H
+
+#include <inttypes.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "common/Mutex.h"
+#include "include/buffer.h"
+#include "include/interval_set.h"
+
+class CephContext;
+
+namespace librbd {
+
+  /**
+   * A file-backed cache of data read from one snapshot of one image.
+   *
+   * Snapshots are immutable, so anything read from one can be kept on
+   * local disk and served again without going back to the cluster,
+   * even by a later process. Data is stored in a sparse file at its
+   * image offset; the set of valid extents is kept in memory and
+   * written to an index file on a clean close. The index is removed
+   * when the cache is opened, so a crash only loses the cache
+   * contents, never returns stale data.
+   *
+   * Cached data is evicted one object at a time, least recently used
+   * first, once more than max_size bytes are cached.
+   *
+   * The data file is locked while open, so only one process at a time
+   * uses a given cache; others run without it.
+   */
+  class PersistentCache {
+  public:
+    PersistentCache(CephContext *cct, const std::string &path,
+		    uint64_t max_size, uint8_t order);
+    ~PersistentCache();
+
+    /**
+     * Build the cache file name for an image snapshot
+     *
+     * @param dir directory holding cache files
+     * @param pool_id pool the image data lives in
+     * @param object_prefix the image's data object prefix
+     * @param snap_id snapshot the cache is for
+     */
+    static std::string get_path(const std::string &dir, int64_t pool_id,
+				const std::string &object_prefix,
+				uint64_t snap_id);
+
+    /// open and lock the data file, and load any saved index
+    int open();
+    /// sync data and save the index so the next open can use it
+    void close();
+
+    /**
+     * Read [off, off+len) if it is entirely cached
+     *
+     * @return true and fill bl on a hit, false otherwise
+     */
+    bool read(uint64_t off, size_t len, ceph::bufferlist *bl);
+
+    /// add [off, off+bl.length()) to the cache
+    void write(uint64_t off, const ceph::bufferlist &bl);
+
+    uint64_t get_cached_bytes() {
+      Mutex::Locker l(m_lock);
+      return m_extents.size();
+    }
+
+  private:
+    void touch_object(uint64_t object_no);
+    void trim();
+    void evict_object(uint64_t object_no);
+    int load_index();
+    int save_index();
+
+    CephContext *m_cct;
+    std::string m_path;
+    std::string m_index_path;
+    uint64_t m_max_size;
+    uint8_t m_order;
+
+    Mutex m_lock; // protects everything below
+    int m_fd;
+    interval_set<uint64_t> m_extents;
+    std::list<uint64_t> m_lru; // object numbers, most recent first
+    std::map<uint64_t, std::list<uint64_t>::iterator> m_lru_pos;
+  };
+}
+
+#endif
@@ -46,15 +46,29 @@ namespace librbd {
       return 0;
     }
 
-    int get_mutable_metadata(librados::IoCtx *ioctx, const std::string &oid,
-			     uint64_t *size, uint64_t *features,
-			     uint64_t *incompatible_features,
-			     map<rados::cls::lock::locker_id_t,
-				 rados::cls::lock::locker_info_t> *lockers,
-                             bool *exclusive_lock,
-			     string *lock_tag,
-			     ::SnapContext *snapc,
-			     parent_info *parent)
+    void get_mutable_metadata_start(librados::ObjectReadOperation *op)
+    {
+      bufferlist sizebl, featuresbl, parentbl, empty;
+      snapid_t snap = CEPH_NOSNAP;
+      ::encode(snap, sizebl);
+      ::encode(snap, featuresbl);
+      ::encode(snap, parentbl);
+      op->exec("rbd", "get_size", sizebl);
+      op->exec("rbd", "get_features", featuresbl);
+      op->exec("rbd", "get_snapcontext", empty);
+      op->exec("rbd", "get_parent", parentbl);
+      rados::cls::lock::get_lock_info_start(op, RBD_LOCK_NAME);
+    }
+
+    int get_mutable_metadata_finish(bufferlist::iterator *it,
+				    uint64_t *size, uint64_t *features,
+				    uint64_t *incompatible_features,
+				    map<rados::cls::lock::locker_id_t,
+					rados::cls::lock::locker_info_t> *lockers,
+				    bool *exclusive_lock,
+				    string *lock_tag,
+				    ::SnapContext *snapc,
+				    parent_info *parent)
     {
       assert(size);
       assert(features);
@@ -64,44 +78,26 @@ namespace librbd {
       assert(snapc);
       assert(parent);
 
-      librados::ObjectReadOperation op;
-      bufferlist sizebl, featuresbl, parentbl, empty;
-      snapid_t snap = CEPH_NOSNAP;
-      ::encode(snap, sizebl);
-      ::encode(snap, featuresbl);
-      ::encode(snap, parentbl);
-      op.exec("rbd", "get_size", sizebl);
-      op.exec("rbd", "get_features", featuresbl);
-      op.exec("rbd", "get_snapcontext", empty);
-      op.exec("rbd", "get_parent", parentbl);
-      rados::cls::lock::get_lock_info_start(&op, RBD_LOCK_NAME);
-
-      bufferlist outbl;
-      int r = ioctx->operate(oid, &op, &outbl);
-      if (r < 0)
-	return r;
-
       try {
-	bufferlist::iterator iter = outbl.begin();
 	uint8_t order;
 	// get_size
-	::decode(order, iter);
-	::decode(*size, iter);
+	::decode(order, *it);
+	::decode(*size, *it);
 	// get_features
-	::decode(*features, iter);
-	::decode(*incompatible_features, iter);
+	::decode(*features, *it);
+	::decode(*incompatible_features, *it);
 	// get_snapcontext
-	::decode(*snapc, iter);
+	::decode(*snapc, *it);
 	// get_parent
-	::decode(parent->spec.pool_id, iter);
-	::decode(parent->spec.image_id, iter);
-	::decode(parent->spec.snap_id, iter);
-	::decode(parent->overlap, iter);
+	::decode(parent->spec.pool_id, *it);
+	::decode(parent->spec.image_id, *it);
+	::decode(parent->spec.snap_id, *it);
+	::decode(parent->overlap, *it);
 
 	// get_lock_info
 	ClsLockType lock_type;
-	r = rados::cls::lock::get_lock_info_finish(&iter, lockers, &lock_type,
-						   lock_tag);
+	int r = rados::cls::lock::get_lock_info_finish(it, lockers, &lock_type,
+						       lock_tag);
 	if (r < 0)
 	  return r;
 
@@ -113,6 +109,31 @@ namespace librbd {
       return 0;
     }
 
+    int get_mutable_metadata(librados::IoCtx *ioctx, const std::string &oid,
+			     uint64_t *size, uint64_t *features,
+			     uint64_t *incompatible_features,
+			     map<rados::cls::lock::locker_id_t,
+				 rados::cls::lock::locker_info_t> *lockers,
+                             bool *exclusive_lock,
+			     string *lock_tag,
+			     ::SnapContext *snapc,
+			     parent_info *parent)
+    {
+      librados::ObjectReadOperation op;
+      get_mutable_metadata_start(&op);
+
+      bufferlist outbl;
+      int r = ioctx->operate(oid, &op, &outbl);
+      if (r < 0)
+	return r;
+
+      bufferlist::iterator iter = outbl.begin();
+      return get_mutable_metadata_finish(&iter, size, features,
+					 incompatible_features, lockers,
+					 exclusive_lock, lock_tag, snapc,
+					 parent);
+    }
+
     int create_image(librados::IoCtx *ioctx, const std::string &oid,
 		     uint64_t size, uint8_t order, uint64_t features,
 		     const std::string &object_prefix)
@@ -321,67 +342,64 @@ namespace librbd {
       return 0;
     }
 
-    int snapshot_list(librados::IoCtx *ioctx, const std::string &oid,
-		      const std::vector<snapid_t> &ids,
-		      std::vector<string> *names,
-		      std::vector<uint64_t> *sizes,
-		      std::vector<uint64_t> *features,
-		      std::vector<parent_info> *parents,
-		      std::vector<uint8_t> *protection_statuses)
+    void snapshot_list_start(librados::ObjectReadOperation *op,
+			     const std::vector<snapid_t> &ids)
     {
-      names->clear();
-      names->resize(ids.size());
-      sizes->clear();
-      sizes->resize(ids.size());
-      features->clear();
-      features->resize(ids.size());
-      parents->clear();
-      parents->resize(ids.size());
-      protection_statuses->clear();
-      protection_statuses->resize(ids.size());
-
-      librados::ObjectReadOperation op;
       for (vector<snapid_t>::const_iterator it = ids.begin();
 	   it != ids.end(); ++it) {
 	snapid_t snap_id = it->val;
 	bufferlist bl1, bl2, bl3, bl4, bl5;
 	::encode(snap_id, bl1);
-	op.exec("rbd", "get_snapshot_name", bl1);
+	op->exec("rbd", "get_snapshot_name", bl1);
 	::encode(snap_id, bl2);
-	op.exec("rbd", "get_size", bl2);
+	op->exec("rbd", "get_size", bl2);
 	::encode(snap_id, bl3);
-	op.exec("rbd", "get_features", bl3);
+	op->exec("rbd", "get_features", bl3);
 	::encode(snap_id, bl4);
-	op.exec("rbd", "get_parent", bl4);
+	op->exec("rbd", "get_parent", bl4);
 	::encode(snap_id, bl5);
-	op.exec("rbd", "get_protection_status", bl5);
+	op->exec("rbd", "get_protection_status", bl5);
       }
+    }
 
-      bufferlist outbl;
-      int r = ioctx->operate(oid, &op, &outbl);
-      if (r < 0)
-	return r;
+    int snapshot_list_finish(bufferlist::iterator *it,
+			     const std::vector<snapid_t> &ids,
+			     std::vector<string> *names,
+			     std::vector<uint64_t> *sizes,
+			     std::vector<uint64_t> *features,
+			     std::vector<parent_info> *parents,
+			     std::vector<uint8_t> *protection_statuses)
+    {
+      names->clear();
+      names->resize(ids.size());
+      sizes->clear();
+      sizes->resize(ids.size());
+      features->clear();
+      features->resize(ids.size());
+      parents->clear();
+      parents->resize(ids.size());
+      protection_statuses->clear();
+      protection_statuses->resize(ids.size());
 
       try {
-	bufferlist::iterator iter = outbl.begin();
 	for (size_t i = 0; i < ids.size(); ++i) {
 	  uint8_t order;
 	  uint64_t incompat_features;
 	  // get_snapshot_name
-	  ::decode((*names)[i], iter);
+	  ::decode((*names)[i], *it);
 	  // get_size
-	  ::decode(order, iter);
-	  ::decode((*sizes)[i], iter);
+	  ::decode(order, *it);
+	  ::decode((*sizes)[i], *it);
 	  // get_features
-	  ::decode((*features)[i], iter);
-	  ::decode(incompat_features, iter);
+	  ::decode((*features)[i], *it);
+	  ::decode(incompat_features, *it);
 	  // get_parent
-	  ::decode((*parents)[i].spec.pool_id, iter);
-	  ::decode((*parents)[i].spec.image_id, iter);
-	  ::decode((*parents)[i].spec.snap_id, iter);
-	  ::decode((*parents)[i].overlap, iter);
+	  ::decode((*parents)[i].spec.pool_id, *it);
+	  ::decode((*parents)[i].spec.image_id, *it);
+	  ::decode((*parents)[i].spec.snap_id, *it);
+	  ::decode((*parents)[i].overlap, *it);
 	  // get_protection_status
-	  ::decode((*protection_statuses)[i], iter);
+	  ::decode((*protection_statuses)[i], *it);
 	}
       } catch (const buffer::error &err) {
 	return -EBADMSG;
@@ -390,6 +408,54 @@ namespace librbd {
       return 0;
     }
 
+    int snapshot_list(librados::IoCtx *ioctx, const std::string &oid,
+		      const std::vector<snapid_t> &ids,
+		      std::vector<string> *names,
+		      std::vector<uint64_t> *sizes,
+		      std::vector<uint64_t> *features,
+		      std::vector<parent_info> *parents,
+		      std::vector<uint8_t> *protection_statuses)
+    {
+      librados::ObjectReadOperation op;
+      snapshot_list_start(&op, ids);
+
+      bufferlist outbl;
+      int r = ioctx->operate(oid, &op, &outbl);
+      if (r < 0)
+	return r;
+
+      bufferlist::iterator iter = outbl.begin();
+      return snapshot_list_finish(&iter, ids, names, sizes, features, parents,
+				  protection_statuses);
+    }
+
+    void get_protection_status_list_start(librados::ObjectReadOperation *op,
+					  const std::vector<snapid_t> &ids)
+    {
+      for (vector<snapid_t>::const_iterator it = ids.begin();
+	   it != ids.end(); ++it) {
+	snapid_t snap_id = it->val;
+	bufferlist bl;
+	::encode(snap_id, bl);
+	op->exec("rbd", "get_protection_status", bl);
+      }
+    }
+
+    int get_protection_status_list_finish(bufferlist::iterator *it,
+					  const std::vector<snapid_t> &ids,
+					  std::vector<uint8_t> *protection_statuses)
+    {
+      protection_statuses->clear();
+      protection_statuses->resize(ids.size());
+      try {
+	for (size_t i = 0; i < ids.size(); ++i)
+	  ::decode((*protection_statuses)[i], *it);
+      } catch (const buffer::error &err) {
+	return -EBADMSG;
+      }
+      return 0;
+    }
+
     int old_snapshot_add(librados::IoCtx *ioctx, const std::string &oid,
 			 snapid_t snap_id, const std::string &snap_name)
     {
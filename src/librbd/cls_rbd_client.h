@@ -29,6 +29,33 @@ namespace librbd {
 			     ::SnapContext *snapc,
 			     parent_info *parent);
 
+    // the same, split so the calls can be batched with others in one
+    // compound operation
+    void get_mutable_metadata_start(librados::ObjectReadOperation *op);
+    int get_mutable_metadata_finish(bufferlist::iterator *it,
+				    uint64_t *size, uint64_t *features,
+				    uint64_t *incompatible_features,
+				    map<rados::cls::lock::locker_id_t,
+					rados::cls::lock::locker_info_t> *lockers,
+				    bool *exclusive_lock,
+				    std::string *lock_tag,
+				    ::SnapContext *snapc,
+				    parent_info *parent);
+    void snapshot_list_start(librados::ObjectReadOperation *op,
+			     const std::vector<snapid_t> &ids);
+    int snapshot_list_finish(bufferlist::iterator *it,
+			     const std::vector<snapid_t> &ids,
+			     std::vector<string> *names,
+			     std::vector<uint64_t> *sizes,
+			     std::vector<uint64_t> *features,
+			     std::vector<parent_info> *parents,
+			     std::vector<uint8_t> *protection_statuses);
+    void get_protection_status_list_start(librados::ObjectReadOperation *op,
+					  const std::vector<snapid_t> &ids);
+    int get_protection_status_list_finish(bufferlist::iterator *it,
+					  const std::vector<snapid_t> &ids,
+					  std::vector<uint8_t> *protection_statuses);
+
     // low-level interface (mainly for testing)
     int create_image(librados::IoCtx *ioctx, const std::string &oid,
 		     uint64_t size, uint8_t order, uint64_t features,
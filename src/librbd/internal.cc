@@ -6,6 +6,8 @@
 #include "common/ceph_context.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "common/Finisher.h"
+#include "common/Throttle.h"
 #include "cls/lock/cls_lock_client.h"
 #include "include/stringify.h"
 
@@ -1519,16 +1521,53 @@ reprotect_and_return_err:
 	  ictx->size = ictx->header.image_size;
 	  ictx->object_prefix = ictx->header.block_name;
 	} else {
+	  // a snapshot's name, size, features and parent never change, so
+	  // only new snapshots need all of them looked up; for the ones we
+	  // already know, the protection status is read in the same round
+	  // trip as the rest of the header
+	  map<snap_t, string> known;
+	  for (map<string, SnapInfo>::const_iterator it =
+		 ictx->snaps_by_name.begin();
+	       it != ictx->snaps_by_name.end(); ++it) {
+	    known[it->second.id] = it->first;
+	  }
+
 	  do {
+	    vector<snapid_t> known_ids;
+	    for (map<snap_t, string>::const_iterator it = known.begin();
+		 it != known.end(); ++it) {
+	      known_ids.push_back(it->first);
+	    }
+
+	    librados::ObjectReadOperation op;
+	    cls_client::get_mutable_metadata_start(&op);
+	    cls_client::get_protection_status_list_start(&op, known_ids);
+
+	    bufferlist outbl;
+	    r = ictx->md_ctx.operate(ictx->header_oid, &op, &outbl);
+	    if (r == -ENOENT && !known.empty()) {
+	      // a snapshot we knew about was removed; look them all up again
+	      ldout(cct, 10) << "known snapshot removed, rereading all" << dendl;
+	      known.clear();
+	      continue;
+	    }
+
 	    uint64_t incompatible_features;
-	    r = cls_client::get_mutable_metadata(&ictx->md_ctx, ictx->header_oid,
-						 &ictx->size, &ictx->features,
-						 &incompatible_features,
-						 &ictx->lockers,
-						 &ictx->exclusive_locked,
-						 &ictx->lock_tag,
-						 &new_snapc,
-						 &ictx->parent_md);
+	    vector<uint8_t> known_protection;
+	    if (r >= 0) {
+	      bufferlist::iterator it = outbl.begin();
+	      r = cls_client::get_mutable_metadata_finish(&it, &ictx->size,
+							  &ictx->features,
+							  &incompatible_features,
+							  &ictx->lockers,
+							  &ictx->exclusive_locked,
+							  &ictx->lock_tag,
+							  &new_snapc,
+							  &ictx->parent_md);
+	      if (r >= 0)
+		r = cls_client::get_protection_status_list_finish(&it, known_ids,
+								  &known_protection);
+	    }
 	    if (r < 0) {
 	      lderr(cct) << "Error reading mutable metadata: " << cpp_strerror(r)
 			 << dendl;
@@ -1542,17 +1581,63 @@ reprotect_and_return_err:
 	      return -ENOSYS;
 	    }
 
-	    r = cls_client::snapshot_list(&(ictx->md_ctx), ictx->header_oid,
-					  new_snapc.snaps, &snap_names,
-					  &snap_sizes, &snap_features,
-					  &snap_parents,
-					  &snap_protection);
-	    // -ENOENT here means we raced with snapshot deletion
-	    if (r < 0 && r != -ENOENT) {
-	      lderr(ictx->cct) << "snapc = " << new_snapc << dendl;
-	      lderr(ictx->cct) << "Error listing snapshots: " << cpp_strerror(r)
-			       << dendl;
-	      return r;
+	    vector<snapid_t> new_ids;
+	    for (vector<snapid_t>::const_iterator it = new_snapc.snaps.begin();
+		 it != new_snapc.snaps.end(); ++it) {
+	      if (!known.count(it->val))
+		new_ids.push_back(*it);
+	    }
+
+	    vector<string> new_names;
+	    vector<uint64_t> new_sizes;
+	    vector<uint64_t> new_features;
+	    vector<parent_info> new_parents;
+	    vector<uint8_t> new_protection;
+	    if (!new_ids.empty()) {
+	      r = cls_client::snapshot_list(&(ictx->md_ctx), ictx->header_oid,
+					    new_ids, &new_names, &new_sizes,
+					    &new_features, &new_parents,
+					    &new_protection);
+	      // -ENOENT here means we raced with snapshot deletion
+	      if (r < 0 && r != -ENOENT) {
+		lderr(ictx->cct) << "snapc = " << new_snapc << dendl;
+		lderr(ictx->cct) << "Error listing snapshots: " << cpp_strerror(r)
+				 << dendl;
+		return r;
+	      }
+	      if (r == -ENOENT)
+		continue;
+	    }
+
+	    // merge known and new snapshots back into snapc order
+	    map<snap_t, uint8_t> protection_by_id;
+	    for (size_t i = 0; i < known_ids.size(); ++i)
+	      protection_by_id[known_ids[i].val] = known_protection[i];
+
+	    snap_names.clear();
+	    snap_sizes.clear();
+	    snap_features.clear();
+	    snap_parents.clear();
+	    snap_protection.clear();
+	    size_t n = 0;
+	    for (vector<snapid_t>::const_iterator it = new_snapc.snaps.begin();
+		 it != new_snapc.snaps.end(); ++it) {
+	      map<snap_t, string>::const_iterator k = known.find(it->val);
+	      if (k != known.end()) {
+		const SnapInfo &info = ictx->snaps_by_name.find(k->second)->second;
+		snap_names.push_back(k->second);
+		snap_sizes.push_back(info.size);
+		snap_features.push_back(info.features);
+		snap_parents.push_back(info.parent);
+		snap_protection.push_back(protection_by_id[it->val]);
+	      } else {
+		snap_names.push_back(new_names[n]);
+		snap_sizes.push_back(new_sizes[n]);
+		snap_features.push_back(new_features[n]);
+		snap_parents.push_back(new_parents[n]);
+		snap_protection.push_back(new_protection[n]);
+		++n;
+	      }
 	    }
 	  } while (r == -ENOENT);
 	}
@@ -1678,38 +1763,97 @@ reprotect_and_return_err:
     return r;
   }
 
-  struct CopyProgressCtx {
-    CopyProgressCtx(ProgressContext &p)
-      : prog_ctx(p)
-    {
-    }
-    ImageCtx *destictx;
-    uint64_t src_size;
-    ProgressContext &prog_ctx;
-  };
+  void rbd_ctx_cb(completion_t cb, void *arg)
+  {
+    Context *ctx = reinterpret_cast<Context *>(arg);
+    AioCompletion *comp = reinterpret_cast<AioCompletion *>(cb);
+    ctx->complete(comp->get_return_value());
+  }
 
-  int do_copy_extent(uint64_t offset, size_t len, const char *buf, void *data)
+  // test if an entire buf is zero in 8-byte chunks
+  static bool buf_is_zero(char *buf, size_t len)
   {
-    CopyProgressCtx *cp = reinterpret_cast<CopyProgressCtx*>(data);
-    cp->prog_ctx.update_progress(offset, cp->src_size);
-    int ret = 0;
-    if (buf) {
-      ret = write(cp->destictx, offset, len, buf);
+    size_t ofs;
+    int chunk = sizeof(uint64_t);
+
+    for (ofs = 0; ofs < len; ofs += sizeof(uint64_t)) {
+      if (*(uint64_t *)(buf + ofs) != 0) {
+	return false;
+      }
     }
-    return ret;
+    for (ofs = (len / chunk) * chunk; ofs < len; ofs++) {
+      if (buf[ofs] != '\0') {
+	return false;
+      }
+    }
+    return true;
   }
 
+  class C_CopyWrite : public Context {
+  public:
+    C_CopyWrite(SimpleThrottle *throttle, bufferlist *bl)
+      : m_throttle(throttle), m_bl(bl) {}
+    virtual void finish(int r) {
+      delete m_bl;
+      m_throttle->end_op(r);
+    }
+  private:
+    SimpleThrottle *m_throttle;
+    bufferlist *m_bl;
+  };
+
+  // runs in copy()'s finisher, so a write blocked on the destination's
+  // cache never holds up a librados callback thread
+  class C_CopyRead : public Context {
+  public:
+    C_CopyRead(SimpleThrottle *throttle, ImageCtx *dest, uint64_t offset,
+	       bufferlist *bl)
+      : m_throttle(throttle), m_dest(dest), m_offset(offset), m_bl(bl) {}
+    virtual void finish(int r) {
+      if (r < 0) {
+	lderr(m_dest->cct) << "error reading from source image at offset "
+			   << m_offset << ": " << cpp_strerror(r) << dendl;
+	delete m_bl;
+	m_throttle->end_op(r);
+	return;
+      }
+
+      // the new image is empty, so there's no need to write zeros
+      if (buf_is_zero(m_bl->c_str(), m_bl->length())) {
+	delete m_bl;
+	m_throttle->end_op(0);
+	return;
+      }
+
+      Context *ctx = new C_CopyWrite(m_throttle, m_bl);
+      AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+      r = aio_write(m_dest, m_offset, m_bl->length(), m_bl->c_str(), comp);
+      if (r < 0) {
+	lderr(m_dest->cct) << "error writing to destination image at offset "
+			   << m_offset << ": " << cpp_strerror(r) << dendl;
+	comp->release();
+	ctx->complete(r);
+	return;
+      }
+      comp->release();
+    }
+  private:
+    SimpleThrottle *m_throttle;
+    ImageCtx *m_dest;
+    uint64_t m_offset;
+    bufferlist *m_bl;
+  };
+
   int copy(ImageCtx *ictx, IoCtx& dest_md_ctx, const char *destname,
 	   ProgressContext &prog_ctx)
   {
     CephContext *cct = (CephContext *)dest_md_ctx.cct();
-    CopyProgressCtx cp(prog_ctx);
     ictx->md_lock.Lock();
     ictx->snap_lock.Lock();
     uint64_t src_size = ictx->get_image_size(ictx->snap_id);
     ictx->snap_lock.Unlock();
     ictx->md_lock.Unlock();
-    int64_t r;
+    int r;
 
     int order = ictx->order;
     r = create(dest_md_ctx, destname, src_size, ictx->old_format,
@@ -1719,22 +1863,49 @@ reprotect_and_return_err:
       return r;
     }
 
-    cp.destictx = new librbd::ImageCtx(destname, "", NULL, dest_md_ctx);
-    cp.src_size = src_size;
-    r = open_image(cp.destictx, true);
+    ImageCtx *destictx = new librbd::ImageCtx(destname, "", NULL, dest_md_ctx);
+    r = open_image(destictx, true);
     if (r < 0) {
       lderr(cct) << "failed to read newly created header" << dendl;
       return r;
     }
 
-    r = read_iterate(ictx, 0, src_size, do_copy_extent, &cp);
-
-    if (r >= 0) {
-      // don't return total bytes read, which may not fit in an int
-      r = 0;
-      prog_ctx.update_progress(cp.src_size, cp.src_size);
+    // keep up to rbd_concurrent_management_ops objects in flight; each
+    // one is read, then written by its read's completion
+    Finisher finisher(cct);
+    finisher.start();
+    SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, false);
+    uint64_t period = get_block_size(ictx->order);
+    for (uint64_t offset = 0; offset < src_size; offset += period) {
+      if (throttle.pending_error())
+	break;
+      prog_ctx.update_progress(offset, src_size);
+
+      uint64_t len = min(period, src_size - offset);
+      bufferlist *bl = new bufferlist();
+      bl->push_back(buffer::create(len));
+      Context *ctx = new C_CopyRead(&throttle, destictx, offset, bl);
+      Context *fin_ctx = new C_OnFinisher(ctx, &finisher);
+      AioCompletion *comp = aio_create_completion_internal(fin_ctx,
+							   rbd_ctx_cb);
+      throttle.start_op();
+      r = aio_read(ictx, offset, len, bl->c_str(), comp);
+      if (r < 0) {
+	comp->release();
+	delete fin_ctx;
+	delete ctx;
+	delete bl;
+	throttle.end_op(r);
+	break;
+      }
+      comp->release();
     }
-    close_image(cp.destictx);
+
+    r = throttle.wait_for_ret();
+    finisher.stop();
+    if (r >= 0)
+      prog_ctx.update_progress(src_size, src_size);
+    close_image(destictx);
     return r;
   }
 
@@ -1819,6 +1990,12 @@ reprotect_and_return_err:
     delete ictx;
   }
 
+  static void rados_throttle_cb(rados_completion_t c, void *arg)
+  {
+    SimpleThrottle *throttle = reinterpret_cast<SimpleThrottle *>(arg);
+    throttle->end_op(rados_aio_get_return_value(c));
+  }
+
   // copy a parent block from buf to the child ictx(offset, len)
   int copyup_block(ImageCtx *ictx, uint64_t offset, size_t len,
 		   const char *buf)
@@ -1838,24 +2015,47 @@ reprotect_and_return_err:
     return cls_client::copyup(&ictx->data_ctx, oid, bl);
   }
 
-  // test if an entire buf is zero in 8-byte chunks
-  static bool buf_is_zero(char *buf, size_t len)
-  {
-    size_t ofs;
-    int chunk = sizeof(uint64_t);
-
-    for (ofs = 0; ofs < len; ofs += sizeof(uint64_t)) {
-      if (*(uint64_t *)(buf + ofs) != 0) {
-	return false;
+  class C_CopyupObject : public Context {
+  public:
+    C_CopyupObject(ImageCtx *ictx, SimpleThrottle *throttle, uint64_t offset,
+		   bufferlist *bl)
+      : m_ictx(ictx), m_throttle(throttle), m_offset(offset), m_bl(bl) {}
+    virtual void finish(int r) {
+      if (r < 0) {
+	lderr(m_ictx->cct) << "error reading from parent at offset "
+			   << m_offset << ": " << cpp_strerror(r) << dendl;
+	delete m_bl;
+	m_throttle->end_op(r);
+	return;
       }
-    }
-    for (ofs = (len / chunk) * chunk; ofs < len; ofs++) {
-      if (buf[ofs] != '\0') {
-	return false;
+
+      // if the data is all zero, don't bother with the object
+      if (buf_is_zero(m_bl->c_str(), m_bl->length())) {
+	delete m_bl;
+	m_throttle->end_op(0);
+	return;
       }
+
+      string oid = get_block_oid(m_ictx->object_prefix,
+				 get_block_num(m_ictx->order, m_offset),
+				 m_ictx->old_format);
+      librados::ObjectWriteOperation copyup;
+      copyup.exec("rbd", "copyup", *m_bl);
+      delete m_bl;
+
+      librados::AioCompletion *rados_completion =
+	Rados::aio_create_completion(m_throttle, NULL, rados_throttle_cb);
+      r = m_ictx->data_ctx.aio_operate(oid, rados_completion, &copyup);
+      rados_completion->release();
+      if (r < 0)
+	m_throttle->end_op(r);
     }
-    return true;
-  }
+  private:
+    ImageCtx *m_ictx;
+    SimpleThrottle *m_throttle;
+    uint64_t m_offset;
+    bufferlist *m_bl;
+  };
 
   // 'flatten' child image by copying all parent's blocks
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx)
@@ -1886,25 +2086,37 @@ reprotect_and_return_err:
 
     uint64_t overlap = ictx->parent_md.overlap;
     uint64_t cblksize = get_block_size(ictx->order);
-    char *buf = new char[cblksize];
+    CephContext *cct = ictx->cct;
+    SimpleThrottle throttle(cct->_conf->rbd_concurrent_management_ops, false);
 
-    size_t ofs = 0;
-    while (ofs < overlap) {
+    for (uint64_t ofs = 0; ofs < overlap; ofs += cblksize) {
+      if (throttle.pending_error())
+	break;
       prog_ctx.update_progress(ofs, overlap);
+
       size_t readsize = min(overlap - ofs, cblksize);
-      if ((r = read(ictx->parent, ofs, readsize, buf)) < 0) {
-	lderr(ictx->cct) << "reading from parent failed" << dendl;
-	goto err;
+      bufferlist *bl = new bufferlist();
+      bl->push_back(buffer::create(readsize));
+      Context *ctx = new C_CopyupObject(ictx, &throttle, ofs, bl);
+      AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+      throttle.start_op();
+      r = aio_read(ictx->parent, ofs, readsize, bl->c_str(), comp);
+      if (r < 0) {
+	lderr(cct) << "reading from parent failed" << dendl;
+	comp->release();
+	delete ctx;
+	delete bl;
+	throttle.end_op(r);
+	break;
       }
+      comp->release();
+    }
 
-      // for actual amount read, if data is all zero, don't bother with block
-      if (!buf_is_zero(buf, r)) {
-	if ((r = copyup_block(ictx, ofs, r, buf)) < 0) {
-	  lderr(ictx->cct) << "failed to copy block to child" << dendl;
-	  goto err;
-	}
-      }
-      ofs += cblksize;
+    r = throttle.wait_for_ret();
+    if (r < 0) {
+      lderr(cct) << "failed to copy parent data to child: "
+		 << cpp_strerror(r) << dendl;
+      return r;
     }
 
     // remove parent from this (base) image
@@ -1930,9 +2142,7 @@ reprotect_and_return_err:
 
     ldout(ictx->cct, 20) << "finished flattening" << dendl;
 
-  err:
-    delete[] buf;
-    return r;
+    return 0;
   }
 
   int list_lockers(ImageCtx *ictx,
@@ -2037,13 +2247,6 @@ reprotect_and_return_err:
     return 0;
   }
 
-  void rbd_ctx_cb(completion_t cb, void *arg)
-  {
-    Context *ctx = reinterpret_cast<Context *>(arg);
-    AioCompletion *comp = reinterpret_cast<AioCompletion *>(cb);
-    ctx->complete(comp->get_return_value());
-  }
-
   int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *),
 		       void *arg)
@@ -2417,7 +2620,6 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
-    // TODO: check for snap
     size_t total_write = 0;
     uint64_t start_block = get_block_num(ictx->order, off);
     uint64_t end_block = get_block_num(ictx->order, off + len - 1);
@@ -2437,9 +2639,25 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
-    vector<ObjectExtent> v;
-    if (ictx->object_cacher)
+    if (snap_id != CEPH_NOSNAP)
+      return -EROFS;
+
+    // drop cached data first, so dirty buffers can't be written back
+    // over the discarded range once the objects are gone
+    if (ictx->object_cacher) {
+      vector<ObjectExtent> v;
       v.reserve(end_block - start_block + 1);
+      uint64_t ofs = off;
+      for (uint64_t i = start_block; i <= end_block; i++) {
+	string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
+	uint64_t block_ofs = get_block_ofs(ictx->order, ofs);
+	uint64_t discard_len = min(block_size - block_ofs, off + len - ofs);
+	v.push_back(ObjectExtent(oid, block_ofs, discard_len));
+	v.back().oloc.pool = ictx->data_ctx.get_id();
+	ofs += discard_len;
+      }
+      ictx->discard_from_cache(v);
+    }
 
     c->get();
     c->init_time(ictx, AIO_TYPE_DISCARD);
@@ -2449,15 +2667,12 @@ reprotect_and_return_err:
       uint64_t block_ofs = get_block_ofs(ictx->order, total_off);;
       uint64_t write_len = min(block_size - block_ofs, left);
 
-      if (ictx->object_cacher) {
-	v.push_back(ObjectExtent(oid, block_ofs, write_len));
-	v.back().oloc.pool = ictx->data_ctx.get_id();
-      }
-
       C_AioWrite *req_comp = new C_AioWrite(cct, c);
       AbstractWrite *req;
       c->add_request();
 
+      // whole objects are removed, tails truncated, and anything else
+      // zeroed, which the OSD turns into a hole where it can
       bool parent_exists = has_parent(parent_pool_id, total_off - block_ofs, overlap);
       if (block_ofs == 0 && write_len == block_size) {
 	req = new AioRemove(ictx, oid, total_off, snapc, snap_id,
@@ -2478,9 +2693,6 @@ reprotect_and_return_err:
     }
     r = 0;
   done:
-    if (ictx->object_cacher)
-      ictx->object_cacher->discard_set(ictx->object_set, v);
-
     c->finish_adding_requests();
     c->put();
 
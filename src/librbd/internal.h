@@ -45,6 +45,11 @@ enum {
   l_librbd_notify,
   l_librbd_resize,
 
+  l_librbd_pcache_hit,        // reads served from the persistent cache
+  l_librbd_pcache_hit_bytes,
+  l_librbd_pcache_miss,       // snapshot reads that went to the cluster
+  l_librbd_pcache_miss_bytes,
+
   l_librbd_last,
 };
 
@@ -0,0 +1,48 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_MOSDPGPULL_H
+#define CEPH_MOSDPGPULL_H
+
+#include "msg/Message.h"
+#include "osd/osd_types.h"
+
+class MOSDPGPull : public Message {
+public:
+  pg_t pgid;
+  epoch_t map_epoch;
+  vector<PullOp> pulls;
+
+  virtual void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    ::decode(pgid, p);
+    ::decode(map_epoch, p);
+    ::decode(pulls, p);
+  }
+
+  virtual void encode_payload(uint64_t features) {
+    ::encode(pgid, payload);
+    ::encode(map_epoch, payload);
+    ::encode(pulls, payload);
+  }
+
+  MOSDPGPull() : Message(MSG_OSD_PG_PULL) {}
+  MOSDPGPull(pg_t p, epoch_t e)
+    : Message(MSG_OSD_PG_PULL),
+      pgid(p),
+      map_epoch(e) {
+  }
+private:
+  ~MOSDPGPull() {}
+
+public:
+  const char *get_type_name() const { return "pg_pull"; }
+  void print(ostream& out) const {
+    out << "pg_pull(" << pgid
+	<< " e " << map_epoch
+	<< " " << pulls
+	<< ")";
+  }
+};
+
+#endif
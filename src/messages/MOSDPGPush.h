@@ -0,0 +1,48 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_MOSDPGPUSH_H
+#define CEPH_MOSDPGPUSH_H
+
+#include "msg/Message.h"
+#include "osd/osd_types.h"
+
+class MOSDPGPush : public Message {
+public:
+  pg_t pgid;
+  epoch_t map_epoch;
+  vector<PushOp> pushes;
+
+  virtual void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    ::decode(pgid, p);
+    ::decode(map_epoch, p);
+    ::decode(pushes, p);
+  }
+
+  virtual void encode_payload(uint64_t features) {
+    ::encode(pgid, payload);
+    ::encode(map_epoch, payload);
+    ::encode(pushes, payload);
+  }
+
+  MOSDPGPush() : Message(MSG_OSD_PG_PUSH) {}
+  MOSDPGPush(pg_t p, epoch_t e)
+    : Message(MSG_OSD_PG_PUSH),
+      pgid(p),
+      map_epoch(e) {
+  }
+private:
+  ~MOSDPGPush() {}
+
+public:
+  const char *get_type_name() const { return "pg_push"; }
+  void print(ostream& out) const {
+    out << "pg_push(" << pgid
+	<< " e " << map_epoch
+	<< " " << pushes
+	<< ")";
+  }
+};
+
+#endif
@@ -0,0 +1,48 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_MOSDPGPUSHREPLY_H
+#define CEPH_MOSDPGPUSHREPLY_H
+
+#include "msg/Message.h"
+#include "osd/osd_types.h"
+
+class MOSDPGPushReply : public Message {
+public:
+  pg_t pgid;
+  epoch_t map_epoch;
+  vector<PushReplyOp> replies;
+
+  virtual void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    ::decode(pgid, p);
+    ::decode(map_epoch, p);
+    ::decode(replies, p);
+  }
+
+  virtual void encode_payload(uint64_t features) {
+    ::encode(pgid, payload);
+    ::encode(map_epoch, payload);
+    ::encode(replies, payload);
+  }
+
+  MOSDPGPushReply() : Message(MSG_OSD_PG_PUSH_REPLY) {}
+  MOSDPGPushReply(pg_t p, epoch_t e)
+    : Message(MSG_OSD_PG_PUSH_REPLY),
+      pgid(p),
+      map_epoch(e) {
+  }
+private:
+  ~MOSDPGPushReply() {}
+
+public:
+  const char *get_type_name() const { return "pg_push_reply"; }
+  void print(ostream& out) const {
+    out << "pg_push_reply(" << pgid
+	<< " e " << map_epoch
+	<< " " << replies
+	<< ")";
+  }
+};
+
+#endif
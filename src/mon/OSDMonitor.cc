@@ -2648,6 +2648,22 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	      getline(ss, rs);
 	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
 	      return true;
+	    } else if (m->cmd[4] == "expected_num_objects") {
+	      // n is too narrow for large pools
+	      string interr;
+	      long long num = strict_strtoll(start, 10, &interr);
+	      if (!interr.empty() || num < 0) {
+		ss << "expected_num_objects must be a non-negative integer";
+		err = -EINVAL;
+		goto out;
+	      }
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      pending_inc.new_pools[pool].expected_num_objects = num;
+	      ss << "set pool " << pool << " expected_num_objects to " << num;
+	      getline(ss, rs);
+	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	      return true;
 	    } else if (m->cmd[4] == "pg_num") {
 	      if (true) {
 		// ** DISABLE THIS FOR NOW **
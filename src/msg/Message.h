@@ -90,6 +90,10 @@
 #define MSG_OSD_PG_SCAN        94
 #define MSG_OSD_PG_BACKFILL    95
 
+#define MSG_OSD_PG_PUSH        105
+#define MSG_OSD_PG_PULL        106
+#define MSG_OSD_PG_PUSH_REPLY  107
+
 #define MSG_COMMAND            97
 #define MSG_COMMAND_REPLY      98
 
@@ -74,6 +74,21 @@ protected:
   /// Type of returned paths
   typedef std::tr1::shared_ptr<Path> IndexedPath;
 
+  /**
+   * Receives subdirectories which have outgrown the split threshold
+   * when splitting is deferred to a background thread.
+   *
+   * @see split_step
+   */
+  class SplitQueue {
+  public:
+    virtual void queue_split(
+      coll_t c,                  ///< [in] Collection to split
+      const vector<string> &path ///< [in] Subdirectory to split
+      ) = 0;
+    virtual ~SplitQueue() {}
+  };
+
   static IndexedPath get_testing_path(string path, coll_t collection) {
     return IndexedPath(new Path(path, collection));
   }
@@ -166,6 +181,39 @@ protected:
     vector<hobject_t> *ls ///< [out] Listed Objects
     ) = 0;
 
+  /**
+   * Prepare an empty collection to hold expected_num_objs objects
+   *
+   * Indexes which can't make use of the hint ignore it.
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int pre_split(
+    uint32_t pg_num,           ///< [in] pg_num of the collection's pool
+    uint64_t expected_num_objs ///< [in] Objects expected in the collection
+    ) { return 0; }
+
+  /**
+   * Remove whatever the index itself keeps in an emptied collection
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int prep_delete() { return 0; }
+
+  /**
+   * Perform part of a split queued to a SplitQueue
+   *
+   * Leaves the collection consistent, so other accesses may come
+   * between steps.
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int split_step(
+    const vector<string> &path, ///< [in] Subdirectory being split
+    uint64_t *moved,            ///< [out] Objects relinked by this step
+    bool *more                  ///< [out] True if path needs more steps
+    ) { *moved = 0; *more = false; return 0; }
+
   /// Virtual destructor
   virtual ~CollectionIndex() {}
 };
@@ -38,6 +38,14 @@ const string DBObjectMap::HOBJECT_TO_SEQ = "_HOBJTOSEQ_";
 const string DBObjectMap::LEAF_PREFIX = "_LEAF_";
 const string DBObjectMap::REVERSE_LEAF_PREFIX = "_REVLEAF_";
 
+DBObjectMap::DBObjectMap(KeyValueDB *db)
+  : db(db),
+    header_lock("DBOBjectMap"),
+    caches(g_conf->filestore_omap_header_cache_size),
+    parent_caches(g_conf->filestore_omap_header_cache_size)
+{
+}
+
 static void append_escaped(const string &in, string *out)
 {
   for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
@@ -504,7 +512,9 @@ int DBObjectMap::set_keys(const hobject_t &hoid,
 			  const SequencerPosition *spos)
 {
   KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  MapHeaderLock hl(this, hoid);
+  CacheUpdates cu;
+  Header header = lookup_create_map_header(hl, hoid, t, &cu);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
@@ -512,7 +522,7 @@ int DBObjectMap::set_keys(const hobject_t &hoid,
 
   t->set(user_prefix(header), set);
 
-  return db->submit_transaction(t);
+  return submit(t, cu);
 }
 
 int DBObjectMap::set_header(const hobject_t &hoid,
@@ -520,13 +530,15 @@ int DBObjectMap::set_header(const hobject_t &hoid,
 			    const SequencerPosition *spos)
 {
   KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  MapHeaderLock hl(this, hoid);
+  CacheUpdates cu;
+  Header header = lookup_create_map_header(hl, hoid, t, &cu);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
   _set_header(header, bl, t);
-  return db->submit_transaction(t);
+  return submit(t, cu);
 }
 
 void DBObjectMap::_set_header(Header header, const bufferlist &bl,
@@ -576,29 +588,32 @@ int DBObjectMap::clear(const hobject_t &hoid,
 		       const SequencerPosition *spos)
 {
   KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_map_header(hoid);
+  MapHeaderLock hl(this, hoid);
+  Header header = lookup_map_header(hl, hoid);
   if (!header)
     return -ENOENT;
   if (check_spos(hoid, header, spos))
     return 0;
-  remove_map_header(hoid, header, t);
+  CacheUpdates cu;
+  remove_map_header(hl, hoid, header, t, &cu);
   assert(header->num_children > 0);
   header->num_children--;
-  int r = _clear(header, t);
+  int r = _clear(header, t, &cu);
   if (r < 0)
     return r;
-  return db->submit_transaction(t);
+  return submit(t, cu);
 }
 
 int DBObjectMap::_clear(Header header,
-			KeyValueDB::Transaction t)
+			KeyValueDB::Transaction t,
+			CacheUpdates *cu)
 {
   while (1) {
     if (header->num_children) {
-      set_header(header, t);
+      set_header(header, t, cu);
       break;
     }
-    clear_header(header, t);
+    clear_header(header, t, cu);
     if (!header->parent)
       break;
     Header parent = lookup_parent(header);
@@ -697,15 +712,17 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
 			 const set<string> &to_clear,
 			 const SequencerPosition *spos)
 {
-  Header header = lookup_map_header(hoid);
+  MapHeaderLock hl(this, hoid);
+  Header header = lookup_map_header(hl, hoid);
   if (!header)
     return -ENOENT;
   KeyValueDB::Transaction t = db->get_transaction();
   if (check_spos(hoid, header, spos))
     return 0;
   t->rmkeys(user_prefix(header), to_clear);
+  CacheUpdates cu;
   if (!header->parent) {
-    return db->submit_transaction(t);
+    return submit(t, cu);
   }
 
   // Copy up keys from parent around to_clear
@@ -760,12 +777,12 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
     if (!parent)
       return -EINVAL;
     parent->num_children--;
-    _clear(parent, t);
+    _clear(parent, t, &cu);
     header->parent = 0;
-    set_map_header(hoid, *header, t);
+    set_map_header(hl, hoid, *header, t, &cu);
     t->rmkeys_by_prefix(complete_prefix(header));
   }
-  return db->submit_transaction(t);
+  return submit(t, cu);
 }
 
 int DBObjectMap::get(const hobject_t &hoid,
@@ -791,8 +808,8 @@ int DBObjectMap::get_keys(const hobject_t &hoid,
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
-  ObjectMapIterator iter = get_iterator(hoid);
-  for (; iter->valid(); iter->next()) {
+  ObjectMapIterator iter = _get_iterator(header);
+  for (iter->seek_to_first(); iter->valid(); iter->next()) {
     if (iter->status())
       return iter->status();
     keys->insert(iter->key());
@@ -871,13 +888,15 @@ int DBObjectMap::set_xattrs(const hobject_t &hoid,
 			    const SequencerPosition *spos)
 {
   KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_create_map_header(hoid, t);
+  MapHeaderLock hl(this, hoid);
+  CacheUpdates cu;
+  Header header = lookup_create_map_header(hl, hoid, t, &cu);
   if (!header)
     return -EINVAL;
   if (check_spos(hoid, header, spos))
     return 0;
   t->set(xattr_prefix(header), to_set);
-  return db->submit_transaction(t);
+  return submit(t, cu);
 }
 
 int DBObjectMap::remove_xattrs(const hobject_t &hoid,
@@ -885,7 +904,8 @@ int DBObjectMap::remove_xattrs(const hobject_t &hoid,
 			       const SequencerPosition *spos)
 {
   KeyValueDB::Transaction t = db->get_transaction();
-  Header header = lookup_map_header(hoid);
+  MapHeaderLock hl(this, hoid);
+  Header header = lookup_map_header(hl, hoid);
   if (!header)
     return -ENOENT;
   if (check_spos(hoid, header, spos))
@@ -901,21 +921,29 @@ int DBObjectMap::clone(const hobject_t &hoid,
   if (hoid == target)
     return 0;
 
+  // take both locks in a fixed order so that concurrent clones between
+  // the same pair of objects can't deadlock
+  MapHeaderLock _l1(this, hoid < target ? hoid : target);
+  MapHeaderLock _l2(this, hoid < target ? target : hoid);
+  MapHeaderLock &source_lock = hoid < target ? _l1 : _l2;
+  MapHeaderLock &target_lock = hoid < target ? _l2 : _l1;
+
   KeyValueDB::Transaction t = db->get_transaction();
+  CacheUpdates cu;
   {
-    Header destination = lookup_map_header(target);
+    Header destination = lookup_map_header(target_lock, target);
     if (destination) {
-      remove_map_header(target, destination, t);
+      remove_map_header(target_lock, target, destination, t, &cu);
       if (check_spos(target, destination, spos))
 	return 0;
       destination->num_children--;
-      _clear(destination, t);
+      _clear(destination, t, &cu);
     }
   }
 
-  Header parent = lookup_map_header(hoid);
+  Header parent = lookup_map_header(source_lock, hoid);
   if (!parent)
-    return db->submit_transaction(t);
+    return submit(t, cu);
 
   Header source = generate_new_header(hoid, parent);
   Header destination = generate_new_header(target, parent);
@@ -923,9 +951,9 @@ int DBObjectMap::clone(const hobject_t &hoid,
     destination->spos = *spos;
 
   parent->num_children = 2;
-  set_header(parent, t);
-  set_map_header(hoid, *source, t);
-  set_map_header(target, *destination, t);
+  set_header(parent, t, &cu);
+  set_map_header(source_lock, hoid, *source, t, &cu);
+  set_map_header(target_lock, target, *destination, t, &cu);
 
   map<string, bufferlist> to_set;
   KeyValueDB::Iterator xattr_iter = db->get_iterator(xattr_prefix(parent));
@@ -936,7 +964,7 @@ int DBObjectMap::clone(const hobject_t &hoid,
   t->set(xattr_prefix(source), to_set);
   t->set(xattr_prefix(destination), to_set);
   t->rmkeys_by_prefix(xattr_prefix(parent));
-  return db->submit_transaction(t);
+  return submit(t, cu);
 }
 
 int DBObjectMap::upgrade()
@@ -1047,18 +1075,45 @@ int DBObjectMap::init(bool do_upgrade)
 int DBObjectMap::sync(const hobject_t *hoid,
 		      const SequencerPosition *spos) {
   KeyValueDB::Transaction t = db->get_transaction();
+  CacheUpdates cu;
   write_state(t);
   if (hoid) {
     assert(spos);
-    Header header = lookup_map_header(*hoid);
+    MapHeaderLock hl(this, *hoid);
+    Header header = lookup_map_header(hl, *hoid);
     if (header) {
       dout(10) << "hoid: " << *hoid << " setting spos to "
 	       << *spos << dendl;
       header->spos = *spos;
-      set_map_header(*hoid, *header, t);
+      set_map_header(hl, *hoid, *header, t, &cu);
     }
   }
-  return db->submit_transaction_sync(t);
+  return submit(t, cu, true);
+}
+
+int DBObjectMap::submit(KeyValueDB::Transaction t, const CacheUpdates &cu,
+			bool sync)
+{
+  int r = sync ? db->submit_transaction_sync(t) : db->submit_transaction(t);
+  if (r < 0)
+    return r;
+  for (set<hobject_t>::const_iterator i = cu.removed_map_headers.begin();
+       i != cu.removed_map_headers.end();
+       ++i)
+    caches.clear(*i);
+  for (map<hobject_t, _Header>::const_iterator i = cu.map_headers.begin();
+       i != cu.map_headers.end();
+       ++i)
+    caches.add(i->first, i->second);
+  for (set<uint64_t>::const_iterator i = cu.removed_parents.begin();
+       i != cu.removed_parents.end();
+       ++i)
+    parent_caches.clear(*i);
+  for (map<uint64_t, _Header>::const_iterator i = cu.parents.begin();
+       i != cu.parents.end();
+       ++i)
+    parent_caches.add(i->first, i->second);
+  return r;
 }
 
 int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
@@ -1073,10 +1128,14 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 }
 
 
-DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
+DBObjectMap::Header DBObjectMap::lookup_map_header(const MapHeaderLock &l,
+						   const hobject_t &hoid)
 {
-  while (map_header_in_use.count(hoid))
-    header_cond.Wait(header_lock);
+  assert(l.get_locked() == hoid);
+
+  Header ret(new _Header());
+  if (caches.lookup(hoid, ret.get()))
+    return ret;
 
   map<string, bufferlist> out;
   set<string> to_get;
@@ -1086,10 +1145,10 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
     return Header();
   if (!out.size())
     return Header();
-  
-  Header ret(new _Header(), RemoveMapHeaderOnDelete(this, hoid));
+
   bufferlist::iterator iter = out.begin()->second.begin();
   ret->decode(iter);
+  caches.add(hoid, *ret);
   return ret;
 }
 
@@ -1113,9 +1172,17 @@ DBObjectMap::Header DBObjectMap::_generate_new_header(const hobject_t &hoid,
 
 DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
 {
-  Mutex::Locker l(header_lock);
-  while (in_use.count(input->parent))
-    header_cond.Wait(header_lock);
+  {
+    Mutex::Locker l(header_lock);
+    while (in_use.count(input->parent))
+      header_cond.Wait(header_lock);
+    in_use.insert(input->parent);
+  }
+  Header header = Header(new _Header(), RemoveOnDelete(this));
+  header->seq = input->parent;
+  if (parent_caches.lookup(input->parent, header.get()))
+    return header;
+
   map<string, bufferlist> out;
   set<string> keys;
   keys.insert(HEADER_KEY);
@@ -1132,30 +1199,30 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
     return Header();
   }
 
-  Header header = Header(new _Header(), RemoveOnDelete(this));
-  header->seq = input->parent;
   bufferlist::iterator iter = out.begin()->second.begin();
   header->decode(iter);
   dout(20) << "lookup_parent: parent seq is " << header->seq << " with parent "
        << header->parent << dendl;
-  in_use.insert(header->seq);
+  parent_caches.add(header->seq, *header);
   return header;
 }
 
 DBObjectMap::Header DBObjectMap::lookup_create_map_header(
+  const MapHeaderLock &l,
   const hobject_t &hoid,
-  KeyValueDB::Transaction t)
+  KeyValueDB::Transaction t,
+  CacheUpdates *cu)
 {
-  Mutex::Locker l(header_lock);
-  Header header = _lookup_map_header(hoid);
+  Header header = lookup_map_header(l, hoid);
   if (!header) {
-    header = _generate_new_header(hoid, Header());
-    set_map_header(hoid, *header, t);
+    header = generate_new_header(hoid, Header());
+    set_map_header(l, hoid, *header, t, cu);
   }
   return header;
 }
 
-void DBObjectMap::clear_header(Header header, KeyValueDB::Transaction t)
+void DBObjectMap::clear_header(Header header, KeyValueDB::Transaction t,
+			       CacheUpdates *cu)
 {
   dout(20) << "clear_header: clearing seq " << header->seq << dendl;
   t->rmkeys_by_prefix(user_prefix(header));
@@ -1165,36 +1232,47 @@ void DBObjectMap::clear_header(Header header, KeyValueDB::Transaction t)
   set<string> keys;
   keys.insert(header_key(header->seq));
   t->rmkeys(USER_PREFIX, keys);
+  cu->remove_parent(header->seq);
 }
 
-void DBObjectMap::set_header(Header header, KeyValueDB::Transaction t)
+void DBObjectMap::set_header(Header header, KeyValueDB::Transaction t,
+			     CacheUpdates *cu)
 {
   dout(20) << "set_header: setting seq " << header->seq << dendl;
   map<string, bufferlist> to_write;
   header->encode(to_write[HEADER_KEY]);
   t->set(sys_prefix(header), to_write);
+  cu->set_parent(header->seq, *header);
 }
 
-void DBObjectMap::remove_map_header(const hobject_t &hoid,
+void DBObjectMap::remove_map_header(const MapHeaderLock &l,
+				    const hobject_t &hoid,
 				    Header header,
-				    KeyValueDB::Transaction t)
+				    KeyValueDB::Transaction t,
+				    CacheUpdates *cu)
 {
+  assert(l.get_locked() == hoid);
   dout(20) << "remove_map_header: removing " << header->seq
 	   << " hoid " << hoid << dendl;
   set<string> to_remove;
   to_remove.insert(map_header_key(hoid));
   t->rmkeys(HOBJECT_TO_SEQ, to_remove);
+  cu->remove_map_header(hoid);
 }
 
-void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
-				 KeyValueDB::Transaction t)
+void DBObjectMap::set_map_header(const MapHeaderLock &l,
+				 const hobject_t &hoid, _Header header,
+				 KeyValueDB::Transaction t,
+				 CacheUpdates *cu)
 {
+  assert(l.get_locked() == hoid);
   dout(20) << "set_map_header: setting " << header.seq
 	   << " hoid " << hoid << " parent seq "
 	   << header.parent << dendl;
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(hoid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
+  cu->set_map_header(hoid, header);
 }
 
 bool DBObjectMap::check_spos(const hobject_t &hoid,
@@ -17,6 +17,7 @@
 #include "osd/osd_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/simple_cache.hpp"
 
 /**
  * DBObjectMap: Implements ObjectMap in terms of KeyValueDB
@@ -57,7 +58,9 @@ public:
   boost::scoped_ptr<KeyValueDB> db;
 
   /**
-   * Serializes access to next_seq as well as the in_use set
+   * Serializes access to next_seq as well as the in_use sets.  It is
+   * only held while those are examined or updated, never across a
+   * KeyValueDB read.
    */
   Mutex header_lock;
   Cond header_cond;
@@ -67,11 +70,13 @@ public:
    * Set of headers currently in use
    */
   set<uint64_t> in_use;
+  /**
+   * Set of objects whose map header is locked
+   * @see MapHeaderLock
+   */
   set<hobject_t> map_header_in_use;
 
-  DBObjectMap(KeyValueDB *db) : db(db),
-				header_lock("DBOBjectMap")
-    {}
+  DBObjectMap(KeyValueDB *db);
 
   int set_keys(
     const hobject_t &hoid,
@@ -274,6 +279,69 @@ private:
   /// Implicit lock on Header->seq
   typedef std::tr1::shared_ptr<_Header> Header;
 
+  /**
+   * Cached copies of hobject_t->header mappings, and of the headers of
+   * parent nodes by seq.  Changes are collected in a CacheUpdates while
+   * the transaction is built and only applied once it has been
+   * submitted successfully, still under the object's MapHeaderLock or
+   * the parent's in_use entry, so a cache hit never needs the db and
+   * never reflects a write that failed.
+   */
+  SimpleLRU<hobject_t, _Header> caches;
+  SimpleLRU<uint64_t, _Header> parent_caches;
+
+  /// Cache changes made by a transaction, @see submit
+  struct CacheUpdates {
+    map<hobject_t, _Header> map_headers;
+    set<hobject_t> removed_map_headers;
+    map<uint64_t, _Header> parents;
+    set<uint64_t> removed_parents;
+
+    void set_map_header(const hobject_t &hoid, const _Header &header) {
+      removed_map_headers.erase(hoid);
+      map_headers[hoid] = header;
+    }
+    void remove_map_header(const hobject_t &hoid) {
+      map_headers.erase(hoid);
+      removed_map_headers.insert(hoid);
+    }
+    void set_parent(uint64_t seq, const _Header &header) {
+      removed_parents.erase(seq);
+      parents[seq] = header;
+    }
+    void remove_parent(uint64_t seq) {
+      parents.erase(seq);
+      removed_parents.insert(seq);
+    }
+  };
+
+  /**
+   * Holds the map header of one object for as long as it's in scope.
+   * Operations on different objects proceed in parallel; header_lock
+   * is only taken to update map_header_in_use.
+   */
+  class MapHeaderLock {
+    DBObjectMap *db;
+    hobject_t hoid;
+  public:
+    MapHeaderLock(DBObjectMap *db, const hobject_t &hoid) : db(db), hoid(hoid) {
+      Mutex::Locker l(db->header_lock);
+      while (db->map_header_in_use.count(hoid))
+	db->map_header_cond.Wait(db->header_lock);
+      db->map_header_in_use.insert(hoid);
+    }
+    ~MapHeaderLock() {
+      Mutex::Locker l(db->header_lock);
+      assert(db->map_header_in_use.count(hoid));
+      db->map_header_in_use.erase(hoid);
+      db->map_header_cond.SignalAll();
+    }
+    const hobject_t &get_locked() const {
+      return hoid;
+    }
+  };
+  friend class MapHeaderLock;
+
   string map_header_key(const hobject_t &hoid);
   string header_key(uint64_t seq);
   string complete_prefix(Header header);
@@ -360,19 +428,25 @@ private:
   /// sys
 
   /// Removes node corresponding to header
-  void clear_header(Header header, KeyValueDB::Transaction t);
+  void clear_header(Header header, KeyValueDB::Transaction t,
+		    CacheUpdates *cu);
 
   /// Set node containing input to new contents
-  void set_header(Header input, KeyValueDB::Transaction t);
+  void set_header(Header input, KeyValueDB::Transaction t,
+		  CacheUpdates *cu);
 
   /// Remove leaf node corresponding to hoid in c
-  void remove_map_header(const hobject_t &hoid,
+  void remove_map_header(const MapHeaderLock &l,
+			 const hobject_t &hoid,
 			 Header header,
-			 KeyValueDB::Transaction t);
+			 KeyValueDB::Transaction t,
+			 CacheUpdates *cu);
 
   /// Set leaf node for c and hoid to the value of header
-  void set_map_header(const hobject_t &hoid, _Header header,
-		      KeyValueDB::Transaction t);
+  void set_map_header(const MapHeaderLock &l,
+		      const hobject_t &hoid, _Header header,
+		      KeyValueDB::Transaction t,
+		      CacheUpdates *cu);
 
   /// Set leaf node for c and hoid to the value of header
   bool check_spos(const hobject_t &hoid,
@@ -380,8 +454,10 @@ private:
 		  const SequencerPosition *spos);
 
   /// Lookup or create header for c hoid
-  Header lookup_create_map_header(const hobject_t &hoid,
-				  KeyValueDB::Transaction t);
+  Header lookup_create_map_header(const MapHeaderLock &l,
+				  const hobject_t &hoid,
+				  KeyValueDB::Transaction t,
+				  CacheUpdates *cu);
 
   /**
    * Generate new header for c hoid with new seq number
@@ -395,10 +471,12 @@ private:
   }
 
   /// Lookup leaf header for c hoid
-  Header _lookup_map_header(const hobject_t &hoid);
+  Header lookup_map_header(const MapHeaderLock &l,
+			   const hobject_t &hoid);
+  /// Lookup leaf header for c hoid, holding its lock only for the lookup
   Header lookup_map_header(const hobject_t &hoid) {
-    Mutex::Locker l(header_lock);
-    return _lookup_map_header(hoid);
+    MapHeaderLock l(this, hoid);
+    return lookup_map_header(l, hoid);
   }
 
   /// Lookup header node for input
@@ -416,13 +494,18 @@ private:
 
   /// Remove header and all related prefixes
   int _clear(Header header,
-	     KeyValueDB::Transaction t);
+	     KeyValueDB::Transaction t,
+	     CacheUpdates *cu);
   /// Adds to t operations necessary to add new_complete to the complete set
   int merge_new_complete(Header header,
 			 const map<string, string> &new_complete,
 			 DBObjectMapIterator iter,
 			 KeyValueDB::Transaction t);
 
+  /// Submits t, applying cu to the caches only if that succeeds
+  int submit(KeyValueDB::Transaction t, const CacheUpdates &cu,
+	     bool sync = false);
+
   /// Writes out State (mainly next_seq)
   int write_state(KeyValueDB::Transaction _t =
 		  KeyValueDB::Transaction());
@@ -438,24 +521,6 @@ private:
   void _set_header(Header header, const bufferlist &bl,
 		   KeyValueDB::Transaction t);
 
-  /** 
-   * Removes map header lock once Header is out of scope
-   * @see lookup_map_header
-   */
-  class RemoveMapHeaderOnDelete {
-  public:
-    DBObjectMap *db;
-    hobject_t obj;
-    RemoveMapHeaderOnDelete(DBObjectMap *db, const hobject_t &obj) :
-      db(db), obj(obj) {}
-    void operator() (_Header *header) {
-      Mutex::Locker l(db->header_lock);
-      db->map_header_in_use.erase(obj);
-      db->map_header_cond.Signal();
-      delete header;
-    }
-  };
-
   /** 
    * Removes header seq lock once Header is out of scope
    * @see lookup_parent
@@ -469,7 +534,7 @@ private:
     void operator() (_Header *header) {
       Mutex::Locker l(db->header_lock);
       db->in_use.erase(header->seq);
-      db->header_cond.Signal();
+      db->header_cond.SignalAll();
       delete header;
     }
   };
@@ -532,18 +532,25 @@ int FileJournal::open(uint64_t fs_op_seq)
       dout(10) << "open reached end of journal." << dendl;
       break;
     }
+    if (seq > next_seq && seq_gaps) {
+      dout(10) << "open entry " << seq << " > next_seq " << next_seq
+	       << ", which is elsewhere; resuming here" << dendl;
+      put_back_entry(old_pos, seq, bl);
+      break;
+    }
     if (seq > next_seq) {
       dout(10) << "open entry " << seq << " len " << bl.length() << " > next_seq " << next_seq
 	       << ", ignoring journal contents"
 	       << dendl;
       read_pos = -1;
+      read_pack.clear();
       last_committed_seq = 0;
       seq = 0;
       return 0;
     }
     if (seq == next_seq) {
       dout(10) << "open reached seq " << seq << dendl;
-      read_pos = old_pos;
+      put_back_entry(old_pos, seq, bl);
       break;
     }
     seq++;  // next event should follow.
@@ -859,6 +866,12 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
 {
   // grab next item
   write_item &next_write = peek_write();
+  if (can_pack(next_write)) {
+    int r = prepare_pack_write(bl, queue_pos, orig_ops, orig_bytes);
+    if (r != -EAGAIN)
+      return r;
+  }
+
   uint64_t seq = next_write.seq;
   bufferlist &ebl = next_write.bl;
   unsigned head_size = sizeof(entry_header_t);
@@ -887,13 +900,35 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
 	   << dendl;
     
   // add it this entry
+  append_entry(bl, queue_pos, seq, ebl, pre_pad, post_pad, false);
+
+  if (next_write.tracked_op)
+    next_write.tracked_op->mark_event("write_thread_in_journal_buffer");
+
+  // pop from writeq
+  pop_write();
+  journalq.push_back(pair<uint64_t,off64_t>(seq, queue_pos));
+  writing_seq = seq;
+
+  queue_pos += size;
+  if (queue_pos > header.max_size)
+    queue_pos = queue_pos + get_top() - header.max_size;
+
+  return 0;
+}
+
+void FileJournal::append_entry(bufferlist& bl, off64_t pos, uint64_t seq, bufferlist& ebl,
+			       unsigned pre_pad, unsigned post_pad, bool packed)
+{
   entry_header_t h;
   memset(&h, 0, sizeof(h));
   h.seq = seq;
   h.pre_pad = pre_pad;
+  if (packed)
+    h.pre_pad |= entry_header_t::PAD_PACKED;
   h.len = ebl.length();
   h.post_pad = post_pad;
-  h.make_magic(queue_pos, header.get_fsid64());
+  h.make_magic(pos, header.get_fsid64());
   h.crc32c = ebl.crc32c(0);
 
   bl.append((const char*)&h, sizeof(h));
@@ -903,17 +938,187 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
   }
   bl.claim_append(ebl);
 
-  if (h.post_pad) {
+  if (post_pad) {
     bufferptr bp = buffer::create_static(post_pad, zero_buf);
     bl.push_back(bp);
   }
   bl.append((const char*)&h, sizeof(h));
+}
 
-  if (next_write.tracked_op)
-    next_write.tracked_op->mark_event("write_thread_in_journal_buffer");
+/*
+ * A tiny LZ77 variant for packed entries.  Each token is a control
+ * byte: below 0x80 it is followed by that many plus one literal bytes;
+ * otherwise it is a match of (c & 0x7f) + 4 bytes, followed by a 16 bit
+ * little endian distance back into the output.  It is meant to be cheap
+ * rather than tight: encoded transactions are mostly small integers,
+ * zero padding and repeated collection and object names.
+ */
+#define PACK_LZ_HASH_BITS 12
+#define PACK_LZ_MIN_MATCH 4
+#define PACK_LZ_MAX_MATCH (0x7f + PACK_LZ_MIN_MATCH)
+#define PACK_LZ_MAX_LITERAL 0x80
+#define PACK_LZ_MAX_DIST 0xffff
 
-  // pop from writeq
-  pop_write();
+static char *pack_lz_literals(char *op, const char *in, unsigned len)
+{
+  while (len) {
+    unsigned n = MIN(len, PACK_LZ_MAX_LITERAL);
+    *op++ = n - 1;
+    memcpy(op, in, n);
+    op += n;
+    in += n;
+    len -= n;
+  }
+  return op;
+}
+
+static void pack_lz_compress(const char *in, unsigned len, bufferlist& out)
+{
+  unsigned table[1 << PACK_LZ_HASH_BITS];  // position + 1 of the last 4 bytes with this hash
+  memset(table, 0, sizeof(table));
+
+  bufferptr bp(len + len / PACK_LZ_MAX_LITERAL + 1);
+  char *op = bp.c_str();
+  unsigned lit = 0, i = 0;
+  while (i + PACK_LZ_MIN_MATCH <= len) {
+    uint32_t v;
+    memcpy(&v, in + i, sizeof(v));
+    unsigned h = (v * 2654435761u) >> (32 - PACK_LZ_HASH_BITS);
+    unsigned ref = table[h];
+    table[h] = i + 1;
+    if (!ref || i + 1 - ref > PACK_LZ_MAX_DIST ||
+	memcmp(in + ref - 1, in + i, PACK_LZ_MIN_MATCH) != 0) {
+      i++;
+      continue;
+    }
+    ref--;
+    unsigned n = PACK_LZ_MIN_MATCH;
+    while (n < PACK_LZ_MAX_MATCH && i + n < len && in[ref + n] == in[i + n])
+      n++;
+    op = pack_lz_literals(op, in + lit, i - lit);
+    unsigned dist = i - ref;
+    *op++ = 0x80 | (n - PACK_LZ_MIN_MATCH);
+    *op++ = dist & 0xff;
+    *op++ = dist >> 8;
+    i += n;
+    lit = i;
+  }
+  op = pack_lz_literals(op, in + lit, len - lit);
+  bp.set_length(op - bp.c_str());
+  out.push_back(bp);
+}
+
+static int pack_lz_decompress(const char *in, unsigned len, char *out, unsigned out_len)
+{
+  unsigned i = 0, o = 0;
+  while (i < len) {
+    unsigned char c = in[i++];
+    if (c < 0x80) {
+      unsigned n = c + 1;
+      if (i + n > len || o + n > out_len)
+	return -EINVAL;
+      memcpy(out + o, in + i, n);
+      i += n;
+      o += n;
+    } else {
+      unsigned n = (c & 0x7f) + PACK_LZ_MIN_MATCH;
+      if (i + 2 > len)
+	return -EINVAL;
+      unsigned dist = (unsigned char)in[i] | ((unsigned char)in[i + 1] << 8);
+      i += 2;
+      if (!dist || dist > o || o + n > out_len)
+	return -EINVAL;
+      for (; n; --n, ++o)
+	out[o] = out[o - dist];  // may overlap what we are writing
+    }
+  }
+  return o == out_len ? 0 : -EINVAL;
+}
+
+bool FileJournal::can_pack(const write_item& w)
+{
+  // packed entries are read whole, which unread_entry() can't undo
+  return g_conf->journal_pack_small_entries && !seq_gaps &&
+    w.bl.length() <= (unsigned)g_conf->journal_pack_entry_max;
+}
+
+/*
+ * Pack the small entries at the front of the queue into one journal
+ * entry, so they share a header, footer and padding.  The payload is
+ *
+ *   __u8 version, __u8 compressed, __u32 count, __u32 raw length,
+ *   then count (seq, bufferlist) pairs, possibly compressed.
+ *
+ * Returns -EAGAIN if packing would not save anything, in which case the
+ * front entry is written on its own.
+ */
+int FileJournal::prepare_pack_write(bufferlist& bl, off64_t& queue_pos, uint64_t& orig_ops, uint64_t& orig_bytes)
+{
+  bool compress = g_conf->journal_compress;
+  unsigned max = g_conf->journal_pack_max_bytes;
+
+  bufferlist raw;
+  uint64_t seq = 0;
+  __u32 count = 0;
+  uint64_t bytes = 0;
+  {
+    Mutex::Locker locker(queue_lock);
+    for (deque<write_item>::iterator p = writeq.begin();
+	 p != writeq.end() && can_pack(*p);
+	 ++p) {
+      if (count && raw.length() + p->bl.length() > max)
+	break;
+      ::encode(p->seq, raw);
+      ::encode(p->bl, raw);
+      seq = p->seq;
+      bytes += p->bl.length();
+      count++;
+    }
+  }
+  if (count < 2 && !compress)
+    return -EAGAIN;
+
+  bufferlist ebl;
+  __u8 v = 1;
+  ::encode(v, ebl);
+  bufferlist cbl;
+  if (compress)
+    pack_lz_compress(raw.c_str(), raw.length(), cbl);
+  __u8 compressed = compress && cbl.length() < raw.length();
+  ::encode(compressed, ebl);
+  ::encode(count, ebl);
+  ::encode((__u32)raw.length(), ebl);
+  if (compressed)
+    ebl.claim_append(cbl);
+  else if (count > 1)
+    ebl.claim_append(raw);
+  else
+    return -EAGAIN;  // didn't compress; no point packing one entry
+
+  unsigned head_size = sizeof(entry_header_t);
+  off64_t base_size = 2*head_size + ebl.length();
+  off64_t size = ROUND_UP_TO(base_size, header.alignment);
+  unsigned post_pad = size - base_size;
+
+  int r = check_for_full(seq, queue_pos, size);
+  if (r < 0)
+    return r;   // ENOSPC or EAGAIN
+
+  dout(15) << "prepare_pack_write " << count << " entries thru seq " << seq
+	   << " will write " << queue_pos << " : " << bytes << " bytes packed to "
+	   << ebl.length() << (compressed ? " (compressed)" : "")
+	   << " -> " << size << dendl;
+
+  append_entry(bl, queue_pos, seq, ebl, 0, post_pad, true);
+
+  for (unsigned i = 0; i < count; ++i) {
+    write_item &w = peek_write();
+    if (w.tracked_op)
+      w.tracked_op->mark_event("write_thread_in_journal_buffer");
+    pop_write();
+  }
+  orig_ops += count;
+  orig_bytes += bytes;
   journalq.push_back(pair<uint64_t,off64_t>(seq, queue_pos));
   writing_seq = seq;
 
@@ -1548,11 +1753,15 @@ void FileJournal::make_writeable()
 {
   _open(true);
 
+  if (seq_gaps)
+    clear_unreplayed();
+
   if (read_pos > 0)
     write_pos = read_pos;
   else
     write_pos = get_top();
   read_pos = 0;
+  read_pack.clear();
 
   must_write_header = true;
   start_writer();
@@ -1591,6 +1800,9 @@ void FileJournal::wrap_read_bl(off64_t& pos, int64_t olen, bufferlist& bl)
 
 bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
 {
+  if (pop_packed_entry(bl, seq))
+    return true;
+
   if (!read_pos) {
     dout(2) << "read_entry -- not readable" << dendl;
     return false;
@@ -1610,8 +1822,8 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
   }
 
   // pad + body + pad
-  if (h->pre_pad)
-    pos += h->pre_pad;
+  if (h->get_pre_pad())
+    pos += h->get_pre_pad();
 
   bl.clear();
   wrap_read_bl(pos, h->len, bl);
@@ -1642,6 +1854,7 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
   // yay!
   dout(2) << "read_entry " << read_pos << " : seq " << h->seq
 	  << " " << h->len << " bytes"
+	  << (h->is_packed() ? " packed" : "")
 	  << dendl;
 
   if (seq && h->seq < seq) {
@@ -1649,16 +1862,173 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
     return false;
   }
 
+  if (h->is_packed() && !unpack_entry(h->seq, bl)) {
+    dout(2) << "read_entry " << read_pos << " : bad packed entry, end of journal" << dendl;
+    return false;
+  }
+
   // ok!
-  seq = h->seq;
   journalq.push_back(pair<uint64_t,off64_t>(h->seq, read_pos));
 
   read_pos = pos;
   assert(read_pos % header.alignment == 0);
- 
+
+  if (h->is_packed()) {
+    bool r = pop_packed_entry(bl, seq);
+    assert(r);  // the last one is h->seq, which we know is wanted
+    return true;
+  }
+
+  seq = h->seq;
+  read_packed = false;
   return true;
 }
 
+/*
+ * split a packed entry's payload into read_pack.  the entries must
+ * ascend and end with seq, the seq in the entry header.
+ */
+bool FileJournal::unpack_entry(uint64_t seq, bufferlist& bl)
+{
+  read_pack.clear();
+  try {
+    bufferlist::iterator p = bl.begin();
+    __u8 v, compressed;
+    __u32 count, raw_len;
+    ::decode(v, p);
+    if (v != 1) {
+      dout(2) << "unpack_entry unknown version " << (int)v << dendl;
+      return false;
+    }
+    ::decode(compressed, p);
+    ::decode(count, p);
+    ::decode(raw_len, p);
+
+    bufferlist raw;
+    if (compressed) {
+      bufferlist cbl;
+      p.copy(bl.length() - p.get_off(), cbl);
+      bufferptr bp(raw_len);
+      int r = pack_lz_decompress(cbl.c_str(), cbl.length(), bp.c_str(), raw_len);
+      if (r < 0) {
+	dout(2) << "unpack_entry corrupt compressed payload" << dendl;
+	return false;
+      }
+      raw.push_back(bp);
+    } else {
+      p.copy(bl.length() - p.get_off(), raw);
+    }
+    if (raw.length() != raw_len) {
+      dout(2) << "unpack_entry payload is " << raw.length() << " bytes, expected "
+	      << raw_len << dendl;
+      return false;
+    }
+
+    bufferlist::iterator q = raw.begin();
+    uint64_t last = 0;
+    for (unsigned i = 0; i < count; ++i) {
+      uint64_t s;
+      ::decode(s, q);
+      if (s <= last)
+	break;
+      last = s;
+      read_pack.push_back(make_pair(s, bufferlist()));
+      ::decode(read_pack.back().second, q);
+    }
+    if (!q.end() || last != seq) {
+      read_pack.clear();
+      return false;
+    }
+  }
+  catch (buffer::error& e) {
+    dout(2) << "unpack_entry error decoding packed entry" << dendl;
+    read_pack.clear();
+    return false;
+  }
+  return true;
+}
+
+/*
+ * return the next entry left from a packed entry, skipping any before
+ * seq (if set).
+ */
+bool FileJournal::pop_packed_entry(bufferlist& bl, uint64_t& seq)
+{
+  while (!read_pack.empty() && seq && read_pack.front().first < seq)
+    read_pack.pop_front();
+  if (read_pack.empty())
+    return false;
+  seq = read_pack.front().first;
+  bl.claim(read_pack.front().second);
+  read_pack.pop_front();
+  read_packed = true;
+  dout(2) << "read_entry seq " << seq << " " << bl.length() << " bytes from packed entry" << dendl;
+  return true;
+}
+
+/*
+ * make the entry read_entry() just returned the next one it returns
+ * again; pos is where read_pos was before reading it.
+ */
+void FileJournal::put_back_entry(off64_t pos, uint64_t seq, bufferlist& bl)
+{
+  if (read_packed)
+    read_pack.push_front(make_pair(seq, bl));
+  else
+    read_pos = pos;
+}
+
+/**
+ * step back over the last entry read_entry() returned.
+ */
+void FileJournal::unread_entry()
+{
+  assert(read_pos);
+  assert(!journalq.empty());
+  assert(!read_packed);  // we don't pack entries when seqs have gaps
+  dout(2) << "unread_entry seq " << journalq.back().first
+	  << " at " << journalq.back().second << dendl;
+  read_pos = journalq.back().second;
+  journalq.pop_back();
+}
+
+/*
+ * Clear the header of every entry from read_pos on.  When this journal
+ * holds only some seqs, replay can stop before its entries do (another
+ * stripe had a hole).  Those entries were never applied.  New entries
+ * reuse their seqs and land at or before their offsets, so a later
+ * replay could take a stale one for the entry that follows what we
+ * write next.
+ */
+void FileJournal::clear_unreplayed()
+{
+  if (!read_pos)
+    return;
+  off64_t start = read_pos;
+  size_t qlen = journalq.size();
+  vector<off64_t> stale;
+  uint64_t seq = journalq.empty() ? 0 : journalq.back().first + 1;
+  bufferlist bl;
+  while (read_entry(bl, seq)) {
+    stale.push_back(journalq.back().second);
+    seq++;
+  }
+  while (journalq.size() > qlen)
+    journalq.pop_back();
+  read_pos = start;
+
+  for (vector<off64_t>::iterator p = stale.begin(); p != stale.end(); ++p) {
+    dout(2) << "clear_unreplayed entry at " << *p << dendl;
+    bufferlist z;
+    z.append_zero(block_size);
+    off64_t pos = *p;
+    int r = write_bl(pos, z);
+    if (r < 0)
+      derr << "clear_unreplayed failed to clear entry at " << *p
+	   << ": " << cpp_strerror(r) << dendl;
+  }
+}
+
 void FileJournal::throttle()
 {
   if (throttle_ops.wait(g_conf->journal_queue_max_ops))
@@ -148,6 +148,20 @@ public:
     uint32_t pre_pad, post_pad;
     uint64_t magic1;
     uint64_t magic2;
+
+    /*
+     * pre_pad is always less than a page, so its top bit is free to
+     * mark an entry that packs several small entries together.  such
+     * an entry carries the seq of the last one it holds.
+     */
+    static const uint32_t PAD_PACKED = 1u << 31;
+
+    bool is_packed() const {
+      return pre_pad & PAD_PACKED;
+    }
+    uint32_t get_pre_pad() const {
+      return pre_pad & ~PAD_PACKED;
+    }
     
     void make_magic(off64_t pos, uint64_t fsid) {
       magic1 = pos;
@@ -170,9 +184,14 @@ private:
   bool is_bdev;
   bool directio, aio;
   bool must_write_header;
+  bool seq_gaps;          // entries need not have consecutive seqs
   off64_t write_pos;      // byte where the next entry to be written will go
   off64_t read_pos;       // 
 
+  /// entries unpacked from the last packed entry read, not yet returned
+  list<pair<uint64_t, bufferlist> > read_pack;
+  bool read_packed;       // last entry returned came out of a packed entry
+
 #ifdef HAVE_LIBAIO
   /// state associated with an in-flight aio request
   /// Protected by aio_lock
@@ -252,6 +271,13 @@ private:
   int check_for_full(uint64_t seq, off64_t pos, off64_t size);
   int prepare_multi_write(bufferlist& bl, uint64_t& orig_ops, uint64_t& orig_bytee);
   int prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64_t& orig_ops, uint64_t& orig_bytes);
+  bool can_pack(const write_item& w);
+  int prepare_pack_write(bufferlist& bl, off64_t& queue_pos, uint64_t& orig_ops, uint64_t& orig_bytes);
+  void append_entry(bufferlist& bl, off64_t pos, uint64_t seq, bufferlist& ebl,
+		    unsigned pre_pad, unsigned post_pad, bool packed);
+  bool unpack_entry(uint64_t seq, bufferlist& bl);
+  bool pop_packed_entry(bufferlist& bl, uint64_t& seq);
+  void put_back_entry(off64_t pos, uint64_t seq, bufferlist& bl);
   void do_write(bufferlist& bl);
 
   void write_finish_thread_entry();
@@ -299,7 +325,8 @@ private:
     max_size(0), block_size(0),
     is_bdev(false), directio(dio), aio(ai),
     must_write_header(false),
-    write_pos(0), read_pos(0),
+    seq_gaps(false),
+    write_pos(0), read_pos(0), read_packed(false),
 #ifdef HAVE_LIBAIO
     aio_lock("FileJournal::aio_lock"),
     aio_num(0), aio_bytes(0),
@@ -346,6 +373,11 @@ private:
 
   // reads
   bool read_entry(bufferlist& bl, uint64_t& seq);
+  void unread_entry();
+  void clear_unreplayed();
+
+  /// this journal holds only some seqs (e.g. one stripe of a StripedJournal)
+  void set_seq_gaps(bool b) { seq_gaps = b; }
 };
 
 WRITE_CLASS_ENCODER(FileJournal::header_t)
@@ -52,10 +52,12 @@
 #include "common/BackTrace.h"
 #include "include/types.h"
 #include "FileJournal.h"
+#include "StripedJournal.h"
 
 #include "osd/osd_types.h"
 #include "include/color.h"
 #include "include/buffer.h"
+#include "include/str_list.h"
 
 #include "common/Timer.h"
 #include "common/debug.h"
@@ -734,6 +736,10 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   op_wq(this, g_conf->filestore_op_thread_timeout,
 	g_conf->filestore_op_thread_suicide_timeout, &op_tp),
   flusher_queue_len(0), flusher_thread(this),
+  split_lock("FileStore::split_lock"), split_stop(false),
+  split_thread(this), split_queue_hook(this),
+  aio_lock("FileStore::aio_lock"), aio_stop(false), aio_num(0),
+  aio_finish_thread(this),
   logger(NULL),
   m_filestore_btrfs_clone_range(g_conf->filestore_btrfs_clone_range),
   m_filestore_btrfs_snap (g_conf->filestore_btrfs_snap ),
@@ -742,6 +748,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   m_filestore_flusher (g_conf->filestore_flusher ),
   m_filestore_fsync_flushes_journal_data(g_conf->filestore_fsync_flushes_journal_data),
   m_filestore_journal_parallel(g_conf->filestore_journal_parallel ),
+  m_filestore_parallel_apply(g_conf->filestore_parallel_apply),
+  m_filestore_aio(g_conf->filestore_aio),
   m_filestore_journal_trailing(g_conf->filestore_journal_trailing),
   m_filestore_journal_writeahead(g_conf->filestore_journal_writeahead),
   m_filestore_fiemap_threshold(g_conf->filestore_fiemap_threshold),
@@ -751,6 +759,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   m_filestore_max_sync_interval(g_conf->filestore_max_sync_interval),
   m_filestore_min_sync_interval(g_conf->filestore_min_sync_interval),
   m_filestore_fail_eio(g_conf->filestore_fail_eio),
+  m_filestore_csum(g_conf->filestore_csum),
+  m_filestore_csum_block_size(g_conf->filestore_csum_block_size),
   do_update(do_update),
   m_journal_dio(g_conf->journal_dio),
   m_journal_aio(g_conf->journal_aio),
@@ -802,6 +812,7 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_fl_avg(l_os_commit_len, "commitcycle_interval");
   plb.add_fl_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
+  plb.add_u64_counter(l_os_csum_err, "csum_errors");
 
   logger = plb.create_perf_counters();
 }
@@ -890,12 +901,32 @@ int FileStore::statfs(struct statfs *buf)
 }
 
 
+/// the osd journal followed by any journal_stripes, or empty for one journal
+static vector<string> get_journal_stripes(const string& journalpath)
+{
+  vector<string> paths;
+  list<string> extra;
+  get_str_list(g_conf->journal_stripes, extra);
+  if (!extra.empty()) {
+    paths.push_back(journalpath);
+    paths.insert(paths.end(), extra.begin(), extra.end());
+  }
+  return paths;
+}
+
 int FileStore::open_journal()
 {
   if (journalpath.length()) {
-    dout(10) << "open_journal at " << journalpath << dendl;
-    journal = new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(),
-			      m_journal_dio, m_journal_aio);
+    vector<string> stripes = get_journal_stripes(journalpath);
+    if (stripes.empty()) {
+      dout(10) << "open_journal at " << journalpath << dendl;
+      journal = new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(),
+				m_journal_dio, m_journal_aio);
+    } else {
+      dout(10) << "open_journal striped over " << stripes << dendl;
+      journal = new StripedJournal(fsid, &finisher, &sync_cond, stripes,
+				   m_journal_dio, m_journal_aio);
+    }
     if (journal)
       journal->logger = logger;
   }
@@ -909,7 +940,12 @@ int FileStore::dump_journal(ostream& out)
   if (!journalpath.length())
     return -EINVAL;
 
-  FileJournal *journal = new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(), m_journal_dio);
+  vector<string> stripes = get_journal_stripes(journalpath);
+  Journal *journal;
+  if (stripes.empty())
+    journal = new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(), m_journal_dio);
+  else
+    journal = new StripedJournal(fsid, &finisher, &sync_cond, stripes, m_journal_dio);
   r = journal->dump(out);
   delete journal;
   return r;
@@ -1936,7 +1972,7 @@ int FileStore::mount()
   }
 
   {
-    LevelDBStore *omap_store = new LevelDBStore(omap_dir);
+    LevelDBStore *omap_store = new LevelDBStore(g_ceph_context, omap_dir);
     stringstream err;
     if (omap_store->init(err)) {
       derr << "Error initializing leveldb: " << err.str() << dendl;
@@ -2052,8 +2088,31 @@ int FileStore::mount()
 
   journal_start();
 
+  if (m_filestore_aio) {
+#ifdef HAVE_LIBAIO
+    aio_ctx = 0;
+    ret = io_setup(g_conf->filestore_aio_queue_depth, &aio_ctx);
+    if (ret < 0) {
+      derr << "mount: unable to set up io context: " << cpp_strerror(ret)
+	   << "; disabling aio" << dendl;
+      m_filestore_aio = false;
+    }
+#else
+    derr << "mount: libaio not compiled in; disabling aio" << dendl;
+    m_filestore_aio = false;
+#endif
+    if (m_filestore_aio) {
+      aio_stop = false;
+      aio_finish_thread.create();
+    }
+  }
   op_tp.start();
   flusher_thread.create();
+  if (g_conf->filestore_split_in_background) {
+    split_stop = false;
+    index_manager.set_split_queue(&split_queue_hook);
+    split_thread.create();
+  }
   op_finisher.start();
   ondisk_finisher.start();
 
@@ -2096,6 +2155,24 @@ int FileStore::umount()
   sync_thread.join();
   op_tp.stop();
   flusher_thread.join();
+  if (aio_finish_thread.is_started()) {
+    aio_lock.Lock();
+    aio_stop = true;
+    aio_cond.SignalAll();
+    aio_lock.Unlock();
+    aio_finish_thread.join();
+#ifdef HAVE_LIBAIO
+    io_destroy(aio_ctx);
+#endif
+  }
+  if (split_thread.is_started()) {
+    index_manager.set_split_queue(NULL);
+    split_lock.Lock();
+    split_stop = true;
+    split_cond.Signal();
+    split_lock.Unlock();
+    split_thread.join();
+  }
 
   journal_stop();
 
@@ -2172,9 +2249,141 @@ FileStore::Op *FileStore::build_op(list<Transaction*>& tls,
   o->ops = ops;
   o->bytes = bytes;
   o->osd_op = osd_op;
+  o->barrier = false;
+  o->applying = o->applied = false;
+  o->osr = NULL;
+  o->aio_pending = 0;
+  if (m_filestore_parallel_apply)
+    _get_touched_objects(o);
+  else if (m_filestore_aio)
+    o->barrier = true;  // one op at a time, but don't wait for its writes
   return o;
 }
 
+/*
+ * Collect the objects o's transactions touch.  Anything that touches
+ * a collection as a whole (or that we don't know about) makes o a
+ * barrier, applied alone and in order.  Objects are compared by
+ * hobject_t only, since collection_add links one file into several
+ * collections.
+ */
+void FileStore::_get_touched_objects(Op *o)
+{
+  for (list<Transaction*>::iterator p = o->tls.begin();
+       p != o->tls.end();
+       ++p) {
+    Transaction::iterator i = (*p)->begin();
+    while (i.have_op()) {
+      int op = i.get_op();
+      switch (op) {
+      case Transaction::OP_NOP:
+	break;
+      case Transaction::OP_TOUCH:
+      case Transaction::OP_REMOVE:
+      case Transaction::OP_RMATTRS:
+      case Transaction::OP_COLL_REMOVE:
+      case Transaction::OP_OMAP_CLEAR:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	break;
+      case Transaction::OP_WRITE:
+	{
+	  i.get_cid();
+	  o->objects.insert(i.get_oid());
+	  i.get_length();
+	  i.get_length();
+	  bufferlist bl;
+	  i.get_bl(bl);
+	}
+	break;
+      case Transaction::OP_ZERO:
+      case Transaction::OP_TRIMCACHE:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	i.get_length();
+	i.get_length();
+	break;
+      case Transaction::OP_TRUNCATE:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	i.get_length();
+	break;
+      case Transaction::OP_SETATTR:
+	{
+	  i.get_cid();
+	  o->objects.insert(i.get_oid());
+	  i.get_attrname();
+	  bufferlist bl;
+	  i.get_bl(bl);
+	}
+	break;
+      case Transaction::OP_SETATTRS:
+	{
+	  i.get_cid();
+	  o->objects.insert(i.get_oid());
+	  map<string, bufferptr> aset;
+	  i.get_attrset(aset);
+	}
+	break;
+      case Transaction::OP_OMAP_SETKEYS:
+	{
+	  i.get_cid();
+	  o->objects.insert(i.get_oid());
+	  map<string, bufferlist> aset;
+	  i.get_attrset(aset);
+	}
+	break;
+      case Transaction::OP_RMATTR:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	i.get_attrname();
+	break;
+      case Transaction::OP_OMAP_RMKEYS:
+	{
+	  i.get_cid();
+	  o->objects.insert(i.get_oid());
+	  set<string> keys;
+	  i.get_keyset(keys);
+	}
+	break;
+      case Transaction::OP_OMAP_SETHEADER:
+	{
+	  i.get_cid();
+	  o->objects.insert(i.get_oid());
+	  bufferlist bl;
+	  i.get_bl(bl);
+	}
+	break;
+      case Transaction::OP_CLONE:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	o->objects.insert(i.get_oid());
+	break;
+      case Transaction::OP_CLONERANGE:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	o->objects.insert(i.get_oid());
+	i.get_length();
+	i.get_length();
+	break;
+      case Transaction::OP_CLONERANGE2:
+	i.get_cid();
+	o->objects.insert(i.get_oid());
+	o->objects.insert(i.get_oid());
+	i.get_length();
+	i.get_length();
+	i.get_length();
+	break;
+      default:
+	// collection ops, startsync, ...; no need to look further
+	o->barrier = true;
+	o->objects.clear();
+	return;
+      }
+    }
+  }
+}
+
 
 
 void FileStore::queue_op(OpSequencer *osr, Op *o)
@@ -2255,6 +2464,10 @@ void FileStore::_op_queue_release_throttle(Op *o)
 
 void FileStore::_do_op(OpSequencer *osr)
 {
+  if (m_filestore_parallel_apply || m_filestore_aio) {
+    _do_parallel_op(osr);
+    return;
+  }
   osr->apply_lock.Lock();
   Op *o = osr->peek_queue();
 
@@ -2271,11 +2484,20 @@ void FileStore::_do_op(OpSequencer *osr)
 
 void FileStore::_finish_op(OpSequencer *osr)
 {
+  if (m_filestore_parallel_apply || m_filestore_aio) {
+    _finish_parallel_op(osr);
+    return;
+  }
   Op *o = osr->dequeue();
   
   dout(10) << "_finish_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << dendl;
   osr->apply_lock.Unlock();  // locked in _do_op
 
+  _complete_op(osr, o);
+}
+
+void FileStore::_complete_op(OpSequencer *osr, Op *o)
+{
   // called with tp lock held
   _op_queue_release_throttle(o);
 
@@ -2291,6 +2513,204 @@ void FileStore::_finish_op(OpSequencer *osr)
   delete o;
 }
 
+/*
+ * With filestore_parallel_apply, each wakeup of osr applies whichever
+ * queued op doesn't conflict with an earlier unfinished one, so several
+ * op threads can work on the same sequencer.  Ops still complete (and
+ * their onreadable callbacks fire) in queue order: _finish_parallel_op
+ * only retires the applied prefix of the queue, and runs under the tp
+ * lock, so two threads never retire ops of the same osr concurrently.
+ */
+void FileStore::_do_parallel_op(OpSequencer *osr)
+{
+  Op *o = osr->start_next();
+  if (!o) {
+    dout(20) << "_do_parallel_op " << *osr << "/" << osr->parent
+	     << " nothing ready, deferring" << dendl;
+    return;
+  }
+
+  dout(5) << "_do_parallel_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent
+	  << " start, " << o->objects.size() << " objects"
+	  << (o->barrier ? " (barrier)" : "") << dendl;
+  if (m_filestore_aio) {
+    o->osr = osr;
+    aio_lock.Lock();
+    o->aio_pending = 1;
+    aio_lock.Unlock();
+    int r = _do_transactions(o->tls, o->op, o);
+    dout(10) << "_do_parallel_op " << o << " seq " << o->op << " r = " << r
+	     << ", submitted" << dendl;
+    _aio_put(o);
+    return;
+  }
+
+  int r = do_transactions(o->tls, o->op);
+  op_apply_finish(o->op);
+  dout(10) << "_do_parallel_op " << o << " seq " << o->op << " r = " << r
+	   << ", finisher " << o->onreadable << " " << o->onreadable_sync << dendl;
+
+  unsigned wake = osr->mark_applied(o);
+  while (wake--)
+    op_wq.queue(osr);
+}
+
+void FileStore::_finish_parallel_op(OpSequencer *osr)
+{
+  list<Op*> ls;
+  osr->dequeue_applied(&ls);
+  for (list<Op*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    dout(10) << "_finish_parallel_op " << *p << " seq " << (*p)->op << " " << *osr << "/" << osr->parent << dendl;
+    _complete_op(osr, *p);
+  }
+}
+
+/*
+ * With filestore_aio, page aligned writes are submitted with O_DIRECT
+ * and the op thread moves on.  Each op holds one reference for itself
+ * while its transactions are applied, and one per write in flight;
+ * whoever drops the last one marks the op applied and retires what it
+ * can, as _finish_parallel_op would.
+ */
+#ifdef HAVE_LIBAIO
+int FileStore::_aio_write(Op *o, int fd, uint64_t off, bufferlist& bl)
+{
+  aio_write_t *aio = new aio_write_t(o, fd, off, bl);
+  aio->iov = new iovec[aio->bl.buffers().size()];
+  int n = 0;
+  for (std::list<buffer::ptr>::const_iterator p = aio->bl.buffers().begin();
+       p != aio->bl.buffers().end();
+       ++p, ++n) {
+    aio->iov[n].iov_base = (void *)p->c_str();
+    aio->iov[n].iov_len = p->length();
+  }
+  io_prep_pwritev(&aio->iocb, fd, aio->iov, n, off);
+
+  aio_lock.Lock();
+  while (aio_num >= g_conf->filestore_aio_queue_depth)
+    aio_cond.Wait(aio_lock);
+  aio_num++;
+  o->aio_pending++;
+  aio_cond.SignalAll();
+  aio_lock.Unlock();
+
+  dout(20) << "_aio_write " << o << " fd " << fd << " " << off << "~" << aio->len
+	   << " in " << n << dendl;
+  iocb *piocb = &aio->iocb;
+  int attempts = 10;
+  while (true) {
+    int r = io_submit(aio_ctx, 1, &piocb);
+    if (r < 0) {
+      derr << "_aio_write io_submit " << off << "~" << aio->len
+	   << " got " << cpp_strerror(r) << dendl;
+      if (r == -EAGAIN && attempts-- > 0) {
+	usleep(500);
+	continue;
+      }
+      assert(0 == "io_submit got unexpected error");
+    }
+    break;
+  }
+  return 0;
+}
+#else
+int FileStore::_aio_write(Op *o, int fd, uint64_t off, bufferlist& bl)
+{
+  assert(0 == "libaio not compiled in");
+  return -EOPNOTSUPP;
+}
+#endif
+
+void FileStore::_aio_wait(Op *o)
+{
+  Mutex::Locker l(aio_lock);
+  dout(20) << "_aio_wait " << o << " on " << (o->aio_pending - 1) << " writes" << dendl;
+  while (o->aio_pending > 1)
+    aio_cond.Wait(aio_lock);
+  o->aio_objects.clear();
+}
+
+void FileStore::_aio_put(Op *o)
+{
+  aio_lock.Lock();
+  assert(o->aio_pending > 0);
+  bool last = --o->aio_pending == 0;
+  aio_lock.Unlock();
+  if (last)
+    _aio_applied(o);
+}
+
+void FileStore::_aio_applied(Op *o)
+{
+  OpSequencer *osr = o->osr;
+  dout(10) << "_aio_applied " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << dendl;
+  op_apply_finish(o->op);
+
+  // o keeps osr alive until it is retired, so do both under the tp lock
+  op_tp.lock();
+  unsigned wake = osr->mark_applied(o);
+  if (wake) {
+    while (wake--)
+      op_wq._enqueue(osr);
+    op_wq._wake();
+  }
+  _finish_parallel_op(osr);
+  op_tp.unlock();
+}
+
+void FileStore::aio_finish_entry()
+{
+#ifdef HAVE_LIBAIO
+  dout(10) << "aio_finish_entry start" << dendl;
+  while (true) {
+    {
+      Mutex::Locker l(aio_lock);
+      if (aio_num == 0) {
+	if (aio_stop)
+	  break;
+	aio_cond.Wait(aio_lock);
+	continue;
+      }
+    }
+
+    io_event event[16];
+    int r = io_getevents(aio_ctx, 1, 16, event, NULL);
+    if (r < 0) {
+      if (r == -EINTR) {
+	dout(0) << "aio_finish_entry io_getevents got " << cpp_strerror(r) << dendl;
+	continue;
+      }
+      derr << "aio_finish_entry io_getevents got " << cpp_strerror(r) << dendl;
+      assert(0 == "got unexpected error from io_getevents");
+    }
+
+    list<Op*> applied;
+    {
+      Mutex::Locker l(aio_lock);
+      for (int i = 0; i < r; i++) {
+	aio_write_t *aio = (aio_write_t *)event[i].obj;
+	if (event[i].res != aio->len) {
+	  derr << "aio write " << aio->off << "~" << aio->len
+	       << " got " << cpp_strerror(event[i].res) << dendl;
+	  assert(0 == "unexpected aio error");
+	}
+	dout(20) << "aio_finish_entry " << aio->op << " " << aio->off << "~" << aio->len
+		 << " done" << dendl;
+	TEMP_FAILURE_RETRY(::close(aio->fd));
+	aio_num--;
+	if (--aio->op->aio_pending == 0)
+	  applied.push_back(aio->op);
+	delete aio;
+      }
+      aio_cond.SignalAll();
+    }
+    for (list<Op*>::iterator p = applied.begin(); p != applied.end(); ++p)
+      _aio_applied(*p);
+  }
+  dout(10) << "aio_finish_entry finish" << dendl;
+#endif
+}
+
 
 struct C_JournaledAhead : public Context {
   FileStore *fs;
@@ -2415,7 +2835,7 @@ void FileStore::_journaled_ahead(OpSequencer *osr, Op *o, Context *ondisk)
   }
 }
 
-int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
+int FileStore::_do_transactions(list<Transaction*> &tls, uint64_t op_seq, Op *o)
 {
   int r = 0;
 
@@ -2431,7 +2851,7 @@ int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
   for (list<Transaction*>::iterator p = tls.begin();
        p != tls.end();
        p++, trans_num++) {
-    r = _do_transaction(**p, op_seq, trans_num);
+    r = _do_transaction(**p, op_seq, trans_num, o);
     if (r < 0)
       break;
   }
@@ -2614,7 +3034,8 @@ int FileStore::_check_replay_guard(int fd, const SequencerPosition& spos)
   }
 }
 
-unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_num)
+unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_num,
+				   Op *o)
 {
   dout(10) << "_do_transaction on " << &t << dendl;
 
@@ -2627,6 +3048,10 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
 
     _inject_failure();
 
+    // only writes may overlap our own writes still in flight
+    if (o && op != Transaction::OP_WRITE && !o->aio_objects.empty())
+      _aio_wait(o);
+
     switch (op) {
     case Transaction::OP_NOP:
       break;
@@ -2648,7 +3073,7 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
 	bufferlist bl;
 	i.get_bl(bl);
 	if (_check_replay_guard(cid, oid, spos) > 0)
-	  r = _write(cid, oid, off, len, bl);
+	  r = _write(cid, oid, off, len, bl, o);
       }
       break;
       
@@ -2887,6 +3312,26 @@ unsigned FileStore::_do_transaction(Transaction& t, uint64_t op_seq, int trans_n
 	r = _omap_setheader(cid, oid, bl, spos);
       }
       break;
+    case Transaction::OP_COLL_HINT:
+      {
+	coll_t cid(i.get_cid());
+	uint32_t type = i.get_u32();
+	bufferlist hint;
+	i.get_bl(hint);
+	bufferlist::iterator hiter = hint.begin();
+	if (type == Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS) {
+	  uint32_t pg_num;
+	  uint64_t expected_num_objs;
+	  ::decode(pg_num, hiter);
+	  ::decode(expected_num_objs, hiter);
+	  if (_check_replay_guard(cid, spos) > 0)
+	    r = _collection_hint_expected_num_objs(cid, pg_num,
+						   expected_num_objs);
+	} else {
+	  dout(10) << "unrecognized collection hint type " << type << dendl;
+	}
+      }
+      break;
 
     default:
       derr << "bad op " << op << dendl;
@@ -2994,8 +3439,238 @@ int FileStore::stat(coll_t cid, const hobject_t& oid, struct stat *st)
   return r;
 }
 
+// -- data checksums --
+
+#define CSUM_XATTR "user.cephos.csum"
+
+/*
+ * crc32c of each block_size block of an object's data, the last block
+ * possibly short.  The sums are only trusted while the object has the
+ * size and mtime recorded with them: a write that didn't update them
+ * (made with filestore_csum off, or lost to a crash before we got to
+ * the xattr) moves the mtime, and they are ignored from then on.
+ */
+struct FileStore::csum_t {
+  uint32_t block_size;
+  uint64_t size;
+  utime_t mtime;
+  vector<uint32_t> crc;
+
+  csum_t() : block_size(0), size(0) {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(block_size, bl);
+    ::encode(size, bl);
+    ::encode(mtime, bl);
+    ::encode(crc, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    DECODE_START(1, p);
+    ::decode(block_size, p);
+    ::decode(size, p);
+    ::decode(mtime, p);
+    ::decode(crc, p);
+    DECODE_FINISH(p);
+  }
+};
+
+static uint32_t crc32c_zeros(uint32_t crc, uint64_t len)
+{
+  static const unsigned char zeros[4096] = { 0 };
+  while (len) {
+    unsigned l = MIN(len, sizeof(zeros));
+    crc = ceph_crc32c_le(crc, zeros, l);
+    len -= l;
+  }
+  return crc;
+}
+
+/**
+ * Read the sums of the object open on fd.
+ *
+ * @param size [out] the object's size, whether or not it has sums
+ * @return 0 if the sums are current, -ENODATA if there are none or they are stale
+ */
+int FileStore::_csum_load(int fd, csum_t *c, uint64_t *size)
+{
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  if (r < 0)
+    return -errno;
+  *size = st.st_size;
+
+  r = do_fgetxattr(fd, CSUM_XATTR, NULL, 0);
+  if (r <= 0)
+    return -ENODATA;
+  bufferptr bp(r);
+  r = do_fgetxattr(fd, CSUM_XATTR, bp.c_str(), bp.length());
+  if (r < 0)
+    return -ENODATA;
+  bp.set_length(r);
+  bufferlist bl;
+  bl.push_back(bp);
+  try {
+    bufferlist::iterator p = bl.begin();
+    c->decode(p);
+  } catch (buffer::error& e) {
+    dout(0) << "_csum_load can't decode sums: " << e.what() << dendl;
+    return -ENODATA;
+  }
+
+  if (c->size != *size ||
+      c->mtime != utime_t(st.st_mtim.tv_sec, st.st_mtim.tv_nsec) ||
+      c->block_size == 0 ||
+      c->crc.size() != (c->size + c->block_size - 1) / c->block_size) {
+    dout(20) << "_csum_load sums for size " << c->size << " mtime " << c->mtime
+	     << " are stale" << dendl;
+    return -ENODATA;
+  }
+  return 0;
+}
+
+int FileStore::_csum_store(int fd, csum_t *c, uint64_t size)
+{
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  if (r < 0)
+    return -errno;
+  c->size = size;
+  c->mtime = utime_t(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+
+  bufferlist bl;
+  c->encode(bl);
+  r = do_fsetxattr(fd, CSUM_XATTR, bl.c_str(), bl.length());
+  if (r < 0) {
+    dout(0) << "_csum_store fsetxattr got " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+/*
+ * Bring the sums up to date after off~len changed and the object became
+ * new_size bytes long.  Blocks holding only bytes we know (from data, a
+ * zeroed range, or a hole past the old end) are summed directly; the
+ * rest are reread.  Without current sums for the old contents we can
+ * only start over if the change rewrote all of them.
+ *
+ * On error the sums are left stale, which is safe: they no longer match
+ * the object's mtime.
+ */
+int FileStore::_csum_update(int fd, csum_t *c, bool valid, uint64_t old_size,
+			    uint64_t new_size, uint64_t off, uint64_t len,
+			    const bufferlist *data, bool zeroed)
+{
+  if (!valid) {
+    if (old_size && new_size && (off > 0 || off + len < old_size)) {
+      dout(20) << "_csum_update no sums for the rest of the object, skipping" << dendl;
+      return 0;
+    }
+    *c = csum_t();
+    c->block_size = m_filestore_csum_block_size;
+    if (!c->block_size)
+      return 0;
+    old_size = 0;
+  }
+  if (data && data->length() < len)
+    data = NULL;
+
+  uint64_t bs = c->block_size;
+  uint64_t lo = off, hi = off + len;
+  if (new_size != old_size) {
+    lo = MIN(lo, MIN(old_size, new_size));
+    hi = MAX(hi, MAX(old_size, new_size));
+  }
+  hi = MIN(hi, new_size);
+
+  c->crc.resize((new_size + bs - 1) / bs);
+  for (uint64_t b = lo / bs; lo < hi && b < (hi + bs - 1) / bs; ++b) {
+    uint64_t bstart = b * bs;
+    uint64_t bend = MIN(bstart + bs, new_size);
+    uint32_t crc = -1;
+    bool known = true;
+    for (uint64_t s = bstart; s < bend && known; ) {
+      uint64_t e;
+      if (s >= off && s < off + len) {
+	e = MIN(bend, off + len);
+	if (data) {
+	  bufferlist sub;
+	  sub.substr_of(*data, s - off, e - s);
+	  crc = sub.crc32c(crc);
+	} else if (zeroed) {
+	  crc = crc32c_zeros(crc, e - s);
+	} else {
+	  known = false;
+	}
+      } else if (s >= old_size) {
+	e = s < off ? MIN(bend, off) : bend;
+	crc = crc32c_zeros(crc, e - s);
+      } else {
+	known = false;
+	e = bend;
+      }
+      s = e;
+    }
+    if (!known) {
+      // page aligned, so this works on an O_DIRECT fd too
+      bufferptr bp = buffer::create_page_aligned(ALIGN_UP(bend - bstart, CEPH_PAGE_SIZE));
+      int r = safe_pread(fd, bp.c_str(), bp.length(), bstart);
+      if (r >= 0 && (uint64_t)r < bend - bstart)
+	r = -EIO;
+      if (r < 0) {
+	dout(0) << "_csum_update reread of " << bstart << "~" << (bend - bstart)
+		<< " got " << cpp_strerror(r) << dendl;
+	return r;
+      }
+      crc = ceph_crc32c_le(-1, (unsigned char*)bp.c_str(), bend - bstart);
+    }
+    c->crc[b] = crc;
+  }
+  dout(20) << "_csum_update " << off << "~" << len << " size " << old_size
+	   << " -> " << new_size << dendl;
+  return _csum_store(fd, c, new_size);
+}
+
+/*
+ * Read offset~len and check it against the sums.  The read is widened to
+ * whole blocks and done in one pread, so unaligned edges cost no extra
+ * trip to the disk.
+ */
+int FileStore::_csum_read(int fd, csum_t *c, uint64_t size, uint64_t offset, size_t len,
+			  bufferlist& bl)
+{
+  if (offset >= size)
+    return 0;
+  uint64_t end = MIN(offset + len, size);
+  uint64_t bs = c->block_size;
+  uint64_t start = offset - offset % bs;
+  uint64_t stop = MIN(ALIGN_UP(end, bs), size);
+
+  bufferptr bptr(stop - start);
+  int r = safe_pread_exact(fd, bptr.c_str(), stop - start, start);
+  if (r < 0) {
+    assert(!m_filestore_fail_eio || r != -EIO);
+    return r == -EDOM ? -EIO : r;
+  }
+  for (uint64_t pos = start; pos < stop; pos += bs) {
+    uint64_t l = MIN(bs, stop - pos);
+    uint32_t crc = ceph_crc32c_le(-1, (unsigned char*)bptr.c_str() + (pos - start), l);
+    if (crc != c->crc[pos / bs]) {
+      derr << "_csum_read block " << pos << "~" << l << " has crc " << crc
+	   << ", expected " << c->crc[pos / bs] << dendl;
+      logger->inc(l_os_csum_err);
+      return -EIO;
+    }
+  }
+  bl.push_back(bufferptr(bptr, offset - start, end - offset));
+  return end - offset;
+}
+
 int FileStore::read(coll_t cid, const hobject_t& oid, 
-                    uint64_t offset, size_t len, bufferlist& bl)
+                    uint64_t offset, size_t len, bufferlist& bl,
+		    uint32_t flags)
 {
   int got;
 
@@ -3007,6 +3682,30 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
     return fd;
   }
 
+#ifdef HAVE_POSIX_FADVISE
+  if ((flags & READ_SEQUENTIAL) && len) {
+    // read ahead harder, and start on the next piece while the caller
+    // works through this one
+    posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, offset + len, len, POSIX_FADV_WILLNEED);
+  }
+#endif
+
+  if (m_filestore_csum) {
+    csum_t csum;
+    uint64_t size;
+    if (_csum_load(fd, &csum, &size) == 0) {
+      got = _csum_read(fd, &csum, size, offset, len ? len : size, bl);
+      TEMP_FAILURE_RETRY(::close(fd));
+      if (got == -EIO)
+	derr << "read " << cid << "/" << oid << " " << offset << "~" << len
+	     << " failed its checksum" << dendl;
+      dout(10) << "FileStore::read " << cid << "/" << oid << " " << offset << "~"
+	       << len << " = " << got << " (checksummed)" << dendl;
+      return got;
+    }
+  }
+
   if (len == 0) {
     struct stat st;
     memset(&st, 0, sizeof(struct stat));
@@ -3123,7 +3822,21 @@ int FileStore::_remove(coll_t cid, const hobject_t& oid,
 int FileStore::_truncate(coll_t cid, const hobject_t& oid, uint64_t size)
 {
   dout(15) << "truncate " << cid << "/" << oid << " size " << size << dendl;
+  int fd = -1;
+  csum_t csum;
+  bool csum_valid = false;
+  uint64_t old_size = 0;
+  if (m_filestore_csum) {
+    fd = lfn_open(cid, oid, O_RDWR);
+    if (fd >= 0)
+      csum_valid = _csum_load(fd, &csum, &old_size) == 0;
+  }
   int r = lfn_truncate(cid, oid, size);
+  if (fd >= 0) {
+    if (r == 0)
+      _csum_update(fd, &csum, csum_valid, old_size, size, size, 0, NULL);
+    TEMP_FAILURE_RETRY(::close(fd));
+  }
   dout(10) << "truncate " << cid << "/" << oid << " size " << size << " = " << r << dendl;
   return r;
 }
@@ -3147,21 +3860,56 @@ int FileStore::_touch(coll_t cid, const hobject_t& oid)
 
 int FileStore::_write(coll_t cid, const hobject_t& oid, 
                      uint64_t offset, size_t len,
-                     const bufferlist& bl)
+                     const bufferlist& bl, Op *o)
 {
   dout(15) << "write " << cid << "/" << oid << " " << offset << "~" << len << dendl;
   int r;
 
   int64_t actual;
 
-  int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
+  // with checksums we may reread the edges of the write
+  int flags = (m_filestore_csum ? O_RDWR : O_WRONLY) | O_CREAT;
+  int fd;
+  csum_t csum;
+  bool csum_valid = false;
+  uint64_t old_size = 0;
+
+  if (o) {
+    // keep our own writes to oid in order
+    if (o->aio_objects.count(oid))
+      _aio_wait(o);
+
+#ifdef HAVE_LIBAIO
+    // page aligned writes go around the page cache, through aio.  not
+    // with checksums: aio_finish_entry owns the fd once it is submitted,
+    // and the sums must be stored after the data lands
+    if (m_filestore_aio && !m_filestore_csum && len == bl.length() &&
+	(offset & ~CEPH_PAGE_MASK) == 0 && (len & ~CEPH_PAGE_MASK) == 0) {
+      fd = lfn_open(cid, oid, flags | O_DIRECT, 0644);
+      if (fd >= 0) {
+	bufferlist abl(bl);
+	abl.rebuild_page_aligned();
+	o->aio_objects.insert(oid);
+	r = _aio_write(o, fd, offset, abl);
+	if (r == 0)
+	  r = len;
+	goto out;
+      }
+      dout(10) << "write couldn't open " << cid << "/" << oid << " O_DIRECT: "
+	       << cpp_strerror(fd) << ", writing through the page cache" << dendl;
+    }
+#endif
+  }
+
+  fd = lfn_open(cid, oid, flags, 0644);
   if (fd < 0) {
     r = fd;
     dout(0) << "write couldn't open " << cid << "/" << oid << " flags " << flags << ": "
 	    << cpp_strerror(r) << dendl;
     goto out;
   }
+  if (m_filestore_csum)
+    csum_valid = _csum_load(fd, &csum, &old_size) == 0;
     
   // seek
   actual = ::lseek64(fd, offset, SEEK_SET);
@@ -3178,8 +3926,12 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
 
   // write
   r = bl.write_fd(fd);
-  if (r == 0)
+  if (r == 0) {
     r = bl.length();
+    if (m_filestore_csum)
+      _csum_update(fd, &csum, csum_valid, old_size, MAX(old_size, offset + len),
+		   offset, len, &bl);
+  }
 
   // flush?
   if ((ssize_t)len < m_filestore_flush_min ||
@@ -3207,16 +3959,26 @@ int FileStore::_zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t l
 #ifdef CEPH_HAVE_FALLOCATE
 # if !defined(DARWIN) && !defined(__FreeBSD__)
   // first try to punch a hole.
-  int fd = lfn_open(cid, oid, O_RDONLY);
+  int fd = lfn_open(cid, oid, m_filestore_csum ? O_RDWR : O_WRONLY);
   if (fd < 0) {
-    ret = -errno;
+    ret = fd;
     goto out;
   }
-
-  // first try fallocate
-  ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE, offset, len);
-  if (ret < 0)
-    ret = -errno;
+  {
+    csum_t csum;
+    bool csum_valid = false;
+    uint64_t size = 0;
+    if (m_filestore_csum)
+      csum_valid = _csum_load(fd, &csum, &size) == 0;
+
+    // first try fallocate.  linux only punches holes that keep the file
+    // size, which is what we want anyway: zeroing never extends an object.
+    ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+    if (ret < 0)
+      ret = -errno;
+    else if (m_filestore_csum)
+      _csum_update(fd, &csum, csum_valid, size, size, offset, len, NULL, true);
+  }
   TEMP_FAILURE_RETRY(::close(fd));
 
   if (ret == 0)
@@ -3271,6 +4033,13 @@ int FileStore::_clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newo
       r = -errno;
       goto out3;
     }
+    if (m_filestore_csum) {
+      // same data, same sums
+      csum_t csum;
+      uint64_t size;
+      if (_csum_load(o, &csum, &size) == 0)
+	_csum_store(n, &csum, size);
+    }
     dout(20) << "objectmap clone" << dendl;
     r = object_map->clone(oldoid, newoid, &spos);
     if (r < 0 && r != -ENOENT)
@@ -3449,12 +4218,22 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
     r = o;
     goto out2;
   }
-  n = lfn_open(cid, newoid, O_CREAT|O_WRONLY, 0644);
+  n = lfn_open(cid, newoid, O_CREAT | (m_filestore_csum ? O_RDWR : O_WRONLY), 0644);
   if (n < 0) {
     r = n;
     goto out;
   }
-  r = _do_clone_range(o, n, srcoff, len, dstoff);
+  {
+    csum_t csum;
+    bool csum_valid = false;
+    uint64_t old_size = 0;
+    if (m_filestore_csum)
+      csum_valid = _csum_load(n, &csum, &old_size) == 0;
+    r = _do_clone_range(o, n, srcoff, len, dstoff);
+    struct stat st;
+    if (r >= 0 && m_filestore_csum && ::fstat(n, &st) == 0)
+      _csum_update(n, &csum, csum_valid, old_size, st.st_size, dstoff, len, NULL);
+  }
 
   // clone is non-idempotent; record our work.
   _set_replay_guard(n, spos, &newoid);
@@ -3540,6 +4319,70 @@ void FileStore::flusher_entry()
   lock.Unlock();
 }
 
+void FileStore::queue_split(coll_t c, const vector<string> &path)
+{
+  Mutex::Locker l(split_lock);
+  pair<coll_t, vector<string> > item(c, path);
+  if (split_queued.count(item))
+    return;
+  dout(10) << "queue_split " << c << " " << path << dendl;
+  split_queued.insert(item);
+  split_queue.push_back(item);
+  split_cond.Signal();
+}
+
+void FileStore::split_entry()
+{
+  split_lock.Lock();
+  dout(20) << "split_entry start" << dendl;
+  while (!split_stop) {
+    if (split_queue.empty()) {
+      split_cond.Wait(split_lock);
+      continue;
+    }
+    pair<coll_t, vector<string> > item = split_queue.front();
+    split_queue.pop_front();
+    split_queued.erase(item);
+    split_lock.Unlock();
+
+    // each step holds the collection's index, and so blocks ops on
+    // that collection, only while it moves one subdirectory
+    uint64_t moved = 0;
+    bool more = false;
+    int r;
+    {
+      Index index;
+      r = get_index(item.first, &index);
+      if (r == 0)
+	r = index->split_step(item.second, &moved, &more);
+    }
+    dout(15) << "split_entry " << item.first << " " << item.second
+	     << " moved " << moved << (more ? ", more to do" : "")
+	     << " = " << r << dendl;
+    if (r < 0) {
+      derr << "split_entry " << item.first << " " << item.second
+	   << " failed: " << cpp_strerror(r) << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+      more = false;
+    }
+
+    split_lock.Lock();
+    if (more && !split_queued.count(item)) {
+      split_queued.insert(item);
+      split_queue.push_back(item);
+    }
+    if (moved && g_conf->filestore_split_rate > 0 && !split_stop) {
+      utime_t wait;
+      wait.set_from_double((double)moved / g_conf->filestore_split_rate);
+      split_cond.WaitInterval(g_ceph_context, split_lock, wait);
+    }
+  }
+  split_queue.clear();
+  split_queued.clear();
+  dout(20) << "split_entry finish" << dendl;
+  split_lock.Unlock();
+}
+
 class SyncEntryTimeout : public Context {
 public:
   SyncEntryTimeout(int commit_timeo) 
@@ -4714,8 +5557,32 @@ int FileStore::_create_collection(coll_t c)
   return init_index(c);
 }
 
+int FileStore::_collection_hint_expected_num_objs(coll_t c, uint32_t pg_num,
+						  uint64_t expected_num_objs)
+{
+  dout(15) << "collection_hint_expected_num_objs " << c << " pg_num " << pg_num
+	   << " expected_num_objs " << expected_num_objs << dendl;
+  Index index;
+  int r = get_index(c, &index);
+  if (r < 0)
+    return r;
+  r = index->pre_split(pg_num, expected_num_objs);
+  dout(10) << "collection_hint_expected_num_objs " << c << " = " << r << dendl;
+  return r;
+}
+
 int FileStore::_destroy_collection(coll_t c) 
 {
+  {
+    // without an index there is nothing to tidy; just try the rmdir
+    Index index;
+    int r = get_index(c, &index);
+    if (r == 0) {
+      r = index->prep_delete();
+      if (r < 0)
+	return r;
+    }
+  }
   char fn[PATH_MAX];
   get_cdir(c, fn, sizeof(fn));
   dout(15) << "_destroy_collection " << fn << dendl;
@@ -4851,6 +5718,8 @@ const char** FileStore::get_tracked_conf_keys() const
     "filestore_dump_file",
     "filestore_kill_at",
     "filestore_fail_eio",
+    "filestore_csum",
+    "filestore_csum_block_size",
     NULL
   };
   return KEYS;
@@ -4875,6 +5744,12 @@ void FileStore::handle_conf_change(const struct md_config_t *conf,
     m_filestore_kill_at.set(conf->filestore_kill_at);
     m_filestore_fail_eio = conf->filestore_fail_eio;
   }
+  if (changed.count("filestore_csum") ||
+      changed.count("filestore_csum_block_size")) {
+    Mutex::Locker l(lock);
+    m_filestore_csum = conf->filestore_csum;
+    m_filestore_csum_block_size = conf->filestore_csum_block_size;
+  }
   if (changed.count("filestore_commit_timeout")) {
     Mutex::Locker l(sync_entry_timeo_lock);
     m_filestore_commit_timeout = conf->filestore_commit_timeout;
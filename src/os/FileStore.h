@@ -43,8 +43,14 @@ using namespace __gnu_cxx;
 
 #include "include/uuid.h"
 
+#ifdef HAVE_LIBAIO
+# include <libaio.h>
+#endif
 
 // from include/linux/falloc.h:
+#ifndef FALLOC_FL_KEEP_SIZE
+# define FALLOC_FL_KEEP_SIZE 0x1
+#endif
 #ifndef FALLOC_FL_PUNCH_HOLE
 # define FALLOC_FL_PUNCH_HOLE 0x2
 #endif
@@ -122,6 +128,7 @@ private:
   void sync_fs(); // actuall sync underlying fs
 
   // -- op workqueue --
+  class OpSequencer;
   struct Op {
     utime_t start;
     uint64_t op;
@@ -129,12 +136,39 @@ private:
     Context *onreadable, *onreadable_sync;
     uint64_t ops, bytes;
     TrackedOpRef osd_op;
+
+    // for filestore_parallel_apply
+    set<hobject_t> objects;  ///< objects touched by tls
+    bool barrier;            ///< touches a collection; conflicts with everything
+    bool applying, applied;
+
+    // for filestore_aio
+    OpSequencer *osr;
+    int aio_pending;         ///< writes in flight, +1 while applying; under aio_lock
+    set<hobject_t> aio_objects;  ///< objects with writes in flight (op thread only)
+
+    bool conflicts_with(const Op *other) const {
+      if (barrier || other->barrier)
+	return true;
+      set<hobject_t>::const_iterator p = objects.begin();
+      set<hobject_t>::const_iterator q = other->objects.begin();
+      while (p != objects.end() && q != other->objects.end()) {
+	if (*p < *q)
+	  ++p;
+	else if (*q < *p)
+	  ++q;
+	else
+	  return true;
+      }
+      return false;
+    }
   };
   class OpSequencer : public Sequencer_impl {
     Mutex qlock; // to protect q, for benefit of flush (peek/dequeue also protected by lock)
     list<Op*> q;
     list<uint64_t> jq;
     Cond cond;
+    unsigned deferred;  // wakeups that found nothing they could apply
   public:
     Sequencer *parent;
     Mutex apply_lock;  // for apply mutual exclusion
@@ -164,6 +198,50 @@ private:
       cond.Signal();
       return o;
     }
+
+    /**
+     * Claim the oldest op that can be applied now, i.e. that touches
+     * no object an earlier, not yet applied op also touches.  If
+     * there is none the wakeup is remembered, and handed back by
+     * mark_applied() once an op in flight has finished.
+     */
+    Op *start_next() {
+      Mutex::Locker l(qlock);
+      for (list<Op*>::iterator p = q.begin(); p != q.end(); ++p) {
+	if ((*p)->applying || (*p)->applied)
+	  continue;
+	list<Op*>::iterator e = q.begin();
+	for (; e != p; ++e)
+	  if (!(*e)->applied && (*e)->conflicts_with(*p))
+	    break;
+	if (e == p) {
+	  (*p)->applying = true;
+	  return *p;
+	}
+      }
+      ++deferred;
+      return NULL;
+    }
+    /// returns the number of deferred wakeups to requeue
+    unsigned mark_applied(Op *o) {
+      Mutex::Locker l(qlock);
+      o->applying = false;
+      o->applied = true;
+      unsigned r = deferred;
+      deferred = 0;
+      return r;
+    }
+    /// pop the applied ops at the front of the queue, in order
+    void dequeue_applied(list<Op*> *ls) {
+      Mutex::Locker l(qlock);
+      while (!q.empty() && q.front()->applied) {
+	ls->push_back(q.front());
+	q.pop_front();
+      }
+      if (!ls->empty())
+	cond.Signal();
+    }
+
     void flush() {
       Mutex::Locker l(qlock);
 
@@ -187,6 +265,7 @@ private:
 
     OpSequencer()
       : qlock("FileStore::OpSequencer::qlock", false, false),
+	deferred(0),
 	apply_lock("FileStore::OpSequencer::apply_lock", false, false) {}
     ~OpSequencer() {
       assert(q.empty());
@@ -242,6 +321,10 @@ private:
 
   void _do_op(OpSequencer *o);
   void _finish_op(OpSequencer *o);
+  void _do_parallel_op(OpSequencer *osr);
+  void _finish_parallel_op(OpSequencer *osr);
+  void _complete_op(OpSequencer *osr, Op *o);
+  void _get_touched_objects(Op *o);
   Op *build_op(list<Transaction*>& tls,
 	       Context *onreadable, Context *onreadable_sync,
 	       TrackedOpRef osd_op);
@@ -267,6 +350,78 @@ private:
   } flusher_thread;
   bool queue_flusher(int fd, uint64_t off, uint64_t len);
 
+  // split thread, @see filestore_split_in_background
+  Mutex split_lock;
+  Cond split_cond;
+  bool split_stop;
+  list<pair<coll_t, vector<string> > > split_queue;
+  set<pair<coll_t, vector<string> > > split_queued;
+  void split_entry();
+  struct SplitThread : public Thread {
+    FileStore *fs;
+    SplitThread(FileStore *f) : fs(f) {}
+    void *entry() {
+      fs->split_entry();
+      return 0;
+    }
+  } split_thread;
+  struct SplitQueueHook : public CollectionIndex::SplitQueue {
+    FileStore *fs;
+    SplitQueueHook(FileStore *f) : fs(f) {}
+    void queue_split(coll_t c, const vector<string> &path) {
+      fs->queue_split(c, path);
+    }
+  } split_queue_hook;
+  void queue_split(coll_t c, const vector<string> &path);
+
+  // aio data path, @see filestore_aio
+  Mutex aio_lock;
+  Cond aio_cond;
+  bool aio_stop;
+  int aio_num;
+#ifdef HAVE_LIBAIO
+  io_context_t aio_ctx;
+  struct aio_write_t {
+    struct iocb iocb;
+    Op *op;
+    int fd;
+    uint64_t off, len;
+    bufferlist bl;
+    struct iovec *iov;
+
+    aio_write_t(Op *o, int f, uint64_t of, bufferlist& b)
+      : op(o), fd(f), off(of), len(b.length()), iov(NULL) {
+      bl.claim(b);
+    }
+    ~aio_write_t() {
+      delete[] iov;
+    }
+  };
+#endif
+  void aio_finish_entry();
+  struct AioFinishThread : public Thread {
+    FileStore *fs;
+    AioFinishThread(FileStore *f) : fs(f) {}
+    void *entry() {
+      fs->aio_finish_entry();
+      return 0;
+    }
+  } aio_finish_thread;
+  int _aio_write(Op *o, int fd, uint64_t off, bufferlist& bl);
+  void _aio_wait(Op *o);
+  void _aio_put(Op *o);
+  void _aio_applied(Op *o);
+
+  // -- data checksums --
+  struct csum_t;
+  int _csum_load(int fd, csum_t *c, uint64_t *size);
+  int _csum_update(int fd, csum_t *c, bool valid, uint64_t old_size,
+		   uint64_t new_size, uint64_t off, uint64_t len,
+		   const bufferlist *data, bool zeroed=false);
+  int _csum_store(int fd, csum_t *c, uint64_t size);
+  int _csum_read(int fd, csum_t *c, uint64_t size, uint64_t offset, size_t len,
+		 bufferlist& bl);
+
   int open_journal();
 
 
@@ -311,10 +466,14 @@ public:
 
   int statfs(struct statfs *buf);
 
-  int do_transactions(list<Transaction*> &tls, uint64_t op_seq);
+  int do_transactions(list<Transaction*> &tls, uint64_t op_seq) {
+    return _do_transactions(tls, op_seq, NULL);
+  }
+  int _do_transactions(list<Transaction*> &tls, uint64_t op_seq, Op *o);
   unsigned apply_transaction(Transaction& t, Context *ondisk=0);
   unsigned apply_transactions(list<Transaction*>& tls, Context *ondisk=0);
-  unsigned _do_transaction(Transaction& t, uint64_t op_seq, int trans_num);
+  unsigned _do_transaction(Transaction& t, uint64_t op_seq, int trans_num,
+			   Op *o = NULL);
 
   int queue_transaction(Sequencer *osr, Transaction* t);
   int queue_transactions(Sequencer *osr, list<Transaction*>& tls,
@@ -366,11 +525,13 @@ public:
   }
   bool exists(coll_t cid, const hobject_t& oid);
   int stat(coll_t cid, const hobject_t& oid, struct stat *st);
-  int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl,
+	   uint32_t flags = 0);
   int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
 
   int _touch(coll_t cid, const hobject_t& oid);
-  int _write(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, const bufferlist& bl);
+  int _write(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, const bufferlist& bl,
+	     Op *o = NULL);
   int _zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len);
   int _truncate(coll_t cid, const hobject_t& oid, uint64_t size);
   int _clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newoid,
@@ -453,6 +614,8 @@ public:
   ObjectMap::ObjectMapIterator get_omap_iterator(coll_t c, const hobject_t &hoid);
 
   int _create_collection(coll_t c);
+  int _collection_hint_expected_num_objs(coll_t c, uint32_t pg_num,
+					 uint64_t expected_num_objs);
   int _destroy_collection(coll_t c);
   int _collection_add(coll_t c, coll_t ocid, const hobject_t& o,
 		      const SequencerPosition& spos);
@@ -484,6 +647,8 @@ private:
   bool m_filestore_flusher;
   bool m_filestore_fsync_flushes_journal_data;
   bool m_filestore_journal_parallel;
+  bool m_filestore_parallel_apply;
+  bool m_filestore_aio;
   bool m_filestore_journal_trailing;
   bool m_filestore_journal_writeahead;
   int m_filestore_fiemap_threshold;
@@ -493,6 +658,8 @@ private:
   double m_filestore_max_sync_interval;
   double m_filestore_min_sync_interval;
   bool m_filestore_fail_eio;
+  bool m_filestore_csum;
+  uint32_t m_filestore_csum_block_size;
   int do_update;
   bool m_journal_dio, m_journal_aio;
   std::string m_osd_rollback_to_cluster_snap;
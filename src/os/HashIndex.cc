@@ -67,6 +67,10 @@ int HashIndex::_created(const vector<string> &path,
     return r;
 
   if (must_split(info)) {
+    if (split_queue) {
+      split_queue->queue_split(coll(), path);
+      return 0;
+    }
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -180,7 +184,9 @@ int HashIndex::set_info(const vector<string> &path, const subdir_info_s &info) {
 }
 
 bool HashIndex::must_merge(const subdir_info_s &info) {
+  // directories laid out by pre_split stay, however empty
   return (info.hash_level > 0 &&
+	  info.hash_level > info.pre_split_level &&
 	  info.objs < (unsigned)merge_threshold &&
 	  info.subdirs == 0);
 }
@@ -348,6 +354,231 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
   return end_split_or_merge(path);
 }
 
+int HashIndex::pre_split(uint32_t pg_num, uint64_t expected_num_objs) {
+  vector<string> path;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  // only an empty collection can be laid out up front
+  if (info.objs || info.subdirs || !expected_num_objs)
+    return 0;
+
+  // low hash bits shared by every object in the pg; with a pg_num
+  // which isn't a power of two, only bits - 1 of them are fixed
+  int fixed_bits = 0;
+  uint32_t ps = 0;
+  pg_t pgid;
+  snapid_t snap;
+  if (pg_num > 1 && coll().is_pg(pgid, snap)) {
+    fixed_bits = pg_pool_t::calc_bits_of(pg_num - 1);
+    if (pg_num & (pg_num - 1))
+      fixed_bits--;
+    ps = pgid.ps();
+  }
+
+  // go deep enough that the directories objects can land in each
+  // start out below the split threshold
+  uint64_t split_at = (uint64_t)merge_threshold * 16 * split_multiplier;
+  if (!split_at)
+    return 0;
+  int levels = 0;
+  while (levels < MAX_PRE_SPLIT_LEVEL) {
+    int free_bits = levels * 4 - fixed_bits;
+    uint64_t leaves = free_bits > 0 ? (1ull << free_bits) : 1;
+    if (expected_num_objs < leaves * split_at)
+      break;
+    ++levels;
+  }
+  dout(10) << "pre_split " << coll() << " expecting " << expected_num_objs
+	   << " objects, pg_num " << pg_num << ": " << levels << " levels"
+	   << dendl;
+  if (!levels)
+    return 0;
+  return pre_split_path(path, levels, ps, fixed_bits);
+}
+
+int HashIndex::pre_split_path(const vector<string> &path,
+			      int levels,
+			      uint32_t ps,
+			      int fixed_bits) {
+  int level = path.size();
+  subdir_info_s info;
+  info.hash_level = level;
+  info.pre_split_level = level + levels;
+  if (levels > 0) {
+    int low = level * 4;
+    for (uint32_t n = 0; n < 16; ++n) {
+      // skip nibbles no object in the collection can have
+      if (fixed_bits > low) {
+	int nbits = MIN(4, fixed_bits - low);
+	uint32_t mask = (1 << nbits) - 1;
+	if ((n & mask) != ((ps >> low) & mask))
+	  continue;
+      }
+      char buf[2];
+      snprintf(buf, sizeof(buf), "%X", n);
+      vector<string> child(path);
+      child.push_back(string(buf));
+      // may be replaying a partial pre_split
+      int r = create_path(child);
+      if (r < 0 && r != -EEXIST)
+	return r;
+      r = pre_split_path(child, levels - 1, ps, fixed_bits);
+      if (r < 0)
+	return r;
+      info.subdirs++;
+    }
+  }
+  // info goes on last so that a directory with info is complete
+  int r = set_info(path, info);
+  if (r < 0)
+    return r;
+  return fsync_dir(path);
+}
+
+int HashIndex::prep_delete() {
+  // a pre-split collection has directories which never held an object
+  bool empty;
+  return remove_empty_subdirs(vector<string>(), &empty);
+}
+
+int HashIndex::remove_empty_subdirs(const vector<string> &path, bool *empty) {
+  set<string> subdirs;
+  int r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  *empty = true;
+  for (set<string>::iterator i = subdirs.begin(); i != subdirs.end(); ++i) {
+    vector<string> child(path);
+    child.push_back(*i);
+    bool child_empty;
+    r = remove_empty_subdirs(child, &child_empty);
+    if (r < 0)
+      return r;
+    if (child_empty) {
+      r = remove_path(child);
+      if (r < 0)
+	return r;
+    } else {
+      *empty = false;
+    }
+  }
+  map<string, hobject_t> objects;
+  r = list_objects(path, 1, 0, &objects);
+  if (r < 0)
+    return r;
+  if (!objects.empty())
+    *empty = false;
+  return 0;
+}
+
+int HashIndex::split_step(const vector<string> &path,
+			  uint64_t *moved,
+			  bool *more) {
+  *moved = 0;
+  *more = false;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r == -ENOENT)
+    return 0;  // merged away since it was queued
+  if (r < 0)
+    return r;
+  if ((info.subdirs == 0 && !must_split(info)) ||
+      info.hash_level >= (unsigned)MAX_HASH_LEVEL)
+    return 0;
+
+  map<string, hobject_t> objects;
+  r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  int level = info.hash_level;
+  map<string, map<string, hobject_t> > mapped;
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    vector<string> new_path;
+    get_path_components(i->second, &new_path);
+    mapped[new_path[level]][i->first] = i->second;
+  }
+
+  // move the largest group which is worth a subdir of its own, as
+  // complete_split would
+  map<string, map<string, hobject_t> >::iterator chosen = mapped.end();
+  int candidates = 0;
+  for (map<string, map<string, hobject_t> >::iterator i = mapped.begin();
+       i != mapped.end();
+       ++i) {
+    subdir_info_s info_new;
+    info_new.objs = i->second.size();
+    info_new.hash_level = level + 1;
+    if (must_merge(info_new) && !subdirs.count(i->first))
+      continue;
+    candidates++;
+    if (chosen == mapped.end() || i->second.size() > chosen->second.size())
+      chosen = i;
+  }
+  if (chosen == mapped.end())
+    return 0;
+  dout(20) << "split_step " << coll() << " " << path << " moving "
+	   << chosen->second.size() << " objects to " << chosen->first << dendl;
+
+  // same steps, and the same in-progress tag, as a full split, so that
+  // cleanup finishes the split if we crash part way
+  r = initiate_split(path, info);
+  if (r < 0)
+    return r;
+  vector<string> dst = path;
+  dst.push_back(chosen->first);
+  if (!subdirs.count(chosen->first)) {
+    r = create_path(dst);
+    if (r < 0)
+      return r;
+    info.subdirs++;
+  }
+  for (map<string, hobject_t>::iterator j = chosen->second.begin();
+       j != chosen->second.end();
+       ++j) {
+    r = link_object(path, dst, j->second, j->first);
+    if (r < 0 && r != -EEXIST)
+      return r;
+  }
+  r = fsync_dir(dst);
+  if (r < 0)
+    return r;
+  subdir_info_s info_new;
+  info_new.objs = chosen->second.size();
+  info_new.hash_level = level + 1;
+  r = set_info(dst, info_new);
+  if (r < 0)
+    return r;
+  r = fsync_dir(dst);
+  if (r < 0)
+    return r;
+
+  r = remove_objects(path, chosen->second, &objects);
+  if (r < 0)
+    return r;
+  info.objs = objects.size();
+  r = set_info(path, info);
+  if (r < 0)
+    return r;
+  r = fsync_dir(path);
+  if (r < 0)
+    return r;
+  r = end_split_or_merge(path);
+  if (r < 0)
+    return r;
+
+  *moved = chosen->second.size();
+  *more = candidates > 1;
+  return 0;
+}
+
 void HashIndex::get_path_components(const hobject_t &hoid,
 				    vector<string> *path) {
   char buf[MAX_HASH_LEVEL + 1];
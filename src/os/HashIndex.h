@@ -45,6 +45,11 @@
  * Subdirectories are created when the number of objects in a directory
  * exceed 32*merge_threshhold.  The number of objects in a directory 
  * is encoded as subdir_info_s in an xattr on the directory.
+ *
+ * Given a SplitQueue, a directory which must split is queued instead
+ * and split a subdirectory at a time by split_step.  pre_split lays out
+ * an empty collection for an expected number of objects so it need not
+ * split at all.
  */
 class HashIndex : public LFNIndex {
 private:
@@ -56,6 +61,8 @@ private:
   static const int PATH_HASH_LEN = 32;
   /// Max length of hashed path
   static const int MAX_HASH_LEVEL = (PATH_HASH_LEN/4);
+  /// Deepest pre_split goes, whatever a pool expects (16^4 leaves at most)
+  static const int MAX_PRE_SPLIT_LEVEL = 4;
 
   /**
    * Merges occur when the number of object drops below
@@ -65,31 +72,44 @@ private:
   int merge_threshold;
   int split_multiplier;
 
+  /// Receives deferred splits, NULL to split inline @see split_step
+  SplitQueue *split_queue;
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
     uint32_t subdirs;    ///< Subdirs in subdir.
     uint32_t hash_level; ///< Hashlevel of subdir.
+    uint32_t pre_split_level; ///< Depth pre_split laid out, 0 if none.
 
-    subdir_info_s() : objs(0), subdirs(0), hash_level(0) {}
+    subdir_info_s()
+      : objs(0), subdirs(0), hash_level(0), pre_split_level(0) {}
     
     void encode(bufferlist &bl) const
     {
-      __u8 v = 1;
+      // only pre-split directories need v2; the rest stay readable
+      // by older code
+      __u8 v = pre_split_level ? 2 : 1;
       ::encode(v, bl);
       ::encode(objs, bl);
       ::encode(subdirs, bl);
       ::encode(hash_level, bl);
+      if (v >= 2)
+	::encode(pre_split_level, bl);
     }
     
     void decode(bufferlist::iterator &bl)
     {
       __u8 v;
       ::decode(v, bl);
-      assert(v == 1);
+      assert(v <= 2);
       ::decode(objs, bl);
       ::decode(subdirs, bl);
       ::decode(hash_level, bl);
+      if (v >= 2)
+	::decode(pre_split_level, bl);
+      else
+	pre_split_level = 0;
     }
   };
 
@@ -134,15 +154,32 @@ public:
     const char *base_path, ///< [in] Path to the index root.
     int merge_at,          ///< [in] Merge threshhold.
     int split_multiple,	   ///< [in] Split threshhold.
-    uint32_t index_version)///< [in] Index version
+    uint32_t index_version,///< [in] Index version
+    SplitQueue *split_queue = NULL) ///< [in] Defer splits to split_queue
     : LFNIndex(collection, base_path, index_version), merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple), split_queue(split_queue) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
 
   /// @see CollectionIndex
   int cleanup();
+
+  /// @see CollectionIndex
+  int pre_split(
+    uint32_t pg_num,
+    uint64_t expected_num_objs
+    );
+
+  /// @see CollectionIndex
+  int split_step(
+    const vector<string> &path,
+    uint64_t *moved,
+    bool *more
+    );
+
+  /// @see CollectionIndex
+  int prep_delete();
 	
 protected:
   int _init();
@@ -233,6 +270,20 @@ private:
     subdir_info_s info	       ///< [in] Info attached to path
     ); /// @return Error Code, 0 on success
 
+  /// Removes subdirectories below path which contain no objects
+  int remove_empty_subdirs(
+    const vector<string> &path, ///< [in] Subdir to clean
+    bool *empty                 ///< [out] True if path is now empty
+    ); /// @return Error Code, 0 on success
+
+  /// Creates the subdirectories below path for pre_split
+  int pre_split_path(
+    const vector<string> &path, ///< [in] Subdir to populate
+    int levels,                 ///< [in] Levels to create below path
+    uint32_t ps,                ///< [in] Hash bits common to the collection
+    int fixed_bits              ///< [in] Number of bits in ps
+    ); /// @return Error Code, 0 on success
+
   /// Determine path components from hoid hash
   void get_path_components(
     const hobject_t &hoid, ///< [in] Object for which to get path components
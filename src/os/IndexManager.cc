@@ -101,7 +101,8 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
       *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version), 
+				   g_conf->filestore_split_multiple, version,
+				   split_queue),
 		     RemoveOnDelete(c, this));
       return 0;
     }
@@ -112,7 +113,8 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     // No need to check
     *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
 				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HOBJECT_WITH_POOL), 
+				 CollectionIndex::HOBJECT_WITH_POOL,
+				 split_queue),
 		   RemoveOnDelete(c, this));
     return 0;
   }
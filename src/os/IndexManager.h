@@ -48,6 +48,8 @@ class IndexManager {
   Mutex lock; ///< Lock for Index Manager
   Cond cond;  ///< Cond for waiters on col_indices
   bool upgrade;
+  /// Receives deferred HashIndex splits, NULL to split inline
+  CollectionIndex::SplitQueue *split_queue;
 
   /// Currently in use CollectionIndices
   map<coll_t,std::tr1::weak_ptr<CollectionIndex> > col_indices;
@@ -86,7 +88,13 @@ class IndexManager {
 public:
   /// Constructor
   IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+			       upgrade(upgrade), split_queue(NULL) {}
+
+  /// Defer directory splits of indices built from now on to q
+  void set_split_queue(CollectionIndex::SplitQueue *q) {
+    Mutex::Locker l(lock);
+    split_queue = q;
+  }
 
   /**
    * Reserve and return index for c
@@ -5,25 +5,168 @@
 #include <set>
 #include <map>
 #include <string>
+#include <sstream>
 #include <tr1/memory>
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "leveldb/slice.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
 #include <errno.h>
+#include "common/admin_socket.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "common/perf_counters.h"
 using std::string;
 
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "leveldb: " << path << " "
+
+class LevelDBStoreHook : public AdminSocketHook {
+  LevelDBStore *store;
+public:
+  LevelDBStoreHook(LevelDBStore *s) : store(s) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    store->dump_stats(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+LevelDBStore::LevelDBStore(CephContext *c, const string &path)
+  : cct(c), logger(NULL), asok_hook(NULL), path(path)
+{
+  options.write_buffer_size = cct->_conf->leveldb_write_buffer_size;
+  options.max_open_files = cct->_conf->leveldb_max_open_files;
+  options.cache_size = cct->_conf->leveldb_cache_size;
+  options.block_size = cct->_conf->leveldb_block_size;
+  options.bloom_size = cct->_conf->leveldb_bloom_size;
+  options.compression_enabled = cct->_conf->leveldb_compression;
+  options.paranoid = cct->_conf->leveldb_paranoid;
+  options.compact_on_mount = cct->_conf->leveldb_compact_on_mount;
+}
+
+LevelDBStore::~LevelDBStore()
+{
+  if (asok_hook) {
+    cct->get_admin_socket()->unregister_command("leveldb_stats");
+    delete asok_hook;
+  }
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
+}
+
 int LevelDBStore::init(ostream &out)
 {
-  leveldb::Options options;
-  options.create_if_missing = true;
+  leveldb::Options ldoptions;
+  if (options.write_buffer_size)
+    ldoptions.write_buffer_size = options.write_buffer_size;
+  if (options.max_open_files)
+    ldoptions.max_open_files = options.max_open_files;
+  if (options.cache_size) {
+    db_cache.reset(leveldb::NewLRUCache(options.cache_size));
+    ldoptions.block_cache = db_cache.get();
+  }
+  if (options.block_size)
+    ldoptions.block_size = options.block_size;
+  if (options.bloom_size) {
+    filterpolicy.reset(leveldb::NewBloomFilterPolicy(options.bloom_size));
+    ldoptions.filter_policy = filterpolicy.get();
+  }
+  if (!options.compression_enabled)
+    ldoptions.compression = leveldb::kNoCompression;
+  ldoptions.paranoid_checks = options.paranoid;
+  ldoptions.create_if_missing = true;
+
   leveldb::DB *_db;
-  leveldb::Status status = leveldb::DB::Open(options, path, &_db);
+  leveldb::Status status = leveldb::DB::Open(ldoptions, path, &_db);
   db.reset(_db);
   if (!status.ok()) {
     out << status.ToString() << std::endl;
     return -EINVAL;
-  } else
-    return 0;
+  }
+
+  PerfCountersBuilder plb(cct, "leveldb", l_leveldb_first, l_leveldb_last);
+  plb.add_u64_counter(l_leveldb_gets, "leveldb_get");
+  plb.add_u64_counter(l_leveldb_txns, "leveldb_transaction");
+  plb.add_fl_avg(l_leveldb_get_latency, "leveldb_get_latency");
+  // leveldb blocks writers while compaction catches up, so stalls show
+  // up here
+  plb.add_fl_avg(l_leveldb_submit_latency, "leveldb_submit_latency");
+  plb.add_fl_avg(l_leveldb_submit_sync_latency, "leveldb_submit_sync_latency");
+  plb.add_u64_counter(l_leveldb_compact, "leveldb_compact");
+  plb.add_fl_avg(l_leveldb_compact_latency, "leveldb_compact_latency");
+  logger = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+
+  // only the first store in a process gets the command
+  asok_hook = new LevelDBStoreHook(this);
+  int r = cct->get_admin_socket()->register_command(
+    "leveldb_stats", asok_hook, "dump leveldb level sizes and compaction stats");
+  if (r < 0) {
+    delete asok_hook;
+    asok_hook = NULL;
+  }
+
+  if (options.compact_on_mount) {
+    ldout(cct, 1) << "compacting on mount" << dendl;
+    compact();
+  }
+  return 0;
+}
+
+void LevelDBStore::compact()
+{
+  utime_t start = ceph_clock_now(cct);
+  db->CompactRange(NULL, NULL);
+  utime_t lat = ceph_clock_now(cct) - start;
+  logger->inc(l_leveldb_compact);
+  logger->finc(l_leveldb_compact_latency, lat);
+  ldout(cct, 10) << "compacted in " << lat << dendl;
+}
+
+void LevelDBStore::dump_stats(ostream &out)
+{
+  string stats;
+  if (db->GetProperty("leveldb.stats", &stats))
+    out << stats;
+  for (int level = 0; ; ++level) {
+    ostringstream prop;
+    prop << "leveldb.num-files-at-level" << level;
+    string files;
+    if (!db->GetProperty(prop.str(), &files))
+      break;
+    out << "level " << level << " files: " << files << "\n";
+  }
+}
+
+int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
+{
+  utime_t start = ceph_clock_now(cct);
+  LevelDBTransactionImpl * _t =
+    static_cast<LevelDBTransactionImpl *>(t.get());
+  leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
+  logger->inc(l_leveldb_txns);
+  logger->finc(l_leveldb_submit_latency, ceph_clock_now(cct) - start);
+  return s.ok() ? 0 : -1;
+}
+
+int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
+{
+  utime_t start = ceph_clock_now(cct);
+  LevelDBTransactionImpl * _t =
+    static_cast<LevelDBTransactionImpl *>(t.get());
+  leveldb::WriteOptions options;
+  options.sync = true;
+  leveldb::Status s = db->Write(options, &(_t->bat));
+  logger->inc(l_leveldb_txns);
+  logger->finc(l_leveldb_submit_sync_latency, ceph_clock_now(cct) - start);
+  return s.ok() ? 0 : -1;
 }
 
 void LevelDBStore::LevelDBTransactionImpl::set(
@@ -66,6 +209,7 @@ int LevelDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  utime_t start = ceph_clock_now(cct);
   KeyValueDB::Iterator it = get_iterator(prefix);
   for (std::set<string>::const_iterator i = keys.begin();
        i != keys.end();
@@ -76,6 +220,8 @@ int LevelDBStore::get(
     } else if (!it->valid())
       break;
   }
+  logger->inc(l_leveldb_gets);
+  logger->finc(l_leveldb_get_latency, ceph_clock_now(cct) - start);
   return 0;
 }
 
@@ -14,19 +14,61 @@
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "leveldb/slice.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
+
+class AdminSocketHook;
+class CephContext;
+class PerfCounters;
+
+enum {
+  l_leveldb_first = 34300,
+  l_leveldb_gets,
+  l_leveldb_txns,
+  l_leveldb_get_latency,
+  l_leveldb_submit_latency,
+  l_leveldb_submit_sync_latency,
+  l_leveldb_compact,
+  l_leveldb_compact_latency,
+  l_leveldb_last,
+};
 
 /**
  * Uses LevelDB to implement the KeyValueDB interface
  */
 class LevelDBStore : public KeyValueDB {
+  CephContext *cct;
+  PerfCounters *logger;
+  AdminSocketHook *asok_hook;
   string path;
-  boost::scoped_ptr<leveldb::DB> db;
+  boost::scoped_ptr<leveldb::Cache> db_cache;
+  boost::scoped_ptr<const leveldb::FilterPolicy> filterpolicy;
+  boost::scoped_ptr<leveldb::DB> db; // declared last so it is closed first
 public:
-  LevelDBStore(const string &path) : path(path) {}
+  LevelDBStore(CephContext *c, const string &path);
+  ~LevelDBStore();
+
+  /// tunables, filled in from the leveldb_* config; adjust before init()
+  struct options_t {
+    uint64_t write_buffer_size; ///< memtable size; 0 for leveldb's default
+    int max_open_files;         ///< 0 for leveldb's default
+    uint64_t cache_size;        ///< block cache bytes; 0 for leveldb's default
+    uint64_t block_size;        ///< 0 for leveldb's default
+    int bloom_size;             ///< bloom filter bits per key; 0 for none
+    bool compression_enabled;
+    bool paranoid;
+    bool compact_on_mount;
+  } options;
 
   /// Opens underlying db
   int init(ostream &out);
 
+  /// compact the whole key space
+  void compact();
+
+  /// describe leveldb's own view of the db: level sizes, compactions
+  void dump_stats(ostream &out);
+
   class LevelDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     leveldb::WriteBatch bat;
@@ -52,21 +94,8 @@ public:
       new LevelDBTransactionImpl(this));
   }
 
-  int submit_transaction(KeyValueDB::Transaction t) {
-    LevelDBTransactionImpl * _t =
-      static_cast<LevelDBTransactionImpl *>(t.get());
-    leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
-    return s.ok() ? 0 : -1;
-  }
-
-  int submit_transaction_sync(KeyValueDB::Transaction t) {
-    LevelDBTransactionImpl * _t =
-      static_cast<LevelDBTransactionImpl *>(t.get());
-    leveldb::WriteOptions options;
-    options.sync = true;
-    leveldb::Status s = db->Write(options, &(_t->bat));
-    return s.ok() ? 0 : -1;
-  }
+  int submit_transaction(KeyValueDB::Transaction t);
+  int submit_transaction_sync(KeyValueDB::Transaction t);
 
   int get(
     const string &prefix,
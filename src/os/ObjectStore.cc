@@ -14,12 +14,276 @@
 #include <sstream>
 #include "ObjectStore.h"
 #include "common/Formatter.h"
+#include "common/config.h"
+#include "global/global_context.h"
 
 ostream& operator<<(ostream& out, const ObjectStore::Sequencer& s)
 {
   return out << "osr(" << s.get_name() << " " << &s << ")";
 }
 
+ObjectStore::Transaction::Transaction() :
+  ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
+  sobject_encoding(false), pool_override(-1), use_pool_override(false),
+  use_tables(false), table_bytes(0)
+{
+  // tools like ceph-dencoder build transactions without a config
+  if (g_conf)
+    use_tables = g_conf->objectstore_transaction_tables;
+}
+
+/*
+ * Add other's ops to ours one at a time, through the same calls that
+ * built them, so that collections and objects land in our tables (or
+ * are spelled out, if we don't use them).
+ */
+void ObjectStore::Transaction::_append_ops(Transaction& other)
+{
+  assert(pad_unused_bytes == 0);
+  assert(other.pad_unused_bytes == 0);
+  iterator i = other.begin();
+  while (i.have_op()) {
+    __u32 op = i.get_op();
+    switch (op) {
+    case OP_NOP:
+      nop();
+      break;
+    case OP_STARTSYNC:
+      start_sync();
+      break;
+    case OP_TOUCH:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	touch(cid, oid);
+      }
+      break;
+    case OP_WRITE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	uint64_t off = i.get_length();
+	uint64_t len = i.get_length();
+	bufferlist bl;
+	i.get_bl(bl);
+	write(cid, oid, off, len, bl);
+      }
+      break;
+    case OP_ZERO:
+    case OP_TRIMCACHE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	uint64_t off = i.get_length();
+	uint64_t len = i.get_length();
+	::encode(op, tbl);
+	_encode_cid(cid);
+	_encode_oid(oid);
+	::encode(off, tbl);
+	::encode(len, tbl);
+	ops++;
+      }
+      break;
+    case OP_TRUNCATE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	uint64_t off = i.get_length();
+	truncate(cid, oid, off);
+      }
+      break;
+    case OP_REMOVE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	remove(cid, oid);
+      }
+      break;
+    case OP_SETATTR:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	string name = i.get_attrname();
+	bufferlist bl;
+	i.get_bl(bl);
+	setattr(cid, oid, name, bl);
+      }
+      break;
+    case OP_SETATTRS:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	map<string, bufferptr> aset;
+	i.get_attrset(aset);
+	setattrs(cid, oid, aset);
+      }
+      break;
+    case OP_RMATTR:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	string name = i.get_attrname();
+	rmattr(cid, oid, name);
+      }
+      break;
+    case OP_RMATTRS:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	::encode(op, tbl);
+	_encode_cid(cid);
+	_encode_oid(oid);
+	ops++;
+      }
+      break;
+    case OP_CLONE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	hobject_t noid = i.get_oid();
+	clone(cid, oid, noid);
+      }
+      break;
+    case OP_CLONERANGE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	hobject_t noid = i.get_oid();
+	uint64_t off = i.get_length();
+	uint64_t len = i.get_length();
+	::encode(op, tbl);
+	_encode_cid(cid);
+	_encode_oid(oid);
+	_encode_oid(noid);
+	::encode(off, tbl);
+	::encode(len, tbl);
+	ops++;
+      }
+      break;
+    case OP_CLONERANGE2:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	hobject_t noid = i.get_oid();
+	uint64_t srcoff = i.get_length();
+	uint64_t len = i.get_length();
+	uint64_t dstoff = i.get_length();
+	clone_range(cid, oid, noid, srcoff, len, dstoff);
+      }
+      break;
+    case OP_MKCOLL:
+      create_collection(i.get_cid());
+      break;
+    case OP_RMCOLL:
+      remove_collection(i.get_cid());
+      break;
+    case OP_COLL_ADD:
+      {
+	coll_t ncid = i.get_cid();
+	coll_t ocid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	collection_add(ncid, ocid, oid);
+      }
+      break;
+    case OP_COLL_REMOVE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	collection_remove(cid, oid);
+      }
+      break;
+    case OP_COLL_MOVE:
+      {
+	coll_t ocid = i.get_cid();
+	coll_t ncid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	::encode(op, tbl);
+	_encode_cid(ocid);
+	_encode_cid(ncid);
+	_encode_oid(oid);
+	ops++;
+      }
+      break;
+    case OP_COLL_SETATTR:
+      {
+	coll_t cid = i.get_cid();
+	string name = i.get_attrname();
+	bufferlist bl;
+	i.get_bl(bl);
+	collection_setattr(cid, name, bl);
+      }
+      break;
+    case OP_COLL_RMATTR:
+      {
+	coll_t cid = i.get_cid();
+	string name = i.get_attrname();
+	collection_rmattr(cid, name);
+      }
+      break;
+    case OP_COLL_SETATTRS:
+      {
+	coll_t cid = i.get_cid();
+	map<string, bufferptr> aset;
+	i.get_attrset(aset);
+	collection_setattrs(cid, aset);
+      }
+      break;
+    case OP_COLL_RENAME:
+      {
+	coll_t cid = i.get_cid();
+	coll_t ncid = i.get_cid();
+	collection_rename(cid, ncid);
+      }
+      break;
+    case OP_OMAP_CLEAR:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	omap_clear(cid, oid);
+      }
+      break;
+    case OP_OMAP_SETKEYS:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	map<string, bufferlist> aset;
+	i.get_attrset(aset);
+	omap_setkeys(cid, oid, aset);
+      }
+      break;
+    case OP_OMAP_RMKEYS:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	set<string> keys;
+	i.get_keyset(keys);
+	omap_rmkeys(cid, oid, keys);
+      }
+      break;
+    case OP_OMAP_SETHEADER:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	bufferlist bl;
+	i.get_bl(bl);
+	omap_setheader(cid, oid, bl);
+      }
+      break;
+    case OP_COLL_HINT:
+      {
+	coll_t cid = i.get_cid();
+	uint32_t type = i.get_u32();
+	bufferlist hint;
+	i.get_bl(hint);
+	collection_hint(cid, type, hint);
+      }
+      break;
+    default:
+      assert(0 == "unknown transaction op");
+    }
+  }
+}
+
 void ObjectStore::Transaction::dump(ceph::Formatter *f)
 {
   f->open_array_section("ops");
@@ -355,6 +619,27 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
       }
       break;
 
+    case Transaction::OP_COLL_HINT:
+      {
+	coll_t cid(i.get_cid());
+	uint32_t type = i.get_u32();
+	bufferlist hint;
+	i.get_bl(hint);
+	f->dump_string("op_name", "collection_hint");
+	f->dump_stream("collection") << cid;
+	f->dump_unsigned("type", type);
+	if (type == Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS) {
+	  bufferlist::iterator hiter = hint.begin();
+	  uint32_t pg_num;
+	  uint64_t expected_num_objs;
+	  ::decode(pg_num, hiter);
+	  ::decode(expected_num_objs, hiter);
+	  f->dump_unsigned("pg_num", pg_num);
+	  f->dump_unsigned("expected_num_objects", expected_num_objs);
+	}
+      }
+      break;
+
     default:
       f->dump_string("op_name", "unknown");
       f->dump_unsigned("op_code", op);
@@ -413,5 +698,21 @@ void ObjectStore::Transaction::generate_test_instances(list<ObjectStore::Transac
   t->collection_setattrs(c, m);
   t->collection_rename(c, c2);
   o.push_back(t);  
+
+  // with collection and object tables, built directly and by append
+  t = new Transaction;
+  t->use_tables = true;
+  t->touch(c, o1);
+  t->write(c, o1, 1, bl.length(), bl);
+  t->setattr(c, o1, "key", bl);
+  t->clone_range(c, o1, o2, 1, 12, 99);
+  t->collection_move(c, c2, o3);
+  o.push_back(t);
+
+  Transaction *t2 = new Transaction;
+  t2->use_tables = true;
+  t2->setattrs(c2, o3, m);
+  t2->append(*t);
+  o.push_back(t2);
 }
 
@@ -67,6 +67,7 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_csum_err,
   l_os_last,
 };
 
@@ -152,6 +153,12 @@ public:
       OP_OMAP_SETKEYS = 32, // cid, attrset
       OP_OMAP_RMKEYS = 33,  // cid, keyset
       OP_OMAP_SETHEADER = 34, // cid, header
+      OP_COLL_HINT = 35,    // cid, type, bl
+    };
+
+    // collection hint types, @see collection_hint
+    enum {
+      COLL_HINT_EXPECTED_NUM_OBJECTS = 1, // u32 pg_num, u64 expected objects
     };
 
   private:
@@ -163,6 +170,66 @@ public:
     int64_t pool_override;
     bool use_pool_override;
 
+    /*
+     * With use_tables (encoding v7), each collection and object an op
+     * names goes in tbl as a __u32 index into colls or objects, which
+     * are encoded once, after tbl.  A write names the same collection
+     * and object several times, so this saves both bytes and decode
+     * work.
+     */
+    bool use_tables;
+    vector<coll_t> colls;
+    vector<hobject_t> objects;
+    map<coll_t, __u32> coll_index;       ///< builder's reverse of colls
+    map<hobject_t, __u32> object_index;  ///< builder's reverse of objects
+    uint64_t table_bytes;                ///< estimated encoded size of the tables
+
+    void _encode_cid(const coll_t &cid) {
+      if (!use_tables) {
+	::encode(cid, tbl);
+	return;
+      }
+      if (coll_index.size() != colls.size()) {
+	// decoded, not built; index what we have
+	for (__u32 i = 0; i < colls.size(); ++i)
+	  coll_index[colls[i]] = i;
+      }
+      map<coll_t, __u32>::iterator p = coll_index.find(cid);
+      __u32 i;
+      if (p == coll_index.end()) {
+	i = colls.size();
+	coll_index[cid] = i;
+	colls.push_back(cid);
+	table_bytes += sizeof(__u32) + cid.to_str().length();
+      } else {
+	i = p->second;
+      }
+      ::encode(i, tbl);
+    }
+    void _encode_oid(const hobject_t &oid) {
+      if (!use_tables) {
+	::encode(oid, tbl);
+	return;
+      }
+      if (object_index.size() != objects.size()) {
+	for (__u32 i = 0; i < objects.size(); ++i)
+	  object_index[objects[i]] = i;
+      }
+      map<hobject_t, __u32>::iterator p = object_index.find(oid);
+      __u32 i;
+      if (p == object_index.end()) {
+	i = objects.size();
+	object_index[oid] = i;
+	objects.push_back(oid);
+	table_bytes += 40 + oid.oid.name.length() + oid.get_key().length() +
+	  oid.nspace.length();
+      } else {
+	i = p->second;
+      }
+      ::encode(i, tbl);
+    }
+    void _append_ops(Transaction& other);
+
   public:
     void set_pool_override(int64_t pool) {
       pool_override = pool;
@@ -174,9 +241,20 @@ public:
       std::swap(largest_data_off, other.largest_data_off);
       std::swap(largest_data_off_in_tbl, other.largest_data_off_in_tbl);
       tbl.swap(other.tbl);
+      std::swap(use_tables, other.use_tables);
+      colls.swap(other.colls);
+      objects.swap(other.objects);
+      coll_index.swap(other.coll_index);
+      object_index.swap(other.object_index);
+      std::swap(table_bytes, other.table_bytes);
     }
 
     void append(Transaction& other) {
+      if (use_tables || other.use_tables) {
+	// other's indices mean nothing in our tables
+	_append_ops(other);
+	return;
+      }
       ops += other.ops;
       assert(pad_unused_bytes == 0);
       assert(other.pad_unused_bytes == 0);
@@ -189,7 +267,7 @@ public:
     }
 
     uint64_t get_encoded_bytes() {
-      return 1 + 8 + 8 + 4 + 4 + 4 + 4 + tbl.length();
+      return 1 + 8 + 8 + 4 + 4 + 4 + 4 + tbl.length() + table_bytes;
     }
 
     uint64_t get_num_bytes() {
@@ -234,12 +312,24 @@ public:
       bool sobject_encoding;
       int64_t pool_override;
       bool use_pool_override;
+      const vector<coll_t> *colls;       ///< NULL unless use_tables
+      const vector<hobject_t> *objects;
 
       iterator(Transaction *t)
 	: p(t->tbl.begin()),
 	  sobject_encoding(t->sobject_encoding),
 	  pool_override(t->pool_override),
-	  use_pool_override(t->use_pool_override) {}
+	  use_pool_override(t->use_pool_override),
+	  colls(t->use_tables ? &t->colls : NULL),
+	  objects(t->use_tables ? &t->objects : NULL) {}
+
+      __u32 get_index(size_t size) {
+	__u32 i;
+	::decode(i, p);
+	if (i >= size)
+	  throw buffer::malformed_input("transaction table index out of range");
+	return i;
+      }
 
       friend class Transaction;
 
@@ -256,6 +346,8 @@ public:
 	::decode(bl, p);
       }
       hobject_t get_oid() {
+	if (objects)
+	  return (*objects)[get_index(objects->size())];
 	hobject_t hoid;
 	if (sobject_encoding) {
 	  sobject_t soid;
@@ -272,6 +364,8 @@ public:
 	return hoid;
       }
       coll_t get_cid() {
+	if (colls)
+	  return (*colls)[get_index(colls->size())];
 	coll_t c;
 	::decode(c, p);
 	return c;
@@ -281,6 +375,11 @@ public:
 	::decode(len, p);
 	return len;
       }
+      uint32_t get_u32() {
+	uint32_t v;
+	::decode(v, p);
+	return v;
+      }
       string get_attrname() {
 	string s;
 	::decode(s, p);
@@ -315,15 +414,15 @@ public:
     void touch(coll_t cid, const hobject_t& oid) {
       __u32 op = OP_TOUCH;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ops++;
     }
     void write(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len, const bufferlist& data) {
       __u32 op = OP_WRITE;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ::encode(off, tbl);
       ::encode(len, tbl);
       assert(len == data.length());
@@ -338,8 +437,8 @@ public:
     void zero(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len) {
       __u32 op = OP_ZERO;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ::encode(off, tbl);
       ::encode(len, tbl);
       ops++;
@@ -347,16 +446,16 @@ public:
     void truncate(coll_t cid, const hobject_t& oid, uint64_t off) {
       __u32 op = OP_TRUNCATE;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ::encode(off, tbl);
       ops++;
     }
     void remove(coll_t cid, const hobject_t& oid) {
       __u32 op = OP_REMOVE;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ops++;
     }
     void setattr(coll_t cid, const hobject_t& oid, const char* name, bufferlist& val) {
@@ -366,8 +465,8 @@ public:
     void setattr(coll_t cid, const hobject_t& oid, const string& s, bufferlist& val) {
       __u32 op = OP_SETATTR;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ::encode(s, tbl);
       ::encode(val, tbl);
       ops++;
@@ -375,8 +474,8 @@ public:
     void setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& attrset) {
       __u32 op = OP_SETATTRS;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ::encode(attrset, tbl);
       ops++;
     }
@@ -387,33 +486,33 @@ public:
     void rmattr(coll_t cid, const hobject_t& oid, const string& s) {
       __u32 op = OP_RMATTR;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ::encode(s, tbl);
       ops++;
     }
     void rmattrs(coll_t cid, const hobject_t& oid) {
-      __u32 op = OP_RMATTR;
+      __u32 op = OP_RMATTRS;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ops++;
     }
     void clone(coll_t cid, const hobject_t& oid, hobject_t noid) {
       __u32 op = OP_CLONE;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(noid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
+      _encode_oid(noid);
       ops++;
     }
     void clone_range(coll_t cid, const hobject_t& oid, hobject_t noid,
 		     uint64_t srcoff, uint64_t srclen, uint64_t dstoff) {
       __u32 op = OP_CLONERANGE2;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
-      ::encode(noid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
+      _encode_oid(noid);
       ::encode(srcoff, tbl);
       ::encode(srclen, tbl);
       ::encode(dstoff, tbl);
@@ -422,28 +521,28 @@ public:
     void create_collection(coll_t cid) {
       __u32 op = OP_MKCOLL;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
+      _encode_cid(cid);
       ops++;
     }
     void remove_collection(coll_t cid) {
       __u32 op = OP_RMCOLL;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
+      _encode_cid(cid);
       ops++;
     }
     void collection_add(coll_t cid, coll_t ocid, const hobject_t& oid) {
       __u32 op = OP_COLL_ADD;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(ocid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_cid(ocid);
+      _encode_oid(oid);
       ops++;
     }
     void collection_remove(coll_t cid, const hobject_t& oid) {
       __u32 op = OP_COLL_REMOVE;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(oid, tbl);
+      _encode_cid(cid);
+      _encode_oid(oid);
       ops++;
     }
     void collection_move(coll_t cid, coll_t oldcid, const hobject_t& oid) {
@@ -459,7 +558,7 @@ public:
     void collection_setattr(coll_t cid, const string& name, bufferlist& val) {
       __u32 op = OP_COLL_SETATTR;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
+      _encode_cid(cid);
       ::encode(name, tbl);
       ::encode(val, tbl);
       ops++;
@@ -472,22 +571,41 @@ public:
     void collection_rmattr(coll_t cid, const string& name) {
       __u32 op = OP_COLL_RMATTR;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
+      _encode_cid(cid);
       ::encode(name, tbl);
       ops++;
     }
     void collection_setattrs(coll_t cid, map<string,bufferptr>& aset) {
       __u32 op = OP_COLL_SETATTRS;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
+      _encode_cid(cid);
       ::encode(aset, tbl);
       ops++;
     }
     void collection_rename(coll_t cid, coll_t ncid) {
       __u32 op = OP_COLL_RENAME;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(ncid, tbl);
+      _encode_cid(cid);
+      _encode_cid(ncid);
+      ops++;
+    }
+
+    /**
+     * Pass a hint about the future use of a collection
+     *
+     * Backends may use it to prepare the collection, and ignore hint
+     * types they don't understand.
+     */
+    void collection_hint(
+      coll_t cid,             ///< [in] Collection the hint applies to
+      uint32_t type,          ///< [in] COLL_HINT_*
+      const bufferlist &hint  ///< [in] Encoded hint
+      ) {
+      __u32 op = OP_COLL_HINT;
+      ::encode(op, tbl);
+      _encode_cid(cid);
+      ::encode(type, tbl);
+      ::encode(hint, tbl);
       ops++;
     }
 
@@ -498,8 +616,8 @@ public:
       ) {
       __u32 op = OP_OMAP_CLEAR;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
+      _encode_cid(cid);
+      _encode_oid(hoid);
       ops++;
     }
     /// Set keys on hoid omap.  Replaces duplicate keys.
@@ -510,8 +628,8 @@ public:
       ) {
       __u32 op = OP_OMAP_SETKEYS;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
+      _encode_cid(cid);
+      _encode_oid(hoid);
       ::encode(attrset, tbl);
       ops++;
     }
@@ -523,8 +641,8 @@ public:
       ) {
       __u32 op = OP_OMAP_RMKEYS;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
+      _encode_cid(cid);
+      _encode_oid(hoid);
       ::encode(keys, tbl);
       ops++;
     }
@@ -537,29 +655,43 @@ public:
       ) {
       __u32 op = OP_OMAP_SETHEADER;
       ::encode(op, tbl);
-      ::encode(cid, tbl);
-      ::encode(hoid, tbl);
+      _encode_cid(cid);
+      _encode_oid(hoid);
       ::encode(bl, tbl);
       ops++;
     }
 
     // etc.
-    Transaction() :
-      ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
-      sobject_encoding(false), pool_override(-1), use_pool_override(false) {}
+    Transaction();  ///< encodes with tables if objectstore_transaction_tables
     Transaction(bufferlist::iterator &dp) :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
-      sobject_encoding(false), pool_override(-1), use_pool_override(false) {
+      sobject_encoding(false), pool_override(-1), use_pool_override(false),
+      use_tables(false), table_bytes(0) {
       decode(dp);
     }
     Transaction(bufferlist &nbl) :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
-      sobject_encoding(false), pool_override(-1), use_pool_override(false) {
+      sobject_encoding(false), pool_override(-1), use_pool_override(false),
+      use_tables(false), table_bytes(0) {
       bufferlist::iterator dp = nbl.begin();
       decode(dp); 
     }
 
     void encode(bufferlist& bl) const {
+      // older peers can't read v7, so only use it when asked to
+      if (use_tables) {
+	ENCODE_START(7, 7, bl);
+	::encode(ops, bl);
+	::encode(pad_unused_bytes, bl);
+	::encode(largest_data_len, bl);
+	::encode(largest_data_off, bl);
+	::encode(largest_data_off_in_tbl, bl);
+	::encode(tbl, bl);
+	::encode(colls, bl);  // after tbl, so get_data_offset() holds
+	::encode(objects, bl);
+	ENCODE_FINISH(bl);
+	return;
+      }
       ENCODE_START(6, 5, bl);
       ::encode(ops, bl);
       ::encode(pad_unused_bytes, bl);
@@ -570,7 +702,7 @@ public:
       ENCODE_FINISH(bl);
     }
     void decode(bufferlist::iterator &bl) {
-      DECODE_START_LEGACY_COMPAT_LEN(6, 5, 5, bl);
+      DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
       DECODE_OLDEST(2);
       if (struct_v < 4)
 	sobject_encoding = true;
@@ -584,6 +716,18 @@ public:
 	::decode(largest_data_off_in_tbl, bl);
       }
       ::decode(tbl, bl);
+      colls.clear();
+      objects.clear();
+      coll_index.clear();
+      object_index.clear();
+      table_bytes = 0;
+      use_tables = struct_v >= 7;
+      if (use_tables) {
+	unsigned start = bl.get_off();
+	::decode(colls, bl);
+	::decode(objects, bl);
+	table_bytes = bl.get_off() - start;
+      }
       DECODE_FINISH(bl);
       if (struct_v < 6) {
 	use_pool_override = true;
@@ -660,7 +804,12 @@ public:
   // objects
   virtual bool exists(coll_t cid, const hobject_t& oid) = 0;                   // useful?
   virtual int stat(coll_t cid, const hobject_t& oid, struct stat *st) = 0;     // struct stat?
-  virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
+  /// read() hints
+  enum {
+    READ_SEQUENTIAL = 1,  ///< the caller goes on to read what follows
+  };
+  virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl,
+		   uint32_t flags = 0) = 0;
   virtual int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
 
   virtual int getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr& value) = 0;
@@ -0,0 +1,223 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "StripedJournal.h"
+#include "common/debug.h"
+#include "common/errno.h"
+
+#define dout_subsys ceph_subsys_journal
+#undef dout_prefix
+#define dout_prefix *_dout << "striped journal "
+
+class C_StripeDurable : public Context {
+  StripedJournal *journal;
+  uint64_t seq;
+public:
+  C_StripeDurable(StripedJournal *j, uint64_t s) : journal(j), seq(s) {}
+  void finish(int r) {
+    journal->entry_durable(seq);
+  }
+};
+
+StripedJournal::StripedJournal(uuid_d fsid, Finisher *fin, Cond *sync_cond,
+			       const vector<string>& paths, bool dio, bool ai)
+  : Journal(fsid, fin, sync_cond),
+    lock("StripedJournal::lock"),
+    ahead(paths.size()),
+    next_seq(0)
+{
+  assert(!paths.empty());
+  for (vector<string>::const_iterator p = paths.begin(); p != paths.end(); ++p) {
+    FileJournal *j = new FileJournal(fsid, fin, sync_cond, p->c_str(), dio, ai);
+    j->set_seq_gaps(true);
+    stripes.push_back(j);
+  }
+}
+
+StripedJournal::~StripedJournal()
+{
+  for (vector<FileJournal*>::iterator p = stripes.begin(); p != stripes.end(); ++p)
+    delete *p;
+}
+
+int StripedJournal::check()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    int r = stripes[i]->check();
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int StripedJournal::create()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    int r = stripes[i]->create();
+    if (r < 0) {
+      derr << "create of stripe " << i << " failed: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  return 0;
+}
+
+int StripedJournal::open(uint64_t fs_op_seq)
+{
+  dout(2) << "open " << stripes.size() << " stripes, fs_op_seq " << fs_op_seq << dendl;
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    int r = stripes[i]->open(fs_op_seq);
+    if (r < 0) {
+      derr << "open of stripe " << i << " failed: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    ahead[i] = lookahead_t();
+  }
+  next_seq = fs_op_seq + 1;
+  return 0;
+}
+
+void StripedJournal::close()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->close();
+}
+
+int StripedJournal::dump(ostream& out)
+{
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    out << "stripe " << i << "\n";
+    int r = stripes[i]->dump(out);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+void StripedJournal::flush()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->flush();
+}
+
+void StripedJournal::throttle()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->throttle();
+}
+
+bool StripedJournal::is_writeable()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    if (!stripes[i]->is_writeable())
+      return false;
+  return true;
+}
+
+void StripedJournal::make_writeable()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    // an entry we read ahead but didn't replay is past the end; the
+    // stripe clears it and everything after it
+    if (ahead[i].valid)
+      stripes[i]->unread_entry();
+    ahead[i] = lookahead_t();
+    stripes[i]->logger = logger;
+    stripes[i]->make_writeable();
+  }
+  next_seq = 0;
+}
+
+void StripedJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment,
+				  Context *oncommit, TrackedOpRef osd_op)
+{
+  {
+    Mutex::Locker l(lock);
+    assert(pending.empty() || pending.rbegin()->first < seq);
+    pending[seq] = make_pair(false, oncommit);
+  }
+  dout(20) << "submit_entry seq " << seq << " to stripe " << (seq % stripes.size()) << dendl;
+  get_stripe(seq)->submit_entry(seq, e, alignment,
+				new C_StripeDurable(this, seq), osd_op);
+}
+
+/*
+ * Called from the finisher as each stripe makes an entry durable (or
+ * a commit makes it unnecessary).  Complete everything up to the first
+ * entry that is still in flight, in order.
+ */
+void StripedJournal::entry_durable(uint64_t seq)
+{
+  list<Context*> ls;
+  {
+    Mutex::Locker l(lock);
+    map<uint64_t, pair<bool, Context*> >::iterator p = pending.find(seq);
+    assert(p != pending.end());
+    p->second.first = true;
+    while (!pending.empty() && pending.begin()->second.first) {
+      if (pending.begin()->second.second)
+	ls.push_back(pending.begin()->second.second);
+      pending.erase(pending.begin());
+    }
+    dout(20) << "entry_durable " << seq << ", completing " << ls.size()
+	     << ", " << pending.size() << " still pending" << dendl;
+  }
+  finish_contexts(g_ceph_context, ls, 0);
+}
+
+void StripedJournal::commit_start()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->commit_start();
+}
+
+void StripedJournal::committed_thru(uint64_t seq)
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->committed_thru(seq);
+}
+
+bool StripedJournal::read_entry(bufferlist& bl, uint64_t &seq)
+{
+  int best = -1;
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    lookahead_t &a = ahead[i];
+    if (!a.valid && !a.eof) {
+      uint64_t s = a.seq ? a.seq + 1 : 0;
+      a.bl.clear();
+      if (stripes[i]->read_entry(a.bl, s)) {
+	a.seq = s;
+	a.valid = true;
+      } else {
+	a.eof = true;
+      }
+    }
+    if (a.valid && (best < 0 || a.seq < ahead[best].seq))
+      best = i;
+  }
+
+  if (best < 0) {
+    dout(2) << "read_entry end of all stripes" << dendl;
+    return false;
+  }
+  lookahead_t &a = ahead[best];
+  if (next_seq && a.seq != next_seq) {
+    dout(2) << "read_entry next entry is seq " << a.seq << " on stripe " << best
+	    << ", expected " << next_seq << ", stopping" << dendl;
+    return false;
+  }
+
+  bl.claim(a.bl);
+  seq = a.seq;
+  a.valid = false;
+  next_seq = seq + 1;
+  return true;
+}
+
+bool StripedJournal::should_commit_now()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    if (stripes[i]->should_commit_now())
+      return true;
+  return false;
+}
@@ -0,0 +1,81 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_STRIPEDJOURNAL_H
+#define CEPH_STRIPEDJOURNAL_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Journal.h"
+#include "FileJournal.h"
+#include "common/Mutex.h"
+
+/**
+ * Journal striped over several FileJournals, each with its own device,
+ * writer thread and aio queue.
+ *
+ * Entry seq goes to stripe seq % n.  Commit callbacks are delivered in
+ * seq order, whichever stripe finishes first.  Replay merges the
+ * stripes by seq and stops at the first missing seq: anything after it
+ * was never acknowledged, and each stripe clears it when the journal is
+ * made writeable.
+ */
+class StripedJournal : public Journal {
+  std::vector<FileJournal*> stripes;
+
+  Mutex lock;
+  /// submitted entries not yet acknowledged: seq -> (durable, oncommit)
+  std::map<uint64_t, std::pair<bool, Context*> > pending;
+
+  /// replay state: next entry of each stripe, read ahead for the merge
+  struct lookahead_t {
+    bool valid, eof;
+    uint64_t seq;
+    bufferlist bl;
+    lookahead_t() : valid(false), eof(false), seq(0) {}
+  };
+  std::vector<lookahead_t> ahead;
+  uint64_t next_seq;  ///< seq replay expects next, or 0 for any
+
+  FileJournal *get_stripe(uint64_t seq) {
+    return stripes[seq % stripes.size()];
+  }
+  void entry_durable(uint64_t seq);
+  friend class C_StripeDurable;
+
+public:
+  StripedJournal(uuid_d fsid, Finisher *fin, Cond *sync_cond,
+		 const std::vector<std::string>& paths,
+		 bool dio=false, bool ai=true);
+  ~StripedJournal();
+
+  unsigned get_num_stripes() const {
+    return stripes.size();
+  }
+
+  int check();
+  int create();
+  int open(uint64_t fs_op_seq);
+  void close();
+
+  int dump(ostream& out);
+
+  void flush();
+  void throttle();
+
+  bool is_writeable();
+  void make_writeable();
+
+  void submit_entry(uint64_t seq, bufferlist& e, int alignment,
+		    Context *oncommit,
+		    TrackedOpRef osd_op = TrackedOpRef());
+  void commit_start();
+  void committed_thru(uint64_t seq);
+  bool read_entry(bufferlist& bl, uint64_t &seq);
+
+  bool should_commit_now();
+};
+
+#endif
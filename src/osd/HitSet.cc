@@ -0,0 +1,140 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "HitSet.h"
+
+#include <algorithm>
+
+#include "include/assert.h"
+#include "include/bloom_filter.hpp"
+
+/*
+ * The filter is encoded as the parameters it was built from plus its bit
+ * table.  Building it again from the same parameters gives the same
+ * salts and table size, and the table is then copied in.
+ */
+class HitSet::filter_t : public bloom_filter {
+public:
+  filter_t(size_t count, double fpp, size_t seed)
+    : bloom_filter(count, fpp, seed) {}
+
+  size_t target_size() const { return predicted_inserted_element_count_; }
+  double fpp() const { return desired_false_positive_probability_; }
+  size_t seed() const { return random_seed_; }
+  size_t table_bytes() const { return raw_table_size_; }
+  cell_type *get_table() { return bit_table_; }
+  void set_element_count(size_t n) { inserted_element_count_ = n; }
+};
+
+HitSet::HitSet()
+  : filter(NULL)
+{
+}
+
+HitSet::HitSet(unsigned target_size, double fpp, uint32_t seed, utime_t b)
+  : filter(new filter_t(std::max(target_size, 1u), fpp, seed)),
+    begin(b)
+{
+}
+
+HitSet::~HitSet()
+{
+  delete filter;
+}
+
+void HitSet::insert(const std::string &name)
+{
+  assert(filter);
+  filter->insert(name);
+}
+
+bool HitSet::contains(const std::string &name) const
+{
+  return filter && filter->contains(name);
+}
+
+unsigned HitSet::insert_count() const
+{
+  return filter ? filter->element_count() : 0;
+}
+
+double HitSet::effective_fpp() const
+{
+  return filter ? filter->effective_fpp() : 0;
+}
+
+unsigned HitSet::size() const
+{
+  return filter ? filter->table_bytes() : 0;
+}
+
+void HitSet::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(begin, bl);
+  ::encode(end, bl);
+  bool have = filter != NULL;
+  ::encode(have, bl);
+  if (have) {
+    ::encode((uint64_t)filter->target_size(), bl);
+    ::encode(filter->fpp(), bl);
+    ::encode((uint32_t)filter->seed(), bl);
+    ::encode((uint64_t)filter->element_count(), bl);
+    uint32_t len = filter->table_bytes();
+    ::encode(len, bl);
+    bl.append((const char *)filter->table(), len);
+  }
+  ENCODE_FINISH(bl);
+}
+
+void HitSet::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(begin, bl);
+  ::decode(end, bl);
+  delete filter;
+  filter = NULL;
+  bool have;
+  ::decode(have, bl);
+  if (have) {
+    uint64_t target_size, count;
+    double fpp;
+    uint32_t seed, len;
+    ::decode(target_size, bl);
+    ::decode(fpp, bl);
+    ::decode(seed, bl);
+    ::decode(count, bl);
+    ::decode(len, bl);
+    filter = new filter_t(target_size, fpp, seed);
+    if (filter->table_bytes() != len) {
+      delete filter;
+      filter = NULL;
+      throw buffer::malformed_input("HitSet filter table size mismatch");
+    }
+    bl.copy(len, (char *)filter->get_table());
+    filter->set_element_count(count);
+  }
+  DECODE_FINISH(bl);
+}
+
+void HitSet::dump(Formatter *f) const
+{
+  f->dump_stream("begin") << begin;
+  f->dump_stream("end") << end;
+  f->dump_unsigned("insert_count", insert_count());
+  if (filter) {
+    f->dump_unsigned("target_size", filter->target_size());
+    f->dump_float("fpp", filter->fpp());
+    f->dump_float("effective_fpp", effective_fpp());
+    f->dump_unsigned("bytes", size());
+  }
+}
+
+void HitSet::generate_test_instances(std::list<HitSet*>& o)
+{
+  o.push_back(new HitSet);
+  o.push_back(new HitSet(10, .1, 1, utime_t(1, 2)));
+  o.back()->end = utime_t(3, 4);
+  o.back()->insert("foo");
+  o.back()->insert("bar");
+}
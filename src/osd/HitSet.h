@@ -0,0 +1,54 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OSD_HITSET_H
+#define CEPH_OSD_HITSET_H
+
+#include <list>
+#include <string>
+
+#include "include/buffer.h"
+#include "include/encoding.h"
+#include "include/utime.h"
+#include "common/Formatter.h"
+
+/**
+ * The names of the objects a PG saw accessed during one interval.
+ *
+ * Names go into a bloom filter sized for target_size of them, so a set
+ * stays the same size however busy its PG is.  contains() never misses
+ * a name that was inserted, but says yes to one that was not about fpp
+ * of the time (more once more than target_size have gone in).
+ */
+class HitSet {
+  class filter_t;
+  filter_t *filter;
+
+  HitSet(const HitSet&);
+  const HitSet& operator=(const HitSet&);
+
+public:
+  utime_t begin, end;  ///< interval covered; end is zero while it is open
+
+  HitSet();
+  HitSet(unsigned target_size, double fpp, uint32_t seed, utime_t begin);
+  ~HitSet();
+
+  void insert(const std::string &name);
+  bool contains(const std::string &name) const;
+
+  /// names inserted, counting repeats
+  unsigned insert_count() const;
+  /// the false positive probability given what has gone in so far
+  double effective_fpp() const;
+  /// bytes in the filter
+  unsigned size() const;
+
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(std::list<HitSet*>& o);
+};
+WRITE_CLASS_ENCODER(HitSet)
+
+#endif
@@ -70,6 +70,9 @@
 #include "messages/MOSDPGTrim.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDPGPush.h"
+#include "messages/MOSDPGPull.h"
+#include "messages/MOSDPGPushReply.h"
 #include "messages/MOSDPGMissing.h"
 
 #include "messages/MOSDAlive.h"
@@ -158,6 +161,7 @@ OSDService::OSDService(OSD *osd) :
   publish_lock("OSDService::publish_lock"),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
+  scrub_bw_lock("OSDService::scrub_bw_lock"), scrub_bw_avail(0),
   watch_lock("OSD::watch_lock"),
   watch_timer(osd->client_messenger->cct, watch_lock),
   watch(NULL),
@@ -690,6 +694,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads, "osd_recovery_threads"),
   disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads, "osd_disk_threads"),
   command_tp(external_messenger->cct, "OSD::command_tp", 1),
+  peering_tp(external_messenger->cct, "OSD::peering_tp", g_conf->osd_peering_threads, "osd_peering_threads"),
   paused_recovery(false),
   heartbeat_lock("OSD::heartbeat_lock"),
   heartbeat_stop(false), heartbeat_need_update(true), heartbeat_epoch(0),
@@ -701,9 +706,16 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_queue_len(0),
+  hit_set_hook(NULL),
+  op_sched_enabled(g_conf->osd_op_sched),
+  op_sched_lock("OSD::op_sched_lock"),
+  op_queue(OP_CLASS_MAX),
+  bg_refused(false), bg_retry_at(0),
   op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
-  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
+  peering_wq(this, g_conf->osd_op_thread_timeout, &peering_tp,
+	     g_conf->osd_peering_wq_batch_size),
+  peering_out_lock("OSD::peering_out_lock"),
+  peering_batches(0), peering_out_pgs(0),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
@@ -781,6 +793,19 @@ public:
 };
 
 
+class HitSetSocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  HitSetSocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    osd->dump_hit_sets(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+
 class OpsFlightSocketHook : public AdminSocketHook {
   OSD *osd;
 public:
@@ -801,6 +826,10 @@ int OSD::init()
   service.watch_timer.init();
   service.watch = new Watch();
 
+  // early, so that boot phases can be timed
+  create_logger();
+  utime_t boot_start = ceph_clock_now(g_ceph_context);
+
   // mount.
   dout(2) << "mounting " << dev_path << " "
 	  << (journal_path.empty() ? "(no journal)" : journal_path) << dendl;
@@ -811,6 +840,7 @@ int OSD::init()
     derr << "OSD:init: unable to mount object store" << dendl;
     return r;
   }
+  logger->fset(l_osd_boot_mount_lat, ceph_clock_now(g_ceph_context) - boot_start);
 
   dout(2) << "boot" << dendl;
 
@@ -862,7 +892,7 @@ int OSD::init()
     return -EINVAL;
   }
 
-  create_logger();
+  logger->fset(l_osd_boot_lat, ceph_clock_now(g_ceph_context) - boot_start);
     
   // i'm ready!
   client_messenger->add_dispatcher_head(this);
@@ -893,10 +923,12 @@ int OSD::init()
 
   osd_lock.Lock();
 
+  update_op_sched_params();
   op_tp.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
+  peering_tp.start();
 
   // start the heartbeat
   heartbeat_thread.create();
@@ -921,6 +953,10 @@ int OSD::init()
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  hit_set_hook = new HitSetSocketHook(this);
+  r = admin_socket->register_command("dump_hit_sets", hit_set_hook,
+                                     "show the hit sets of primary pgs");
+  assert(r == 0);
 
   return 0;
 }
@@ -942,6 +978,8 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes");   // client read out bytes
   osd_plb.add_fl_avg(l_osd_op_r_lat,  "op_r_latency");    // client read latency
+  osd_plb.add_u64_counter(l_osd_op_r_replica, "op_r_replica");    // reads served as a replica
+  osd_plb.add_u64_counter(l_osd_op_r_redirect, "op_r_redirect");  // reads sent back to the primary
   osd_plb.add_u64_counter(l_osd_op_w,      "op_w");        // client writes
   osd_plb.add_u64_counter(l_osd_op_w_inb,  "op_w_in_bytes");    // client write in bytes
   osd_plb.add_fl_avg(l_osd_op_w_rlat, "op_w_rlat");   // client write readable/applied latency
@@ -968,9 +1006,15 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_pull,      "pull");       // pull requests sent
   osd_plb.add_u64_counter(l_osd_push,      "push");       // push messages
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
+  osd_plb.add_u64_counter(l_osd_push_delta, "push_delta");     // pushes of changed extents only
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
+  osd_plb.add_u64_counter(l_osd_obc_cache_hit, "object_context_cache_hit");    // idle object contexts reused
+  osd_plb.add_u64_counter(l_osd_obc_cache_miss, "object_context_cache_miss");  // object info read from disk
+  osd_plb.add_u64_counter(l_osd_ssc_cache_hit, "snapset_context_cache_hit");
+  osd_plb.add_u64_counter(l_osd_ssc_cache_miss, "snapset_context_cache_miss");
+
   osd_plb.add_fl(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
 
@@ -984,6 +1028,19 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
 
+  osd_plb.add_fl(l_osd_boot_mount_lat, "boot_mount_latency");       // seconds to mount the store
+  osd_plb.add_fl(l_osd_boot_load_pgs_lat, "boot_load_pgs_latency"); // ... to read pg state
+  osd_plb.add_fl(l_osd_boot_past_intervals_lat, "boot_past_intervals_latency");
+  osd_plb.add_fl(l_osd_boot_lat, "boot_latency");                   // mount through pg load
+  osd_plb.add_fl_avg(l_osd_pg_log_load_lat, "pg_log_load_latency"); // per pg log read
+
+  // queued (client, subop) or held back (the rest) by the op scheduler
+  osd_plb.add_fl_avg(l_osd_sched_client_lat, "sched_client_latency");
+  osd_plb.add_fl_avg(l_osd_sched_subop_lat, "sched_subop_latency");
+  osd_plb.add_fl_avg(l_osd_sched_recovery_lat, "sched_recovery_latency");
+  osd_plb.add_fl_avg(l_osd_sched_scrub_lat, "sched_scrub_latency");
+  osd_plb.add_fl_avg(l_osd_sched_snaptrim_lat, "sched_snaptrim_latency");
+
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -1003,6 +1060,7 @@ void OSD::suicide(int exitcode)
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
+  peering_tp.pause();
 
   derr << " flushing io" << dendl;
   store->sync_and_flush();
@@ -1052,6 +1110,8 @@ int OSD::shutdown()
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
+  peering_tp.stop();
+  dout(10) << "peering tp stopped" << dendl;
   op_tp.stop();
   dout(10) << "op tp stopped" << dendl;
 
@@ -1084,6 +1144,10 @@ int OSD::shutdown()
   }
 
   osd_lock.Unlock();
+  // the hook takes osd_lock while the admin socket holds its own lock
+  cct->get_admin_socket()->unregister_command("dump_hit_sets");
+  delete hit_set_hook;
+  hit_set_hook = NULL;
   store->sync();
   store->flush();
   osd_lock.Lock();
@@ -1283,6 +1347,18 @@ PG *OSD::_create_lock_pg(
   PG *pg = _open_lock_pg(createmap, pgid, true, hold_map_lock);
 
   t.create_collection(coll_t(pgid));
+  const pg_pool_t *pool = createmap->get_pg_pool(pgid.pool());
+  if (pool && pool->get_expected_num_objects()) {
+    // let the store lay out the collection for its share of the pool
+    bufferlist hint;
+    uint32_t pg_num = pool->get_pg_num();
+    uint64_t expected_num_objs = pool->get_expected_num_objects() / pg_num;
+    ::encode(pg_num, hint);
+    ::encode(expected_num_objs, hint);
+    t.collection_hint(coll_t(pgid),
+		      ObjectStore::Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS,
+		      hint);
+  }
 
   if (newly_created) {
     /* This is weird, but all the peering code needs last_epoch_start
@@ -1349,11 +1425,53 @@ PG *OSD::lookup_lock_raw_pg(pg_t pgid)
 }
 
 
+/*
+ * reads the on-disk state of the pgs load_pgs() found, several at
+ * once, so that a big osd isn't stuck doing one seek at a time.
+ */
+struct LoadPGWQ : public ThreadPool::WorkQueue<PG> {
+  list<PG*> pgs;
+  ObjectStore *store;
+  bool lazy_log;
+
+  LoadPGWQ(ObjectStore *s, bool lazy, ThreadPool *tp)
+    : ThreadPool::WorkQueue<PG>("OSD::LoadPGWQ", g_conf->osd_op_thread_timeout, 0, tp),
+      store(s), lazy_log(lazy) {}
+
+  bool _empty() {
+    return pgs.empty();
+  }
+  bool _enqueue(PG *pg) {
+    pgs.push_back(pg);
+    return true;
+  }
+  void _dequeue(PG *pg) {
+    pgs.remove(pg);
+  }
+  PG *_dequeue() {
+    if (pgs.empty())
+      return NULL;
+    PG *pg = pgs.front();
+    pgs.pop_front();
+    return pg;
+  }
+  void _process(PG *pg) {
+    pg->lock();
+    pg->read_state(store, lazy_log);
+    pg->unlock();
+  }
+  void _clear() {
+    pgs.clear();
+  }
+};
+
 void OSD::load_pgs()
 {
   assert(osd_lock.is_locked());
   dout(10) << "load_pgs" << dendl;
   assert(pg_map.empty());
+  utime_t start = ceph_clock_now(g_ceph_context);
+  list<PG*> loading;
 
   vector<coll_t> ls;
   int r = store->list_collections(ls);
@@ -1410,9 +1528,36 @@ void OSD::load_pgs()
     }
 
     PG *pg = _open_lock_pg(osdmap, pgid);
+    pg->unlock();
+    loading.push_back(pg);
+  }
+
+  // read pg state, log
+  bool lazy_log = g_conf->osd_lazy_pg_log;
+  int threads = MIN(g_conf->osd_load_pgs_threads, (int)loading.size());
+  dout(10) << "load_pgs reading " << loading.size() << " pgs with "
+	   << MAX(threads, 1) << " threads"
+	   << (lazy_log ? ", deferring logs" : "") << dendl;
+  if (threads > 1) {
+    ThreadPool load_tp(g_ceph_context, "OSD::load_tp", threads);
+    LoadPGWQ load_wq(store, lazy_log, &load_tp);
+    for (list<PG*>::iterator p = loading.begin(); p != loading.end(); ++p)
+      load_wq.queue(*p);
+    load_tp.start();
+    load_wq.drain();
+    load_tp.stop();
+  } else {
+    for (list<PG*>::iterator p = loading.begin(); p != loading.end(); ++p) {
+      (*p)->lock();
+      (*p)->read_state(store, lazy_log);
+      (*p)->unlock();
+    }
+  }
 
-    // read pg state, log
-    pg->read_state(store);
+  for (list<PG*>::iterator p = loading.begin(); p != loading.end(); ++p) {
+    PG *pg = *p;
+    pg_t pgid = pg->info.pgid;
+    pg->lock();
 
     service.reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
@@ -1428,8 +1573,11 @@ void OSD::load_pgs()
     pg->unlock();
   }
   dout(10) << "load_pgs done" << dendl;
+  utime_t loaded = ceph_clock_now(g_ceph_context);
+  logger->fset(l_osd_boot_load_pgs_lat, loaded - start);
 
   build_past_intervals_parallel();
+  logger->fset(l_osd_boot_past_intervals_lat, ceph_clock_now(g_ceph_context) - loaded);
 }
 
 
@@ -2075,6 +2223,8 @@ void OSD::tick()
 
   logger->set(l_osd_buf, buffer::get_total_alloc());
 
+  update_op_sched_params();
+
   if (is_active()) {
     // periodically kick recovery work queue
     recovery_tp.wake();
@@ -2147,6 +2297,29 @@ void OSD::dump_ops_in_flight(ostream& ss)
   op_tracker.dump_ops_in_flight(ss);
 }
 
+void OSD::dump_hit_sets(ostream& ss)
+{
+  Mutex::Locker l(osd_lock);
+  if (is_stopping())
+    return;
+  JSONFormatter f(true);
+  f.open_array_section("pgs");
+  for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
+       p != pg_map.end();
+       ++p) {
+    PG *pg = p->second;
+    pg->lock();
+    if (pg->is_primary()) {
+      f.open_object_section("pg");
+      static_cast<ReplicatedPG*>(pg)->dump_hit_sets(&f);
+      f.close_section();
+    }
+    pg->unlock();
+  }
+  f.close_section();
+  f.flush(ss);
+}
+
 // =========================================
 void OSD::RemoveWQ::_process(boost::tuple<coll_t, SequencerRef, DeletingStateRef> *item)
 {
@@ -2767,6 +2940,7 @@ void OSD::do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist
 	assert(q != pg_map.end());
 	PG *pg = q->second;
 	pg->lock();
+	pg->ensure_log_loaded();
 
 	fout << *pg << std::endl;
 	std::map<hobject_t, pg_missing_t::item>::iterator mend = pg->missing.missing.end();
@@ -2815,6 +2989,12 @@ void OSD::do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist
     ss << "dump pg recovery stats: " << s.str();
   }
 
+  else if (cmd[0] == "dump_pg_recovery_histogram") {
+    stringstream s;
+    pg_recovery_stats.dump_histogram(s);
+    ss << "dump pg recovery histogram: " << s.str();
+  }
+
   else if (cmd[0] == "reset_pg_recovery_stats") {
     ss << "reset pg recovery stats";
     pg_recovery_stats.reset();
@@ -3169,6 +3349,15 @@ void OSD::dispatch_op(OpRequestRef op)
   case MSG_OSD_SUBOPREPLY:
     handle_sub_op_reply(op);
     break;
+  case MSG_OSD_PG_PUSH:
+    handle_replica_op<MOSDPGPush, MSG_OSD_PG_PUSH>(op);
+    break;
+  case MSG_OSD_PG_PULL:
+    handle_replica_op<MOSDPGPull, MSG_OSD_PG_PULL>(op);
+    break;
+  case MSG_OSD_PG_PUSH_REPLY:
+    handle_replica_op<MOSDPGPushReply, MSG_OSD_PG_PUSH_REPLY>(op);
+    break;
   }
 }
 
@@ -3396,6 +3585,34 @@ bool OSDService::inc_scrubs_pending()
   return result;
 }
 
+bool OSDService::scrub_bw_ready()
+{
+  double rate = g_conf->osd_deep_scrub_bytes_per_sec;
+  if (rate <= 0)
+    return true;
+  Mutex::Locker l(scrub_bw_lock);
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (!scrub_bw_stamp.is_zero()) {
+    scrub_bw_avail += rate * (double)(now - scrub_bw_stamp);
+    if (scrub_bw_avail > rate)
+      scrub_bw_avail = rate;  // bursts of at most a second's worth
+  }
+  scrub_bw_stamp = now;
+  if (scrub_bw_avail < 0) {
+    dout(20) << "scrub_bw_ready " << -scrub_bw_avail << " bytes in debt" << dendl;
+    return false;
+  }
+  return true;
+}
+
+void OSDService::scrub_bw_take(uint64_t bytes)
+{
+  if (g_conf->osd_deep_scrub_bytes_per_sec <= 0)
+    return;
+  Mutex::Locker l(scrub_bw_lock);
+  scrub_bw_avail -= bytes;
+}
+
 void OSDService::dec_scrubs_pending()
 {
   sched_scrub_lock.Lock();
@@ -4692,6 +4909,13 @@ void OSD::handle_pg_notify(OpRequestRef op)
       continue;
     }
 
+    // an existing pg drops stale events itself; don't wait for its lock
+    if (_have_pg(it->first.info.pgid)) {
+      _lookup_pg(it->first.info.pgid)->queue_notify(
+	it->first.epoch_sent, it->first.query_epoch, from, it->first);
+      continue;
+    }
+
     int created = 0;
     pg = get_or_create_pg(it->first.info, it->second,
 			  it->first.query_epoch, from, created, true);
@@ -4719,12 +4943,18 @@ void OSD::handle_pg_log(OpRequestRef op)
     return;
   }
 
+  op->mark_started();
+  if (_have_pg(m->info.pgid)) {
+    _lookup_pg(m->info.pgid)->queue_log(m->get_epoch(), m->get_query_epoch(),
+					from, m);
+    return;
+  }
+
   int created = 0;
   PG *pg = get_or_create_pg(m->info, m->past_intervals, m->get_epoch(), 
 			    from, created, false);
   if (!pg)
     return;
-  op->mark_started();
   pg->queue_log(m->get_epoch(), m->get_query_epoch(), from, m);
   pg->unlock();
 }
@@ -4753,6 +4983,12 @@ void OSD::handle_pg_info(OpRequestRef op)
       continue;
     }
 
+    if (_have_pg(p->first.info.pgid)) {
+      _lookup_pg(p->first.info.pgid)->queue_info(
+	p->first.epoch_sent, p->first.query_epoch, from, p->first.info);
+      continue;
+    }
+
     PG *pg = get_or_create_pg(p->first.info, p->second, p->first.epoch_sent,
 			      from, created, false);
     if (!pg)
@@ -4805,6 +5041,7 @@ void OSD::handle_pg_trim(OpRequestRef op)
     } else {
       // primary is instructing us to trim
       ObjectStore::Transaction *t = new ObjectStore::Transaction;
+      pg->ensure_log_loaded();
       pg->trim(*t, m->trim_to);
       pg->write_info(*t);
       int tr = store->queue_transaction(pg->osr.get(), t,
@@ -4908,10 +5145,9 @@ void OSD::handle_pg_query(OpRequestRef op)
     PG *pg = 0;
 
     if (pg_map.count(pgid)) {
-      pg = _lookup_lock_pg(pgid);
+      pg = _lookup_pg(pgid);
       pg->queue_query(it->second.epoch_sent, it->second.epoch_sent,
 		      from, it->second);
-      pg->unlock();
       continue;
     }
 
@@ -5028,6 +5264,7 @@ void OSD::_remove_pg(PG *pg)
   }
   rmt->remove(coll_t::META_COLL, pg->log_oid);
   rmt->remove(coll_t::META_COLL, pg->biginfo_oid);
+  rmt->remove(coll_t::META_COLL, make_pg_hit_set_oid(pg->info.pgid));
 
   store->queue_transaction(
     pg->osr.get(), rmt,
@@ -5057,6 +5294,7 @@ void OSD::_remove_pg(PG *pg)
   pg_stat_queue_dequeue(pg);
   op_wq.dequeue(pg);
   peering_wq.dequeue(pg);
+  pg->clear_peering_queue();
 
   pg->deleting = true;
 
@@ -5131,6 +5369,10 @@ bool OSD::_recover_now()
     dout(15) << "_recover_now defer until " << defer_recovery_until << dendl;
     return false;
   }
+  if (!admit_background(OP_CLASS_RECOVERY)) {
+    dout(15) << "_recover_now op scheduler says wait" << dendl;
+    return false;
+  }
 
   return true;
 }
@@ -5140,6 +5382,8 @@ void OSD::do_recovery(PG *pg)
   // see how many we should try to start.  note that this is a bit racy.
   recovery_wq.lock();
   int max = g_conf->osd_recovery_max_active - recovery_ops_active;
+  if (max > 1)
+    max = 1 + admit_background(OP_CLASS_RECOVERY, max - 1);  // _recover_now got us one
   recovery_wq.unlock();
   if (max == 0) {
     dout(10) << "do_recovery raced and failed to start anything; requeuing " << *pg << dendl;
@@ -5160,6 +5404,7 @@ void OSD::do_recovery(PG *pg)
     
     PG::RecoveryCtx rctx = create_context();
     int started = pg->start_recovery_ops(max, &rctx);
+    pg->send_pending_recovery();
     dout(10) << "do_recovery started " << started
 	     << " (" << recovery_ops_active << "/" << g_conf->osd_recovery_max_active << " rops) on "
 	     << *pg << dendl;
@@ -5463,6 +5708,36 @@ void OSD::handle_sub_op_reply(OpRequestRef op)
   enqueue_op(pg, op);
 }
 
+template<typename T, int MSGTYPE>
+void OSD::handle_replica_op(OpRequestRef op)
+{
+  T *m = static_cast<T *>(op->request);
+  assert(m->get_header().type == MSGTYPE);
+
+  dout(10) << __func__ << " " << *m << " epoch " << m->map_epoch << dendl;
+  if (m->map_epoch < up_epoch) {
+    dout(3) << "replica op from before up" << dendl;
+    return;
+  }
+
+  if (!require_osd_peer(op))
+    return;
+
+  // require same or newer map
+  if (!require_same_or_newer_map(op, m->map_epoch))
+    return;
+
+  // share our map with sender, if they're old
+  _share_map_incoming(m->get_source_inst(), m->map_epoch,
+		      (Session*)m->get_connection()->get_priv());
+
+  PG *pg = _have_pg(m->pgid) ? _lookup_pg(m->pgid) : NULL;
+  if (!pg) {
+    return;
+  }
+  enqueue_op(pg, op);
+}
+
 bool OSD::op_is_discardable(MOSDOp *op)
 {
   // drop client request if they are not connected and can't get the
@@ -5484,34 +5759,138 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
   pg->queue_op(op);
 }
 
-bool OSD::OpWQ::_enqueue(PG *pg)
+bool OSD::OpWQ::_enqueue(PG *pg, int op_class)
 {
+  if (!osd->op_sched_enabled)
+    op_class = OP_CLASS_CLIENT;
   pg->get();
-  osd->op_queue.push_back(pg);
-  osd->op_queue_len++;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  Mutex::Locker l(osd->op_sched_lock);
+  osd->op_queue.enqueue(op_class, pg, ceph_clock_now(g_ceph_context));
+  osd->logger->set(l_osd_opq, osd->op_queue.size());
   return true;
 }
 
+void OSD::OpWQ::_dequeue(PG *pg)
+{
+  Mutex::Locker l(osd->op_sched_lock);
+  for (unsigned n = osd->op_queue.remove(pg); n > 0; --n)
+    pg->put();
+  // slots scheduled for ops that are no longer queued
+  for (unsigned c = 0; c < OP_CLASS_MAX; ++c)
+    pg->op_sched_due[c].set(0);
+  osd->logger->set(l_osd_opq, osd->op_queue.size());
+}
+
 PG *OSD::OpWQ::_dequeue()
 {
-  if (osd->op_queue.empty())
+  utime_t now = ceph_clock_now(g_ceph_context);
+  Mutex::Locker l(osd->op_sched_lock);
+  PG *pg;
+  unsigned op_class;
+  utime_t stamp;
+  if (!osd->op_queue.dequeue(now, false, &pg, &op_class, &stamp))
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
-  osd->op_queue_len--;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  if (osd->op_sched_enabled)
+    pg->op_sched_due[op_class].inc();
+  osd->logger->set(l_osd_opq, osd->op_queue.size());
+  osd->logger->finc(l_osd_sched_client_lat + op_class, now - stamp);
   return pg;
 }
 
+void OSD::update_op_sched_params()
+{
+  if (!op_sched_enabled)
+    return;
+  OpScheduler<PG*>::params_t p[OP_CLASS_MAX];
+  p[OP_CLASS_CLIENT] = OpScheduler<PG*>::params_t(
+    g_conf->osd_op_sched_client_res, g_conf->osd_op_sched_client_wgt,
+    g_conf->osd_op_sched_client_lim);
+  p[OP_CLASS_SUBOP] = OpScheduler<PG*>::params_t(
+    g_conf->osd_op_sched_subop_res, g_conf->osd_op_sched_subop_wgt,
+    g_conf->osd_op_sched_subop_lim);
+  p[OP_CLASS_RECOVERY] = OpScheduler<PG*>::params_t(
+    g_conf->osd_op_sched_recovery_res, g_conf->osd_op_sched_recovery_wgt,
+    g_conf->osd_op_sched_recovery_lim);
+  p[OP_CLASS_SCRUB] = OpScheduler<PG*>::params_t(
+    g_conf->osd_op_sched_scrub_res, g_conf->osd_op_sched_scrub_wgt,
+    g_conf->osd_op_sched_scrub_lim);
+  p[OP_CLASS_SNAPTRIM] = OpScheduler<PG*>::params_t(
+    g_conf->osd_op_sched_snaptrim_res, g_conf->osd_op_sched_snaptrim_wgt,
+    g_conf->osd_op_sched_snaptrim_lim);
+
+  Mutex::Locker l(op_sched_lock);
+  for (int c = 0; c < OP_CLASS_MAX; ++c)
+    op_queue.set_params(c, p[c]);
+}
+
+/*
+ * May n more pieces of background work of this class start?  Called
+ * from the recovery and disk thread pools' _dequeue, with their lock
+ * held, and by the snap trimmer for the rest of a batch.  Returns how
+ * many may.
+ */
+int OSD::admit_background(int op_class, int n)
+{
+  if (!op_sched_enabled)
+    return n;
+  utime_t now = ceph_clock_now(g_ceph_context);
+  Mutex::Locker l(op_sched_lock);
+  int admitted = 0;
+  while (admitted < n && op_queue.admit(op_class, now))
+    admitted++;
+  if (admitted) {
+    utime_t waited;
+    if (!bg_wait_since[op_class].is_zero()) {
+      waited = now - bg_wait_since[op_class];
+      bg_wait_since[op_class] = utime_t();
+    }
+    logger->finc(l_osd_sched_client_lat + op_class, waited);
+  } else {
+    if (bg_wait_since[op_class].is_zero())
+      bg_wait_since[op_class] = now;
+    double due = op_queue.reservation_due(op_class);
+    if (!bg_refused || due < bg_retry_at)
+      bg_retry_at = due;
+    bg_refused = true;
+  }
+  return admitted;
+}
+
+/*
+ * Background threads that were told to wait only poll every couple of
+ * seconds; kick them when the op queue empties or a reservation of
+ * theirs comes due.
+ */
+void OSD::maybe_wake_background()
+{
+  if (!op_sched_enabled)
+    return;
+  {
+    Mutex::Locker l(op_sched_lock);
+    if (!bg_refused)
+      return;
+    if (!op_queue.empty() &&
+	(double)ceph_clock_now(g_ceph_context) < bg_retry_at)
+      return;
+    bg_refused = false;
+  }
+  recovery_tp.wake();
+  disk_tp.wake();
+}
+
 void OSDService::queue_for_peering(PG *pg)
 {
   peering_wq.queue(pg);
 }
 
-void OSDService::queue_for_op(PG *pg)
+void OSDService::queue_for_op(PG *pg, int op_class)
 {
-  op_wq.queue(pg);
+  osd->op_wq.queue(pg, op_class);
+}
+
+int OSDService::admit_background(int op_class, int n)
+{
+  return osd->admit_background(op_class, n);
 }
 
 void OSD::process_peering_events(const list<PG*> &pgs)
@@ -5520,6 +5899,7 @@ void OSD::process_peering_events(const list<PG*> &pgs)
   epoch_t same_interval_since = 0;
   OSDMapRef curmap = service.get_osdmap();
   PG::RecoveryCtx rctx = create_context();
+  start_peering_batch();
   for (list<PG*>::const_iterator i = pgs.begin();
        i != pgs.end();
        ++i) {
@@ -5531,11 +5911,9 @@ void OSD::process_peering_events(const list<PG*> &pgs)
       continue;
     }
     advance_pg(curmap->get_epoch(), pg, &rctx);
-    if (!pg->peering_queue.empty()) {
-      PG::CephPeeringEvtRef evt = pg->peering_queue.front();
-      pg->peering_queue.pop_front();
+    PG::CephPeeringEvtRef evt = pg->take_peering_event();
+    if (evt)
       pg->handle_peering_event(evt, &rctx);
-    }
     need_up_thru = pg->need_up_thru || need_up_thru;
     same_interval_since = MAX(pg->info.history.same_interval_since,
 			      same_interval_since);
@@ -5545,11 +5923,79 @@ void OSD::process_peering_events(const list<PG*> &pgs)
   }
   if (need_up_thru)
     queue_want_up_thru(same_interval_since);
-  dispatch_context(rctx, 0, curmap);
+  finish_peering_batch(rctx, curmap);
 
   service.send_pg_temp();
 }
 
+void OSD::start_peering_batch()
+{
+  Mutex::Locker l(peering_out_lock);
+  peering_batches++;
+}
+
+void OSD::finish_peering_batch(PG::RecoveryCtx &rctx, OSDMapRef curmap)
+{
+  map< int, map<pg_t,pg_query_t> > queries;
+  map< int, vector<pair<pg_notify_t, pg_interval_map_t> > > notifies, infos;
+  OSDMapRef sendmap;
+  {
+    Mutex::Locker l(peering_out_lock);
+    assert(peering_batches > 0);
+    peering_batches--;
+    for (map< int, map<pg_t,pg_query_t> >::iterator p = rctx.query_map->begin();
+	 p != rctx.query_map->end();
+	 ++p) {
+      for (map<pg_t,pg_query_t>::iterator q = p->second.begin();
+	   q != p->second.end();
+	   ++q)
+	peering_out_queries[p->first][q->first] = q->second;
+      peering_out_pgs += p->second.size();
+    }
+    for (map< int, vector<pair<pg_notify_t, pg_interval_map_t> > >::iterator p =
+	   rctx.notify_list->begin();
+	 p != rctx.notify_list->end();
+	 ++p) {
+      vector<pair<pg_notify_t, pg_interval_map_t> > &v = peering_out_notifies[p->first];
+      v.insert(v.end(), p->second.begin(), p->second.end());
+      peering_out_pgs += p->second.size();
+    }
+    for (map< int, vector<pair<pg_notify_t, pg_interval_map_t> > >::iterator p =
+	   rctx.info_map->begin();
+	 p != rctx.info_map->end();
+	 ++p) {
+      vector<pair<pg_notify_t, pg_interval_map_t> > &v = peering_out_infos[p->first];
+      v.insert(v.end(), p->second.begin(), p->second.end());
+      peering_out_pgs += p->second.size();
+    }
+    if (peering_out_pgs &&
+	(!peering_out_map || curmap->get_epoch() > peering_out_map->get_epoch()))
+      peering_out_map = curmap;
+
+    if (peering_out_pgs &&
+	(peering_batches == 0 ||
+	 peering_out_pgs >= g_conf->osd_peering_wq_batch_size)) {
+      dout(10) << "finish_peering_batch sending for " << peering_out_pgs
+	       << " pgs, " << peering_batches << " batches in flight" << dendl;
+      queries.swap(peering_out_queries);
+      notifies.swap(peering_out_notifies);
+      infos.swap(peering_out_infos);
+      sendmap.swap(peering_out_map);
+      peering_out_pgs = 0;
+    }
+  }
+  rctx.query_map->clear();
+  rctx.notify_list->clear();
+  rctx.info_map->clear();
+  dispatch_context(rctx, 0, curmap);
+
+  if (sendmap) {
+    do_notifies(notifies, sendmap);
+    do_queries(queries, sendmap);
+    do_infos(infos, sendmap);
+  }
+}
+
 /*
  * NOTE: dequeue called in worker thread, without osd_lock
  */
@@ -5566,8 +6012,19 @@ void OSD::dequeue_op(PG *pg)
 
   pg->lockq();
   assert(!pg->op_queue.empty());
-  op = pg->op_queue.front();
-  pg->op_queue.pop_front();
+  list<OpRequestRef>::iterator p = pg->op_queue.begin();
+  if (op_sched_enabled) {
+    // the oldest op of a class the scheduler picked for this pg
+    while (p != pg->op_queue.end() &&
+	   pg->op_sched_due[(*p)->get_op_class()].read() == 0)
+      ++p;
+    if (p == pg->op_queue.end())
+      p = pg->op_queue.begin();
+    else
+      pg->op_sched_due[(*p)->get_op_class()].dec();
+  }
+  op = *p;
+  pg->op_queue.erase(p);
   pg->unlockq();
     
   dout(10) << "dequeue_op " << op << " " << *op->request << " pg " << *pg << dendl;
@@ -5583,6 +6040,8 @@ void OSD::dequeue_op(PG *pg)
   //#warning foo
   //scrub_wq.queue(pg);
 
+  maybe_wake_background();
+
   // finish
   dout(10) << "dequeue_op " << op << " finish" << dendl;
 }
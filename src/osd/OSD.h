@@ -29,6 +29,7 @@
 
 #include "os/ObjectStore.h"
 #include "OSDCap.h"
+#include "OpScheduler.h"
 
 #include "common/DecayCounter.h"
 #include "osd/ClassHandler.h"
@@ -67,6 +68,8 @@ enum {
   l_osd_op_r,
   l_osd_op_r_outb,
   l_osd_op_r_lat,
+  l_osd_op_r_replica,
+  l_osd_op_r_redirect,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_rlat,
@@ -92,9 +95,15 @@ enum {
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_delta,
 
   l_osd_rop,
 
+  l_osd_obc_cache_hit,
+  l_osd_obc_cache_miss,
+  l_osd_ssc_cache_hit,
+  l_osd_ssc_cache_miss,
+
   l_osd_loadavg,
   l_osd_buf,
 
@@ -108,6 +117,18 @@ enum {
   l_osd_mape,
   l_osd_mape_dup,
 
+  l_osd_boot_mount_lat,
+  l_osd_boot_load_pgs_lat,
+  l_osd_boot_past_intervals_lat,
+  l_osd_boot_lat,
+  l_osd_pg_log_load_lat,
+
+  l_osd_sched_client_lat,   // in OP_CLASS_* order
+  l_osd_sched_subop_lat,
+  l_osd_sched_recovery_lat,
+  l_osd_sched_scrub_lat,
+  l_osd_sched_snaptrim_lat,
+
   l_osd_last,
 };
 
@@ -129,6 +150,7 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
 class HistoricOpsSocketHook;
+class HitSetSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -234,6 +256,18 @@ public:
   void dec_scrubs_pending();
   void dec_scrubs_active();
 
+  // -- deep scrub bandwidth --
+  /*
+   * A token bucket of osd_deep_scrub_bytes_per_sec.  Deep scrub reads
+   * first and pays after, so the balance can go negative; no scrub
+   * chunk starts until it is paid back.
+   */
+  Mutex scrub_bw_lock;
+  double scrub_bw_avail;
+  utime_t scrub_bw_stamp;
+  bool scrub_bw_ready();
+  void scrub_bw_take(uint64_t bytes);
+
   void reply_op_error(OpRequestRef op, int err);
   void reply_op_error(OpRequestRef op, int err, eversion_t v);
   void handle_misdirected_op(PG *pg, OpRequestRef op);
@@ -266,7 +300,8 @@ public:
   void send_pg_temp();
 
   void queue_for_peering(PG *pg);
-  void queue_for_op(PG *pg);
+  void queue_for_op(PG *pg, int op_class);
+  int admit_background(int op_class, int n);
   bool queue_for_recovery(PG *pg);
   bool queue_for_snap_trim(PG *pg) {
     return snap_trim_wq.queue(pg);
@@ -386,6 +421,14 @@ public:
     getline(ss, s);
     return hobject_t(sobject_t(object_t(s.c_str()), 0));
   }
+
+  static hobject_t make_pg_hit_set_oid(pg_t pg) {
+    stringstream ss;
+    ss << "pghitset_" << pg;
+    string s;
+    getline(ss, s);
+    return hobject_t(sobject_t(object_t(s.c_str()), 0));
+  }
   
 
 private:
@@ -421,6 +464,7 @@ private:
   ThreadPool recovery_tp;
   ThreadPool disk_tp;
   ThreadPool command_tp;
+  ThreadPool peering_tp;
 
   bool paused_recovery;
 
@@ -546,29 +590,47 @@ private:
   OpsFlightSocketHook *admin_ops_hook;
   HistoricOpsSocketHook *historic_ops_hook;
 
+  // -- hit sets --
+  void dump_hit_sets(ostream& ss);
+  friend class HitSetSocketHook;
+  HitSetSocketHook *hit_set_hook;
+
   // -- op queue --
-  list<PG*> op_queue;
-  int op_queue_len;
+  /*
+   * One slot per queued op, tagged with the op's class.  With
+   * osd_op_sched off every slot is OP_CLASS_CLIENT and this is a fifo.
+   * op_sched_lock nests inside the thread pool locks, so recovery and
+   * scrub threads can ask admit_background() without the op_tp lock.
+   */
+  bool op_sched_enabled;  ///< osd_op_sched, read at startup
+  Mutex op_sched_lock;
+  OpScheduler<PG*> op_queue;
+  utime_t bg_wait_since[OP_CLASS_MAX];  ///< first refusal since last admission
+  bool bg_refused;     ///< background work is waiting on the op queue
+  double bg_retry_at;  ///< ... and one of its reservations comes due then
+
+  void update_op_sched_params();
+  int admit_background(int op_class, int n = 1);
+  void maybe_wake_background();
 
   struct OpWQ : public ThreadPool::WorkQueue<PG> {
     OSD *osd;
     OpWQ(OSD *o, time_t ti, ThreadPool *tp)
       : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
 
-    bool _enqueue(PG *pg);
-    void _dequeue(PG *pg) {
-      for (list<PG*>::iterator i = osd->op_queue.begin();
-	   i != osd->op_queue.end();
-	   ) {
-	if (*i == pg) {
-	  osd->op_queue.erase(i++);
-	  pg->put();
-	} else {
-	  ++i;
-	}
-      }
+    void queue(PG *pg, int op_class) {
+      lock();
+      _enqueue(pg, op_class);
+      _wake();
+      unlock();
+    }
+    bool _enqueue(PG *pg) {
+      return _enqueue(pg, OP_CLASS_CLIENT);
     }
+    bool _enqueue(PG *pg, int op_class);
+    void _dequeue(PG *pg);
     bool _empty() {
+      Mutex::Locker l(osd->op_sched_lock);
       return osd->op_queue.empty();
     }
     PG *_dequeue();
@@ -576,6 +638,7 @@ private:
       osd->dequeue_op(pg);
     }
     void _clear() {
+      Mutex::Locker l(osd->op_sched_lock);
       assert(osd->op_queue.empty());
     }
   } op_wq;
@@ -653,6 +716,21 @@ private:
 
   void process_peering_events(const list<PG*> &pg);
 
+  /*
+   * Notifies, queries and infos from concurrent peering batches are
+   * gathered here and sent as one message per peer when the last batch
+   * in flight finishes, or when osd_peering_wq_batch_size pgs are waiting.
+   */
+  Mutex peering_out_lock;
+  int peering_batches;  ///< batches in flight
+  unsigned peering_out_pgs;
+  OSDMapRef peering_out_map;
+  map< int, map<pg_t,pg_query_t> > peering_out_queries;
+  map< int, vector<pair<pg_notify_t, pg_interval_map_t> > > peering_out_notifies;
+  map< int, vector<pair<pg_notify_t, pg_interval_map_t> > > peering_out_infos;
+  void start_peering_batch();
+  void finish_peering_batch(PG::RecoveryCtx &rctx, OSDMapRef curmap);
+
   friend class PG;
   friend class ReplicatedPG;
 
@@ -1064,6 +1142,8 @@ protected:
     PG *_dequeue() {
       if (osd->snap_trim_queue.empty())
 	return NULL;
+      if (!osd->admit_background(OP_CLASS_SNAPTRIM))
+	return NULL;
       PG *pg = osd->snap_trim_queue.front();
       osd->snap_trim_queue.pop_front();
       return pg;
@@ -1107,6 +1187,10 @@ protected:
     PG *_dequeue() {
       if (osd->scrub_queue.empty())
 	return NULL;
+      if (!osd->admit_background(OP_CLASS_SCRUB))
+	return NULL;
+      if (!osd->service.scrub_bw_ready())
+	return NULL;
       PG *pg = osd->scrub_queue.front();
       osd->scrub_queue.pop_front();
       return pg;
@@ -1192,6 +1276,10 @@ protected:
     MOSDRepScrub *_dequeue() {
       if (rep_scrub_queue.empty())
 	return NULL;
+      if (!osd->admit_background(OP_CLASS_SCRUB))
+	return NULL;
+      if (!osd->service.scrub_bw_ready())
+	return NULL;
       MOSDRepScrub *msg = rep_scrub_queue.front();
       rep_scrub_queue.pop_front();
       return msg;
@@ -1323,6 +1411,8 @@ public:
   void handle_op(OpRequestRef op);
   void handle_sub_op(OpRequestRef op);
   void handle_sub_op_reply(OpRequestRef op);
+  template<typename T, int MSGTYPE>
+  void handle_replica_op(OpRequestRef op);
 
   /// check if we can throw out op from a disconnected client
   static bool op_is_discardable(class MOSDOp *m);
@@ -9,6 +9,7 @@
 #include "msg/Message.h"
 #include "messages/MOSDOp.h"
 #include "messages/MOSDSubOp.h"
+#include "messages/MOSDSubOpReply.h"
 #include "include/assert.h"
 
 #define dout_subsys ceph_subsys_optracker
@@ -227,6 +228,55 @@ void OpTracker::RemoveOnDelete::operator()(OpRequest *op) {
   // Do not delete op, unregister_inflight_op took control
 }
 
+const char *op_class_name(int c)
+{
+  switch (c) {
+  case OP_CLASS_CLIENT: return "client";
+  case OP_CLASS_SUBOP: return "subop";
+  case OP_CLASS_RECOVERY: return "recovery";
+  case OP_CLASS_SCRUB: return "scrub";
+  case OP_CLASS_SNAPTRIM: return "snaptrim";
+  default: return "???";
+  }
+}
+
+static int sub_op_class(const vector<OSDOp> &ops)
+{
+  if (ops.empty())
+    return OP_CLASS_SUBOP;
+  switch (ops[0].op.op) {
+  case CEPH_OSD_OP_PUSH:
+  case CEPH_OSD_OP_PULL:
+    return OP_CLASS_RECOVERY;
+  case CEPH_OSD_OP_SCRUB:
+  case CEPH_OSD_OP_SCRUB_RESERVE:
+  case CEPH_OSD_OP_SCRUB_UNRESERVE:
+  case CEPH_OSD_OP_SCRUB_STOP:
+  case CEPH_OSD_OP_SCRUB_MAP:
+    return OP_CLASS_SCRUB;
+  default:
+    return OP_CLASS_SUBOP;
+  }
+}
+
+static int get_op_class(Message *m)
+{
+  switch (m->get_type()) {
+  case MSG_OSD_SUBOP:
+    return sub_op_class(static_cast<MOSDSubOp*>(m)->ops);
+  case MSG_OSD_SUBOPREPLY:
+    return sub_op_class(static_cast<MOSDSubOpReply*>(m)->ops);
+  case MSG_OSD_PG_SCAN:
+  case MSG_OSD_PG_BACKFILL:
+  case MSG_OSD_PG_PUSH:
+  case MSG_OSD_PG_PULL:
+  case MSG_OSD_PG_PUSH_REPLY:
+    return OP_CLASS_RECOVERY;
+  default:
+    return OP_CLASS_CLIENT;
+  }
+}
+
 OpRequestRef OpTracker::create_request(Message *ref)
 {
   OpRequestRef retval(new OpRequest(ref, this),
@@ -237,6 +287,7 @@ OpRequestRef OpTracker::create_request(Message *ref)
   } else if (ref->get_type() == MSG_OSD_SUBOP) {
     retval->reqid = static_cast<MOSDSubOp*>(ref)->reqid;
   }
+  retval->op_class = get_op_class(ref);
   _mark_event(retval.get(), "header_read", ref->get_recv_stamp());
   _mark_event(retval.get(), "throttled", ref->get_throttle_stamp());
   _mark_event(retval.get(), "all_read", ref->get_recv_complete_stamp());
@@ -72,6 +72,17 @@ public:
   OpRequestRef create_request(Message *req);
 };
 
+/// kinds of work the OSD schedules separately (see osd_op_sched)
+enum {
+  OP_CLASS_CLIENT,
+  OP_CLASS_SUBOP,
+  OP_CLASS_RECOVERY,
+  OP_CLASS_SCRUB,
+  OP_CLASS_SNAPTRIM,
+  OP_CLASS_MAX
+};
+extern const char *op_class_name(int c);
+
 /**
  * The OpRequest takes in a Message* and takes over a single reference
  * to it, which it puts() when destroyed.
@@ -103,6 +114,7 @@ private:
   uint8_t hit_flag_points;
   uint8_t latest_flag_point;
   uint64_t seq;
+  int op_class;
   static const uint8_t flag_queued_for_pg=1 << 0;
   static const uint8_t flag_reached_pg =  1 << 1;
   static const uint8_t flag_delayed =     1 << 2;
@@ -115,7 +127,7 @@ private:
     lock("OpRequest::lock"),
     tracker(tracker),
     hit_flag_points(0), latest_flag_point(0),
-    seq(0) {
+    seq(0), op_class(OP_CLASS_CLIENT) {
     received_time = request->get_recv_stamp();
     tracker->register_inflight_op(&xitem);
   }
@@ -177,6 +189,9 @@ public:
   osd_reqid_t get_reqid() const {
     return reqid;
   }
+  int get_op_class() const {
+    return op_class;
+  }
 };
 
 #endif /* OPREQUEST_H_ */
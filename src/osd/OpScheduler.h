@@ -0,0 +1,238 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OSD_OPSCHEDULER_H
+#define CEPH_OSD_OPSCHEDULER_H
+
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <vector>
+
+#include "include/utime.h"
+
+/**
+ * Chooses which class of work an OSD does next.  This is mClock (Gulati
+ * et al., OSDI '10) with classes of work in place of clients.
+ *
+ * Each class has a reservation, in ops/s, that it gets before weights
+ * are considered.  Its weight sets its share of what is left.  Above
+ * its limit, in ops/s, it waits.  A reservation or limit of 0 means
+ * none.
+ *
+ * Work comes in two ways.  Some is queued here as items, like client
+ * ops and replica ops.  Other work runs on its own threads, like
+ * recovery, scrub and snap trim, and asks admit() before each piece.
+ * Admitted work is charged the same tags as a queued item would be.
+ * So background work yields to queued ops unless its reservation is
+ * due, or its weight lets it pass them.
+ */
+template <typename T>
+class OpScheduler {
+public:
+  struct params_t {
+    double reservation, weight, limit;
+    params_t(double r = 0, double w = 1, double l = 0)
+      : reservation(r), weight(w), limit(l) {}
+  };
+
+private:
+  struct request_t {
+    T item;
+    double r, p, l;   ///< reservation, proportional and limit tags
+    utime_t stamp;    ///< when it was queued
+  };
+  struct class_t {
+    params_t params;
+    double r, p, l;   ///< tags of the last request charged
+    std::list<request_t> q;
+    class_t() : r(0), p(0), l(0) {}
+  };
+  std::vector<class_t> classes;
+  unsigned length;
+
+  static double inf() {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  void next_tags(const class_t &c, double now, request_t *req) const {
+    const params_t &pr = c.params;
+    req->r = pr.reservation > 0 ? std::max(c.r + 1.0 / pr.reservation, now) : inf();
+    req->p = pr.weight > 0 ? std::max(c.p + 1.0 / pr.weight, now) : inf();
+    req->l = pr.limit > 0 ? std::max(c.l + 1.0 / pr.limit, now) : 0;
+  }
+
+  /// served out of its share, not its reservation: give that back
+  void refund_reservation(class_t &c) {
+    if (c.params.reservation <= 0)
+      return;
+    double d = 1.0 / c.params.reservation;
+    c.r -= d;
+    for (typename std::list<request_t>::iterator i = c.q.begin(); i != c.q.end(); ++i)
+      i->r -= d;
+  }
+
+  void charge(class_t &c, const request_t &req, bool weight_phase) {
+    if (c.params.reservation > 0) {
+      c.r = req.r;
+      if (weight_phase)
+	refund_reservation(c);
+    }
+    if (c.params.weight > 0)
+      c.p = req.p;
+    if (c.params.limit > 0)
+      c.l = req.l;
+  }
+
+  /// a class coming back from idle starts level with the others, not ahead
+  void catch_up(class_t &c) {
+    if (!c.q.empty() || c.params.weight <= 0)
+      return;
+    double min_p = inf();
+    for (unsigned i = 0; i < classes.size(); ++i)
+      if (!classes[i].q.empty())
+	min_p = std::min(min_p, classes[i].q.front().p);
+    if (min_p < inf())
+      c.p = std::max(c.p, min_p - 1.0 / c.params.weight);
+  }
+
+public:
+  explicit OpScheduler(unsigned num_classes)
+    : classes(num_classes), length(0) {}
+
+  void set_params(unsigned c, const params_t &p) {
+    classes[c].params = p;
+  }
+  const params_t &get_params(unsigned c) const {
+    return classes[c].params;
+  }
+
+  bool empty() const {
+    return length == 0;
+  }
+  unsigned size() const {
+    return length;
+  }
+  unsigned size(unsigned c) const {
+    return classes[c].q.size();
+  }
+
+  void enqueue(unsigned c, T item, utime_t now) {
+    class_t &k = classes[c];
+    catch_up(k);
+    request_t req;
+    next_tags(k, (double)now, &req);
+    req.item = item;
+    req.stamp = now;
+    charge(k, req, false);
+    k.q.push_back(req);
+    length++;
+  }
+
+  /**
+   * Take the next item: the earliest reservation that is due, else the
+   * earliest proportional tag among classes under their limit.
+   *
+   * @param strict if false and every class with work is over its limit,
+   *               take from the one that comes under it first rather
+   *               than nothing
+   * @return false if nothing may go now
+   */
+  bool dequeue(utime_t now, bool strict, T *item, unsigned *cls, utime_t *stamp) {
+    double t = now;
+    int best = -1;
+    for (unsigned i = 0; i < classes.size(); ++i) {
+      if (classes[i].q.empty())
+	continue;
+      const request_t &req = classes[i].q.front();
+      if (req.r <= t && (best < 0 || req.r < classes[best].q.front().r))
+	best = i;
+    }
+    bool weight_phase = false;
+    if (best < 0) {
+      weight_phase = true;
+      for (unsigned i = 0; i < classes.size(); ++i) {
+	if (classes[i].q.empty())
+	  continue;
+	const request_t &req = classes[i].q.front();
+	if (req.l <= t && (best < 0 || req.p < classes[best].q.front().p))
+	  best = i;
+      }
+    }
+    if (best < 0 && !strict) {
+      for (unsigned i = 0; i < classes.size(); ++i) {
+	if (classes[i].q.empty())
+	  continue;
+	if (best < 0 || classes[i].q.front().l < classes[best].q.front().l)
+	  best = i;
+      }
+    }
+    if (best < 0)
+      return false;
+
+    class_t &k = classes[best];
+    *item = k.q.front().item;
+    *cls = best;
+    *stamp = k.q.front().stamp;
+    k.q.pop_front();
+    length--;
+    if (weight_phase)
+      refund_reservation(k);
+    return true;
+  }
+
+  /**
+   * May one piece of class c's background work start now?  It is only
+   * charged if so.
+   */
+  bool admit(unsigned c, utime_t now) {
+    class_t &k = classes[c];
+    double t = now;
+    catch_up(k);
+    request_t req;
+    next_tags(k, t, &req);
+    if (req.r <= t) {
+      charge(k, req, false);
+      return true;
+    }
+    if (req.l > t)
+      return false;
+    for (unsigned i = 0; i < classes.size(); ++i) {
+      if (classes[i].q.empty())
+	continue;
+      const request_t &head = classes[i].q.front();
+      if (head.r <= t || (head.l <= t && head.p < req.p))
+	return false;
+    }
+    charge(k, req, true);
+    return true;
+  }
+
+  /// when admit(c) will next succeed on reservation alone (inf if never)
+  double reservation_due(unsigned c) const {
+    const class_t &k = classes[c];
+    if (k.params.reservation <= 0)
+      return inf();
+    return k.r + 1.0 / k.params.reservation;
+  }
+
+  /// drop every queued copy of item; @return how many there were
+  unsigned remove(const T &item) {
+    unsigned n = 0;
+    for (unsigned c = 0; c < classes.size(); ++c) {
+      for (typename std::list<request_t>::iterator i = classes[c].q.begin();
+	   i != classes[c].q.end(); ) {
+	if (i->item == item) {
+	  classes[c].q.erase(i++);
+	  n++;
+	} else {
+	  ++i;
+	}
+      }
+    }
+    length -= n;
+    return n;
+  }
+};
+
+#endif
@@ -18,6 +18,7 @@
 #include "OpRequest.h"
 
 #include "common/Timer.h"
+#include "common/perf_counters.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDPGNotify.h"
@@ -27,6 +28,9 @@
 #include "messages/MOSDPGTrim.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDPGPush.h"
+#include "messages/MOSDPGPull.h"
+#include "messages/MOSDPGPushReply.h"
 
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
@@ -62,7 +66,7 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   osd(o), osdmap_ref(curmap), pool(_pool),
   _lock("PG::_lock"),
   _qlock("PG::_qlock"),
-  ref(0), deleting(false), dirty_info(false), dirty_log(false),
+  ref(0), deleting(false), dirty_info(false), dirty_log(false), log_loaded(true),
   info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
   recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), stat_queue_item(this),
   recovery_ops_active(0),
@@ -1597,6 +1601,11 @@ void PG::do_request(OpRequestRef op)
 
   switch (op->request->get_type()) {
   case CEPH_MSG_OSD_OP:
+    if (!is_primary() && !is_active()) {
+      // a read meant for a replica; the primary can take it
+      osd->reply_op_error(op, -EAGAIN);
+      return;
+    }
     if (is_replay() || !is_active()) {
       waiting_for_active.push_back(op);
       return;
@@ -1620,9 +1629,24 @@ void PG::do_request(OpRequestRef op)
     do_backfill(op);
     break;
 
+  case MSG_OSD_PG_PUSH:
+    do_push(op);
+    break;
+
+  case MSG_OSD_PG_PULL:
+    do_pull(op);
+    break;
+
+  case MSG_OSD_PG_PUSH_REPLY:
+    do_push_reply(op);
+    break;
+
   default:
     assert(0 == "bad message type in do_request");
   }
+
+  // anything the op started recovering goes out in as few messages as we can
+  send_pending_recovery();
 }
 
 
@@ -2514,7 +2538,12 @@ std::string PG::get_corrupt_pg_log_name() const
   return buf;
 }
 
-void PG::read_state(ObjectStore *store)
+/*
+ * read pg info.  if lazy_log, reading the log and building the missing
+ * set is left to the first peering event that needs them, via
+ * ensure_log_loaded().
+ */
+void PG::read_state(ObjectStore *store, bool lazy_log)
 {
   bufferlist bl;
   bufferlist::iterator p;
@@ -2556,6 +2585,16 @@ void PG::read_state(ObjectStore *store)
       ::decode(info, p);
   }
 
+  if (lazy_log) {
+    log_loaded = false;
+    return;
+  }
+  load_log(store);
+}
+
+void PG::load_log(ObjectStore *store)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
   try {
     read_log(store);
   }
@@ -2586,8 +2625,21 @@ void PG::read_state(ObjectStore *store)
     info.stats.stats.clear();
   }
 
+  log_loaded = true;
+
   // log any weirdness
   log_weirdness();
+
+  if (osd->logger)
+    osd->logger->finc(l_osd_pg_log_load_lat, ceph_clock_now(g_ceph_context) - start);
+}
+
+void PG::ensure_log_loaded()
+{
+  if (!log_loaded) {
+    dout(10) << "ensure_log_loaded reading deferred log" << dendl;
+    load_log(osd->store);
+  }
 }
 
 void PG::log_weirdness()
@@ -2710,9 +2762,9 @@ void PG::requeue_ops(list<OpRequestRef> &ls)
   dout(15) << " requeue_ops " << ls << dendl;
   lockq();
   assert(&ls != &op_queue);
-  size_t requeue_size = ls.size();
+  for (list<OpRequestRef>::iterator i = ls.begin(); i != ls.end(); ++i)
+    osd->queue_for_op(this, (*i)->get_op_class());
   op_queue.splice(op_queue.begin(), ls, ls.begin(), ls.end());
-  for (size_t i = 0; i < requeue_size; ++i) osd->queue_for_op(this);
   unlockq();
 }
 
@@ -2872,18 +2924,39 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
 
       // calculate the CRC32 on deep scrubs
       if (deep) {
-        bufferhash h;
-        bufferlist bl;
+        bufferhash h, oh;
+        bufferlist bl, hdrbl;
         int r;
         __u64 pos = 0;
         while ( (r = osd->store->read(coll, poid, pos,
-                                      g_conf->osd_deep_scrub_stride, bl)) > 0) {
+                                      g_conf->osd_deep_scrub_stride, bl,
+                                      ObjectStore::READ_SEQUENTIAL)) > 0) {
           h << bl;
           pos += bl.length();
           bl.clear();
         }
         o.digest = h.digest();
         o.digest_present = true;
+
+        // and over the omap: header, then each key and value
+        uint64_t omap_bytes = 0;
+        osd->store->omap_get_header(coll, poid, &hdrbl);
+        oh << hdrbl;
+        omap_bytes += hdrbl.length();
+        ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(coll, poid);
+        if (iter) {
+          for (iter->seek_to_first(); iter->valid(); iter->next()) {
+            bufferlist kv;
+            ::encode(iter->key(), kv);
+            ::encode(iter->value(), kv);
+            oh << kv;
+            omap_bytes += kv.length();
+          }
+        }
+        o.omap_digest = oh.digest();
+        o.omap_digest_present = true;
+
+        osd->scrub_bw_take(pos + omap_bytes);
       }
 
       dout(25) << "_scan_list  " << poid << dendl;
@@ -3779,6 +3852,16 @@ bool PG::_compare_scrub_objects(ScrubMap::object &auth,
                   << " != known digest " << auth.digest;
     }
   }
+  if (auth.omap_digest_present && candidate.omap_digest_present) {
+    if (auth.omap_digest != candidate.omap_digest) {
+      if (!ok)
+        errorstream << ", ";
+      ok = false;
+
+      errorstream << "omap digest " << candidate.omap_digest
+                  << " != known omap digest " << auth.omap_digest;
+    }
+  }
   for (map<string,bufferptr>::const_iterator i = auth.attrs.begin();
        i != auth.attrs.end();
        i++) {
@@ -4347,6 +4430,8 @@ void PG::start_peering_interval(const OSDMapRef lastmap,
   // reset primary state?
   if (oldrole == 0 || get_role() == 0)
     clear_primary_state();
+  else
+    min_last_complete_ondisk = eversion_t();  // until the primary tells us
 
     
   // pg->on_*
@@ -4576,6 +4661,19 @@ bool PG::can_discard_backfill(OpRequestRef op)
 
 }
 
+template<typename T, int MSGTYPE>
+bool PG::can_discard_replica_op(OpRequestRef op)
+{
+  T *m = static_cast<T *>(op->request);
+  assert(m->get_header().type == MSGTYPE);
+
+  if (old_peering_msg(m->map_epoch, m->map_epoch)) {
+    dout(10) << " got old " << m->get_type_name() << ", ignoring" << dendl;
+    return true;
+  }
+  return false;
+}
+
 bool PG::can_discard_request(OpRequestRef op)
 {
   switch (op->request->get_type()) {
@@ -4590,6 +4688,13 @@ bool PG::can_discard_request(OpRequestRef op)
 
   case MSG_OSD_PG_BACKFILL:
     return can_discard_backfill(op);
+
+  case MSG_OSD_PG_PUSH:
+    return can_discard_replica_op<MOSDPGPush, MSG_OSD_PG_PUSH>(op);
+  case MSG_OSD_PG_PULL:
+    return can_discard_replica_op<MOSDPGPull, MSG_OSD_PG_PULL>(op);
+  case MSG_OSD_PG_PUSH_REPLY:
+    return can_discard_replica_op<MOSDPGPushReply, MSG_OSD_PG_PUSH_REPLY>(op);
   }
   return true;
 }
@@ -4616,6 +4721,18 @@ bool PG::must_delay_request(OpRequestRef op)
   case MSG_OSD_PG_BACKFILL:
     return !require_same_or_newer_map(
       static_cast<MOSDPGBackfill*>(op->request)->map_epoch);
+
+  case MSG_OSD_PG_PUSH:
+    return !require_same_or_newer_map(
+      static_cast<MOSDPGPush*>(op->request)->map_epoch);
+
+  case MSG_OSD_PG_PULL:
+    return !require_same_or_newer_map(
+      static_cast<MOSDPGPull*>(op->request)->map_epoch);
+
+  case MSG_OSD_PG_PUSH_REPLY:
+    return !require_same_or_newer_map(
+      static_cast<MOSDPGPushReply*>(op->request)->map_epoch);
   }
   assert(0);
   return false;
@@ -4625,7 +4742,7 @@ void PG::queue_op(OpRequestRef op)
 {
   _qlock.Lock();
   op_queue.push_back(op);
-  osd->queue_for_op(this);
+  osd->queue_for_op(this, op->get_op_class());
   _qlock.Unlock();
 }
 
@@ -4636,8 +4753,10 @@ void PG::take_waiters()
   for (list<CephPeeringEvtRef>::iterator i = peering_waiters.begin();
        i != peering_waiters.end();
        ++i) osd->queue_for_peering(this);
+  lockq();
   peering_queue.splice(peering_queue.begin(), peering_waiters,
 		       peering_waiters.begin(), peering_waiters.end());
+  unlockq();
 }
 
 void PG::handle_peering_event(CephPeeringEvtRef evt, RecoveryCtx *rctx)
@@ -4650,6 +4769,7 @@ void PG::handle_peering_event(CephPeeringEvtRef evt, RecoveryCtx *rctx)
   }
   if (old_peering_evt(evt))
     return;
+  ensure_log_loaded();
   recovery_state.handle_event(evt, rctx);
 }
 
@@ -4657,16 +4777,51 @@ void PG::queue_peering_event(CephPeeringEvtRef evt)
 {
   if (old_peering_evt(evt))
     return;
+  lockq();
+  peering_queue.push_back(evt);
+  unlockq();
+  osd->queue_for_peering(this);
+}
+
+/*
+ * Events from peers are queued without the pg lock, so the dispatch
+ * thread never waits behind a peering thread working on this pg.  They
+ * go on the same queue as local events, in arrival order, and
+ * handle_peering_event() drops the stale ones.  Nothing here may look
+ * at pg state.
+ */
+void PG::queue_incoming_peering_event(CephPeeringEvtRef evt)
+{
+  lockq();
   peering_queue.push_back(evt);
+  unlockq();
   osd->queue_for_peering(this);
 }
 
+PG::CephPeeringEvtRef PG::take_peering_event()
+{
+  CephPeeringEvtRef evt;
+  lockq();
+  if (!peering_queue.empty()) {
+    evt = peering_queue.front();
+    peering_queue.pop_front();
+  }
+  unlockq();
+  return evt;
+}
+
+void PG::clear_peering_queue()
+{
+  lockq();
+  peering_queue.clear();
+  unlockq();
+}
+
 void PG::queue_notify(epoch_t msg_epoch,
 		      epoch_t query_epoch,
 		      int from, pg_notify_t& i)
 {
-  dout(10) << "notify " << i << " from osd." << from << dendl;
-  queue_peering_event(
+  queue_incoming_peering_event(
     CephPeeringEvtRef(new CephPeeringEvt(msg_epoch, query_epoch,
 					 MNotifyRec(from, i))));
 }
@@ -4675,8 +4830,7 @@ void PG::queue_info(epoch_t msg_epoch,
 		     epoch_t query_epoch,
 		     int from, pg_info_t& i)
 {
-  dout(10) << "info " << i << " from osd." << from << dendl;
-  queue_peering_event(
+  queue_incoming_peering_event(
     CephPeeringEvtRef(new CephPeeringEvt(msg_epoch, query_epoch,
 					 MInfoRec(from, i, msg_epoch))));
 }
@@ -4686,8 +4840,7 @@ void PG::queue_log(epoch_t msg_epoch,
 		   int from,
 		   MOSDPGLog *msg)
 {
-  dout(10) << "log " << *msg << " from osd." << from << dendl;
-  queue_peering_event(
+  queue_incoming_peering_event(
     CephPeeringEvtRef(new CephPeeringEvt(msg_epoch, query_epoch,
 					 MLogRec(from, msg))));
 }
@@ -4713,8 +4866,7 @@ void PG::queue_query(epoch_t msg_epoch,
 		     epoch_t query_epoch,
 		     int from, const pg_query_t& q)
 {
-  dout(10) << "handle_query " << q << " from osd." << from << dendl;
-  queue_peering_event(
+  queue_incoming_peering_event(
     CephPeeringEvtRef(new CephPeeringEvt(msg_epoch, query_epoch,
 					 MQuery(from, q, query_epoch))));
 }
@@ -4729,6 +4881,7 @@ void PG::handle_advance_map(OSDMapRef osdmap, OSDMapRef lastmap,
   dout(10) << "handle_advance_map " << newup << "/" << newacting << dendl;
   osdmap_ref = osdmap;
   pool.update(osdmap);
+  ensure_log_loaded();
   AdvMap evt(osdmap, lastmap, newup, newacting);
   recovery_state.handle_event(evt, rctx);
 }
@@ -4736,6 +4889,7 @@ void PG::handle_advance_map(OSDMapRef osdmap, OSDMapRef lastmap,
 void PG::handle_activate_map(RecoveryCtx *rctx)
 {
   dout(10) << "handle_activate_map " << dendl;
+  ensure_log_loaded();
   ActMap evt;
   recovery_state.handle_event(evt, rctx);
 }
@@ -4766,6 +4920,7 @@ void PG::handle_create(RecoveryCtx *rctx)
 void PG::handle_query_state(Formatter *f)
 {
   dout(10) << "handle_query_state" << dendl;
+  ensure_log_loaded();
   QueryState q(f);
   recovery_state.handle_event(q, 0);
 }
@@ -67,14 +67,20 @@ class MOSDPGInfo;
 
 
 struct PGRecoveryStats {
+  /// histogram buckets: [0] is under 1ms, [i] under 2^i ms, the last unbounded
+  static const unsigned NUM_BUCKETS = 20;
+
   struct per_state_info {
     uint64_t enter, exit;     // enter/exit counts
     uint64_t events;
     utime_t event_time;       // time spent processing events
     utime_t total_time;       // total time in state
     utime_t min_time, max_time;
+    uint64_t hist[NUM_BUCKETS];  // exits by time in state
 
-    per_state_info() : enter(0), exit(0), events(0) {}
+    per_state_info() : enter(0), exit(0), events(0) {
+      memset(hist, 0, sizeof(hist));
+    }
   };
   map<const char *,per_state_info> info;
   Mutex lock;
@@ -97,6 +103,17 @@ struct PGRecoveryStats {
 	       
     }
   }
+  void dump_histogram(ostream& out) {
+    Mutex::Locker l(lock);
+    for (unsigned b = 0; b < NUM_BUCKETS - 1; b++)
+      out << "<" << (1 << b) << "ms\t";
+    out << "more\tstate\n";
+    for (map<const char *,per_state_info>::iterator p = info.begin(); p != info.end(); p++) {
+      for (unsigned b = 0; b < NUM_BUCKETS; b++)
+	out << p->second.hist[b] << "\t";
+      out << p->first << "\n";
+    }
+  }
 
   void log_enter(const char *s) {
     Mutex::Locker l(lock);
@@ -113,6 +130,11 @@ struct PGRecoveryStats {
       i.min_time = dur;
     i.events += events;
     i.event_time += event_dur;
+    uint64_t ms = (uint64_t)dur.sec() * 1000 + dur.nsec() / 1000000;
+    unsigned b = 0;
+    while (b < NUM_BUCKETS - 1 && ms >= (1ull << b))
+      b++;
+    i.hist[b]++;
   }
 };
 
@@ -404,8 +426,10 @@ public:
 
 
   list<OpRequestRef> op_queue;  // op queue
+  atomic_t op_sched_due[OP_CLASS_MAX];  ///< slots the osd scheduled, per class, not yet taken
 
   bool dirty_info, dirty_log;
+  bool log_loaded;  ///< false until read_log() is run, if that's deferred
 
 public:
   // pg state
@@ -943,7 +967,7 @@ public:
     string get_desc() { return desc; }
   };
   typedef std::tr1::shared_ptr<CephPeeringEvt> CephPeeringEvtRef;
-  list<CephPeeringEvtRef> peering_queue;  // op queue
+  list<CephPeeringEvtRef> peering_queue;  ///< under _qlock, @see take_peering_event
   list<CephPeeringEvtRef> peering_waiters;
 
   struct QueryState : boost::statechart::event< QueryState > {
@@ -1557,7 +1581,9 @@ public:
   void trim_peers();
 
   std::string get_corrupt_pg_log_name() const;
-  void read_state(ObjectStore *store);
+  void read_state(ObjectStore *store, bool lazy_log=false);
+  void load_log(ObjectStore *store);
+  void ensure_log_loaded();
   coll_t make_snap_collection(ObjectStore::Transaction& t, snapid_t sn);
   void update_snap_collections(vector<pg_log_entry_t> &log_entries,
 			       ObjectStore::Transaction& t);
@@ -1593,6 +1619,8 @@ public:
   bool can_discard_scan(OpRequestRef op);
   bool can_discard_subop(OpRequestRef op);
   bool can_discard_backfill(OpRequestRef op);
+  template<typename T, int MSGTYPE>
+  bool can_discard_replica_op(OpRequestRef op);
   bool can_discard_request(OpRequestRef op);
 
   bool must_delay_request(OpRequestRef op);
@@ -1612,6 +1640,9 @@ public:
   // recovery bits
   void take_waiters();
   void queue_peering_event(CephPeeringEvtRef evt);
+  void queue_incoming_peering_event(CephPeeringEvtRef evt);
+  CephPeeringEvtRef take_peering_event();
+  void clear_peering_queue();
   void handle_peering_event(CephPeeringEvtRef evt, RecoveryCtx *rctx);
   void queue_notify(epoch_t msg_epoch, epoch_t query_epoch,
 		    int from, pg_notify_t& i);
@@ -1643,6 +1674,10 @@ public:
   virtual void do_sub_op_reply(OpRequestRef op) = 0;
   virtual void do_scan(OpRequestRef op) = 0;
   virtual void do_backfill(OpRequestRef op) = 0;
+  virtual void do_push(OpRequestRef op) = 0;
+  virtual void do_pull(OpRequestRef op) = 0;
+  virtual void do_push_reply(OpRequestRef op) = 0;
+  virtual void send_pending_recovery() = 0;
   virtual void snap_trimmer() = 0;
 
   virtual int do_command(vector<string>& cmd, ostream& ss,
@@ -30,6 +30,9 @@
 #include "messages/MOSDPGTrim.h"
 #include "messages/MOSDPGScan.h"
 #include "messages/MOSDPGBackfill.h"
+#include "messages/MOSDPGPush.h"
+#include "messages/MOSDPGPull.h"
+#include "messages/MOSDPGPushReply.h"
 
 #include "messages/MOSDPing.h"
 #include "messages/MWatchNotify.h"
@@ -130,6 +133,31 @@ void ReplicatedPG::wait_for_all_missing(OpRequestRef op)
   waiting_for_all_missing.push_back(op);
 }
 
+/*
+ * Our copy of soid failed a read (with filestore_csum, a checksum
+ * mismatch).  If a replica has the object, mark ours missing so that
+ * it is pulled from there.
+ */
+bool ReplicatedPG::recover_read_error(const hobject_t& soid, eversion_t v)
+{
+  if (!is_primary() || is_missing_object(soid))
+    return false;
+  for (unsigned i = 1; i < acting.size(); i++) {
+    int peer = acting[i];
+    if (peer == backfill_target ||
+	(peer_missing.count(peer) && peer_missing[peer].is_missing(soid)))
+      continue;
+    osd->clog.error() << info.pgid << " " << soid << " v " << v
+		      << " failed to read, recovering it from osd." << peer << "\n";
+    missing.add(soid, v, eversion_t());
+    missing_loc[soid].insert(peer);
+    missing_loc_sources.insert(peer);
+    osd->queue_for_recovery(this);
+    return true;
+  }
+  return false;
+}
+
 bool ReplicatedPG::is_degraded_object(const hobject_t& soid)
 {
   if (missing.missing.count(soid))
@@ -398,6 +426,46 @@ bool ReplicatedPG::pg_op_must_wait(MOSDOp *op)
   return false;
 }
 
+/**
+ * A replica serves a balanced or localized read only if it has the
+ * object, and every write to it is committed by the whole acting set,
+ * so a new primary can't roll it back.  min_last_complete_ondisk is
+ * as of the primary's last sub op, so this errs toward the primary.
+ */
+bool ReplicatedPG::can_serve_replica_read(MOSDOp *op)
+{
+  if (!is_replica() ||
+      !(op->get_flags() & (CEPH_OSD_FLAG_BALANCE_READS |
+			   CEPH_OSD_FLAG_LOCALIZE_READS)) ||
+      (op->get_rmw_flags() & CEPH_OSD_FLAG_PGOP) ||
+      op->may_write() ||
+      op->get_map_epoch() < info.history.same_interval_since)
+    return false;
+
+  hobject_t head(op->get_oid(), op->get_object_locator().key,
+		 CEPH_NOSNAP, op->get_pg().ps(),
+		 info.pgid.pool());
+  hobject_t snapdir(op->get_oid(), op->get_object_locator().key,
+		    CEPH_SNAPDIR, op->get_pg().ps(), info.pgid.pool());
+  if (head > info.last_backfill ||
+      is_missing_object(head) || is_missing_object(snapdir))
+    return false;
+
+  // the newest write must be durable everywhere, and applied here: the
+  // journal commits (and the primary acks) before the store applies
+  hash_map<hobject_t,pg_log_entry_t*>::const_iterator p = log.objects.find(head);
+  if (p != log.objects.end() &&
+      (p->second->version > min_last_complete_ondisk ||
+       p->second->version > last_update_applied))
+    return false;
+  p = log.objects.find(snapdir);
+  if (p != log.objects.end() &&
+      (p->second->version > min_last_complete_ondisk ||
+       p->second->version > last_update_applied))
+    return false;
+  return true;
+}
+
 void ReplicatedPG::do_pg_op(OpRequestRef op)
 {
   MOSDOp *m = (MOSDOp *)op->request;
@@ -537,6 +605,30 @@ void ReplicatedPG::do_pg_op(OpRequestRef op)
       }
       break;
 
+    case CEPH_OSD_OP_PG_HITSET_LS:
+      {
+	list<pair<utime_t,utime_t> > ls;
+	result = hit_set_list(&ls);
+	if (result == 0)
+	  ::encode(ls, outdata);
+      }
+      break;
+
+    case CEPH_OSD_OP_PG_HITSET_GET:
+      {
+	utime_t stamp;
+	try {
+	  ::decode(stamp, bp);
+	}
+	catch (const buffer::error& e) {
+	  dout(0) << "unable to decode PG_HITSET_GET stamp in " << *m << dendl;
+	  result = -EINVAL;
+	  break;
+	}
+	result = hit_set_get(stamp, &outdata);
+      }
+      break;
+
     default:
       result = -EINVAL;
       break;
@@ -552,6 +644,170 @@ void ReplicatedPG::do_pg_op(OpRequestRef op)
   delete filter;
 }
 
+// ==========================================================
+// hit sets
+
+/*
+ * Sealed hit sets are kept in the omap of a meta object, one key per
+ * set.  The key holds the interval, so they sort by time and can be
+ * listed without reading the filters.
+ */
+string ReplicatedPG::hit_set_key(utime_t begin, utime_t end)
+{
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%010u.%09u_%010u.%09u",
+	   begin.sec(), begin.nsec(), end.sec(), end.nsec());
+  return string(buf);
+}
+
+bool ReplicatedPG::hit_set_key_parse(const string &key, utime_t *begin, utime_t *end)
+{
+  unsigned bs, bn, es, en;
+  if (sscanf(key.c_str(), "%u.%u_%u.%u", &bs, &bn, &es, &en) != 4)
+    return false;
+  *begin = utime_t(bs, bn);
+  *end = utime_t(es, en);
+  return true;
+}
+
+void ReplicatedPG::hit_set_load_keys()
+{
+  if (hit_set_keys_loaded)
+    return;
+  hit_set_keys.clear();
+  // the first load comes before this pg queues any hit set writes of
+  // its own, and hit_set_keys tracks them from then on, so there is
+  // nothing to flush
+  int r = osd->store->omap_get_keys(coll_t::META_COLL, hit_set_oid, &hit_set_keys);
+  if (r < 0 && r != -ENOENT)
+    dout(0) << "hit_set_load_keys got " << cpp_strerror(r) << dendl;
+  hit_set_keys_loaded = true;
+}
+
+/// note an access to oid, sealing the current set first if its period is up
+void ReplicatedPG::hit_set_record(const object_t &oid)
+{
+  int period = g_conf->osd_hit_set_period;
+  if (period <= 0) {
+    hit_set_clear();
+    return;
+  }
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (hit_set) {
+    utime_t due = hit_set->begin;
+    due += (double)period;
+    if (now >= due)
+      hit_set_persist(now);
+  }
+  if (!hit_set)
+    hit_set = new HitSet(g_conf->osd_hit_set_target_size, g_conf->osd_hit_set_fpp,
+			 info.pgid.ps(), now);
+  hit_set->insert(oid.name);
+}
+
+/// seal the current set at now, store it, and trim the oldest
+void ReplicatedPG::hit_set_persist(utime_t now)
+{
+  assert(hit_set);
+  hit_set->end = now;
+  string key = hit_set_key(hit_set->begin, hit_set->end);
+  dout(10) << "hit_set_persist " << key << " with "
+	   << hit_set->insert_count() << " inserts" << dendl;
+  hit_set_load_keys();
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  map<string, bufferlist> to_set;
+  ::encode(*hit_set, to_set[key]);
+  t->touch(coll_t::META_COLL, hit_set_oid);
+  t->omap_setkeys(coll_t::META_COLL, hit_set_oid, to_set);
+  hit_set_keys.insert(key);
+
+  set<string> to_rm;
+  while ((int)hit_set_keys.size() > MAX(g_conf->osd_hit_set_count, 0)) {
+    to_rm.insert(*hit_set_keys.begin());
+    hit_set_keys.erase(hit_set_keys.begin());
+  }
+  if (!to_rm.empty())
+    t->omap_rmkeys(coll_t::META_COLL, hit_set_oid, to_rm);
+
+  int r = osd->store->queue_transaction(osr.get(), t,
+					new ObjectStore::C_DeleteTransaction(t));
+  assert(r == 0);
+
+  delete hit_set;
+  hit_set = NULL;
+}
+
+void ReplicatedPG::hit_set_clear()
+{
+  delete hit_set;
+  hit_set = NULL;
+}
+
+/// the intervals of the sealed sets, oldest first, then the open one
+int ReplicatedPG::hit_set_list(list<pair<utime_t,utime_t> > *ls)
+{
+  hit_set_load_keys();
+  for (set<string>::iterator p = hit_set_keys.begin(); p != hit_set_keys.end(); ++p) {
+    utime_t begin, end;
+    if (hit_set_key_parse(*p, &begin, &end))
+      ls->push_back(make_pair(begin, end));
+  }
+  if (hit_set)
+    ls->push_back(make_pair(hit_set->begin, utime_t()));
+  return 0;
+}
+
+/// the encoded set whose interval covers stamp
+int ReplicatedPG::hit_set_get(utime_t stamp, bufferlist *bl)
+{
+  if (hit_set && stamp >= hit_set->begin) {
+    ::encode(*hit_set, *bl);
+    return 0;
+  }
+  hit_set_load_keys();
+  for (set<string>::iterator p = hit_set_keys.begin(); p != hit_set_keys.end(); ++p) {
+    utime_t begin, end;
+    if (!hit_set_key_parse(*p, &begin, &end) ||
+	stamp < begin || stamp > end)
+      continue;
+    set<string> keys;
+    keys.insert(*p);
+    map<string, bufferlist> values;
+    osr->flush();
+    int r = osd->store->omap_get_values(coll_t::META_COLL, hit_set_oid, keys, &values);
+    if (r < 0)
+      return r;
+    if (!values.count(*p))
+      return -ENOENT;
+    bl->claim_append(values[*p]);
+    return 0;
+  }
+  return -ENOENT;
+}
+
+void ReplicatedPG::dump_hit_sets(Formatter *f)
+{
+  f->dump_stream("pgid") << info.pgid;
+  f->open_array_section("hit_sets");
+  hit_set_load_keys();
+  for (set<string>::iterator p = hit_set_keys.begin(); p != hit_set_keys.end(); ++p) {
+    utime_t begin, end;
+    if (!hit_set_key_parse(*p, &begin, &end))
+      continue;
+    f->open_object_section("hit_set");
+    f->dump_stream("begin") << begin;
+    f->dump_stream("end") << end;
+    f->close_section();
+  }
+  if (hit_set) {
+    f->open_object_section("hit_set");
+    hit_set->dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
 void ReplicatedPG::calc_trim_to()
 {
   if (!is_degraded() && !is_scrubbing() && is_clean()) {
@@ -584,7 +840,10 @@ void ReplicatedPG::calc_trim_to()
 ReplicatedPG::ReplicatedPG(OSDService *o, OSDMapRef curmap,
 			   const PGPool &_pool, pg_t p, const hobject_t& oid,
 			   const hobject_t& ioid) :
-  PG(o, curmap, _pool, p, oid, ioid), temp_created(false),
+  PG(o, curmap, _pool, p, oid, ioid),
+  hit_set(NULL), hit_set_oid(OSD::make_pg_hit_set_oid(p)),
+  hit_set_keys_loaded(false),
+  temp_created(false),
   temp_coll(coll_t::make_temp_coll(p)), snap_trimmer_machine(this)
 { 
   snap_trimmer_machine.initiate();
@@ -605,6 +864,12 @@ void ReplicatedPG::do_op(OpRequestRef op)
 {
   MOSDOp *m = (MOSDOp*)op->request;
   assert(m->get_header().type == CEPH_MSG_OSD_OP);
+  if (!is_primary() && !can_serve_replica_read(m)) {
+    dout(10) << "do_op can't serve " << *m << " as a replica, sending it to the primary" << dendl;
+    osd->logger->inc(l_osd_op_r_redirect);
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
   if ((m->get_rmw_flags() & CEPH_OSD_FLAG_PGOP)) {
     if (pg_op_must_wait(m)) {
       wait_for_all_missing(op);
@@ -630,6 +895,16 @@ void ReplicatedPG::do_op(OpRequestRef op)
     }
   }
 
+  // stay behind ops waiting to read this object
+  map<hobject_t, list<OpRequestRef> >::iterator w = waiting_for_ondisk_read.find(head);
+  if (w != waiting_for_ondisk_read.end()) {
+    dout(10) << "do_op waiting behind " << w->second.size()
+	     << " ops to read " << head << dendl;
+    w->second.push_back(op);
+    op->mark_delayed();
+    return;
+  }
+
   // missing object?
   if (is_missing_object(head)) {
     wait_for_missing_object(head, op);
@@ -671,10 +946,10 @@ void ReplicatedPG::do_op(OpRequestRef op)
     &obc, can_create, &snapid);
   if (r) {
     if (r == -EAGAIN) {
-      // If we're not the primary of this OSD, and we have
-      // CEPH_OSD_FLAG_LOCALIZE_READS set, we just return -EAGAIN. Otherwise,
-      // we have to wait for the object.
-      if (is_primary() || (!(m->get_rmw_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      // If we're a replica serving a balanced or localized read, we just
+      // return -EAGAIN and the client goes to the primary. Otherwise, we
+      // have to wait for the object.
+      if (is_primary()) {
 	// missing the specific snap we need; requeue and wait.
 	assert(!can_create); // only happens on a read
 	hobject_t soid(m->get_oid(), m->get_object_locator().key,
@@ -814,6 +1089,20 @@ void ReplicatedPG::do_op(OpRequestRef op)
     return;
   }
 
+  // a plain read sees only applied state; a write that reads needs it
+  // only if it reads more than the object_info we project
+  bool ondisk_read = m->may_read() &&
+    (!m->may_write() || ops_read_ondisk(m->ops));
+  if (ondisk_read && obc->unapplied_repops) {
+    dout(10) << "do_op waiting for " << obc->unapplied_repops
+	     << " writes to " << obc->obs.oi.soid << " to apply" << dendl;
+    waiting_for_ondisk_read[head].push_back(op);
+    op->mark_delayed();
+    put_object_contexts(src_obc);
+    put_object_context(obc);
+    return;
+  }
+
   op->mark_started();
 
   const hobject_t& soid = obc->obs.oi.soid;
@@ -903,7 +1192,7 @@ void ReplicatedPG::do_op(OpRequestRef op)
   uint64_t old_size = obc->obs.oi.size;
   eversion_t old_version = obc->obs.oi.version;
 
-  if (m->may_read()) {
+  if (ondisk_read) {
     dout(10) << " taking ondisk_read_lock" << dendl;
     obc->ondisk_read_lock();
   }
@@ -914,7 +1203,7 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   int result = prepare_transaction(ctx);
 
-  if (m->may_read()) {
+  if (ondisk_read) {
     dout(10) << " dropping ondisk_read_lock" << dendl;
     obc->ondisk_read_unlock();
   }
@@ -931,6 +1220,31 @@ void ReplicatedPG::do_op(OpRequestRef op)
     return;
   }
 
+  // count the access only now that the op won't be requeued or bounced
+  if (is_primary())
+    hit_set_record(m->get_oid());
+
+  if (!is_primary() &&
+      (!ctx->op_t.empty() || ctx->modify || ctx->read_error)) {
+    // a read with side effects, or one we failed; the primary handles those
+    dout(10) << "do_op replica can't complete " << *m << ", sending it to the primary" << dendl;
+    osd->logger->inc(l_osd_op_r_redirect);
+    osd->reply_op_error(op, -EAGAIN);
+    delete ctx;
+    put_object_context(obc);
+    put_object_contexts(src_obc);
+    return;
+  }
+
+  if (ctx->read_error && ctx->op_t.empty() && !ctx->modify &&
+      recover_read_error(soid, obc->obs.oi.version)) {
+    wait_for_missing_object(soid, op);
+    delete ctx;
+    put_object_context(obc);
+    put_object_contexts(src_obc);
+    return;
+  }
+
   // prepare the reply
   ctx->reply = new MOSDOpReply(m, 0, get_osdmap()->get_epoch(), 0);
 
@@ -960,6 +1274,8 @@ void ReplicatedPG::do_op(OpRequestRef op)
     if (result >= 0) {
       log_op_stats(ctx);
       update_stats();
+      if (!is_primary())
+	osd->logger->inc(l_osd_op_r_replica);
     }
     
     MOSDOpReply *reply = ctx->reply;
@@ -1249,11 +1565,12 @@ void ReplicatedPG::do_backfill(OpRequestRef op)
   }
 }
 
-/* Returns head of snap_trimq as snap_to_trim and the relevant objects as 
- * obs_to_trim */
+/* Returns head of snap_trimq as snap_to_trim and the first of the
+ * relevant objects as obs_to_trim */
 bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
 				   coll_t &col_to_trim,
-				   vector<hobject_t> &obs_to_trim)
+				   vector<hobject_t> &obs_to_trim,
+				   hobject_t &next)
 {
   assert_locked();
   obs_to_trim.clear();
@@ -1275,22 +1592,38 @@ bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
   col_to_trim = coll_t(info.pgid, snap_to_trim);
 
   if (!snap_collections.contains(snap_to_trim)) {
+    next = hobject_t::get_max();
     return true;
   }
 
-  // flush pg ops to fs so we can rely on collection_list()
-  osr->flush();
+  next = hobject_t();
+  list_obs_to_trim(col_to_trim, obs_to_trim, next);
+  return true;
+}
 
-  osd->store->collection_list(col_to_trim, obs_to_trim);
+/* Lists the next osd_snap_trim_list_max objects of col_to_trim from
+ * next, rather than the whole collection at once */
+void ReplicatedPG::list_obs_to_trim(coll_t col_to_trim,
+				    vector<hobject_t> &obs_to_trim,
+				    hobject_t &next)
+{
+  obs_to_trim.clear();
 
-  return true;
+  // flush pg ops to fs so we can rely on collection_list_partial()
+  osr->flush();
+
+  int max = MAX(g_conf->osd_snap_trim_list_max, 1);
+  int r = osd->store->collection_list_partial(col_to_trim, next, max, max, 0,
+					      &obs_to_trim, &next);
+  assert(r == 0);
+  dout(10) << "list_obs_to_trim " << col_to_trim << " got " << obs_to_trim.size()
+	   << ", next " << next << dendl;
 }
 
-ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
-						   const snapid_t &sn)
+ReplicatedPG::ObjectContext *ReplicatedPG::get_clone_to_trim(const hobject_t &coid,
+							     const snapid_t &sn)
 {
   // load clone info
-  bufferlist bl;
   ObjectContext *obc = 0;
   int r = find_object_context(
     hobject_t(coid.oid, coid.get_key(), sn, coid.hash, info.pgid.pool()),
@@ -1301,30 +1634,91 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   }
   assert(r == 0);
   assert(obc->registered);
-  object_info_t &coi = obc->obs.oi;
-  vector<snapid_t>& snaps = coi.snaps;
 
   // get snap set context
   if (!obc->ssc)
     obc->ssc = get_snapset_context(coid.oid, coid.get_key(), coid.hash, false);
+  assert(obc->ssc);
+  return obc;
+}
+
+/*
+ * Trim up to max clones from p on, in one transaction and repop.  Each
+ * clone belongs to a different head, so the batch stops early at a
+ * second clone of one it already has.  Clones that are already gone
+ * are just dropped from the snap collection.  Returns NULL if no clone
+ * needed trimming.
+ */
+ReplicatedPG::RepGather *ReplicatedPG::trim_objects(vector<hobject_t>::iterator &p,
+						    vector<hobject_t>::iterator end,
+						    const snapid_t &sn,
+						    unsigned max)
+{
+  RepGather *repop = 0;
+  set<object_t> heads;
+  ObjectStore::Transaction *stale = 0;
+  unsigned n = 0;
+  for (; p != end && n < max; ++p) {
+    if (heads.count(p->oid))
+      break;
+    ObjectContext *obc = get_clone_to_trim(*p, sn);
+    if (!obc) {
+      // object has already been trimmed, this is an extra
+      dout(10) << "trim_objects " << *p << " already trimmed" << dendl;
+      if (!stale)
+	stale = new ObjectStore::Transaction;
+      stale->collection_remove(coll_t(info.pgid, sn), *p);
+      continue;
+    }
+    if (!repop) {
+      vector<OSDOp> ops;
+      tid_t rep_tid = osd->get_tid();
+      osd_reqid_t reqid(osd->cluster_messenger->get_myname(), 0, rep_tid);
+      OpContext *ctx = new OpContext(OpRequestRef(), reqid, ops, &obc->obs, obc->ssc, this);
+      ctx->mtime = ceph_clock_now(g_ceph_context);
+
+      ctx->at_version.epoch = get_osdmap()->get_epoch();
+      ctx->at_version.version = log.head.version + 1;
+
+      repop = new_repop(ctx, obc, rep_tid);
+    } else {
+      repop->src_obc[*p] = obc;  // released with the repop's other contexts
+    }
+    heads.insert(p->oid);
+    trim_object(repop, obc);
+    n++;
+  }
+  if (stale) {
+    int r = osd->store->queue_transaction(NULL, stale, new ObjectStore::C_DeleteTransaction(stale));
+    assert(r == 0);
+  }
+  if (repop) {
+    // issue_repop takes repop->v from at_version: the repop is only
+    // applied and committed once its last entry is, not the first clone's
+    assert(!repop->ctx->log.empty());
+    repop->ctx->at_version = repop->ctx->log.rbegin()->version;
+    dout(10) << "trim_objects " << n << " clones in " << *repop
+	     << " up to " << repop->ctx->at_version << dendl;
+  }
+  return repop;
+}
+
+void ReplicatedPG::trim_object(RepGather *repop, ObjectContext *obc)
+{
+  OpContext *ctx = repop->ctx;
+  const hobject_t &coid = obc->obs.oi.soid;
+  bufferlist bl;
+  object_info_t &coi = obc->obs.oi;
+  vector<snapid_t>& snaps = coi.snaps;
   SnapSetContext *ssc = obc->ssc;
-  assert(ssc);
   SnapSet& snapset = ssc->snapset;
 
   dout(10) << coid << " snaps " << snaps << " old snapset " << snapset << dendl;
   assert(snapset.seq);
 
-  vector<OSDOp> ops;
-  tid_t rep_tid = osd->get_tid();
-  osd_reqid_t reqid(osd->cluster_messenger->get_myname(), 0, rep_tid);
-  OpContext *ctx = new OpContext(OpRequestRef(), reqid, ops, &obc->obs, ssc, this);
-  ctx->mtime = ceph_clock_now(g_ceph_context);
-
-  ctx->at_version.epoch = get_osdmap()->get_epoch();
-  ctx->at_version.version = log.head.version + 1;
-
-
-  RepGather *repop = new_repop(ctx, obc, rep_tid);
+  // follow the entries of the clones before us in this repop
+  if (!ctx->log.empty())
+    ctx->at_version.version++;
 
   ObjectStore::Transaction *t = &ctx->op_t;
     
@@ -1368,9 +1762,10 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
     snapset.clone_overlap.erase(last);
     snapset.clone_size.erase(last);
 	
-    ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::DELETE, coid, ctx->at_version, ctx->obs->oi.version,
+    ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::DELETE, coid, ctx->at_version, coi.version,
 				  osd_reqid_t(), ctx->mtime));
     ctx->at_version.version++;
+    obc->obs.exists = false;
   } else {
     // save adjusted snaps for this object
     dout(10) << coid << " snaps " << snaps << " -> " << newsnaps << dendl;
@@ -1405,33 +1800,35 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   hobject_t snapoid(coid.oid, coid.get_key(),
 		    snapset.head_exists ? CEPH_NOSNAP:CEPH_SNAPDIR, coid.hash,
 		    info.pgid.pool());
-  ctx->snapset_obc = get_object_context(snapoid, coi.oloc, false);
-  assert(ctx->snapset_obc->registered);
+  ObjectContext *snapset_obc = get_object_context(snapoid, coi.oloc, false);
+  assert(snapset_obc->registered);
+  if (!ctx->snapset_obc)
+    ctx->snapset_obc = snapset_obc;
+  else
+    repop->src_obc[snapoid] = snapset_obc;
   if (snapset.clones.empty() && !snapset.head_exists) {
     dout(10) << coid << " removing " << snapoid << dendl;
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::DELETE, snapoid, ctx->at_version, 
-				  ctx->snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
-    ctx->snapset_obc->obs.exists = false;
+				  snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
+    snapset_obc->obs.exists = false;
 
     t->remove(coll, snapoid);
   } else {
     dout(10) << coid << " updating snapset on " << snapoid << dendl;
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::MODIFY, snapoid, ctx->at_version, 
-				  ctx->snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
+				  snapset_obc->obs.oi.version, osd_reqid_t(), ctx->mtime));
 
-    ctx->snapset_obc->obs.oi.prior_version = ctx->snapset_obc->obs.oi.version;
-    ctx->snapset_obc->obs.oi.version = ctx->at_version;
+    snapset_obc->obs.oi.prior_version = snapset_obc->obs.oi.version;
+    snapset_obc->obs.oi.version = ctx->at_version;
 
     bl.clear();
     ::encode(snapset, bl);
     t->setattr(coll, snapoid, SS_ATTR, bl);
 
     bl.clear();
-    ::encode(ctx->snapset_obc->obs.oi, bl);
+    ::encode(snapset_obc->obs.oi, bl);
     t->setattr(coll, snapoid, OI_ATTR, bl);
   }
-
-  return repop;
 }
 
 void ReplicatedPG::snap_trimmer()
@@ -1593,13 +1990,23 @@ void ReplicatedPG::remove_watchers_and_notifies()
 
   dout(10) << "remove_watchers" << dendl;
 
-  osd->watch_lock.Lock();
+  // idle contexts have no watchers; and putting the others may trim
+  // the lru, so don't walk object_contexts while we do
+  vector<ObjectContext*> obcs;
   for (map<hobject_t, ObjectContext*>::iterator oiter = object_contexts.begin();
        oiter != object_contexts.end();
-       ) {
-    map<hobject_t, ObjectContext *>::iterator iter = oiter++;
-    ObjectContext *obc = iter->second;
-    obc->ref++;
+       ++oiter) {
+    if (oiter->second->ref > 0) {
+      oiter->second->get();
+      obcs.push_back(oiter->second);
+    }
+  }
+
+  osd->watch_lock.Lock();
+  for (vector<ObjectContext*>::iterator oiter = obcs.begin();
+       oiter != obcs.end();
+       ++oiter) {
+    ObjectContext *obc = *oiter;
     for (map<entity_name_t, OSD::Session *>::iterator witer = obc->watchers.begin();
 	 witer != obc->watchers.end();
 	 remove_watcher(obc, (witer++)->first)) ;
@@ -1697,6 +2104,8 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	else {
 	  result = r;
 	  op.extent.length = 0;
+	  if (r == -EIO)
+	    ctx->read_error = true;
 	}
 	ctx->delta_stats.num_rd_kb += SHIFT_ROUND_UP(op.extent.length, 10);
 	ctx->delta_stats.num_rd++;
@@ -2059,6 +2468,11 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    t.truncate(coll, soid, op.extent.truncate_size);
 	    oi.truncate_seq = op.extent.truncate_seq;
 	    oi.truncate_size = op.extent.truncate_size;
+	    if (op.extent.truncate_size < oi.size) {
+	      interval_set<uint64_t> trim;
+	      trim.insert(op.extent.truncate_size, oi.size - op.extent.truncate_size);
+	      ctx->modified_ranges.union_of(trim);
+	    }
 	    if (op.extent.truncate_size != oi.size) {
 	      ctx->delta_stats.num_bytes -= oi.size;
 	      ctx->delta_stats.num_bytes += op.extent.truncate_size;
@@ -2115,10 +2529,13 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
     case CEPH_OSD_OP_ZERO:
       { // zero
 	assert(op.extent.length);
-	if (obs.exists) {
-	  t.zero(coll, soid, op.extent.offset, op.extent.length);
+	if (obs.exists && op.extent.offset < oi.size) {
+	  // zeroing never extends the object; anything past the end
+	  // already reads as zeros
+	  uint64_t len = MIN(op.extent.length, oi.size - op.extent.offset);
+	  t.zero(coll, soid, op.extent.offset, len);
 	  interval_set<uint64_t> ch;
-	  ch.insert(op.extent.offset, op.extent.length);
+	  ch.insert(op.extent.offset, len);
 	  ctx->modified_ranges.union_of(ch);
 	  ctx->delta_stats.num_wr++;
 	} else {
@@ -3310,6 +3727,9 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
   }
 
 
+  // make_writeable trims this to what the clone shares; keep it for the log
+  interval_set<uint64_t> dirty_extents = ctx->modified_ranges;
+
   // clone, if necessary
   make_writeable(ctx);
 
@@ -3397,6 +3817,17 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     logopcode = pg_log_entry_t::DELETE;
   ctx->log.push_back(pg_log_entry_t(logopcode, soid, ctx->at_version, old_version,
 				ctx->reqid, ctx->mtime));
+  if (g_conf->osd_recovery_delta && ctx->new_obs.exists) {
+    // modified_ranges only covers the old size; add what the object grew by
+    uint64_t old_size = ctx->obs->exists ? ctx->obs->oi.size : 0;
+    if (ctx->new_obs.oi.size > old_size) {
+      interval_set<uint64_t> grown;
+      grown.insert(old_size, ctx->new_obs.oi.size - old_size);
+      dirty_extents.union_of(grown);
+    }
+    ctx->log.back().dirty_extents_valid = true;
+    ctx->log.back().dirty_extents.swap(dirty_extents);
+  }
 
   // apply new object state.
   ctx->obc->obs = ctx->new_obs;
@@ -3469,8 +3900,11 @@ void ReplicatedPG::apply_repop(RepGather *repop)
   repop->tls.push_back(&repop->ctx->op_t);
 
   repop->obc->ondisk_write_lock();
-  if (repop->ctx->clone_obc)
+  repop->obc->unapplied_repops++;
+  if (repop->ctx->clone_obc) {
     repop->ctx->clone_obc->ondisk_write_lock();
+    repop->ctx->clone_obc->unapplied_repops++;
+  }
 
   Context *oncommit = new C_OSD_OpCommit(this, repop);
   Context *onapplied = new C_OSD_OpApplied(this, repop);
@@ -3501,6 +3935,8 @@ void ReplicatedPG::op_applied(RepGather *repop)
   int whoami = osd->get_nodeid();
 
   if (repop->ctx->clone_obc) {
+    repop->ctx->clone_obc->unapplied_repops--;
+    kick_ondisk_readers(repop->ctx->clone_obc);
     put_object_context(repop->ctx->clone_obc);
     repop->ctx->clone_obc = 0;
   }
@@ -3513,6 +3949,9 @@ void ReplicatedPG::op_applied(RepGather *repop)
   mode.write_applied();
   dout(10) << "op_applied mode now " << mode << " (finish_write)" << dendl;
 
+  repop->obc->unapplied_repops--;
+  kick_ondisk_readers(repop->obc);
+
   put_object_context(repop->obc);
   put_object_contexts(repop->src_obc);
   repop->obc = 0;
@@ -3781,6 +4220,7 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
     }
     
     wr->pg_trim_to = pg_trim_to;
+    wr->min_last_complete_ondisk = min_last_complete_ondisk;
     osd->cluster_messenger->send_message(wr, get_osdmap()->get_cluster_inst(peer));
 
     // keep peer_info up to date
@@ -3881,7 +4321,7 @@ void ReplicatedPG::repop_ack(RepGather *repop, int result, int ack_type,
 
 void ReplicatedPG::populate_obc_watchers(ObjectContext *obc)
 {
-  if (!is_active() || is_degraded_object(obc->obs.oi.soid) ||
+  if (!is_primary() || !is_active() || is_degraded_object(obc->obs.oi.soid) ||
       is_missing_object(obc->obs.oi.soid))
     return;
 
@@ -3968,6 +4408,7 @@ void ReplicatedPG::handle_watch_timeout(void *_obc,
 				ctx->at_version,
 				obc->obs.oi.version,
 				osd_reqid_t(), ctx->mtime));
+  ctx->log.back().dirty_extents_valid = g_conf->osd_recovery_delta;  // no data changes
 
   eversion_t old_last_update = log.head;
   bool old_exists = repop->obc->obs.exists;
@@ -4017,7 +4458,11 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
     obc = p->second;
     dout(10) << "get_object_context " << obc << " " << soid << " " << obc->ref
 	     << " -> " << (obc->ref+1) << dendl;
+    if (obc->ref == 0)
+      osd->logger->inc(l_osd_obc_cache_hit);
   } else {
+    osd->logger->inc(l_osd_obc_cache_miss);
+
     // check disk
     bufferlist bv;
     int r = osd->store->getattr(coll, soid, OI_ATTR, bv);
@@ -4053,10 +4498,47 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
     populate_obc_watchers(obc);
     dout(10) << "get_object_context " << obc << " " << soid << " 0 -> 1 read " << obc->obs.oi << dendl;
   }
-  obc->ref++;
+  obc->get();
   return obc;
 }
 
+/// do any of these ops read object data, xattrs or omap from the store?
+bool ReplicatedPG::ops_read_ondisk(const vector<OSDOp>& ops)
+{
+  for (vector<OSDOp>::const_iterator p = ops.begin(); p != ops.end(); ++p) {
+    if (!ceph_osd_op_mode_read(p->op.op))
+      continue;
+    switch (p->op.op) {
+    case CEPH_OSD_OP_STAT:
+    case CEPH_OSD_OP_ASSERT_VER:
+    case CEPH_OSD_OP_MASKTRUNC:
+    case CEPH_OSD_OP_NOTIFY:
+    case CEPH_OSD_OP_NOTIFY_ACK:
+    case CEPH_OSD_OP_ASSERT_SRC_VERSION:  // src is locked separately
+      break;
+    default:
+      return true;
+    }
+  }
+  return false;
+}
+
+void ReplicatedPG::kick_ondisk_readers(ObjectContext *obc)
+{
+  if (obc->unapplied_repops)
+    return;
+  const hobject_t& soid = obc->obs.oi.soid;
+  hobject_t head(soid.oid, soid.get_key(), CEPH_NOSNAP, soid.hash,
+		 info.pgid.pool());
+  map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_ondisk_read.find(head);
+  if (p == waiting_for_ondisk_read.end())
+    return;
+  dout(10) << "kick_ondisk_readers " << soid << " requeuing "
+	   << p->second.size() << " ops" << dendl;
+  requeue_ops(p->second);
+  waiting_for_ondisk_read.erase(p);
+}
+
 void ReplicatedPG::context_registry_on_change()
 {
   remove_watchers_and_notifies();
@@ -4174,18 +4656,88 @@ void ReplicatedPG::put_object_context(ObjectContext *obc)
 
   --obc->ref;
   if (obc->ref == 0) {
-    if (obc->ssc)
-      put_snapset_context(obc->ssc);
+    if (obc->registered && obc->obs.exists && is_primary()) {
+      // keep it around in case the object is used again soon
+      object_context_lru.push_back(&obc->lru_item);
+      trim_object_context_lru(g_conf->osd_pg_object_context_cache_count);
+    } else {
+      if (obc->ssc)
+	put_snapset_context(obc->ssc);
 
-    if (obc->registered)
-      object_contexts.erase(obc->obs.oi.soid);
-    delete obc;
+      if (obc->registered)
+	object_contexts.erase(obc->obs.oi.soid);
+      delete obc;
+    }
 
-    if (object_contexts.empty())
+    if (object_contexts.size() == (unsigned)object_context_lru.size())
       kick();
   }
 }
 
+void ReplicatedPG::trim_object_context_lru(unsigned max)
+{
+  while ((unsigned)object_context_lru.size() > max) {
+    ObjectContext *obc = object_context_lru.front();
+    dout(20) << "trim_object_context_lru " << obc << " " << obc->obs.oi.soid << dendl;
+    assert(obc->ref == 0);
+    object_context_lru.pop_front();
+    object_contexts.erase(obc->obs.oi.soid);
+    SnapSetContext *ssc = obc->ssc;
+    delete obc;
+    if (ssc)
+      put_snapset_context(ssc);
+  }
+}
+
+void ReplicatedPG::trim_snapset_context_lru(unsigned max)
+{
+  while ((unsigned)snapset_context_lru.size() > max) {
+    SnapSetContext *ssc = snapset_context_lru.front();
+    dout(20) << "trim_snapset_context_lru " << ssc->oid << dendl;
+    assert(ssc->ref == 0);
+    snapset_context_lru.pop_front();
+    snapset_contexts.erase(ssc->oid);
+    delete ssc;
+  }
+}
+
+/*
+ * Drop any idle contexts for soid before recovery writes it, along
+ * with its snapset if it is a head or snapdir.  Idle clone contexts
+ * may be what still holds that snapset.
+ */
+void ReplicatedPG::invalidate_object_context(const hobject_t& soid)
+{
+  map<hobject_t, ObjectContext*>::iterator p = object_contexts.find(soid);
+  if (p != object_contexts.end() && p->second->ref == 0) {
+    dout(20) << "invalidate_object_context " << soid << dendl;
+    // move it to the front and trim it off
+    p->second->lru_item.move_to_front();
+    trim_object_context_lru(object_context_lru.size() - 1);
+  }
+
+  if (soid.snap != CEPH_NOSNAP && soid.snap != CEPH_SNAPDIR)
+    return;
+  map<object_t, SnapSetContext*>::iterator q = snapset_contexts.find(soid.oid);
+  if (q == snapset_contexts.end())
+    return;
+  SnapSetContext *ssc = q->second;
+  for (xlist<ObjectContext*>::iterator i = object_context_lru.begin(); !i.end(); ) {
+    ObjectContext *obc = *i;
+    ++i;
+    if (obc->ssc == ssc) {
+      obc->lru_item.move_to_front();
+      trim_object_context_lru(object_context_lru.size() - 1);
+    }
+  }
+  // the last put may have trimmed it already
+  q = snapset_contexts.find(soid.oid);
+  if (q != snapset_contexts.end() && q->second->ref == 0) {
+    q->second->lru_item.move_to_front();
+    trim_snapset_context_lru(snapset_context_lru.size() - 1);
+  }
+}
+
 void ReplicatedPG::put_object_contexts(map<hobject_t,ObjectContext*>& obcv)
 {
   if (obcv.empty())
@@ -4252,7 +4804,13 @@ ReplicatedPG::SnapSetContext *ReplicatedPG::get_snapset_context(const object_t&
   map<object_t, SnapSetContext*>::iterator p = snapset_contexts.find(oid);
   if (p != snapset_contexts.end()) {
     ssc = p->second;
+    if (ssc->ref == 0) {
+      ssc->lru_item.remove_myself();
+      osd->logger->inc(l_osd_ssc_cache_hit);
+    }
   } else {
+    osd->logger->inc(l_osd_ssc_cache_miss);
+
     bufferlist bv;
     hobject_t head(oid, key, CEPH_NOSNAP, seed,
 		   info.pgid.pool());
@@ -4286,9 +4844,14 @@ void ReplicatedPG::put_snapset_context(SnapSetContext *ssc)
 
   --ssc->ref;
   if (ssc->ref == 0) {
-    if (ssc->registered)
-      snapset_contexts.erase(ssc->oid);
-    delete ssc;
+    if (ssc->registered && is_primary()) {
+      snapset_context_lru.push_back(&ssc->lru_item);
+      trim_snapset_context_lru(g_conf->osd_pg_object_context_cache_count);
+    } else {
+      if (ssc->registered)
+	snapset_contexts.erase(ssc->oid);
+      delete ssc;
+    }
   }
 }
 
@@ -4325,6 +4888,10 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   // we better not be missing this.
   assert(!missing.is_missing(soid));
 
+  // for can_serve_replica_read()
+  if (m->min_last_complete_ondisk > min_last_complete_ondisk)
+    min_last_complete_ondisk = m->min_last_complete_ondisk;
+
   int ackerosd = acting[0];
   
   op->mark_started();
@@ -4644,6 +5211,73 @@ void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
 }
 
 
+/*
+ * If the peer has an older copy of head and our log says which extents
+ * every write since then touched, push only those.  The peer keeps the
+ * rest of its copy, which clone_subsets[head] tells it to do.
+ */
+bool ReplicatedPG::calc_delta_subsets(ObjectContext *obc, const hobject_t& head, int peer,
+				      interval_set<uint64_t>& data_subset,
+				      map<hobject_t, interval_set<uint64_t> >& clone_subsets)
+{
+  if (!g_conf->osd_recovery_delta)
+    return false;
+
+  map<hobject_t, pg_missing_t::item>::iterator m = peer_missing[peer].missing.find(head);
+  if (m == peer_missing[peer].missing.end())
+    return false;
+  eversion_t have = m->second.have;
+  if (have == eversion_t() || have < log.tail) {
+    dout(15) << "calc_delta_subsets " << head << " osd." << peer << " has " << have
+	     << ", not in log (tail " << log.tail << ")" << dendl;
+    return false;
+  }
+
+  Connection *con = osd->cluster_messenger->get_connection(
+    get_osdmap()->get_cluster_inst(peer));
+  bool supported = con->features & CEPH_FEATURE_OSD_DELTA_RECOVERY;
+  con->put();
+  if (!supported) {
+    dout(15) << "calc_delta_subsets osd." << peer << " does not support delta pushes" << dendl;
+    return false;
+  }
+
+  // walk back through every update since the peer's copy
+  interval_set<uint64_t> dirty;
+  eversion_t expect = obc->obs.oi.version;
+  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > have;
+       ++p) {
+    if (p->soid != head)
+      continue;
+    if (p->version != expect || !p->is_modify() || !p->dirty_extents_valid) {
+      dout(15) << "calc_delta_subsets " << head << " can't use " << *p << dendl;
+      return false;
+    }
+    dirty.union_of(p->dirty_extents);
+    expect = p->prior_version;
+  }
+  if (expect != have) {
+    dout(15) << "calc_delta_subsets " << head << " log reaches " << expect
+	     << ", not " << have << dendl;
+    return false;
+  }
+
+  interval_set<uint64_t> keep;
+  if (obc->obs.oi.size)
+    keep.insert(0, obc->obs.oi.size);
+  dirty.intersection_of(keep);
+  keep.subtract(dirty);
+  data_subset.swap(dirty);
+  clone_subsets[head].swap(keep);
+
+  dout(10) << "calc_delta_subsets " << head << " osd." << peer << " has " << have
+	   << ", data_subset " << data_subset
+	   << " keeping " << clone_subsets[head] << dendl;
+  return true;
+}
+
+
 /** pull - request object from a peer
  */
 
@@ -4774,6 +5408,12 @@ void ReplicatedPG::send_remove_op(const hobject_t& oid, eversion_t v, int peer)
  */
 void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, int peer)
 {
+  if (missing.is_missing(soid)) {
+    // our copy failed a read; it is pushed once it has been recovered
+    dout(10) << "push_to_replica " << soid << " is missing here, not pushing"
+	     << dendl;
+    return;
+  }
   const object_info_t& oi = obc->obs.oi;
   uint64_t size = obc->obs.oi.size;
 
@@ -4819,6 +5459,12 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
 		       data_subset, clone_subsets);
     put_snapset_context(ssc);
   } else if (soid.snap == CEPH_NOSNAP) {
+    // does the replica only need what changed since its copy?
+    if (calc_delta_subsets(obc, soid, peer, data_subset, clone_subsets)) {
+      osd->logger->inc(l_osd_push_delta);
+      return push_start(obc, soid, peer, oi.version, data_subset, clone_subsets);
+    }
+
     // pushing head or unversioned object.
     // base this on partially on replica's clones?
     SnapSetContext *ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
@@ -4865,14 +5511,52 @@ void ReplicatedPG::push_start(
   pi.recovery_progress.omap_complete = 0;
 
   ObjectRecoveryProgress new_progress;
-  send_push(peer, pi.recovery_info, pi.recovery_progress, &new_progress);
+  int r = send_push(peer, pi.recovery_info, pi.recovery_progress, &new_progress);
+  if (r < 0) {
+    push_read_error(soid, peer);
+    return;
+  }
   pi.recovery_progress = new_progress;
 }
 
+/*
+ * Reading our copy of soid to push it to peer failed.  Drop the push,
+ * so the peer keeps it missing (or backfill doesn't move past it), and
+ * recover our own copy from another replica first; the object is
+ * pushed again once that is done.  The caller closes out the recovery
+ * op if nothing else is pushing soid.
+ */
+void ReplicatedPG::push_read_error(const hobject_t& soid, int peer)
+{
+  eversion_t v = pushing[soid][peer].recovery_info.version;
+  pushing[soid].erase(peer);
+  if (pushing[soid].empty())
+    pushing.erase(soid);
+  if (!recover_read_error(soid, v))
+    osd->clog.error() << info.pgid << " " << soid << " v " << v
+		      << " failed to read and there is no other copy to"
+		      << " recover it from\n";
+}
+
 int ReplicatedPG::send_pull(int peer,
 			    ObjectRecoveryInfo recovery_info,
 			    ObjectRecoveryProgress progress)
 {
+  if (can_batch_recovery(peer)) {
+    dout(10) << "send_pull " << recovery_info.soid << " "
+	     << recovery_info.version
+	     << " first=" << progress.first
+	     << " data " << recovery_info.copy_subset
+	     << " from osd." << peer << ", batched" << dendl;
+    vector<PullOp> &pops = pending_pulls[peer];
+    pops.push_back(PullOp());
+    pops.back().soid = recovery_info.soid;
+    pops.back().recovery_info = recovery_info;
+    pops.back().recovery_progress = progress;
+    osd->logger->inc(l_osd_pull);
+    return 0;
+  }
+
   // send op
   tid_t tid = osd->get_tid();
   osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
@@ -4910,12 +5594,22 @@ void ReplicatedPG::submit_push_data(
   map<string, bufferlist> &omap_entries,
   ObjectStore::Transaction *t)
 {
+  // a delta push (see calc_delta_subsets) updates our own copy in place
+  bool in_place = recovery_info.clone_subset.count(recovery_info.soid);
+  coll_t target = in_place ? coll : get_temp_coll(t);
   if (first) {
     missing.revise_have(recovery_info.soid, eversion_t());
-    remove_object_with_snap_hardlinks(*t, recovery_info.soid);
-    t->remove(get_temp_coll(t), recovery_info.soid);
-    t->touch(get_temp_coll(t), recovery_info.soid);
-    t->omap_setheader(get_temp_coll(t), recovery_info.soid, omap_header);
+    if (in_place) {
+      // dropping OI_ATTR leaves the object missing if we crash part way
+      t->rmattrs(coll, recovery_info.soid);
+      t->omap_clear(coll, recovery_info.soid);
+      t->truncate(coll, recovery_info.soid, recovery_info.size);
+    } else {
+      remove_object_with_snap_hardlinks(*t, recovery_info.soid);
+      t->remove(get_temp_coll(t), recovery_info.soid);
+      t->touch(get_temp_coll(t), recovery_info.soid);
+    }
+    t->omap_setheader(target, recovery_info.soid, omap_header);
   }
   uint64_t off = 0;
   for (interval_set<uint64_t>::const_iterator p = intervals_included.begin();
@@ -4923,26 +5617,42 @@ void ReplicatedPG::submit_push_data(
        ++p) {
     bufferlist bit;
     bit.substr_of(data_included, off, p.get_len());
-    t->write(get_temp_coll(t), recovery_info.soid,
+    t->write(target, recovery_info.soid,
 	     p.get_start(), p.get_len(), bit);
     off += p.get_len();
   }
 
-  t->omap_setkeys(get_temp_coll(t), recovery_info.soid,
+  t->omap_setkeys(target, recovery_info.soid,
 		  omap_entries);
-  t->setattrs(get_temp_coll(t), recovery_info.soid,
-	      attrs);
+  if (in_place && attrs.count(OI_ATTR)) {
+    // written by submit_push_complete
+    map<string, bufferptr> rest = attrs;
+    rest.erase(OI_ATTR);
+    t->setattrs(target, recovery_info.soid, rest);
+  } else {
+    t->setattrs(target, recovery_info.soid,
+		attrs);
+  }
 }
 
 void ReplicatedPG::submit_push_complete(ObjectRecoveryInfo &recovery_info,
 					ObjectStore::Transaction *t)
 {
-  remove_object_with_snap_hardlinks(*t, recovery_info.soid);
-  t->collection_move(coll, get_temp_coll(t), recovery_info.soid);
+  if (recovery_info.clone_subset.count(recovery_info.soid)) {
+    // delta push: the data is in place, now it is current
+    bufferlist bv;
+    ::encode(recovery_info.oi, bv);
+    t->setattr(coll, recovery_info.soid, OI_ATTR, bv);
+  } else {
+    remove_object_with_snap_hardlinks(*t, recovery_info.soid);
+    t->collection_move(coll, get_temp_coll(t), recovery_info.soid);
+  }
   for (map<hobject_t, interval_set<uint64_t> >::const_iterator p =
 	 recovery_info.clone_subset.begin();
        p != recovery_info.clone_subset.end();
        ++p) {
+    if (p->first == recovery_info.soid)
+      continue;
     for (interval_set<uint64_t>::const_iterator q = p->second.begin();
 	 q != p->second.end();
 	 ++q) {
@@ -5009,37 +5719,39 @@ ObjectRecoveryInfo ReplicatedPG::recalc_subsets(ObjectRecoveryInfo recovery_info
   return new_info;
 }
 
-void ReplicatedPG::handle_pull_response(OpRequestRef op)
+bool ReplicatedPG::handle_pull_response(
+  int from, PushOp &pop, PullOp *response,
+  ObjectStore::Transaction *t,
+  C_Contexts *onreadable, C_Contexts *onreadable_sync)
 {
-  MOSDSubOp *m = (MOSDSubOp *)op->request;
+  interval_set<uint64_t> data_included = pop.data_included;
   bufferlist data;
-  m->claim_data(data);
-  interval_set<uint64_t> data_included = m->data_included;
+  data.claim(pop.data);
   dout(10) << "handle_pull_response "
-	   << m->recovery_info
-	   << m->recovery_progress
+	   << pop.recovery_info
+	   << pop.after_progress
 	   << " data.size() is " << data.length()
 	   << " data_included: " << data_included
 	   << dendl;
-  if (m->version == eversion_t()) {
+  if (pop.version == eversion_t()) {
     // replica doesn't have it!
-    _failed_push(op);
-    return;
+    _failed_push(from, pop.soid);
+    return false;
   }
 
-  hobject_t &hoid = m->recovery_info.soid;
+  hobject_t &hoid = pop.soid;
   assert((data_included.empty() && data.length() == 0) ||
 	 (!data_included.empty() && data.length() > 0));
 
   if (!pulling.count(hoid)) {
-    return;
+    return false;
   }
 
   PullInfo &pi = pulling[hoid];
   if (pi.recovery_info.size == (uint64_t(-1))) {
-    pi.recovery_info.size = m->recovery_info.size;
+    pi.recovery_info.size = pop.recovery_info.size;
     pi.recovery_info.copy_subset.intersection_of(
-      m->recovery_info.copy_subset);
+      pop.recovery_info.copy_subset);
   }
 
   pi.recovery_info = recalc_subsets(pi.recovery_info);
@@ -5055,7 +5767,7 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
   data.claim(usable_data);
 
   bool first = pi.recovery_progress.first;
-  pi.recovery_progress = m->recovery_progress;
+  pi.recovery_progress = pop.after_progress;
 
   dout(10) << "new recovery_info " << pi.recovery_info
 	   << ", new progress " << pi.recovery_progress
@@ -5063,15 +5775,15 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
 
   if (first) {
     bufferlist oibl;
-    if (m->attrset.count(OI_ATTR)) {
-      oibl.push_back(m->attrset[OI_ATTR]);
+    if (pop.attrset.count(OI_ATTR)) {
+      oibl.push_back(pop.attrset[OI_ATTR]);
       ::decode(pi.recovery_info.oi, oibl);
     } else {
       assert(0);
     }
     bufferlist ssbl;
-    if (m->attrset.count(SS_ATTR)) {
-      ssbl.push_back(m->attrset[SS_ATTR]);
+    if (pop.attrset.count(SS_ATTR)) {
+      ssbl.push_back(pop.attrset[SS_ATTR]);
       ::decode(pi.recovery_info.ss, ssbl);
     } else {
       assert(pi.recovery_info.soid.snap != CEPH_NOSNAP &&
@@ -5081,37 +5793,78 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
 
   bool complete = pi.is_complete();
 
-  ObjectStore::Transaction *t = new ObjectStore::Transaction;
-  Context *onreadable = 0;
-  Context *onreadable_sync = 0;
   submit_push_data(pi.recovery_info, first,
 		   data_included, data,
-		   m->omap_header,
-		   m->attrset,
-		   m->omap_entries,
+		   pop.omap_header,
+		   pop.attrset,
+		   pop.omap_entries,
 		   t);
 
-  if (complete) {
-    submit_push_complete(pi.recovery_info, t);
+  if (!complete) {
+    response->soid = pi.recovery_info.soid;
+    response->recovery_info = pi.recovery_info;
+    response->recovery_progress = pi.recovery_progress;
+    return true;
+  }
 
-    SnapSetContext *ssc;
-    if (hoid.snap == CEPH_NOSNAP || hoid.snap == CEPH_SNAPDIR) {
-      ssc = create_snapset_context(hoid.oid);
-      ssc->snapset = pi.recovery_info.ss;
-    } else {
-      ssc = get_snapset_context(hoid.oid, hoid.get_key(), hoid.hash, false);
-      assert(ssc);
-    }
-    ObjectContext *obc = create_object_context(pi.recovery_info.oi, ssc);
-    obc->obs.exists = true;
+  submit_push_complete(pi.recovery_info, t);
 
-    obc->ondisk_write_lock();
+  invalidate_object_context(hoid);
 
-    onreadable = new C_OSD_AppliedRecoveredObject(this, t, obc);
-    onreadable_sync = new C_OSD_OndiskWriteUnlock(obc);
+  SnapSetContext *ssc;
+  if (hoid.snap == CEPH_NOSNAP || hoid.snap == CEPH_SNAPDIR) {
+    ssc = create_snapset_context(hoid.oid);
+    ssc->snapset = pi.recovery_info.ss;
   } else {
-    onreadable = new ObjectStore::C_DeleteTransaction(t);
+    ssc = get_snapset_context(hoid.oid, hoid.get_key(), hoid.hash, false);
+    assert(ssc);
   }
+  ObjectContext *obc = create_object_context(pi.recovery_info.oi, ssc);
+  obc->obs.exists = true;
+
+  obc->ondisk_write_lock();
+
+  // keep track of active pushes for scrub
+  ++active_pushes;
+
+  // the transaction is shared; handle_pull_responses frees it
+  onreadable->add(new C_OSD_AppliedRecoveredObject(this, 0, obc));
+  onreadable_sync->add(new C_OSD_OndiskWriteUnlock(obc));
+
+  finish_recovery_op(hoid);
+  pull_from_peer[from].erase(hoid);
+  if (waiting_for_missing_object.count(hoid)) {
+    dout(20) << " kicking waiters on " << hoid << dendl;
+    requeue_ops(waiting_for_missing_object[hoid]);
+    waiting_for_missing_object.erase(hoid);
+    if (missing.missing.size() == 0) {
+      requeue_ops(waiting_for_all_missing);
+      waiting_for_all_missing.clear();
+    }
+  }
+  pulling.erase(hoid);
+  update_stats();
+  return false;
+}
+
+/**
+ * apply the pushes one peer sent in reply to our pulls, all in one
+ * transaction, and pull whatever is left of each object
+ */
+void ReplicatedPG::handle_pull_responses(int from, vector<PushOp> &pops,
+					 OpRequestRef op)
+{
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  C_Contexts *onreadable = new C_Contexts(g_ceph_context);
+  C_Contexts *onreadable_sync = new C_Contexts(g_ceph_context);
+  list<PullOp> responses;
+  for (vector<PushOp>::iterator p = pops.begin(); p != pops.end(); ++p) {
+    responses.push_back(PullOp());
+    if (!handle_pull_response(from, *p, &responses.back(), t,
+			      onreadable, onreadable_sync))
+      responses.pop_back();
+  }
+  onreadable->add(new ObjectStore::C_DeleteTransaction(t));
 
   int r = osd->store->
     queue_transaction(osr.get(), t,
@@ -5122,66 +5875,93 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
 		      onreadable_sync);
   assert(r == 0);
 
-  if (complete) {
-    finish_recovery_op(hoid);
-    pulling.erase(hoid);
-    pull_from_peer[m->get_source().num()].erase(hoid);
-    update_stats();
-    if (waiting_for_missing_object.count(hoid)) {
-      dout(20) << " kicking waiters on " << hoid << dendl;
-      requeue_ops(waiting_for_missing_object[hoid]);
-      waiting_for_missing_object.erase(hoid);
-      if (missing.missing.size() == 0) {
-	requeue_ops(waiting_for_all_missing);
-	waiting_for_all_missing.clear();
-      }
-    }
-  } else {
-    send_pull(m->get_source().num(), pi.recovery_info, pi.recovery_progress);
-  }
+  for (list<PullOp>::iterator p = responses.begin(); p != responses.end(); ++p)
+    send_pull(from, p->recovery_info, p->recovery_progress);
 }
 
-void ReplicatedPG::handle_push(OpRequestRef op)
+void ReplicatedPG::handle_push(PushOp &pop, ObjectStore::Transaction *t)
 {
-  MOSDSubOp *m = (MOSDSubOp *)op->request;
   dout(10) << "handle_push "
-	   << m->recovery_info
-	   << m->recovery_progress
+	   << pop.recovery_info
+	   << pop.after_progress
 	   << dendl;
-  bufferlist data;
-  m->claim_data(data);
-  bool first = m->current_progress.first;
-  bool complete = m->recovery_progress.data_complete &&
-    m->recovery_progress.omap_complete;
-  ObjectStore::Transaction *t = new ObjectStore::Transaction;
-  Context *onreadable = new C_OSD_AppliedRecoveredObjectReplica(this, t);
-  Context *onreadable_sync = 0;
-  submit_push_data(m->recovery_info,
+  bool first = pop.before_progress.first;
+  bool complete = pop.after_progress.data_complete &&
+    pop.after_progress.omap_complete;
+  submit_push_data(pop.recovery_info,
 		   first,
-		   m->data_included,
-		   data,
-		   m->omap_header,
-		   m->attrset,
-		   m->omap_entries,
+		   pop.data_included,
+		   pop.data,
+		   pop.omap_header,
+		   pop.attrset,
+		   pop.omap_entries,
 		   t);
   if (complete)
-    submit_push_complete(m->recovery_info,
+    submit_push_complete(pop.recovery_info,
 			 t);
+}
+
+/// apply pushes from the primary, all in one transaction
+void ReplicatedPG::handle_pushes(vector<PushOp> &pops, OpRequestRef op)
+{
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  for (vector<PushOp>::iterator p = pops.begin(); p != pops.end(); ++p)
+    handle_push(*p, t);
+
+  // keep track of active pushes for scrub
+  ++active_pushes;
 
   int r = osd->store->
     queue_transaction(osr.get(), t,
-		      onreadable,
+		      new C_OSD_AppliedRecoveredObjectReplica(this, t),
 		      new C_OSD_CommittedPushedObject(
 			this, op,
 			info.history.same_interval_since,
-			info.last_complete),
-		      onreadable_sync);
+			info.last_complete));
   assert(r == 0);
+}
+
+bool ReplicatedPG::can_batch_recovery(int peer)
+{
+  if (!g_conf->osd_recovery_batch)
+    return false;
+  Connection *con = osd->cluster_messenger->get_connection(
+    get_osdmap()->get_cluster_inst(peer));
+  bool supported = con->features & CEPH_FEATURE_OSD_BATCHED_RECOVERY;
+  con->put();
+  return supported;
+}
+
+void ReplicatedPG::send_pending_pushes(int peer)
+{
+  map<int, vector<PushOp> >::iterator p = pending_pushes.find(peer);
+  if (p == pending_pushes.end())
+    return;
+  MOSDPGPush *msg = new MOSDPGPush(info.pgid, get_osdmap()->get_epoch());
+  msg->pushes.swap(p->second);
+  pending_pushes.erase(p);
+  dout(10) << "send_pending_pushes " << msg->pushes.size()
+	   << " to osd." << peer << dendl;
+  osd->cluster_messenger->send_message(msg,
+				       get_osdmap()->get_cluster_inst(peer));
+}
+
+void ReplicatedPG::send_pending_recovery()
+{
+  while (!pending_pushes.empty())
+    send_pending_pushes(pending_pushes.begin()->first);
 
-  MOSDSubOpReply *reply = new MOSDSubOpReply(
-    m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
-  assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
-  osd->cluster_messenger->send_message(reply, m->get_connection());
+  for (map<int, vector<PullOp> >::iterator p = pending_pulls.begin();
+       p != pending_pulls.end();
+       ++p) {
+    MOSDPGPull *msg = new MOSDPGPull(info.pgid, get_osdmap()->get_epoch());
+    msg->pulls.swap(p->second);
+    dout(10) << "send_pending_recovery " << msg->pulls.size()
+	     << " pulls to osd." << p->first << dendl;
+    osd->cluster_messenger->send_message(msg,
+					 get_osdmap()->get_cluster_inst(p->first));
+  }
+  pending_pulls.clear();
 }
 
 int ReplicatedPG::send_push(int peer,
@@ -5189,13 +5969,59 @@ int ReplicatedPG::send_push(int peer,
 			    ObjectRecoveryProgress progress,
 			    ObjectRecoveryProgress *out_progress)
 {
-  ObjectRecoveryProgress new_progress = progress;
+  if (can_batch_recovery(peer)) {
+    vector<PushOp> &pops = pending_pushes[peer];
+    pops.push_back(PushOp());
+    int r = build_push_op(peer, recovery_info, progress, out_progress,
+			  &pops.back());
+    if (r < 0) {
+      pops.pop_back();
+      if (pops.empty())
+	pending_pushes.erase(peer);
+      return r;
+    }
+
+    // a batch holds about as much as one chunk of a big object would
+    uint64_t bytes = 0;
+    for (vector<PushOp>::iterator p = pops.begin(); p != pops.end(); ++p)
+      bytes += p->data.length() + p->omap_header.length();
+    if (bytes >= g_conf->osd_recovery_max_chunk)
+      send_pending_pushes(peer);
+    return 0;
+  }
+
+  PushOp pop;
+  int r = build_push_op(peer, recovery_info, progress, out_progress, &pop);
+  if (r < 0)
+    return r;
 
   tid_t tid = osd->get_tid();
   osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
   MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, recovery_info.soid,
 				   false, 0, get_osdmap()->get_epoch(),
 				   tid, recovery_info.version);
+  subop->ops = vector<OSDOp>(1);
+  subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
+  subop->ops[0].indata.claim(pop.data);
+  subop->data_included.swap(pop.data_included);
+  subop->omap_header.claim(pop.omap_header);
+  subop->omap_entries.swap(pop.omap_entries);
+  subop->attrset.swap(pop.attrset);
+  subop->recovery_info = recovery_info;
+  subop->recovery_progress = pop.after_progress;
+  subop->current_progress = progress;
+  osd->cluster_messenger->
+    send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  return 0;
+}
+
+int ReplicatedPG::build_push_op(int peer,
+				const ObjectRecoveryInfo &recovery_info,
+				const ObjectRecoveryProgress &progress,
+				ObjectRecoveryProgress *out_progress,
+				PushOp *out_op)
+{
+  ObjectRecoveryProgress new_progress = progress;
 
   dout(7) << "send_push_op " << recovery_info.soid
 	  << " v " << recovery_info.version
@@ -5204,16 +6030,13 @@ int ReplicatedPG::send_push(int peer,
 	  << " recovery_info: " << recovery_info
           << dendl;
 
-  subop->ops = vector<OSDOp>(1);
-  subop->ops[0].op.op = CEPH_OSD_OP_PUSH;
-
   if (progress.first) {
-    osd->store->omap_get_header(coll, recovery_info.soid, &subop->omap_header);
-    osd->store->getattrs(coll, recovery_info.soid, subop->attrset);
+    osd->store->omap_get_header(coll, recovery_info.soid, &out_op->omap_header);
+    osd->store->getattrs(coll, recovery_info.soid, out_op->attrset);
 
     // Debug
     bufferlist bv;
-    bv.push_back(subop->attrset[OI_ATTR]);
+    bv.push_back(out_op->attrset[OI_ATTR]);
     object_info_t oi(bv);
 
     if (oi.version != recovery_info.version) {
@@ -5222,7 +6045,6 @@ int ReplicatedPG::send_push(int peer,
 			<< recovery_info.version << " to osd." << peer
 			<< " failed because local copy is "
 			<< oi.version << "\n";
-      subop->put();
       return -1;
     }
 
@@ -5239,7 +6061,7 @@ int ReplicatedPG::send_push(int peer,
 	 iter->next()) {
       if (available < (iter->key().size() + iter->value().length()))
 	break;
-      subop->omap_entries.insert(make_pair(iter->key(), iter->value()));
+      out_op->omap_entries.insert(make_pair(iter->key(), iter->value()));
       available -= (iter->key().size() + iter->value().length());
     }
     if (!iter->valid())
@@ -5248,16 +6070,24 @@ int ReplicatedPG::send_push(int peer,
       new_progress.omap_recovered_to = iter->key();
   }
 
-  subop->data_included.span_of(recovery_info.copy_subset,
-			       progress.data_recovered_to,
-			       available);
+  out_op->data_included.span_of(recovery_info.copy_subset,
+				progress.data_recovered_to,
+				available);
 
-  for (interval_set<uint64_t>::iterator p = subop->data_included.begin();
-       p != subop->data_included.end();
+  for (interval_set<uint64_t>::iterator p = out_op->data_included.begin();
+       p != out_op->data_included.end();
        ++p) {
     bufferlist bit;
-    osd->store->read(coll, recovery_info.soid,
-		     p.get_start(), p.get_len(), bit);
+    int r = osd->store->read(coll, recovery_info.soid,
+			     p.get_start(), p.get_len(), bit);
+    if (r < 0) {
+      // don't pass on a short (or corrupt) copy as the whole object
+      osd->clog.error() << info.pgid << " push " << recovery_info.soid
+			<< " v " << recovery_info.version << " to osd." << peer
+			<< " failed to read " << p.get_start() << "~"
+			<< p.get_len() << ": " << cpp_strerror(r) << "\n";
+      return r;
+    }
     if (p.get_len() != bit.length()) {
       dout(10) << " extent " << p.get_start() << "~" << p.get_len()
 	       << " is actually " << p.get_start() << "~" << bit.length()
@@ -5265,24 +6095,23 @@ int ReplicatedPG::send_push(int peer,
       p.set_len(bit.length());
       new_progress.data_complete = true;
     }
-    subop->ops[0].indata.claim_append(bit);
+    out_op->data.claim_append(bit);
   }
 
-  if (!subop->data_included.empty())
-    new_progress.data_recovered_to = subop->data_included.range_end();
+  if (!out_op->data_included.empty())
+    new_progress.data_recovered_to = out_op->data_included.range_end();
 
   if (new_progress.is_complete(recovery_info))
     new_progress.data_complete = true;
 
   osd->logger->inc(l_osd_push);
-  osd->logger->inc(l_osd_push_outb, subop->ops[0].indata.length());
-  
-  // send
-  subop->recovery_info = recovery_info;
-  subop->recovery_progress = new_progress;
-  subop->current_progress = progress;
-  osd->cluster_messenger->
-    send_message(subop, get_osdmap()->get_cluster_inst(peer));
+  osd->logger->inc(l_osd_push_outb, out_op->data.length());
+
+  out_op->soid = recovery_info.soid;
+  out_op->version = recovery_info.version;
+  out_op->recovery_info = recovery_info;
+  out_op->after_progress = new_progress;
+  out_op->before_progress = progress;
   if (out_progress)
     *out_progress = new_progress;
   return 0;
@@ -5290,6 +6119,13 @@ int ReplicatedPG::send_push(int peer,
 
 void ReplicatedPG::send_push_op_blank(const hobject_t& soid, int peer)
 {
+  if (can_batch_recovery(peer)) {
+    // a push with no version tells the primary we don't have it
+    pending_pushes[peer].push_back(PushOp());
+    pending_pushes[peer].back().soid = soid;
+    return;
+  }
+
   // send a blank push back to the primary
   tid_t tid = osd->get_tid();
   osd_reqid_t rid(osd->cluster_messenger->get_myname(), 0, tid);
@@ -5309,10 +6145,12 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
   dout(10) << "sub_op_push_reply from " << reply->get_source() << " " << *reply << dendl;
 
   op->mark_started();
-  
-  int peer = reply->get_source().num();
-  const hobject_t& soid = reply->get_poid();
-  
+
+  handle_push_reply(reply->get_source().num(), reply->get_poid());
+}
+
+void ReplicatedPG::handle_push_reply(int peer, const hobject_t& soid)
+{
   if (pushing.count(soid) == 0) {
     dout(10) << "huh, i wasn't pushing " << soid << " to osd." << peer
 	     << ", or anybody else"
@@ -5328,8 +6166,14 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
 	       << pi->recovery_progress.data_recovered_to
 	       << " of " << pi->recovery_info.copy_subset << dendl;
       ObjectRecoveryProgress new_progress;
-      send_push(
+      int r = send_push(
 	peer, pi->recovery_info, pi->recovery_progress, &new_progress);
+      if (r < 0) {
+	push_read_error(soid, peer);
+	if (!pushing.count(soid))
+	  finish_recovery_op(soid);
+	return;
+      }
       pi->recovery_progress = new_progress;
     } else {
       // done!
@@ -5389,23 +6233,34 @@ void ReplicatedPG::sub_op_pull(OpRequestRef op)
 
   op->mark_started();
 
-  const hobject_t soid = m->poid;
-
-  dout(7) << "op_pull " << soid << " v " << m->version
+  dout(7) << "op_pull " << m->poid << " v " << m->version
           << " from " << m->get_source()
           << dendl;
 
+  PullOp pop;
+  pop.soid = m->poid;
+  pop.recovery_info = m->recovery_info;
+  pop.recovery_progress = m->recovery_progress;
+  handle_pull(m->get_source().num(), pop);
+
+  log_subop_stats(op, 0, l_osd_sop_pull_lat);
+}
+
+void ReplicatedPG::handle_pull(int peer, PullOp &op)
+{
+  const hobject_t &soid = op.soid;
+
   assert(!is_primary());  // we should be a replica or stray.
 
   struct stat st;
   int r = osd->store->stat(coll, soid, &st);
   if (r != 0) {
-    osd->clog.error() << info.pgid << " " << m->get_source() << " tried to pull " << soid
+    osd->clog.error() << info.pgid << " osd." << peer << " tried to pull " << soid
 		      << " but got " << cpp_strerror(-r) << "\n";
-    send_push_op_blank(soid, m->get_source().num());
+    send_push_op_blank(soid, peer);
   } else {
-    ObjectRecoveryInfo recovery_info = m->recovery_info;
-    ObjectRecoveryProgress progress = m->recovery_progress;
+    ObjectRecoveryInfo &recovery_info = op.recovery_info;
+    ObjectRecoveryProgress &progress = op.recovery_progress;
     if (progress.first && recovery_info.size == ((uint64_t)-1)) {
       // Adjust size and copy_subset
       recovery_info.size = st.st_size;
@@ -5415,12 +6270,10 @@ void ReplicatedPG::sub_op_pull(OpRequestRef op)
       assert(recovery_info.clone_subset.empty());
     }
 
-    r = send_push(m->get_source().num(), recovery_info, progress);
+    r = send_push(peer, recovery_info, progress);
     if (r < 0)
-      send_push_op_blank(soid, m->get_source().num());
+      send_push_op_blank(soid, peer);
   }
-
-  log_subop_stats(op, 0, l_osd_sop_pull_lat);
 }
 
 
@@ -5462,8 +6315,15 @@ void ReplicatedPG::_applied_recovered_object(ObjectStore::Transaction *t, Object
 {
   lock();
   dout(10) << "_applied_recovered_object " << *obc << dendl;
+  hobject_t soid = obc->obs.oi.soid;
+  eversion_t v = obc->obs.oi.version;
   put_object_context(obc);
 
+  // a backfill push which failed to read our old copy can go now
+  if (is_primary() && backfill_target >= 0 &&
+      backfills_in_flight.count(soid) && !pushing.count(soid))
+    push_backfill_object(soid, v, eversion_t(), backfill_target);
+
   assert(active_pushes >= 1);
   --active_pushes;
 
@@ -5581,23 +6441,86 @@ void ReplicatedPG::sub_op_push(OpRequestRef op)
 {
   op->mark_started();
 
-  // keep track of active pushes for scrub
-  ++active_pushes;
+  MOSDSubOp *m = (MOSDSubOp *)op->request;
+  int from = m->get_source().num();
+  vector<PushOp> pops(1);
+  PushOp &pop = pops.back();
+  pop.soid = m->poid;
+  pop.version = m->version;
+  m->claim_data(pop.data);
+  pop.data_included = m->data_included;
+  pop.omap_header = m->omap_header;
+  pop.omap_entries = m->omap_entries;
+  pop.attrset = m->attrset;
+  pop.recovery_info = m->recovery_info;
+  pop.before_progress = m->current_progress;
+  pop.after_progress = m->recovery_progress;
 
   if (is_primary()) {
-    handle_pull_response(op);
+    handle_pull_responses(from, pops, op);
   } else {
-    handle_push(op);
+    handle_pushes(pops, op);
+
+    MOSDSubOpReply *reply = new MOSDSubOpReply(
+      m, 0, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+    assert(entity_name_t::TYPE_OSD == m->get_connection()->peer_type);
+    osd->cluster_messenger->send_message(reply, m->get_connection());
   }
-  return;
 }
 
-void ReplicatedPG::_failed_push(OpRequestRef op)
+void ReplicatedPG::do_push(OpRequestRef op)
+{
+  MOSDPGPush *m = static_cast<MOSDPGPush *>(op->request);
+  assert(m->get_header().type == MSG_OSD_PG_PUSH);
+  dout(10) << "do_push " << m->pushes.size() << " from " << m->get_source() << dendl;
+
+  op->mark_started();
+
+  if (is_primary()) {
+    handle_pull_responses(m->get_source().num(), m->pushes, op);
+  } else {
+    handle_pushes(m->pushes, op);
+
+    MOSDPGPushReply *reply = new MOSDPGPushReply(info.pgid,
+						 get_osdmap()->get_epoch());
+    for (vector<PushOp>::iterator p = m->pushes.begin();
+	 p != m->pushes.end();
+	 ++p)
+      reply->replies.push_back(PushReplyOp(p->soid));
+    osd->cluster_messenger->send_message(reply, m->get_connection());
+  }
+}
+
+void ReplicatedPG::do_pull(OpRequestRef op)
+{
+  MOSDPGPull *m = static_cast<MOSDPGPull *>(op->request);
+  assert(m->get_header().type == MSG_OSD_PG_PULL);
+  dout(7) << "do_pull " << m->pulls.size() << " from " << m->get_source() << dendl;
+
+  op->mark_started();
+
+  for (vector<PullOp>::iterator p = m->pulls.begin(); p != m->pulls.end(); ++p)
+    handle_pull(m->get_source().num(), *p);
+
+  log_subop_stats(op, 0, l_osd_sop_pull_lat);
+}
+
+void ReplicatedPG::do_push_reply(OpRequestRef op)
+{
+  MOSDPGPushReply *m = static_cast<MOSDPGPushReply *>(op->request);
+  assert(m->get_header().type == MSG_OSD_PG_PUSH_REPLY);
+  dout(10) << "do_push_reply " << m->replies.size() << " from " << m->get_source() << dendl;
+
+  op->mark_started();
+
+  for (vector<PushReplyOp>::iterator p = m->replies.begin();
+       p != m->replies.end();
+       ++p)
+    handle_push_reply(m->get_source().num(), p->soid);
+}
+
+void ReplicatedPG::_failed_push(int from, const hobject_t& soid)
 {
-  MOSDSubOp *m = (MOSDSubOp*)op->request;
-  assert(m->get_header().type == MSG_OSD_SUBOP);
-  const hobject_t& soid = m->poid;
-  int from = m->get_source().num();
   map<hobject_t,set<int> >::iterator p = missing_loc.find(soid);
   if (p != missing_loc.end()) {
     dout(0) << "_failed_push " << soid << " from osd." << from
@@ -5869,6 +6792,8 @@ void ReplicatedPG::on_removal()
   dout(10) << "on_removal" << dendl;
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  clear_object_context_lru();
+  hit_set_clear();
 }
 
 void ReplicatedPG::on_shutdown()
@@ -5876,6 +6801,8 @@ void ReplicatedPG::on_shutdown()
   dout(10) << "on_shutdown" << dendl;
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  clear_object_context_lru();
+  hit_set_clear();
 }
 
 void ReplicatedPG::on_activate()
@@ -5905,6 +6832,7 @@ void ReplicatedPG::on_change()
   context_registry_on_change();
 
   // requeue object waiters
+  requeue_object_waiters(waiting_for_ondisk_read);
   requeue_object_waiters(waiting_for_missing_object);
   for (map<hobject_t,list<OpRequestRef> >::iterator p = waiting_for_degraded_object.begin();
        p != waiting_for_degraded_object.end();
@@ -5927,6 +6855,14 @@ void ReplicatedPG::on_change()
 
   // clear snap_trimmer state
   snap_trimmer_machine.process_event(Reset());
+
+  // whoever is primary now, what we cached may be stale by the time we
+  // are primary again
+  clear_object_context_lru();
+
+  // seal what the last interval saw rather than carry it into the next
+  if (hit_set)
+    hit_set_persist(ceph_clock_now(g_ceph_context));
 }
 
 void ReplicatedPG::on_role_change()
@@ -6296,6 +7232,8 @@ int ReplicatedPG::recover_object_replicas(const hobject_t& soid, eversion_t v)
       push_to_replica(obc, soid, peer);
     }
   }
+  if (started && !pushing.count(soid))
+    finish_recovery_op(soid);  // no push got going
   
   dout(10) << " ondisk_read_unlock on " << soid << dendl;
   obc->ondisk_read_unlock();
@@ -6554,13 +7492,19 @@ void ReplicatedPG::push_backfill_object(hobject_t oid, eversion_t v, eversion_t
 
   backfills_in_flight.insert(oid);
 
-  if (!pushing.count(oid))
+  bool started = false;
+  if (!pushing.count(oid)) {
     start_recovery_op(oid);
+    started = true;
+  }
   ObjectContext *obc = get_object_context(oid, OLOC_BLANK, false);
   obc->ondisk_read_lock();
   push_to_replica(obc, oid, peer);
   obc->ondisk_read_unlock();
   put_object_context(obc);
+  // on a read error oid stays in flight until our copy is recovered
+  if (started && !pushing.count(oid))
+    finish_recovery_op(oid);
 }
 
 void ReplicatedPG::scan_range(hobject_t begin, int min, int max, BackfillInterval *bi)
@@ -6883,7 +7827,8 @@ boost::statechart::result ReplicatedPG::NotTrimming::react(const SnapTrim&)
   coll_t &col_to_trim = context<SnapTrimmer>().col_to_trim;
   if (!pg->get_obs_to_trim(snap_to_trim,
 			   col_to_trim,
-			   obs_to_trim)) {
+			   obs_to_trim,
+			   context<SnapTrimmer>().next_to_list)) {
     // Nothing to trim
     dout(10) << "NotTrimming: nothing to trim" << dendl;
     return discard_event();
@@ -6975,17 +7920,37 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
   dout(10) << "TrimmingObjects react" << dendl;
   ReplicatedPG *pg = context< SnapTrimmer >().pg;
   vector<hobject_t> &obs_to_trim = context<SnapTrimmer>().obs_to_trim;
+  hobject_t &next_to_list = context<SnapTrimmer>().next_to_list;
   snapid_t &snap_to_trim = context<SnapTrimmer>().snap_to_trim;
   set<RepGather *> &repops = context<SnapTrimmer>().repops;
 
+  // On to the next part of the collection
+  if (position == obs_to_trim.end() && !next_to_list.is_max()) {
+    pg->list_obs_to_trim(context<SnapTrimmer>().col_to_trim,
+			 obs_to_trim, next_to_list);
+    position = obs_to_trim.begin();
+  }
+
   // Done, 
   if (position == obs_to_trim.end()) {
     post_event(SnapTrim());
     return transit< WaitingOnReplicas >();
   }
 
-  dout(10) << "TrimmingObjects react trimming " << *position << dendl;
-  RepGather *repop = pg->trim_object(*position, snap_to_trim);
+  // The work queue admitted one object; ask for the rest of the batch.
+  // issue_repop decides what to ship a backfill target by the repop's
+  // first object, so don't batch while backfilling.
+  unsigned max = MIN(MAX(g_conf->osd_snap_trim_batch, 1),
+		     obs_to_trim.end() - position);
+  if (pg->backfill_target >= 0)
+    max = 1;
+  else if (max > 1)
+    max = 1 + pg->osd->admit_background(OP_CLASS_SNAPTRIM, max - 1);
+
+  dout(10) << "TrimmingObjects react trimming up to " << max
+	   << " from " << *position << dendl;
+  RepGather *repop = pg->trim_objects(position, obs_to_trim.end(),
+				      snap_to_trim, max);
 
   if (repop) {
     repop->queue_snap_trimmer = true;
@@ -6999,14 +7964,6 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
     pg->eval_repop(repop);
     
     repops.insert(repop);
-    ++position;
-  } else {
-    // object has already been trimmed, this is an extra
-    coll_t col_to_trim(pg->info.pgid, snap_to_trim);
-    ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->collection_remove(col_to_trim, *position);
-    int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
-    assert(r == 0);
   }
   return discard_event();
 }
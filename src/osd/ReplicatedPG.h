@@ -19,6 +19,7 @@
 #include "OSD.h"
 #include "Watch.h"
 #include "OpRequest.h"
+#include "HitSet.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -101,7 +102,10 @@ public:
     bool registered; 
     SnapSet snapset;
 
-    SnapSetContext(const object_t& o) : oid(o), ref(0), registered(false) { }
+    xlist<SnapSetContext*>::item lru_item;  // on snapset_context_lru while ref == 0
+
+    SnapSetContext(const object_t& o)
+      : oid(o), ref(0), registered(false), lru_item(this) { }
   };
 
   struct ObjectState {
@@ -274,6 +278,9 @@ public:
     Cond cond;
     int unstable_writes, readers, writers_waiting, readers_waiting;
 
+    // repops queued to the store and not yet applied; pg lock protects this
+    int unapplied_repops;
+
     // set if writes for this object are blocked on another objects recovery
     ObjectContext *blocked_by;      // object blocking our writes
     set<ObjectContext*> blocking;   // objects whose writes we block
@@ -283,13 +290,19 @@ public:
     map<entity_name_t, Watch::C_WatchTimeout *> unconnected_watchers;
     map<Watch::Notification *, bool> notifs;
 
+    xlist<ObjectContext*>::item lru_item;  // on object_context_lru while ref == 0
+
     ObjectContext(const object_info_t &oi_, bool exists_, SnapSetContext *ssc_)
       : ref(0), registered(false), obs(oi_, exists_), ssc(ssc_),
 	lock("ReplicatedPG::ObjectContext::lock"),
 	unstable_writes(0), readers(0), writers_waiting(0), readers_waiting(0),
-	blocked_by(0) {}
+	unapplied_repops(0), blocked_by(0), lru_item(this) {}
     
-    void get() { ++ref; }
+    void get() {
+      if (ref == 0)
+	lru_item.remove_myself();
+      ++ref;
+    }
 
     // do simple synchronous mutual exclusion, for now.  now waitqueues or anything fancy.
     void ondisk_write_lock() {
@@ -371,6 +384,7 @@ public:
     ObjectContext *snapset_obc;  // if we created/deleted a snapdir
 
     int data_off;        // FIXME: we may want to kill this msgr hint off at some point!
+    bool read_error;     // the store failed a read with EIO
 
     MOSDOpReply *reply;
 
@@ -388,7 +402,8 @@ public:
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
       bytes_written(0), bytes_read(0),
-      obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
+      obc(0), clone_obc(0), snapset_obc(0), data_off(0), read_error(false),
+      reply(NULL), pg(_pg) { 
       if (_ssc) {
 	new_snapset = _ssc->snapset;
 	snapset = &_ssc->snapset;
@@ -516,6 +531,24 @@ protected:
   map<hobject_t, ObjectContext*> object_contexts;
   map<object_t, SnapSetContext*> snapset_contexts;
 
+  /*
+   * Contexts nobody holds a ref on stay registered, least recently
+   * used first, up to osd_pg_object_context_cache_count of each, so
+   * the next op on the object need not reread its attrs.  Only the
+   * primary's ops keep them current; they are dropped on any change of
+   * interval and before recovery rewrites an object.
+   */
+  xlist<ObjectContext*> object_context_lru;
+  xlist<SnapSetContext*> snapset_context_lru;
+
+  void trim_object_context_lru(unsigned max);
+  void trim_snapset_context_lru(unsigned max);
+  void invalidate_object_context(const hobject_t& soid);
+  void clear_object_context_lru() {
+    trim_object_context_lru(0);
+    trim_snapset_context_lru(0);
+  }
+
   void populate_obc_watchers(ObjectContext *obc);
   void register_unconnected_watcher(void *obc,
 				    entity_name_t entity,
@@ -529,7 +562,7 @@ protected:
   ObjectContext *lookup_object_context(const hobject_t& soid) {
     if (object_contexts.count(soid)) {
       ObjectContext *obc = object_contexts[soid];
-      obc->ref++;
+      obc->get();
       return obc;
     }
     return NULL;
@@ -548,6 +581,17 @@ protected:
       register_snapset_context(obc->ssc);
   }
 
+  /*
+   * Ops that must read an object's applied state while repops to it
+   * are still applying wait here, by head, rather than block the op
+   * thread in ondisk_read_lock().  Later ops to the object queue
+   * behind them to keep order.  Writes that only read the projected
+   * object_info don't wait at all, so they pipeline.
+   */
+  map<hobject_t, list<OpRequestRef> > waiting_for_ondisk_read;
+  bool ops_read_ondisk(const vector<OSDOp>& ops);
+  void kick_ondisk_readers(ObjectContext *obc);
+
   void context_registry_on_change();
   void put_object_context(ObjectContext *obc);
   void put_object_contexts(map<hobject_t,ObjectContext*>& obcv);
@@ -622,12 +666,29 @@ protected:
 			       bufferlist data_received,
 			       interval_set<uint64_t> *intervals_usable,
 			       bufferlist *data_usable);
-  void handle_pull_response(OpRequestRef op);
-  void handle_push(OpRequestRef op);
+  bool handle_pull_response(int from, PushOp &pop, PullOp *response,
+			    ObjectStore::Transaction *t,
+			    C_Contexts *onreadable, C_Contexts *onreadable_sync);
+  void handle_pull_responses(int from, vector<PushOp> &pops, OpRequestRef op);
+  void handle_push(PushOp &pop, ObjectStore::Transaction *t);
+  void handle_pushes(vector<PushOp> &pops, OpRequestRef op);
+  void handle_push_reply(int peer, const hobject_t &soid);
+  void handle_pull(int peer, PullOp &op);
   int send_push(int peer,
 		ObjectRecoveryInfo recovery_info,
 		ObjectRecoveryProgress progress,
 		ObjectRecoveryProgress *out_progress = 0);
+  int build_push_op(int peer,
+		    const ObjectRecoveryInfo &recovery_info,
+		    const ObjectRecoveryProgress &progress,
+		    ObjectRecoveryProgress *out_progress,
+		    PushOp *out_op);
+
+  // pushes and pulls per peer, sent together (osd_recovery_batch)
+  map<int, vector<PushOp> > pending_pushes;
+  map<int, vector<PullOp> > pending_pulls;
+  bool can_batch_recovery(int peer);
+  void send_pending_pushes(int peer);
   int send_pull(int peer,
 		ObjectRecoveryInfo recovery_info,
 		ObjectRecoveryProgress progress);
@@ -751,7 +812,11 @@ protected:
 			  const hobject_t &last_backfill,
 			  interval_set<uint64_t>& data_subset,
 			  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+  bool calc_delta_subsets(ObjectContext *obc, const hobject_t& head, int peer,
+			  interval_set<uint64_t>& data_subset,
+			  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
   void push_to_replica(ObjectContext *obc, const hobject_t& oid, int dest);
+  void push_read_error(const hobject_t& soid, int peer);
   void push_start(ObjectContext *obc,
 		  const hobject_t& oid, int dest);
   void push_start(ObjectContext *obc,
@@ -907,7 +972,7 @@ protected:
   void _committed_pushed_object(OpRequestRef op, epoch_t same_since, eversion_t lc);
   void recover_got(hobject_t oid, eversion_t v);
   void sub_op_push(OpRequestRef op);
-  void _failed_push(OpRequestRef op);
+  void _failed_push(int from, const hobject_t &soid);
   void sub_op_push_reply(OpRequestRef op);
   void sub_op_pull(OpRequestRef op);
 
@@ -929,25 +994,57 @@ protected:
   bool pgls_filter(PGLSFilter *filter, hobject_t& sobj, bufferlist& outdata);
   int get_pgls_filter(bufferlist::iterator& iter, PGLSFilter **pfilter);
 
+  // -- hit sets --
+  HitSet *hit_set;           ///< names accessed this interval, on the primary
+  hobject_t hit_set_oid;     ///< meta object whose omap keeps sealed sets
+  set<string> hit_set_keys;  ///< omap keys of the sealed sets, oldest first
+  bool hit_set_keys_loaded;
+
+  static string hit_set_key(utime_t begin, utime_t end);
+  static bool hit_set_key_parse(const string &key, utime_t *begin, utime_t *end);
+  void hit_set_load_keys();
+  void hit_set_record(const object_t &oid);
+  void hit_set_persist(utime_t now);
+  void hit_set_clear();
+  int hit_set_list(list<pair<utime_t,utime_t> > *ls);
+  int hit_set_get(utime_t stamp, bufferlist *bl);
+
 public:
   ReplicatedPG(OSDService *o, OSDMapRef curmap,
 	       const PGPool &_pool, pg_t p, const hobject_t& oid,
 	       const hobject_t& ioid);
-  ~ReplicatedPG() {}
+  ~ReplicatedPG() {
+    delete hit_set;
+  }
+
+  void dump_hit_sets(Formatter *f);
 
   int do_command(vector<string>& cmd, ostream& ss, bufferlist& idata, bufferlist& odata);
 
   void do_op(OpRequestRef op);
   bool pg_op_must_wait(MOSDOp *op);
+  bool can_serve_replica_read(MOSDOp *op);
   void do_pg_op(OpRequestRef op);
   void do_sub_op(OpRequestRef op);
   void do_sub_op_reply(OpRequestRef op);
   void do_scan(OpRequestRef op);
   void do_backfill(OpRequestRef op);
+  void do_push(OpRequestRef op);
+  void do_pull(OpRequestRef op);
+  void do_push_reply(OpRequestRef op);
+  void send_pending_recovery();
   bool get_obs_to_trim(snapid_t &snap_to_trim,
 		       coll_t &col_to_trim,
-		       vector<hobject_t> &obs_to_trim);
-  RepGather *trim_object(const hobject_t &coid, const snapid_t &sn);
+		       vector<hobject_t> &obs_to_trim,
+		       hobject_t &next);
+  void list_obs_to_trim(coll_t col_to_trim,
+			vector<hobject_t> &obs_to_trim,
+			hobject_t &next);
+  ObjectContext *get_clone_to_trim(const hobject_t &coid, const snapid_t &sn);
+  RepGather *trim_objects(vector<hobject_t>::iterator &p,
+			  vector<hobject_t>::iterator end,
+			  const snapid_t &sn, unsigned max);
+  void trim_object(RepGather *repop, ObjectContext *obc);
   void snap_trimmer();
   int do_osd_ops(OpContext *ctx, vector<OSDOp>& ops);
   void do_osd_op_effects(OpContext *ctx);
@@ -974,6 +1071,7 @@ private:
     ReplicatedPG *pg;
     set<RepGather *> repops;
     vector<hobject_t> obs_to_trim;
+    hobject_t next_to_list;  ///< where to list col_to_trim from once obs_to_trim is done
     snapid_t snap_to_trim;
     coll_t col_to_trim;
     bool need_share_pg_info;
@@ -1039,6 +1137,7 @@ public:
   bool is_missing_object(const hobject_t& oid);
   void wait_for_missing_object(const hobject_t& oid, OpRequestRef op);
   void wait_for_all_missing(OpRequestRef op);
+  bool recover_read_error(const hobject_t& soid, eversion_t v);
 
   bool is_degraded_object(const hobject_t& oid);
   void wait_for_degraded_object(const hobject_t& oid, OpRequestRef op);
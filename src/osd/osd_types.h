@@ -624,6 +624,7 @@ public:
   epoch_t snap_epoch;       /// osdmap epoch of last snap
   uint64_t auid;            /// who owns the pg
   __u32 crash_replay_interval; /// seconds to allow clients to replay ACKed but unCOMMITted requests
+  uint64_t expected_num_objects; /// objects the pool is expected to hold, 0 if unknown
 
   /*
    * Pool snaps (global to this pool).  These define a SnapContext for
@@ -648,6 +649,7 @@ public:
       snap_seq(0), snap_epoch(0),
       auid(0),
       crash_replay_interval(0),
+      expected_num_objects(0),
       pg_num_mask(0), pgp_num_mask(0) { }
 
   void dump(Formatter *f) const;
@@ -665,6 +667,7 @@ public:
   snapid_t get_snap_seq() const { return snap_seq; }
   uint64_t get_auid() const { return auid; }
   unsigned get_crash_replay_interval() const { return crash_replay_interval; }
+  uint64_t get_expected_num_objects() const { return expected_num_objects; }
 
   void set_snap_seq(snapid_t s) { snap_seq = s; }
   void set_snap_epoch(epoch_t e) { snap_epoch = e; }
@@ -1246,17 +1249,22 @@ struct pg_log_entry_t {
   bool invalid_hash; // only when decoding sobject_t based entries
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
+  /// object data this modify may have changed, when known (osd_recovery_delta)
+  bool dirty_extents_valid;
+  interval_set<uint64_t> dirty_extents;
+
   uint64_t offset;   // [soft state] my offset on disk
       
   pg_log_entry_t()
-    : op(0), invalid_hash(false), invalid_pool(false), offset(0) {}
+    : op(0), invalid_hash(false), invalid_pool(false),
+      dirty_extents_valid(false), offset(0) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
       reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
-      offset(0) {}
+      dirty_extents_valid(false), offset(0) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -1781,6 +1789,66 @@ struct ObjectRecoveryProgress {
 WRITE_CLASS_ENCODER(ObjectRecoveryProgress)
 ostream& operator<<(ostream& out, const ObjectRecoveryProgress &prog);
 
+/*
+ * one object's part of a batched push (MOSDPGPush)
+ */
+struct PushOp {
+  hobject_t soid;
+  eversion_t version;   ///< zero if the sender has no copy
+  bufferlist data;
+  interval_set<uint64_t> data_included;
+  bufferlist omap_header;
+  map<string, bufferlist> omap_entries;
+  map<string, bufferptr> attrset;
+
+  ObjectRecoveryInfo recovery_info;
+  ObjectRecoveryProgress before_progress;
+  ObjectRecoveryProgress after_progress;
+
+  static void generate_test_instances(list<PushOp*>& o);
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  ostream &print(ostream &out) const;
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(PushOp)
+ostream& operator<<(ostream& out, const PushOp &op);
+
+/*
+ * one object's part of a batched pull (MOSDPGPull)
+ */
+struct PullOp {
+  hobject_t soid;
+  ObjectRecoveryInfo recovery_info;
+  ObjectRecoveryProgress recovery_progress;
+
+  static void generate_test_instances(list<PullOp*>& o);
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  ostream &print(ostream &out) const;
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(PullOp)
+ostream& operator<<(ostream& out, const PullOp &op);
+
+/*
+ * one object's part of a batched push reply (MOSDPGPushReply)
+ */
+struct PushReplyOp {
+  hobject_t soid;
+
+  PushReplyOp() {}
+  PushReplyOp(const hobject_t &o) : soid(o) {}
+
+  static void generate_test_instances(list<PushReplyOp*>& o);
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  ostream &print(ostream &out) const;
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(PushReplyOp)
+ostream& operator<<(ostream& out, const PushReplyOp &op);
+
 
 /*
  * summarize pg contents for purposes of a scrub
@@ -1792,8 +1860,11 @@ struct ScrubMap {
     map<string,bufferptr> attrs;
     __u32 digest;
     bool digest_present;
+    __u32 omap_digest;         ///< crc32c of the omap header, keys and values
+    bool omap_digest_present;
 
-    object(): size(0), negative(false), digest(0), digest_present(false) {}
+    object(): size(0), negative(false), digest(0), digest_present(false),
+	      omap_digest(0), omap_digest_present(false) {}
 
     void encode(bufferlist& bl) const;
     void decode(bufferlist::iterator& bl);
@@ -31,6 +31,7 @@ ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, loff_t o
   right->last_write_tid = left->last_write_tid;
   right->set_state(left->get_state());
   right->snapc = left->snapc;
+  right->dirty_stamp = left->dirty_stamp;
 
   loff_t newleftlen = off - left->start();
   right->set_start(off);
@@ -92,6 +93,16 @@ void ObjectCacher::Object::merge_left(BufferHead *left, BufferHead *right)
   left->last_write_tid =  MAX( left->last_write_tid, right->last_write_tid );
   left->last_write = MAX( left->last_write, right->last_write );
 
+  // keep the older flush deadline
+  if (right->dirty_stamp < left->dirty_stamp) {
+    bool dirty = left->is_dirty();
+    if (dirty)
+      oc->dirty_bh.erase(left);
+    left->dirty_stamp = right->dirty_stamp;
+    if (dirty)
+      oc->dirty_bh.insert(left);
+  }
+
   // waiters
   for (map<loff_t, list<Context*> >::iterator p = right->waitfor_read.begin();
        p != right->waitfor_read.end();
@@ -428,7 +439,9 @@ ObjectCacher::ObjectCacher(CephContext *cct_, string name, WritebackHandler& wb,
   : perfcounter(NULL),
     cct(cct_), writeback_handler(wb), name(name), lock(l),
     max_dirty(max_dirty), target_dirty(target_dirty), max_size(max_size),
+    max_dirty_per_set(0), max_flush_size(0),
     flush_set_callback(flush_callback), flush_set_callback_arg(flush_callback_arg),
+    dirty_or_tx_sets(0),
     flusher_stop(false), flusher_thread(this),
     stat_clean(0), stat_dirty(0), stat_rx(0), stat_tx(0), stat_missing(0),
     stat_error(0), stat_dirty_waiting(0)
@@ -642,6 +655,82 @@ void ObjectCacher::bh_write(BufferHead *bh)
   mark_tx(bh);
 }
 
+loff_t ObjectCacher::bh_write_adjacencies(BufferHead *bh)
+{
+  assert(bh->is_dirty());
+  Object *ob = bh->ob;
+
+  // gather contiguous dirty bhs on either side
+  list<BufferHead*> blist;
+  blist.push_back(bh);
+  loff_t total = bh->length();
+
+  map<loff_t, BufferHead*>::iterator p = ob->data.find(bh->start());
+  assert(p != ob->data.end());
+  while (p != ob->data.begin()) {
+    --p;
+    BufferHead *left = p->second;
+    if (!left->is_dirty() ||
+	left->end() != blist.front()->start() ||
+	left->snapc.seq != bh->snapc.seq ||
+	(max_flush_size > 0 && total + left->length() > max_flush_size))
+      break;
+    blist.push_front(left);
+    total += left->length();
+  }
+  p = ob->data.find(bh->start());
+  for (++p; p != ob->data.end(); ++p) {
+    BufferHead *right = p->second;
+    if (!right->is_dirty() ||
+	right->start() != blist.back()->end() ||
+	right->snapc.seq != bh->snapc.seq ||
+	(max_flush_size > 0 && total + right->length() > max_flush_size))
+      break;
+    blist.push_back(right);
+    total += right->length();
+  }
+
+  if (blist.size() == 1) {
+    bh_write(bh);
+    return total;
+  }
+
+  BufferHead *first = blist.front();
+  ldout(cct, 7) << "bh_write_adjacencies " << blist.size() << " bhs "
+		<< first->start() << "~" << total << " in " << *ob << dendl;
+
+  bufferlist bl;
+  utime_t mtime;
+  for (list<BufferHead*>::iterator i = blist.begin(); i != blist.end(); ++i) {
+    bl.append((*i)->bl);
+    if ((*i)->last_write > mtime)
+      mtime = (*i)->last_write;
+  }
+
+  // a single commit covers the whole extent; bh_write_commit cleans
+  // every bh in it that still carries this tid.
+  C_WriteCommit *oncommit = new C_WriteCommit(this, ob->oloc.pool,
+                                              ob->get_soid(), first->start(), total);
+  ObjectSet *oset = ob->oset;
+  tid_t tid = writeback_handler.write(ob->get_oid(), ob->get_oloc(),
+				      first->start(), total,
+				      bh->snapc, bl, mtime,
+				      oset->truncate_size, oset->truncate_seq,
+				      oncommit);
+  oncommit->tid = tid;
+  ob->last_write_tid = tid;
+
+  for (list<BufferHead*>::iterator i = blist.begin(); i != blist.end(); ++i) {
+    (*i)->last_write_tid = tid;
+    mark_tx(*i);
+  }
+
+  if (perfcounter) {
+    perfcounter->inc(l_objectcacher_data_flushed, total);
+  }
+  return total;
+}
+
 void ObjectCacher::lock_ack(int64_t poolid, list<sobject_t>& oids, tid_t tid)
 {
   for (list<sobject_t>::iterator i = oids.begin();
@@ -802,11 +891,26 @@ void ObjectCacher::flush(loff_t amount)
     if (!bh) break;
     if (bh->last_write > cutoff) break;
 
-    did += bh->length();
-    bh_write(bh);
+    did += bh_write_adjacencies(bh);
   }    
 }
 
+/*
+ * write out everything that has been dirty since before cutoff, oldest
+ * first.  unlike the lru, a bh that is rewritten over and over keeps
+ * its original deadline.
+ */
+void ObjectCacher::flush_aged(const utime_t& cutoff)
+{
+  while (!dirty_bh.empty()) {
+    BufferHead *bh = *dirty_bh.begin();
+    if (bh->dirty_stamp >= cutoff)
+      break;
+    ldout(cct, 10) << "flush_aged flushing aged dirty bh " << *bh << dendl;
+    bh_write_adjacencies(bh);
+  }
+}
+
 
 void ObjectCacher::trim(loff_t max)
 {
@@ -1139,15 +1243,30 @@ int ObjectCacher::_wait_for_write(OSDWrite *wr, uint64_t len, ObjectSet *oset, M
     //  - do not wait for bytes other waiters are waiting on.  this means that
     //    threads do not wait for each other.  this effectively allows the cache size
     //    to balloon proportional to the data that is in flight.
-    while (get_stat_dirty() + get_stat_tx() >= max_dirty + get_stat_dirty_waiting()) {
+    //  - a set below its fair share of max_dirty is not held back by
+    //    the global limit, so one busy set cannot stall all the others.
+    //  - a set over max_dirty_per_set waits on its own writeback.
+    while (true) {
+      bool over_set = max_dirty_per_set > 0 &&
+	oset->dirty_or_tx >= max_dirty_per_set + oset->dirty_waiting;
+      bool over_global =
+	get_stat_dirty() + get_stat_tx() >= max_dirty + get_stat_dirty_waiting() &&
+	_set_over_fair_share(oset);
+      if (!over_set && !over_global)
+	break;
       ldout(cct, 10) << "wait_for_write waiting on " << len << ", dirty|tx " 
 		     << (get_stat_dirty() + get_stat_tx()) 
 		     << " >= max " << max_dirty << " + dirty_waiting " << get_stat_dirty_waiting()
+		     << ", " << *oset
 		     << dendl;
+      if (over_set)
+	flush_set(oset);
       flusher_cond.Signal();
       stat_dirty_waiting += len;
+      oset->dirty_waiting += len;
       stat_cond.Wait(lock);
       stat_dirty_waiting -= len;
+      oset->dirty_waiting -= len;
       blocked++;
       ldout(cct, 10) << "wait_for_write woke up" << dendl;
     }
@@ -1179,6 +1298,13 @@ int ObjectCacher::_wait_for_write(OSDWrite *wr, uint64_t len, ObjectSet *oset, M
   return ret;
 }
 
+bool ObjectCacher::_set_over_fair_share(ObjectSet *oset)
+{
+  if (dirty_or_tx_sets <= 1)
+    return true;
+  return oset->dirty_or_tx >= max_dirty / dirty_or_tx_sets;
+}
+
 void ObjectCacher::flusher_entry()
 {
   ldout(cct, 10) << "flusher start" << dendl;
@@ -1194,6 +1320,11 @@ void ObjectCacher::flusher_entry()
 		   << target_dirty << " target, "
 		   << max_dirty << " max)"
 		   << dendl;
+    // anything past its deadline goes first, oldest first
+    utime_t cutoff = ceph_clock_now(cct);
+    cutoff -= max_dirty_age;
+    flush_aged(cutoff);
+
     loff_t actual = get_stat_dirty() + get_stat_dirty_waiting();
     if (actual > target_dirty) {
       // flush some dirty pages
@@ -1203,16 +1334,6 @@ void ObjectCacher::flusher_entry()
 		     << target_dirty
 		     << ", flushing some dirty bhs" << dendl;
       flush(actual - target_dirty);
-    } else {
-      // check tail of lru for old dirty items
-      utime_t cutoff = ceph_clock_now(cct);
-      cutoff -= max_dirty_age;
-      BufferHead *bh = 0;
-      while ((bh = (BufferHead*)lru_dirty.lru_get_next_expire()) != 0 &&
-	     bh->last_write < cutoff) {
-	ldout(cct, 10) << "flusher flushing aged dirty bh " << *bh << dendl;
-	bh_write(bh);
-      }
     }
     if (flusher_stop)
       break;
@@ -1453,7 +1574,7 @@ bool ObjectCacher::flush(Object *ob, loff_t offset, loff_t length)
     if (!bh->is_dirty()) {
       continue;
     }
-    bh_write(bh);
+    bh_write_adjacencies(bh);
     clean = false;
   }
   return clean;
@@ -1823,11 +1944,15 @@ void ObjectCacher::bh_stat_add(BufferHead *bh)
   case BufferHead::STATE_DIRTY:
     stat_dirty += bh->length();
     bh->ob->dirty_or_tx += bh->length();
+    if (bh->ob->oset->dirty_or_tx == 0 && bh->length())
+      dirty_or_tx_sets++;
     bh->ob->oset->dirty_or_tx += bh->length();
     break;
   case BufferHead::STATE_TX:
     stat_tx += bh->length();
     bh->ob->dirty_or_tx += bh->length();
+    if (bh->ob->oset->dirty_or_tx == 0 && bh->length())
+      dirty_or_tx_sets++;
     bh->ob->oset->dirty_or_tx += bh->length();
     break;
   case BufferHead::STATE_RX:
@@ -1856,11 +1981,15 @@ void ObjectCacher::bh_stat_sub(BufferHead *bh)
     stat_dirty -= bh->length();
     bh->ob->dirty_or_tx -= bh->length();
     bh->ob->oset->dirty_or_tx -= bh->length();
+    if (bh->ob->oset->dirty_or_tx == 0 && bh->length())
+      dirty_or_tx_sets--;
     break;
   case BufferHead::STATE_TX:
     stat_tx -= bh->length();
     bh->ob->dirty_or_tx -= bh->length();
     bh->ob->oset->dirty_or_tx -= bh->length();
+    if (bh->ob->oset->dirty_or_tx == 0 && bh->length())
+      dirty_or_tx_sets--;
     break;
   case BufferHead::STATE_RX:
     stat_rx -= bh->length();
@@ -1879,6 +2008,7 @@ void ObjectCacher::bh_set_state(BufferHead *bh, int s)
   if (s == BufferHead::STATE_DIRTY && bh->get_state() != BufferHead::STATE_DIRTY) {
     lru_rest.lru_remove(bh);
     lru_dirty.lru_insert_top(bh);
+    bh->dirty_stamp = ceph_clock_now(cct);
     dirty_bh.insert(bh);
   }
   if (s != BufferHead::STATE_DIRTY && bh->get_state() == BufferHead::STATE_DIRTY) {
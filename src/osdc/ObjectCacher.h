@@ -102,6 +102,7 @@ class ObjectCacher {
     bufferlist  bl;
     tid_t last_write_tid;  // version of bh (if non-zero)
     utime_t last_write;
+    utime_t dirty_stamp;   // when bh went dirty; flush deadline is relative to this
     SnapContext snapc;
     int error; // holds return value for failed reads
     
@@ -150,6 +151,15 @@ class ObjectCacher {
       --ref;
       return ref;
     }
+
+    /// order dirty bhs by age, oldest first
+    struct dirty_stamp_lt {
+      bool operator()(const BufferHead *l, const BufferHead *r) const {
+	if (l->dirty_stamp != r->dirty_stamp)
+	  return l->dirty_stamp < r->dirty_stamp;
+	return l < r;
+      }
+    };
   };
 
   // ******* Object *********
@@ -284,10 +294,12 @@ class ObjectCacher {
     xlist<Object*> objects;
 
     int dirty_or_tx;
+    loff_t dirty_waiting;  // bytes writers to this set are waiting on
 
     ObjectSet(void *p, int64_t _poolid, inodeno_t i)
       : parent(p), ino(i), truncate_seq(0),
-	truncate_size(0), poolid(_poolid), dirty_or_tx(0) {}
+	truncate_size(0), poolid(_poolid), dirty_or_tx(0),
+	dirty_waiting(0) {}
   };
 
 
@@ -300,6 +312,8 @@ class ObjectCacher {
   Mutex& lock;
   
   int64_t max_dirty, target_dirty, max_size;
+  int64_t max_dirty_per_set;  // per-ObjectSet dirty|tx limit, 0 for none
+  int64_t max_flush_size;     // largest coalesced write we will issue
   utime_t max_dirty_age;
 
   flush_set_callback_t flush_set_callback;
@@ -307,8 +321,9 @@ class ObjectCacher {
 
   vector<hash_map<sobject_t, Object*> > objects; // indexed by pool_id
 
-  set<BufferHead*>    dirty_bh;
+  set<BufferHead*, BufferHead::dirty_stamp_lt> dirty_bh;  // oldest first
   LRU   lru_dirty, lru_rest;
+  int dirty_or_tx_sets;  // number of ObjectSets with dirty or tx data
 
   Cond flusher_cond;
   bool flusher_stop;
@@ -389,8 +404,20 @@ class ObjectCacher {
   void bh_read(BufferHead *bh);
   void bh_write(BufferHead *bh);
 
+  /**
+   * write a dirty bh along with any contiguous dirty neighbors
+   *
+   * Neighbors are only included if they share the bh's snap context,
+   * and the combined write is capped at max_flush_size.
+   *
+   * @param bh dirty buffer to write
+   * @return number of bytes sent to the writeback handler
+   */
+  loff_t bh_write_adjacencies(BufferHead *bh);
+
   void trim(loff_t max=-1);
   void flush(loff_t amount=0);
+  void flush_aged(const utime_t& cutoff);
 
   /**
    * flush a range of buffers
@@ -525,6 +552,7 @@ class ObjectCacher {
 private:
   // write blocking
   int _wait_for_write(OSDWrite *wr, uint64_t len, ObjectSet *oset, Mutex& lock);
+  bool _set_over_fair_share(ObjectSet *oset);
   
 public:
   bool set_is_cached(ObjectSet *oset);
@@ -556,6 +584,12 @@ public:
   void set_max_dirty_age(double a) {
     max_dirty_age.set_from_double(a);
   }
+  void set_max_dirty_per_set(int64_t v) {
+    max_dirty_per_set = v;
+  }
+  void set_max_flush_size(int64_t v) {
+    max_flush_size = v;
+  }
 
   // file functions
 
@@ -612,6 +646,7 @@ inline ostream& operator<<(ostream& out, ObjectCacher::ObjectSet &os)
 	     << " ts " << os.truncate_seq << "/" << os.truncate_size
 	     << " objects " << os.objects.size()
 	     << " dirty_or_tx " << os.dirty_or_tx
+	     << " dirty_waiting " << os.dirty_waiting
 	     << "]";
 }
 
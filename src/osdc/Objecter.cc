@@ -1068,11 +1068,25 @@ int Objecter::recalc_op_target(Op *op)
       int osd;
       bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
       if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
-	int p = rand() % acting.size();
+	// the one we have fewest ops in flight to; ties at random
+	unsigned p = 0, ties = 0;
+	int best_load = -1;
+	for (unsigned i = 0; i < acting.size(); ++i) {
+	  map<int,OSDSession*>::iterator q = osd_sessions.find(acting[i]);
+	  int load = q == osd_sessions.end() ? 0 : q->second->ops.size();
+	  if (best_load < 0 || load < best_load) {
+	    p = i;
+	    best_load = load;
+	    ties = 1;
+	  } else if (load == best_load && rand() % ++ties == 0) {
+	    p = i;
+	  }
+	}
 	if (p)
 	  op->used_replica = true;
 	osd = acting[p];
-	ldout(cct, 10) << " chose random osd." << osd << " of " << acting << dendl;
+	ldout(cct, 10) << " chose osd." << osd << " of " << acting
+		       << " with " << best_load << " ops in flight" << dendl;
       } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
 	// look for a local replica
 	int i;
@@ -1298,6 +1312,17 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   int rc = m->get_result();
 
+  if (rc == -EAGAIN && op->used_replica) {
+    // the replica couldn't serve it; the primary can
+    ldout(cct, 7) << " got -EAGAIN from replica, resending to primary" << dendl;
+    op->flags &= ~(CEPH_OSD_FLAG_BALANCE_READS | CEPH_OSD_FLAG_LOCALIZE_READS);
+    op->acting.clear();  // force a new target
+    if (recalc_op_target(op) == RECALC_OP_TARGET_NEED_RESEND && op->session)
+      send_op(op);
+    m->put();
+    return;
+  }
+
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
     if (op->onack)
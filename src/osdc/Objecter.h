@@ -163,6 +163,18 @@ struct ObjectOperation {
     flags |= CEPH_OSD_FLAG_PGOP;
   }
 
+  /// the pg's hit set intervals, as an encoded list<pair<utime_t,utime_t> >
+  void hit_set_ls() {
+    add_op(CEPH_OSD_OP_PG_HITSET_LS);
+    flags |= CEPH_OSD_FLAG_PGOP;
+  }
+  /// the pg's encoded HitSet covering stamp
+  void hit_set_get(utime_t stamp) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_PG_HITSET_GET);
+    ::encode(stamp, osd_op.indata);
+    flags |= CEPH_OSD_FLAG_PGOP;
+  }
+
   void create(bool excl) {
     OSDOp& o = add_op(CEPH_OSD_OP_CREATE);
     o.op.flags = (excl ? CEPH_OSD_OP_FLAG_EXCL : 0);
@@ -1046,6 +1058,21 @@ private:
     o->out_rval.swap(op.out_rval);
     return op_submit(o);
   }
+  /// send PG ops to the pg with seed hash in oloc's pool
+  tid_t pg_read(uint32_t hash, const object_locator_t& oloc,
+		ObjectOperation& op, bufferlist *pbl, int flags,
+		Context *onack, epoch_t *reply_epoch) {
+    Op *o = new Op(object_t(), oloc, op.ops,
+		   flags | global_op_flags | CEPH_OSD_FLAG_READ | CEPH_OSD_FLAG_PGOP,
+		   onack, NULL, NULL);
+    o->priority = op.priority;
+    o->snapid = CEPH_NOSNAP;
+    o->outbl = pbl;
+    o->reply_epoch = reply_epoch;
+    o->pgid = pg_t(hash, oloc.pool, -1);
+    o->precalc_pgid = true;
+    return op_submit(o);
+  }
   tid_t linger(const object_t& oid, const object_locator_t& oloc, 
 	       ObjectOperation& op,
 	       snapid_t snap, bufferlist& inbl, bufferlist *poutbl, int flags,
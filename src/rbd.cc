@@ -22,6 +22,8 @@
 #include "global/global_init.h"
 #include "common/safe_io.h"
 #include "common/secret.h"
+#include "common/Mutex.h"
+#include "common/Throttle.h"
 #include "include/rados/librados.hpp"
 #include "include/rbd/librbd.hpp"
 #include "include/byteorder.h"
@@ -79,6 +81,7 @@ void usage()
 "  resize --size <MB> <image-name>             resize (expand or contract) image\n"
 "  rm <image-name>                             delete an image\n"
 "  export <image-name> <path>                  export image to file\n"
+"                                              \"-\" for stdout\n"
 "  import <path> <image-name>                  import image from file\n"
 "                                              (dest defaults)\n"
 "                                              as the filename part of file)\n"
@@ -447,57 +450,154 @@ static int do_lock_remove(librbd::Image& image, const char *client,
 }
 
 struct ExportContext {
+  librbd::Image &image;
   int fd;
+  bool sequential; // fd can't seek, so data must be written in order
+  SimpleThrottle throttle;
   MyProgressContext pc;
 
-  ExportContext(int f) : fd(f), pc("Exporting image") {}
+  Mutex lock; // protects next_ofs and pending
+  uint64_t next_ofs;
+  map<uint64_t, bufferlist> pending; // completed reads waiting their turn
+
+  ExportContext(librbd::Image &i, int f, bool seq)
+    : image(i), fd(f), sequential(seq),
+      throttle(g_conf->rbd_concurrent_management_ops, false),
+      pc("Exporting image"), lock("ExportContext::lock"), next_ofs(0) {}
+};
+
+struct ExportChunk {
+  ExportContext *ec;
+  uint64_t ofs;
+  bufferlist bl;
+
+  ExportChunk(ExportContext *e, uint64_t o) : ec(e), ofs(o) {}
 };
 
-static int export_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
+/*
+ * once an error is recorded nothing more can be written in order, so
+ * let go of the chunks waiting their turn.  completions that see the
+ * error after this don't park.
+ */
+static void export_drop_pending(ExportContext *ec)
 {
-  ssize_t ret;
-  ExportContext *ec = (ExportContext *)arg;
-  int fd = ec->fd;
+  assert(ec->lock.is_locked());
+  for (map<uint64_t, bufferlist>::iterator p = ec->pending.begin();
+       p != ec->pending.end();
+       ++p)
+    ec->throttle.end_op(0);
+  ec->pending.clear();
+}
 
-  if (!buf) /* a hole */
-    return 0;
+static void export_aio_cb(librbd::completion_t cb, void *arg)
+{
+  librbd::RBD::AioCompletion *comp = (librbd::RBD::AioCompletion *)cb;
+  ExportChunk *chunk = (ExportChunk *)arg;
+  ExportContext *ec = chunk->ec;
+  int r = comp->get_return_value();
 
-  ret = lseek64(fd, ofs, SEEK_SET);
-  if (ret < 0)
-    return -errno;
-  ret = write(fd, buf, len);
-  if (ret < 0)
-    return -errno;
+  if (r < 0) {
+    cerr << "error reading from image at offset " << chunk->ofs << ": "
+	 << cpp_strerror(r) << std::endl;
+    ec->throttle.end_op(r);
+    delete chunk;
+    if (ec->sequential) {
+      Mutex::Locker l(ec->lock);
+      export_drop_pending(ec);
+    }
+    return;
+  }
 
-  cerr << "writing " << len << " bytes at ofs " << ofs << std::endl;
-  return 0;
+  if (!ec->sequential) {
+    // holes are left for the final ftruncate to fill in
+    if (!chunk->bl.is_zero()) {
+      r = safe_pwrite(ec->fd, chunk->bl.c_str(), chunk->bl.length(),
+		      chunk->ofs);
+      if (r < 0)
+	cerr << "error writing to file: " << cpp_strerror(r) << std::endl;
+    }
+    ec->throttle.end_op(r);
+    delete chunk;
+    return;
+  }
+
+  // each chunk holds its throttle slot until it's written, so the
+  // pending map is bounded by the window
+  Mutex::Locker l(ec->lock);
+  if (ec->throttle.pending_error()) {
+    delete chunk;
+    ec->throttle.end_op(0);
+    return;
+  }
+  ec->pending[chunk->ofs].claim(chunk->bl);
+  delete chunk;
+  map<uint64_t, bufferlist>::iterator p = ec->pending.begin();
+  while (p != ec->pending.end() && p->first == ec->next_ofs) {
+    r = p->second.write_fd(ec->fd);
+    ec->next_ofs += p->second.length();
+    ec->pending.erase(p++);
+    ec->throttle.end_op(r);
+    if (r < 0) {
+      cerr << "error writing to output: " << cpp_strerror(r) << std::endl;
+      export_drop_pending(ec);
+      break;
+    }
+  }
 }
 
 static int do_export(librbd::Image& image, const char *path)
 {
-  int64_t r;
+  int r;
   librbd::image_info_t info;
   int fd;
+  bool to_stdout = (strcmp(path, "-") == 0);
 
   r = image.stat(info, sizeof(info));
   if (r < 0)
     return r;
 
-  fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (to_stdout)
+    fd = 1;
+  else
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
   if (fd < 0)
     return -errno;
 
-  ExportContext ec(fd);
-  r = image.read_iterate(0, info.size, export_read_cb, (void *)&ec);
-  if (r < 0)
-    goto out;
+  // keep a window of object-sized reads in flight; each is written
+  // out by its completion
+  ExportContext ec(image, fd, to_stdout);
+  uint64_t period = 1ull << info.order;
+  for (uint64_t ofs = 0; ofs < info.size; ofs += period) {
+    if (ec.throttle.pending_error())
+      break;
+    ec.pc.update_progress(ofs, info.size);
+
+    uint64_t len = MIN(period, info.size - ofs);
+    ExportChunk *chunk = new ExportChunk(&ec, ofs);
+    librbd::RBD::AioCompletion *comp =
+      new librbd::RBD::AioCompletion(chunk, export_aio_cb);
+    ec.throttle.start_op();
+    r = image.aio_read(ofs, len, chunk->bl, comp);
+    if (r < 0) {
+      cerr << "error reading from image at offset " << ofs << ": "
+	   << cpp_strerror(r) << std::endl;
+      comp->release();
+      delete chunk;
+      ec.throttle.end_op(r);
+      break;
+    }
+    comp->release();
+  }
 
-  r = ftruncate(fd, info.size);
-  if (r < 0)
-    goto out;
+  r = ec.throttle.wait_for_ret();
+  if (r >= 0 && !to_stdout) {
+    r = ftruncate(fd, info.size);
+    if (r < 0)
+      r = -errno;
+  }
 
- out:
-  close(fd);
+  if (!to_stdout)
+    close(fd);
   if (r < 0)
     ec.pc.fail();
   else
@@ -564,6 +664,13 @@ done_img:
   update_snap_name(*new_img, snap);
 }
 
+static void import_aio_cb(librbd::completion_t cb, void *arg)
+{
+  librbd::RBD::AioCompletion *comp = (librbd::RBD::AioCompletion *)cb;
+  SimpleThrottle *throttle = (SimpleThrottle *)arg;
+  throttle->end_op(comp->get_return_value());
+}
+
 static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
 		     const char *imgname, int *order, const char *path,
 		     int format, uint64_t features, int64_t size)
@@ -572,6 +679,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   struct stat stat_buf;
   struct fiemap *fiemap;
   MyProgressContext pc("Importing image");
+  SimpleThrottle throttle(g_conf->rbd_concurrent_management_ops, false);
 
   if (! strcmp(path, "-")) {
     fd = 0;
@@ -693,22 +801,21 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
           goto done;
         }
         bufferlist bl;
-        bl.append(p);
-        librbd::RBD::AioCompletion *completion = new librbd::RBD::AioCompletion(NULL, NULL);
-        if (!completion) {
-          r = -ENOMEM;
-          goto done;
+        bl.append(p, 0, len);
+        // the new image is empty, so there's no need to write zeros
+        if (!bl.is_zero()) {
+          librbd::RBD::AioCompletion *completion =
+            new librbd::RBD::AioCompletion(&throttle, import_aio_cb);
+          throttle.start_op();
+          r = image.aio_write(file_pos, len, bl, completion);
+          completion->release();
+          if (r < 0) {
+            throttle.end_op(r);
+            goto done;
+          }
         }
-        r = image.aio_write(file_pos, len, bl, completion);
-        if (r < 0)
-          goto done;
-	completion->wait_for_complete();
-	r = completion->get_return_value();
-	completion->release();
-        if (r < 0) {
-          cerr << "error writing to image block" << std::endl;
+        if (throttle.pending_error())
           goto done;
-        }
 
         file_pos += len;
         cur_seg -= len;
@@ -720,6 +827,14 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   r = 0;
 
  done:
+  {
+    int ret = throttle.wait_for_ret();
+    if (ret < 0) {
+      cerr << "error writing to image: " << cpp_strerror(ret) << std::endl;
+      if (r >= 0)
+	r = ret;
+    }
+  }
   if (r < 0)
     pc.fail();
   else
@@ -2,6 +2,9 @@
 #include <pthread.h>
 #include "include/buffer.h"
 #include "os/LevelDBStore.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
 #include <sys/types.h>
 #include <dirent.h>
 #include <string>
@@ -75,7 +78,12 @@ void *write(void *_db) {
   return 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
   char *path = getenv("OBJECT_MAP_PATH");
   boost::scoped_ptr< KeyValueDB > db;
   if (!path) {
@@ -84,7 +92,7 @@ int main() {
   }
   string strpath(path);
   std::cerr << "Using path: " << strpath << std::endl;
-  LevelDBStore *store = new LevelDBStore(strpath);
+  LevelDBStore *store = new LevelDBStore(g_ceph_context, strpath);
   assert(!store->init(std::cerr));
   db.reset(store);
 
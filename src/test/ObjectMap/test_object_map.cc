@@ -14,6 +14,7 @@
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
 #include <dirent.h>
+#include <errno.h>
 
 #include "gtest/gtest.h"
 #include "stdlib.h"
@@ -518,7 +519,7 @@ public:
     string strpath(path);
 
     cerr << "using path " << strpath << std::endl;;
-    LevelDBStore *store = new LevelDBStore(strpath);
+    LevelDBStore *store = new LevelDBStore(g_ceph_context, strpath);
     assert(!store->init(cerr));
 
     db.reset(new DBObjectMap(store));
@@ -710,6 +711,86 @@ TEST_F(ObjectMapTest, OddEvenClone) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, CloneOverExisting) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+
+  tester.set_key(hoid, "foo", "bar");
+  tester.set_key(hoid2, "old", "value");
+  string result;
+  int r = tester.get_key(hoid2, "old", &result);
+  ASSERT_EQ(1, r);
+
+  // replaces the (cached) header of hoid2
+  db->clone(hoid, hoid2);
+  r = tester.get_key(hoid2, "old", &result);
+  ASSERT_EQ(0, r);
+  r = tester.get_key(hoid2, "foo", &result);
+  ASSERT_EQ(1, r);
+  ASSERT_EQ("bar", result);
+
+  // hoid2 must not see its parent go away with hoid
+  db->clear(hoid);
+  r = tester.get_key(hoid, "foo", &result);
+  ASSERT_EQ(0, r);
+  r = tester.get_key(hoid2, "foo", &result);
+  ASSERT_EQ(1, r);
+  ASSERT_EQ("bar", result);
+
+  // a recreated hoid starts out empty
+  tester.set_key(hoid, "new", "value");
+  r = tester.get_key(hoid, "foo", &result);
+  ASSERT_EQ(0, r);
+  r = tester.get_key(hoid, "new", &result);
+  ASSERT_EQ(1, r);
+  ASSERT_EQ("value", result);
+
+  tester.remove_key(hoid2, "foo");
+  r = tester.get_key(hoid2, "foo", &result);
+  ASSERT_EQ(0, r);
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
+/// Drops every transaction while fail is set
+class FailingKeyValueDBMemory : public KeyValueDBMemory {
+public:
+  bool fail;
+  FailingKeyValueDBMemory() : fail(false) {}
+  int submit_transaction(Transaction t) {
+    if (fail)
+      return -EIO;
+    return KeyValueDBMemory::submit_transaction(t);
+  }
+};
+
+TEST(DBObjectMap, FailedSubmitLeavesCache) {
+  FailingKeyValueDBMemory *store = new FailingKeyValueDBMemory;
+  DBObjectMap omap(store);
+  ObjectMapTester tester;
+  tester.db = &omap;
+
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  tester.set_key(hoid, "foo", "bar");
+  string result;
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+
+  // the clone gives both objects new (cached) headers; none of it lands
+  store->fail = true;
+  ASSERT_GT(0, omap.clone(hoid, hoid2));
+  ASSERT_GT(0, omap.clear(hoid));
+  store->fail = false;
+
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ("bar", result);
+  ASSERT_EQ(0, tester.get_key(hoid2, "foo", &result));
+  ASSERT_TRUE(omap.check(std::cerr));
+
+  omap.clear(hoid);
+}
+
 TEST_F(ObjectMapTest, RandomTest) {
   tester.def_init();
   for (unsigned i = 0; i < 5000; ++i) {
@@ -14,6 +14,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -15,6 +15,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -75,6 +76,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -135,6 +137,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -195,6 +198,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -255,6 +259,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -315,6 +320,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -375,6 +381,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -435,6 +442,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -495,6 +503,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -555,6 +564,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -615,6 +625,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
@@ -675,6 +686,7 @@
     resize --size <MB> <image-name>             resize (expand or contract) image
     rm <image-name>                             delete an image
     export <image-name> <path>                  export image to file
+                                                "-" for stdout
     import <path> <image-name>                  import image from file
                                                 (dest defaults)
                                                 as the filename part of file)
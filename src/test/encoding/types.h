@@ -57,10 +57,16 @@ TYPE(object_info_t)
 TYPE(SnapSet)
 TYPE(ObjectRecoveryInfo)
 TYPE(ObjectRecoveryProgress)
+TYPE(PushOp)
+TYPE(PullOp)
+TYPE(PushReplyOp)
 TYPE(ScrubMap::object)
 TYPE(ScrubMap)
 TYPE(osd_peer_stat_t)
 
+#include "osd/HitSet.h"
+TYPE(HitSet)
+
 #include "os/ObjectStore.h"
 TYPE(ObjectStore::Transaction)
 
@@ -305,6 +311,12 @@ MESSAGE(MOSDPGLog)
 MESSAGE(MOSDPGMissing)
 #include "messages/MOSDPGNotify.h"
 MESSAGE(MOSDPGNotify)
+#include "messages/MOSDPGPull.h"
+MESSAGE(MOSDPGPull)
+#include "messages/MOSDPGPush.h"
+MESSAGE(MOSDPGPush)
+#include "messages/MOSDPGPushReply.h"
+MESSAGE(MOSDPGPushReply)
 #include "messages/MOSDPGQuery.h"
 MESSAGE(MOSDPGQuery)
 #include "messages/MOSDPGRemove.h"
@@ -0,0 +1,212 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Compare FileStore apply throughput for a single sequencer with and
+ * without filestore_parallel_apply and filestore_aio.
+ *
+ * All transactions go through one Sequencer, as they would for one hot
+ * PG.  Each writes one of --objects objects, so with parallel apply the
+ * op threads can work on different objects at once, and with aio each
+ * page aligned write is submitted without waiting for it.  Every run
+ * also checks that onreadable callbacks fire in submission order and
+ * that each object ends up holding its last write.
+ */
+
+#include "os/FileStore.h"
+#include "include/utime.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+static void usage()
+{
+  cout << "usage: test_filestore_parallel_apply [options] <store dir>\n"
+       << "  --ops <n>           transactions to queue (default 10000)\n"
+       << "  --objects <n>       objects written to (default 64)\n"
+       << "  --size <bytes>      bytes per write (default 4096)\n"
+       << std::endl;
+}
+
+struct Completions {
+  Mutex lock;
+  Cond cond;
+  uint64_t next;      ///< seq we expect to complete next
+  uint64_t out_of_order;
+
+  Completions() : lock("Completions::lock"), next(0), out_of_order(0) {}
+};
+
+class C_Applied : public Context {
+  Completions *c;
+  uint64_t seq;
+  ObjectStore::Transaction *t;
+public:
+  C_Applied(Completions *c, uint64_t seq, ObjectStore::Transaction *t)
+    : c(c), seq(seq), t(t) {}
+  void finish(int r) {
+    delete t;
+    Mutex::Locker l(c->lock);
+    if (seq != c->next)
+      c->out_of_order++;
+    c->next = seq + 1;
+    c->cond.Signal();
+  }
+};
+
+static hobject_t object_name(int i)
+{
+  ostringstream oss;
+  oss << "obj" << i;
+  return hobject_t(sobject_t(oss.str(), CEPH_NOSNAP));
+}
+
+static void fill(bufferlist *bl, uint64_t seq, int size)
+{
+  bufferptr bp(size);
+  for (int i = 0; i < size; ++i)
+    bp[i] = (char)(seq + i);
+  bl->append(bp);
+}
+
+static int run(const string &dir, bool parallel, bool aio, int ops,
+	       int objects, int size, double *elapsed)
+{
+  g_ceph_context->_conf->set_val("filestore_parallel_apply",
+				 parallel ? "true" : "false");
+  g_ceph_context->_conf->set_val("filestore_aio", aio ? "true" : "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ::mkdir(dir.c_str(), 0755);
+  FileStore store(dir, dir + "/journal");
+  int r = store.mkfs();
+  if (r < 0) {
+    cerr << "mkfs in " << dir << " failed: " << r << std::endl;
+    return r;
+  }
+  r = store.mount();
+  if (r < 0) {
+    cerr << "mount of " << dir << " failed: " << r << std::endl;
+    return r;
+  }
+
+  coll_t cid("bench");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    for (int i = 0; i < objects; ++i)
+      t.touch(cid, object_name(i));
+    store.apply_transaction(t);
+  }
+
+  ObjectStore::Sequencer osr("bench");
+  Completions c;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < ops; ++i) {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    bufferlist bl;
+    fill(&bl, i, size);
+    t->write(cid, object_name(i % objects), 0, bl.length(), bl);
+    list<ObjectStore::Transaction*> tls;
+    tls.push_back(t);
+    store.queue_transactions(&osr, tls, new C_Applied(&c, i, t));
+  }
+  c.lock.Lock();
+  while (c.next < (uint64_t)ops)
+    c.cond.Wait(c.lock);
+  c.lock.Unlock();
+  *elapsed = (double)(ceph_clock_now(g_ceph_context) - start);
+
+  int errors = 0;
+  if (c.out_of_order) {
+    cerr << c.out_of_order << " completions out of order" << std::endl;
+    errors++;
+  }
+  for (int i = 0; i < objects && i < ops; ++i) {
+    int last = ops - 1 - ((ops - 1 - i) % objects);
+    bufferlist expected, got;
+    fill(&expected, last, size);
+    store.read(cid, object_name(i), 0, size, got);
+    if (!got.contents_equal(expected)) {
+      cerr << object_name(i) << " does not hold write " << last << std::endl;
+      errors++;
+    }
+  }
+
+  store.umount();
+  return errors ? -EIO : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int ops = 10000;
+  int objects = 64;
+  int size = 4096;
+  string dir;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)NULL)) {
+      ops = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--objects", (char*)NULL)) {
+      objects = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)NULL)) {
+      size = atoi(val.c_str());
+    } else if (dir.empty()) {
+      dir = *i;
+      i = args.erase(i);
+    } else {
+      cerr << "unrecognized argument: " << *i << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (dir.empty() || ops <= 0 || objects <= 0 || size <= 0) {
+    usage();
+    return 1;
+  }
+
+  ::mkdir(dir.c_str(), 0755);
+  cout << "mode\tops\tseconds\tops/sec" << std::endl;
+  struct {
+    const char *name;
+    bool parallel, aio;
+  } modes[] = {
+    { "serial", false, false },
+    { "parallel", true, false },
+    { "aio", false, true },
+    { "parallel_aio", true, true },
+  };
+  for (unsigned m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    double elapsed;
+    int r = run(dir + "/" + modes[m].name, modes[m].parallel, modes[m].aio,
+		ops, objects, size, &elapsed);
+    if (r < 0)
+      return 1;
+    cout << modes[m].name << "\t" << ops << "\t" << elapsed << "\t"
+	 << (elapsed > 0 ? ops / elapsed : 0) << std::endl;
+  }
+  return 0;
+}
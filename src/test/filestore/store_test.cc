@@ -16,6 +16,8 @@
 #include <string.h>
 #include <iostream>
 #include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include "os/FileStore.h"
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
@@ -448,6 +450,159 @@ public:
   }
 };
 
+TEST_F(StoreTest, PreSplitTest) {
+  int NUM_OBJS = 500;
+  int r = 0;
+  coll_t cid("presplit");
+  set<hobject_t> created;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    bufferlist hint;
+    uint32_t pg_num = 1;
+    uint64_t expected_num_objs = 50000;
+    ::encode(pg_num, hint);
+    ::encode(expected_num_objs, hint);
+    t.collection_hint(cid,
+		      ObjectStore::Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS,
+		      hint);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  for (int i = 0; i < NUM_OBJS; ++i) {
+    ObjectStore::Transaction t;
+    char buf[100];
+    snprintf(buf, sizeof(buf), "obj%d", i);
+    hobject_t hoid(buf, "", CEPH_NOSNAP, rand(), 0);
+    t.touch(cid, hoid);
+    created.insert(hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    struct stat buf;
+    ASSERT_TRUE(!store->stat(cid, *i, &buf));
+  }
+
+  set<hobject_t> listed;
+  vector<hobject_t> objects;
+  hobject_t start, next;
+  while (1) {
+    r = store->collection_list_partial(cid, start,
+				       50,
+				       60,
+				       0,
+				       &objects,
+				       &next);
+    ASSERT_TRUE(sorted(objects));
+    ASSERT_EQ(r, 0);
+    listed.insert(objects.begin(), objects.end());
+    if (objects.size() < 50) {
+      ASSERT_TRUE(next.max);
+      break;
+    }
+    objects.clear();
+    start = next;
+  }
+  ASSERT_EQ(listed, created);
+
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  objects.clear();
+  r = store->collection_list(cid, objects);
+  ASSERT_EQ(r, 0);
+  ASSERT_TRUE(objects.empty());
+  {
+    ObjectStore::Transaction t;
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+static int count_hash_dirs(const string &path, int depth) {
+  DIR *dir = ::opendir(path.c_str());
+  if (!dir)
+    return 0;
+  int count = 0;
+  struct dirent *de;
+  while ((de = ::readdir(dir))) {
+    string name(de->d_name);
+    if (name.substr(0, 4) != "DIR_")
+      continue;
+    if (depth > 1)
+      count += count_hash_dirs(path + "/" + name, depth - 1);
+    else
+      count++;
+  }
+  ::closedir(dir);
+  return count;
+}
+
+TEST_F(StoreTest, PreSplitRemoveTest) {
+  int r = 0;
+  coll_t cid("presplit_remove");
+  string cdir = string("store_test_temp_dir/current/") + cid.to_str();
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    bufferlist hint;
+    uint32_t pg_num = 1;
+    uint64_t expected_num_objs = 50000;
+    ::encode(pg_num, hint);
+    ::encode(expected_num_objs, hint);
+    t.collection_hint(cid,
+		      ObjectStore::Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS,
+		      hint);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  // two levels of 16 directories with the default thresholds
+  ASSERT_EQ(256, count_hash_dirs(cdir, 2));
+
+  set<hobject_t> created;
+  for (int i = 0; i < 100; ++i) {
+    ObjectStore::Transaction t;
+    char buf[100];
+    snprintf(buf, sizeof(buf), "obj%d", i);
+    hobject_t hoid(buf, "", CEPH_NOSNAP, rand(), 0);
+    t.touch(cid, hoid);
+    created.insert(hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    ObjectStore::Transaction t;
+    t.remove(cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // emptying the pre-split directories must not merge them away
+  ASSERT_EQ(256, count_hash_dirs(cdir, 2));
+  vector<hobject_t> objects;
+  r = store->collection_list(cid, objects);
+  ASSERT_EQ(r, 0);
+  ASSERT_TRUE(objects.empty());
+  {
+    ObjectStore::Transaction t;
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_F(StoreTest, Synthetic) {
   ObjectStore::Sequencer osr("test");
   MixedGenerator gen;
@@ -732,6 +887,237 @@ TEST_F(StoreTest, XattrTest) {
   ASSERT_TRUE(bl2 == attrs["attr3"]);
 }
 
+TEST_F(StoreTest, DeltaPushTest) {
+  coll_t cid("delta");
+  hobject_t hoid("deltaobj", "", CEPH_NOSNAP, 0, 0);
+  string expected(3 * 4096, 'a');
+  int r;
+  {
+    bufferlist data, old;
+    data.append(expected);
+    old.append("old");
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.write(cid, hoid, 0, data.length(), data);
+    t.setattr(cid, hoid, "_", old);
+    t.setattr(cid, hoid, "stale", old);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // what a replica applies for an in place delta push, sent over the wire
+  bufferlist oi, snapset, delta, header;
+  oi.append("oi");
+  snapset.append("snapset");
+  delta.append(string(4096, 'b'));
+  header.append("header");
+  {
+    map<string, bufferptr> attrs;
+    attrs["snapset"] = bufferptr(snapset.c_str(), snapset.length());
+    map<string, bufferlist> omap;
+    omap["key"] = header;
+    ObjectStore::Transaction t;
+    t.rmattrs(cid, hoid);
+    t.omap_clear(cid, hoid);
+    t.truncate(cid, hoid, 2 * 4096 + 100);
+    t.omap_setheader(cid, hoid, header);
+    t.write(cid, hoid, 4096, delta.length(), delta);
+    t.omap_setkeys(cid, hoid, omap);
+    t.setattrs(cid, hoid, attrs);
+    t.setattr(cid, hoid, "_", oi);
+
+    bufferlist bl;
+    ::encode(t, bl);
+    bufferlist::iterator p = bl.begin();
+    ObjectStore::Transaction d(p);
+    r = store->apply_transaction(d);
+    ASSERT_EQ(r, 0);
+    expected.resize(2 * 4096 + 100);
+    expected.replace(4096, 4096, string(4096, 'b'));
+  }
+
+  bufferlist bl;
+  r = store->read(cid, hoid, 0, 0, bl);
+  ASSERT_EQ(r, (int)expected.length());
+  ASSERT_TRUE(string(bl.c_str(), bl.length()) == expected);
+
+  map<string, bufferptr> aset;
+  store->getattrs(cid, hoid, aset);
+  ASSERT_EQ(2u, aset.size());
+  ASSERT_TRUE(aset.count("_"));
+  ASSERT_EQ(string("oi"), string(aset["_"].c_str(), aset["_"].length()));
+  ASSERT_TRUE(aset.count("snapset"));
+  ASSERT_EQ(string("snapset"),
+	    string(aset["snapset"].c_str(), aset["snapset"].length()));
+
+  bufferlist got_header;
+  map<string, bufferlist> got_omap;
+  r = store->omap_get(cid, hoid, &got_header, &got_omap);
+  ASSERT_EQ(r, 0);
+  ASSERT_TRUE(got_header == header);
+  ASSERT_EQ(1u, got_omap.size());
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_F(StoreTest, ZeroTest) {
+  coll_t cid("zero");
+  hobject_t hoid("tesozero", "", CEPH_NOSNAP, 0, 0);
+  bufferlist data;
+  data.append(string(4 * 65536, 'a'));
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, hoid, 65536, 2 * 65536);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  struct stat st;
+  r = store->stat(cid, hoid, &st);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ((uint64_t)st.st_size, (uint64_t)data.length());
+
+  bufferlist expected;
+  expected.append(string(65536, 'a'));
+  expected.append(string(2 * 65536, '\0'));
+  expected.append(string(65536, 'a'));
+  bufferlist bl;
+  r = store->read(cid, hoid, 0, data.length(), bl);
+  ASSERT_EQ(r, (int)data.length());
+  ASSERT_TRUE(bl == expected);
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_F(StoreTest, CsumTest) {
+  g_ceph_context->_conf->set_val("filestore_csum", "true");
+  g_ceph_context->_conf->set_val("filestore_csum_block_size", "4096");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  coll_t cid("csum");
+  hobject_t hoid("csumobj", "", CEPH_NOSNAP, 0, 0);
+  hobject_t clone("csumclone", "", CEPH_NOSNAP, 0, 0);
+  string expected(10000, 'a');
+  int r;
+  {
+    bufferlist data;
+    data.append(expected);
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // unaligned overwrite, a write past the end, a hole, and a clone
+    bufferlist a, b;
+    a.append(string(3000, 'b'));
+    b.append(string(100, 'c'));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 3000, a.length(), a);
+    t.write(cid, hoid, 20000, b.length(), b);
+    t.zero(cid, hoid, 5000, 2000);
+    t.clone(cid, hoid, clone);
+    t.truncate(cid, hoid, 19000);
+    t.clone_range(cid, clone, hoid, 20000, 100, 8000);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    expected.replace(3000, 3000, string(3000, 'b'));
+    expected.resize(20000, '\0');
+    expected.append(string(100, 'c'));
+    expected.replace(5000, 2000, string(2000, '\0'));
+  }
+
+  bufferlist bl;
+  r = store->read(cid, clone, 0, 0, bl);
+  ASSERT_EQ(r, (int)expected.length());
+  ASSERT_TRUE(string(bl.c_str(), bl.length()) == expected);
+
+  expected.resize(19000);
+  expected.replace(8000, 100, string(100, 'c'));
+  bl.clear();
+  r = store->read(cid, hoid, 0, 0, bl);
+  ASSERT_EQ(r, (int)expected.length());
+  ASSERT_TRUE(string(bl.c_str(), bl.length()) == expected);
+  bl.clear();
+  r = store->read(cid, hoid, 4097, 5000, bl);
+  ASSERT_EQ(r, 5000);
+  ASSERT_TRUE(string(bl.c_str(), bl.length()) == expected.substr(4097, 5000));
+
+  // flip a byte behind the store's back, keeping the mtime
+  string fn;
+  string dir = "store_test_temp_dir/current/" + cid.to_str();
+  DIR *d = ::opendir(dir.c_str());
+  ASSERT_TRUE(d != NULL);
+  struct dirent *de;
+  while ((de = ::readdir(d)) != NULL)
+    if (strncmp(de->d_name, "csumobj", 7) == 0)
+      fn = dir + "/" + de->d_name;
+  ::closedir(d);
+  ASSERT_FALSE(fn.empty());
+  int fd = ::open(fn.c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  struct stat st;
+  ASSERT_EQ(::fstat(fd, &st), 0);
+  ASSERT_EQ(::pwrite(fd, "x", 1, 12345), 1);
+  struct timespec times[2] = { st.st_atim, st.st_mtim };
+  ASSERT_EQ(::futimens(fd, times), 0);
+  ::close(fd);
+
+  bl.clear();
+  r = store->read(cid, hoid, 12300, 100, bl);
+  ASSERT_EQ(r, -EIO);
+  bl.clear();
+  r = store->read(cid, hoid, 0, 12288, bl);
+  ASSERT_EQ(r, 12288);
+
+  // rewriting the whole object starts over
+  {
+    bufferlist data;
+    data.append(string(5000, 'd'));
+    ObjectStore::Transaction t;
+    t.truncate(cid, hoid, 0);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  bl.clear();
+  r = store->read(cid, hoid, 0, 0, bl);
+  ASSERT_EQ(r, 5000);
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, clone);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  g_ceph_context->_conf->set_val("filestore_csum", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Compare the size and encode/decode cost of ObjectStore::Transaction
+ * with and without collection and object tables
+ * (objectstore_transaction_tables).
+ *
+ * Each transaction looks like what a replicated pg queues for a small
+ * client write: the data, the object_info and snapset attrs, a pg log
+ * append and the pg info.  Decoding walks every op the way FileStore
+ * does.  Both encodings are also checked to dump identically.
+ */
+
+#include "os/ObjectStore.h"
+#include "include/utime.h"
+#include "common/Clock.h"
+#include "common/Formatter.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+static void usage()
+{
+  cout << "usage: test_filestore_transaction_encoding [options]\n"
+       << "  --transactions <n>  transactions to encode and decode (default 100000)\n"
+       << "  --size <bytes>      bytes written by each (default 4096)\n"
+       << std::endl;
+}
+
+static ObjectStore::Transaction *build(bool tables, int i, const bufferlist &data)
+{
+  g_ceph_context->_conf->set_val("objectstore_transaction_tables",
+				 tables ? "true" : "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  coll_t cid(pg_t(i % 64, 3, -1), CEPH_NOSNAP);
+  ostringstream oss;
+  oss << "rb.0.1234.5678abcd." << (i % 1024);
+  hobject_t oid(sobject_t(oss.str(), CEPH_NOSNAP), "", i * 7919, 3);
+  hobject_t log_oid(sobject_t("pglog_3.1f", CEPH_NOSNAP), "", 0, -1);
+
+  bufferlist oi, ss, log, info;
+  oi.append_zero(200);
+  ss.append_zero(30);
+  log.append_zero(180);
+  info.append_zero(300);
+
+  t->write(cid, oid, (i % 1024) * data.length(), data.length(), data);
+  t->setattr(cid, oid, "_", oi);
+  t->setattr(cid, oid, "snapset", ss);
+  t->write(coll_t::META_COLL, log_oid, i * log.length(), log.length(), log);
+  t->collection_setattr(cid, "info", info);
+  return t;
+}
+
+static void walk(ObjectStore::Transaction &t)
+{
+  ObjectStore::Transaction::iterator i = t.begin();
+  while (i.have_op()) {
+    int op = i.get_op();
+    switch (op) {
+    case ObjectStore::Transaction::OP_WRITE:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	i.get_length();
+	i.get_length();
+	bufferlist bl;
+	i.get_bl(bl);
+      }
+      break;
+    case ObjectStore::Transaction::OP_SETATTR:
+      {
+	coll_t cid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	string name = i.get_attrname();
+	bufferlist bl;
+	i.get_bl(bl);
+      }
+      break;
+    case ObjectStore::Transaction::OP_COLL_SETATTR:
+      {
+	coll_t cid = i.get_cid();
+	string name = i.get_attrname();
+	bufferlist bl;
+	i.get_bl(bl);
+      }
+      break;
+    default:
+      assert(0 == "unexpected op");
+    }
+  }
+}
+
+static string dump(ObjectStore::Transaction &t)
+{
+  JSONFormatter f;
+  t.dump(&f);
+  ostringstream oss;
+  f.flush(oss);
+  return oss.str();
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int count = 100000;
+  int size = 4096;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--transactions", (char*)NULL)) {
+      count = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)NULL)) {
+      size = atoi(val.c_str());
+    } else {
+      cerr << "unrecognized argument: " << *i << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (count <= 0 || size < 0) {
+    usage();
+    return 1;
+  }
+
+  bufferlist data;
+  data.append_zero(size);
+
+  // same ops either way
+  for (int i = 0; i < 100; ++i) {
+    ObjectStore::Transaction *a = build(false, i, data);
+    ObjectStore::Transaction *b = build(true, i, data);
+    bufferlist abl, bbl;
+    ::encode(*a, abl);
+    ::encode(*b, bbl);
+    ObjectStore::Transaction da(abl), db(bbl);
+    if (dump(da) != dump(db)) {
+      cerr << "transaction " << i << " decodes differently with tables" << std::endl;
+      return 1;
+    }
+    delete a;
+    delete b;
+  }
+
+  cout << "tables\tbytes/txn\tmetadata/txn\tencode_us\tdecode_us" << std::endl;
+  for (int tables = 0; tables < 2; ++tables) {
+    vector<ObjectStore::Transaction*> ts;
+    for (int i = 0; i < count; ++i)
+      ts.push_back(build(tables, i, data));
+
+    vector<bufferlist> bls(count);
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (int i = 0; i < count; ++i)
+      ::encode(*ts[i], bls[i]);
+    utime_t encoded = ceph_clock_now(g_ceph_context);
+
+    uint64_t bytes = 0;
+    for (int i = 0; i < count; ++i) {
+      bytes += bls[i].length();
+      ObjectStore::Transaction t(bls[i]);
+      walk(t);
+    }
+    utime_t decoded = ceph_clock_now(g_ceph_context);
+
+    double per = (double)bytes / count;
+    cout << (tables ? "yes" : "no") << "\t" << per
+	 << "\t" << per - size - 180 - 200 - 30 - 300
+	 << "\t" << (double)(encoded - start) * 1000000 / count
+	 << "\t" << (double)(decoded - encoded) * 1000000 / count
+	 << std::endl;
+
+    for (int i = 0; i < count; ++i)
+      delete ts[i];
+  }
+  return 0;
+}
@@ -0,0 +1,183 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Measure how image open and header refresh latency grow with the
+ * number of snapshots.
+ *
+ * A format 2 image is created and snapshots are added to it in steps.
+ * At each step the image is opened and closed several times, and a
+ * refresh is timed by creating one more snapshot through an open handle
+ * and then calling stat(), which rereads the header.
+ */
+
+#include "include/rados/librados.hpp"
+#include "include/rbd/librbd.hpp"
+#include "include/utime.h"
+#include "common/Clock.h"
+#include "common/errno.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+static void usage()
+{
+  cout << "usage: librbd_open_bench [options]\n"
+       << "  --pool <pool>       pool to create the image in (default rbd)\n"
+       << "  --image <name>      image name (default open_bench)\n"
+       << "  --max-snaps <n>     snapshots to end with (default 500)\n"
+       << "  --step <n>          snapshots added between measurements (default 50)\n"
+       << "  --iterations <n>    opens timed at each step (default 10)\n"
+       << std::endl;
+}
+
+static string snap_name(int i)
+{
+  ostringstream oss;
+  oss << "snap" << i;
+  return oss.str();
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  string pool = "rbd";
+  string image_name = "open_bench";
+  int max_snaps = 500;
+  int step = 50;
+  int iterations = 10;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--pool", (char*)NULL)) {
+      pool = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--image", (char*)NULL)) {
+      image_name = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--max-snaps", (char*)NULL)) {
+      max_snaps = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--step", (char*)NULL)) {
+      step = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--iterations", (char*)NULL)) {
+      iterations = atoi(val.c_str());
+    } else {
+      cerr << "unrecognized argument: " << *i << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (step <= 0 || iterations <= 0 || max_snaps < 0) {
+    usage();
+    return 1;
+  }
+
+  librados::Rados rados;
+  int r = rados.init_with_context(g_ceph_context);
+  if (r < 0) {
+    cerr << "error initializing rados: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  r = rados.connect();
+  if (r < 0) {
+    cerr << "error connecting: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  librados::IoCtx io_ctx;
+  r = rados.ioctx_create(pool.c_str(), io_ctx);
+  if (r < 0) {
+    cerr << "error opening pool " << pool << ": " << cpp_strerror(r)
+	 << std::endl;
+    return 1;
+  }
+
+  librbd::RBD rbd;
+  int order = 22;
+  r = rbd.create2(io_ctx, image_name.c_str(), 1 << order,
+		  RBD_FEATURE_LAYERING, &order);
+  if (r < 0) {
+    cerr << "error creating image " << image_name << ": " << cpp_strerror(r)
+	 << std::endl;
+    return 1;
+  }
+
+  cout << "#snaps\topen_avg\trefresh" << std::endl;
+  int snaps = 0;
+  while (true) {
+    utime_t total;
+    for (int i = 0; i < iterations; ++i) {
+      librbd::Image image;
+      utime_t start = ceph_clock_now(g_ceph_context);
+      r = rbd.open(io_ctx, image, image_name.c_str());
+      if (r < 0) {
+	cerr << "error opening image: " << cpp_strerror(r) << std::endl;
+	goto out;
+      }
+      total += ceph_clock_now(g_ceph_context) - start;
+    }
+
+    {
+      librbd::Image image;
+      r = rbd.open(io_ctx, image, image_name.c_str());
+      if (r < 0) {
+	cerr << "error opening image: " << cpp_strerror(r) << std::endl;
+	goto out;
+      }
+      // the new snapshot makes the next call reread the header
+      int measured = snaps;
+      r = image.snap_create(snap_name(snaps).c_str());
+      if (r < 0) {
+	cerr << "error creating snapshot: " << cpp_strerror(r) << std::endl;
+	goto out;
+      }
+      ++snaps;
+      librbd::image_info_t info;
+      utime_t start = ceph_clock_now(g_ceph_context);
+      r = image.stat(info, sizeof(info));
+      if (r < 0) {
+	cerr << "error refreshing image: " << cpp_strerror(r) << std::endl;
+	goto out;
+      }
+      utime_t refresh = ceph_clock_now(g_ceph_context) - start;
+
+      cout << measured << "\t" << (double)total / iterations << "\t"
+	   << (double)refresh << std::endl;
+
+      if (snaps > max_snaps)
+	break;
+      for (int i = 0; i < step - 1 && snaps <= max_snaps; ++i, ++snaps) {
+	r = image.snap_create(snap_name(snaps).c_str());
+	if (r < 0) {
+	  cerr << "error creating snapshot: " << cpp_strerror(r) << std::endl;
+	  goto out;
+	}
+      }
+    }
+  }
+  r = 0;
+
+ out:
+  {
+    librbd::Image image;
+    if (rbd.open(io_ctx, image, image_name.c_str()) == 0) {
+      for (int i = 0; i < snaps; ++i)
+	image.snap_remove(snap_name(i).c_str());
+    }
+  }
+  rbd.remove(io_ctx, image_name.c_str());
+  return r < 0 ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "include/buffer.h"
+#include "librbd/PersistentCache.h"
+#include "test/unit.h"
+
+using ceph::bufferlist;
+using librbd::PersistentCache;
+
+static std::string make_cache_dir()
+{
+  char tmpl[] = "/tmp/test_persistent_cache.XXXXXX";
+  char *dir = mkdtemp(tmpl);
+  assert(dir);
+  return std::string(dir);
+}
+
+static bufferlist make_data(size_t len, char c)
+{
+  bufferlist bl;
+  bl.append(std::string(len, c));
+  return bl;
+}
+
+TEST(PersistentCache, ReadWrite) {
+  std::string path = PersistentCache::get_path(make_cache_dir(), 1, "rbd_data.abc", 4);
+  PersistentCache cache(g_ceph_context, path, 1 << 20, 16);
+  ASSERT_EQ(0, cache.open());
+
+  bufferlist out;
+  ASSERT_FALSE(cache.read(0, 4096, &out));
+
+  cache.write(8192, make_data(4096, 'a'));
+  ASSERT_TRUE(cache.read(8192, 4096, &out));
+  ASSERT_TRUE(make_data(4096, 'a').contents_equal(out));
+  ASSERT_TRUE(cache.read(9000, 100, &out));
+  // partially cached is a miss
+  ASSERT_FALSE(cache.read(8000, 4096, &out));
+  ASSERT_EQ(4096u, cache.get_cached_bytes());
+}
+
+TEST(PersistentCache, Persist) {
+  std::string path = PersistentCache::get_path(make_cache_dir(), 1, "rbd_data.abc", 4);
+  {
+    PersistentCache cache(g_ceph_context, path, 1 << 20, 16);
+    ASSERT_EQ(0, cache.open());
+    cache.write(0, make_data(4096, 'b'));
+  }
+
+  PersistentCache cache(g_ceph_context, path, 1 << 20, 16);
+  ASSERT_EQ(0, cache.open());
+  bufferlist out;
+  ASSERT_TRUE(cache.read(0, 4096, &out));
+  ASSERT_TRUE(make_data(4096, 'b').contents_equal(out));
+
+  // only one user at a time
+  PersistentCache other(g_ceph_context, path, 1 << 20, 16);
+  ASSERT_GT(0, other.open());
+}
+
+TEST(PersistentCache, Evict) {
+  std::string path = PersistentCache::get_path(make_cache_dir(), 1, "rbd_data.abc", 4);
+  // room for two 4k objects
+  PersistentCache cache(g_ceph_context, path, 8192, 12);
+  ASSERT_EQ(0, cache.open());
+
+  cache.write(0, make_data(4096, 'c'));
+  cache.write(4096, make_data(4096, 'd'));
+  bufferlist out;
+  ASSERT_TRUE(cache.read(0, 4096, &out));  // object 1 is now the oldest
+  cache.write(8192, make_data(4096, 'e'));
+
+  ASSERT_EQ(8192u, cache.get_cached_bytes());
+  ASSERT_TRUE(cache.read(0, 4096, &out));
+  ASSERT_FALSE(cache.read(4096, 4096, &out));
+  ASSERT_TRUE(cache.read(8192, 4096, &out));
+}
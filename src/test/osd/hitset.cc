@@ -0,0 +1,57 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <sstream>
+
+#include "osd/HitSet.h"
+
+#include "gtest/gtest.h"
+
+static std::string name(int i)
+{
+  std::ostringstream ss;
+  ss << "obj" << i;
+  return ss.str();
+}
+
+TEST(HitSet, Contains) {
+  HitSet h(1000, .01, 1, utime_t(10, 0));
+  for (int i = 0; i < 1000; ++i)
+    h.insert(name(i));
+  ASSERT_EQ(1000u, h.insert_count());
+  for (int i = 0; i < 1000; ++i)
+    ASSERT_TRUE(h.contains(name(i)));
+  int false_positives = 0;
+  for (int i = 1000; i < 11000; ++i)
+    if (h.contains(name(i)))
+      false_positives++;
+  // about 1% expected; allow plenty of slack
+  ASSERT_LT(false_positives, 500);
+}
+
+TEST(HitSet, Empty) {
+  HitSet h;
+  ASSERT_FALSE(h.contains("foo"));
+  ASSERT_EQ(0u, h.insert_count());
+}
+
+TEST(HitSet, EncodeDecode) {
+  HitSet h(100, .05, 7, utime_t(10, 0));
+  h.end = utime_t(20, 0);
+  for (int i = 0; i < 50; ++i)
+    h.insert(name(i));
+  bufferlist bl;
+  ::encode(h, bl);
+
+  HitSet d;
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_EQ(h.begin, d.begin);
+  ASSERT_EQ(h.end, d.end);
+  ASSERT_EQ(h.insert_count(), d.insert_count());
+  ASSERT_EQ(h.size(), d.size());
+  for (int i = 0; i < 50; ++i)
+    ASSERT_TRUE(d.contains(name(i)));
+  for (int i = 50; i < 1000; ++i)
+    ASSERT_EQ(h.contains(name(i)), d.contains(name(i)));
+}
@@ -0,0 +1,163 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "osd/OpScheduler.h"
+
+#include "gtest/gtest.h"
+
+typedef OpScheduler<int> Sched;
+
+static utime_t at(double t)
+{
+  utime_t u;
+  u.set_from_double(t);
+  return u;
+}
+
+TEST(OpScheduler, Fifo) {
+  Sched s(1);
+  for (int i = 0; i < 10; ++i)
+    s.enqueue(0, i, at(1));
+  ASSERT_EQ(10u, s.size());
+  for (int i = 0; i < 10; ++i) {
+    int item;
+    unsigned c;
+    utime_t stamp;
+    ASSERT_TRUE(s.dequeue(at(1), true, &item, &c, &stamp));
+    ASSERT_EQ(i, item);
+    ASSERT_EQ(0u, c);
+    ASSERT_EQ(at(1), stamp);
+  }
+  ASSERT_TRUE(s.empty());
+  int item;
+  unsigned c;
+  utime_t stamp;
+  ASSERT_FALSE(s.dequeue(at(1), false, &item, &c, &stamp));
+}
+
+TEST(OpScheduler, Weight) {
+  Sched s(2);
+  s.set_params(0, Sched::params_t(0, 3, 0));
+  s.set_params(1, Sched::params_t(0, 1, 0));
+  for (int i = 0; i < 400; ++i) {
+    s.enqueue(0, i, at(1));
+    s.enqueue(1, i, at(1));
+  }
+  unsigned count[2] = {0, 0};
+  for (int i = 0; i < 400; ++i) {
+    int item;
+    unsigned c;
+    utime_t stamp;
+    ASSERT_TRUE(s.dequeue(at(1), true, &item, &c, &stamp));
+    count[c]++;
+  }
+  ASSERT_EQ(300u, count[0]);
+  ASSERT_EQ(100u, count[1]);
+}
+
+TEST(OpScheduler, Reservation) {
+  // class 1 barely weighs anything, but is promised 10 ops/s
+  Sched s(2);
+  s.set_params(0, Sched::params_t(0, 1000, 0));
+  s.set_params(1, Sched::params_t(10, 1, 0));
+  for (int i = 0; i < 1000; ++i) {
+    s.enqueue(0, i, at(1));
+    s.enqueue(1, i, at(1));
+  }
+  // serve 100 ops/s for two seconds
+  unsigned count[2] = {0, 0};
+  for (int i = 0; i < 200; ++i) {
+    int item;
+    unsigned c;
+    utime_t stamp;
+    ASSERT_TRUE(s.dequeue(at(1 + i / 100.0), true, &item, &c, &stamp));
+    count[c]++;
+  }
+  ASSERT_GE(count[1], 20u);
+  ASSERT_LE(count[1], 22u);
+}
+
+TEST(OpScheduler, Limit) {
+  Sched s(2);
+  s.set_params(0, Sched::params_t(0, 1, 2));
+  s.set_params(1, Sched::params_t(0, 1, 0));
+  for (int i = 0; i < 5; ++i)
+    s.enqueue(0, i, at(10));
+  int item;
+  unsigned c;
+  utime_t stamp;
+
+  // two per second, the first of them at once
+  ASSERT_TRUE(s.dequeue(at(10), true, &item, &c, &stamp));
+  ASSERT_FALSE(s.dequeue(at(10), true, &item, &c, &stamp));
+  ASSERT_TRUE(s.dequeue(at(10.5), true, &item, &c, &stamp));
+  ASSERT_FALSE(s.dequeue(at(10.6), true, &item, &c, &stamp));
+
+  // others are not held up by it
+  s.enqueue(1, 100, at(10.6));
+  ASSERT_TRUE(s.dequeue(at(10.6), true, &item, &c, &stamp));
+  ASSERT_EQ(100, item);
+
+  // and when nothing else is waiting, it is served anyway
+  ASSERT_TRUE(s.dequeue(at(10.6), false, &item, &c, &stamp));
+  ASSERT_EQ(0u, c);
+  ASSERT_EQ(2, item);
+}
+
+TEST(OpScheduler, AdmitLimit) {
+  Sched s(2);
+  s.set_params(1, Sched::params_t(0, 1, 5));
+
+  // nothing queued: background goes, up to its limit
+  ASSERT_TRUE(s.admit(1, at(1)));
+  ASSERT_FALSE(s.admit(1, at(1)));
+  ASSERT_TRUE(s.admit(1, at(1.25)));
+}
+
+TEST(OpScheduler, AdmitWeight) {
+  Sched s(2);
+  s.set_params(0, Sched::params_t(0, 10, 0));
+  s.set_params(1, Sched::params_t(0, 1, 0));
+
+  // with ops queued, background takes its weighted turn
+  for (int i = 0; i < 100; ++i)
+    s.enqueue(0, i, at(2));
+  unsigned admitted = 0;
+  while (!s.empty()) {
+    if (s.admit(1, at(2))) {
+      admitted++;
+    } else {
+      int item;
+      unsigned c;
+      utime_t stamp;
+      ASSERT_TRUE(s.dequeue(at(2), true, &item, &c, &stamp));
+    }
+  }
+  ASSERT_GE(admitted, 9u);
+  ASSERT_LE(admitted, 11u);
+}
+
+TEST(OpScheduler, AdmitReservation) {
+  Sched s(2);
+  s.set_params(0, Sched::params_t(0, 100, 0));
+  s.set_params(1, Sched::params_t(2, 1, 0));
+  for (int i = 0; i < 1000; ++i)
+    s.enqueue(0, i, at(1));
+  ASSERT_TRUE(s.admit(1, at(1)));
+  ASSERT_FALSE(s.admit(1, at(1)));
+  ASSERT_DOUBLE_EQ(1.5, s.reservation_due(1));
+  ASSERT_TRUE(s.admit(1, at(1.5)));
+}
+
+TEST(OpScheduler, Remove) {
+  Sched s(2);
+  s.enqueue(0, 1, at(1));
+  s.enqueue(1, 2, at(1));
+  s.enqueue(1, 1, at(1));
+  s.enqueue(0, 3, at(1));
+  ASSERT_EQ(2u, s.remove(1));
+  ASSERT_EQ(0u, s.remove(1));
+  ASSERT_EQ(2u, s.size());
+  ASSERT_EQ(1u, s.size(0));
+  ASSERT_EQ(1u, s.size(1));
+}
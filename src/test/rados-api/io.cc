@@ -72,6 +72,65 @@ TEST(LibRadosIo, RoundTripPP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
 
+TEST(LibRadosIo, ReplicaReadRoundTripPP) {
+  char buf[128];
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ((int)sizeof(buf), ioctx.write("foo", bl, sizeof(buf), 0));
+
+  // replicas that can't serve these yet send them on to the primary
+  ioctx.set_read_flags(OPERATION_BALANCE_READS);
+  for (int i = 0; i < 10; ++i) {
+    bufferlist cl;
+    ASSERT_EQ((int)sizeof(buf), ioctx.read("foo", cl, sizeof(buf), 0));
+    ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+  }
+  ioctx.set_read_flags(OPERATION_NOFLAG);
+
+  ObjectReadOperation op;
+  bufferlist cl;
+  int rval;
+  op.read(0, sizeof(buf), &cl, &rval);
+  ASSERT_EQ(0, ioctx.operate("foo", &op, NULL, OPERATION_LOCALIZE_READS));
+  ASSERT_EQ((int)sizeof(buf), (int)cl.length());
+  ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosIo, ReplicaReadAfterWritePP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+
+  // each read comes right after an acked write, and must see it
+  for (int i = 0; i < 100; ++i) {
+    char buf[128];
+    memset(buf, i, sizeof(buf));
+    bufferlist bl;
+    bl.append(buf, sizeof(buf));
+    ASSERT_EQ(0, ioctx.write_full("foo", bl));
+
+    ObjectReadOperation op;
+    bufferlist cl;
+    int rval;
+    op.read(0, sizeof(buf), &cl, &rval);
+    ASSERT_EQ(0, ioctx.operate("foo", &op, NULL, OPERATION_BALANCE_READS));
+    ASSERT_EQ((int)sizeof(buf), (int)cl.length());
+    ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+  }
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
 TEST(LibRadosIo, OverlappingWriteRoundTrip) {
   char buf[128];
   char buf2[64];
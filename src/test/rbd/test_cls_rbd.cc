@@ -32,6 +32,12 @@ using ::librbd::cls_client::remove_child;
 using ::librbd::cls_client::get_children;
 using ::librbd::cls_client::get_snapcontext;
 using ::librbd::cls_client::snapshot_list;
+using ::librbd::cls_client::snapshot_list_start;
+using ::librbd::cls_client::snapshot_list_finish;
+using ::librbd::cls_client::get_mutable_metadata_start;
+using ::librbd::cls_client::get_mutable_metadata_finish;
+using ::librbd::cls_client::get_protection_status_list_start;
+using ::librbd::cls_client::get_protection_status_list_finish;
 using ::librbd::cls_client::copyup;
 using ::librbd::cls_client::get_id;
 using ::librbd::cls_client::set_id;
@@ -514,6 +520,77 @@ TEST(cls_rbd, protection_status)
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
 }
 
+TEST(cls_rbd, batched_header_read)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  ASSERT_EQ(0, create_image(&ioctx, "foo", 10, 22, RBD_FEATURE_LAYERING, "foo"));
+  ASSERT_EQ(0, snapshot_add(&ioctx, "foo", 10, "snap1"));
+  ASSERT_EQ(0, set_size(&ioctx, "foo", 20));
+  ASSERT_EQ(0, snapshot_add(&ioctx, "foo", 20, "snap2"));
+  ASSERT_EQ(0, set_protection_status(&ioctx, "foo",
+				     20, RBD_PROTECTION_STATUS_PROTECTED));
+
+  vector<snapid_t> known, added;
+  known.push_back(10);
+  added.push_back(20);
+
+  librados::ObjectReadOperation op;
+  get_mutable_metadata_start(&op);
+  get_protection_status_list_start(&op, known);
+  snapshot_list_start(&op, added);
+  bufferlist outbl;
+  ASSERT_EQ(0, ioctx.operate("foo", &op, &outbl));
+
+  bufferlist::iterator it = outbl.begin();
+  uint64_t size, features, incompatible_features;
+  map<rados::cls::lock::locker_id_t, rados::cls::lock::locker_info_t> lockers;
+  bool exclusive_lock;
+  string lock_tag;
+  ::SnapContext snapc;
+  parent_info parent;
+  ASSERT_EQ(0, get_mutable_metadata_finish(&it, &size, &features,
+					   &incompatible_features, &lockers,
+					   &exclusive_lock, &lock_tag, &snapc,
+					   &parent));
+  ASSERT_EQ(20u, size);
+  ASSERT_EQ(2u, snapc.snaps.size());
+  ASSERT_EQ(20u, snapc.snaps[0]);
+  ASSERT_EQ(10u, snapc.snaps[1]);
+
+  vector<uint8_t> known_protection;
+  ASSERT_EQ(0, get_protection_status_list_finish(&it, known,
+						 &known_protection));
+  ASSERT_EQ(1u, known_protection.size());
+  ASSERT_EQ(RBD_PROTECTION_STATUS_UNPROTECTED, known_protection[0]);
+
+  vector<string> names;
+  vector<uint64_t> sizes, snap_features;
+  vector<parent_info> parents;
+  vector<uint8_t> protection;
+  ASSERT_EQ(0, snapshot_list_finish(&it, added, &names, &sizes,
+				    &snap_features, &parents, &protection));
+  ASSERT_EQ(1u, names.size());
+  ASSERT_EQ("snap2", names[0]);
+  ASSERT_EQ(20u, sizes[0]);
+  ASSERT_EQ(RBD_PROTECTION_STATUS_PROTECTED, protection[0]);
+
+  // a removed snapshot fails the whole batch
+  ASSERT_EQ(0, snapshot_remove(&ioctx, "foo", 10));
+  librados::ObjectReadOperation op2;
+  get_mutable_metadata_start(&op2);
+  get_protection_status_list_start(&op2, known);
+  ASSERT_EQ(-ENOENT, ioctx.operate("foo", &op2, &outbl));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
 TEST(cls_rbd, parents)
 {
   librados::Rados rados;
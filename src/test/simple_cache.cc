@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+
+#include "common/simple_cache.hpp"
+
+TEST(SimpleLRU, Trim)
+{
+  SimpleLRU<int, int> c(2);
+  c.add(1, 10);
+  c.add(2, 20);
+  c.add(3, 30);
+  int v;
+  ASSERT_FALSE(c.lookup(1, &v));
+  ASSERT_TRUE(c.lookup(2, &v));
+  ASSERT_EQ(20, v);
+  ASSERT_TRUE(c.lookup(3, &v));
+  ASSERT_EQ(30, v);
+}
+
+TEST(SimpleLRU, ReAdd)
+{
+  SimpleLRU<int, int> c(2);
+  c.add(1, 10);
+  c.add(2, 20);
+  // updates 1 in place and makes it the most recent
+  c.add(1, 11);
+  c.add(3, 30);
+  int v;
+  ASSERT_TRUE(c.lookup(1, &v));
+  ASSERT_EQ(11, v);
+  ASSERT_FALSE(c.lookup(2, &v));
+  ASSERT_TRUE(c.lookup(3, &v));
+
+  // re-adding never leaves a stale entry for trim to evict the key by
+  for (int i = 0; i < 10; ++i)
+    c.add(3, 30 + i);
+  c.add(4, 40);
+  ASSERT_TRUE(c.lookup(3, &v));
+  ASSERT_EQ(39, v);
+  ASSERT_TRUE(c.lookup(4, &v));
+  ASSERT_EQ(40, v);
+}
+
+TEST(SimpleLRU, Clear)
+{
+  SimpleLRU<int, int> c(2);
+  c.add(1, 10);
+  c.clear(1);
+  int v;
+  ASSERT_FALSE(c.lookup(1, &v));
+  c.add(1, 12);
+  ASSERT_TRUE(c.lookup(1, &v));
+  ASSERT_EQ(12, v);
+}